@@ -0,0 +1,173 @@
+#include "asyncsessioncipher.h"
+#include "sessioncipher.h"
+#include "invalidkeyidexception.h"
+
+#include "concurrent/functionrunnable.h"
+#include "util/medium.h"
+
+#include <exception>
+
+// Runs the ratchet step, whatever it throws ends up in onError instead of
+// escaping into the crypto pool
+static bool attempt(const std::function<void()> &operation, const AsyncSessionCipher::ErrorCallback &onError)
+{
+    try {
+        operation();
+        return true;
+    } catch (const WhisperException &e) {
+        onError(e);
+    } catch (const std::exception &e) {
+        onError(WhisperException("UnknownException", QString::fromLocal8Bit(e.what())));
+    } catch (...) {
+        onError(WhisperException("UnknownException"));
+    }
+    return false;
+}
+
+// Presents one already loaded session record (and optionally one prekey) as
+// blocking stores, so SessionCipher runs unchanged on the crypto pool.
+class LoadedRecordStore : public SessionStore, public PreKeyStore
+{
+public:
+    LoadedRecordStore(SessionRecord *record, QSharedPointer<PreKeyRecord> preKey = QSharedPointer<PreKeyRecord>())
+        : record(record), preKey(preKey), removedPreKey(false) {}
+
+    SessionRecord *loadSession(const AxolotlAddress &) { return record; }
+    QList<int> getSubDeviceSessions(const QString &) { return QList<int>(); }
+    void storeSession(const AxolotlAddress &, SessionRecord *sessionRecord) { record = sessionRecord; }
+    bool containsSession(const AxolotlAddress &) { return !record->isFresh(); }
+    void deleteSession(const AxolotlAddress &) {}
+    void deleteAllSessions(const QString &) {}
+
+    PreKeyRecord loadPreKey(qulonglong preKeyId) {
+        if (!containsPreKey(preKeyId)) {
+            throw InvalidKeyIdException(QString("No such prekey: %1").arg(preKeyId));
+        }
+        return *preKey;
+    }
+    void storePreKey(qulonglong, const PreKeyRecord &) {}
+    bool containsPreKey(qulonglong preKeyId) { return !preKey.isNull() && !removedPreKey && preKey->getId() == preKeyId; }
+    void removePreKey(qulonglong preKeyId) { if (containsPreKey(preKeyId)) removedPreKey = true; }
+    int countPreKeys() { return containsPreKey(preKey.isNull() ? 0 : preKey->getId()) ? 1 : 0; }
+
+    SessionRecord *sessionRecord() const { return record; }
+    bool preKeyRemoved() const { return removedPreKey; }
+
+private:
+    SessionRecord               *record;
+    QSharedPointer<PreKeyRecord> preKey;
+    bool                         removedPreKey;
+};
+
+AsyncSessionCipher::AsyncSessionCipher(QSharedPointer<AsyncSessionStore> sessionStore, QSharedPointer<AsyncPreKeyStore> preKeyStore, QSharedPointer<SignedPreKeyStore> signedPreKeyStore, QSharedPointer<IdentityKeyStore> identityKeyStore, const AxolotlAddress &remoteAddress, QThreadPool *cryptoPool)
+{
+    this->sessionStore      = sessionStore;
+    this->preKeyStore       = preKeyStore;
+    this->signedPreKeyStore = signedPreKeyStore;
+    this->identityKeyStore  = identityKeyStore;
+    this->remoteAddress     = remoteAddress;
+    this->cryptoPool        = cryptoPool;
+}
+
+void AsyncSessionCipher::encrypt(const QByteArray &paddedMessage, const EncryptCallback &onEncrypted, const ErrorCallback &onError)
+{
+    QSharedPointer<AsyncSessionStore> sessionStore      = this->sessionStore;
+    QSharedPointer<SignedPreKeyStore> signedPreKeyStore = this->signedPreKeyStore;
+    QSharedPointer<IdentityKeyStore>  identityKeyStore  = this->identityKeyStore;
+    AxolotlAddress                    remoteAddress     = this->remoteAddress;
+    QThreadPool                      *cryptoPool        = this->cryptoPool;
+
+    sessionStore->loadSessionAsync(remoteAddress, [=](SessionRecord *sessionRecord) {
+        FunctionRunnable::start(cryptoPool, [=]() {
+            QSharedPointer<LoadedRecordStore> loaded(new LoadedRecordStore(sessionRecord));
+            QSharedPointer<CiphertextMessage> ciphertext;
+
+            bool encrypted = attempt([&]() {
+                SessionCipher cipher(loaded, loaded, signedPreKeyStore, identityKeyStore, remoteAddress);
+                ciphertext = cipher.encrypt(paddedMessage);
+            }, onError);
+            if (!encrypted) {
+                return;
+            }
+
+            sessionStore->storeSessionAsync(remoteAddress, loaded->sessionRecord(), [=]() {
+                onEncrypted(ciphertext);
+            }, onError);
+        });
+    }, onError);
+}
+
+void AsyncSessionCipher::decrypt(QSharedPointer<WhisperMessage> ciphertext, const DecryptCallback &onDecrypted, const ErrorCallback &onError)
+{
+    QSharedPointer<AsyncSessionStore> sessionStore      = this->sessionStore;
+    QSharedPointer<SignedPreKeyStore> signedPreKeyStore = this->signedPreKeyStore;
+    QSharedPointer<IdentityKeyStore>  identityKeyStore  = this->identityKeyStore;
+    AxolotlAddress                    remoteAddress     = this->remoteAddress;
+    QThreadPool                      *cryptoPool        = this->cryptoPool;
+
+    sessionStore->loadSessionAsync(remoteAddress, [=](SessionRecord *sessionRecord) {
+        FunctionRunnable::start(cryptoPool, [=]() {
+            QSharedPointer<LoadedRecordStore> loaded(new LoadedRecordStore(sessionRecord));
+            QByteArray plaintext;
+
+            bool decrypted = attempt([&]() {
+                SessionCipher cipher(loaded, loaded, signedPreKeyStore, identityKeyStore, remoteAddress);
+                plaintext = cipher.decrypt(ciphertext);
+            }, onError);
+            if (!decrypted) {
+                return;
+            }
+
+            sessionStore->storeSessionAsync(remoteAddress, loaded->sessionRecord(), [=]() {
+                onDecrypted(plaintext);
+            }, onError);
+        });
+    }, onError);
+}
+
+void AsyncSessionCipher::decrypt(QSharedPointer<PreKeyWhisperMessage> ciphertext, const DecryptCallback &onDecrypted, const ErrorCallback &onError)
+{
+    QSharedPointer<AsyncSessionStore> sessionStore      = this->sessionStore;
+    QSharedPointer<AsyncPreKeyStore>  preKeyStore       = this->preKeyStore;
+    QSharedPointer<SignedPreKeyStore> signedPreKeyStore = this->signedPreKeyStore;
+    QSharedPointer<IdentityKeyStore>  identityKeyStore  = this->identityKeyStore;
+    AxolotlAddress                    remoteAddress     = this->remoteAddress;
+    QThreadPool                      *cryptoPool        = this->cryptoPool;
+    ulong                             preKeyId          = ciphertext->getPreKeyId();
+
+    auto process = [=](SessionRecord *sessionRecord, QSharedPointer<PreKeyRecord> preKey) {
+        FunctionRunnable::start(cryptoPool, [=]() {
+            QSharedPointer<LoadedRecordStore> loaded(new LoadedRecordStore(sessionRecord, preKey));
+            QByteArray plaintext;
+
+            bool decrypted = attempt([&]() {
+                SessionCipher cipher(loaded, loaded, signedPreKeyStore, identityKeyStore, remoteAddress);
+                plaintext = cipher.decrypt(ciphertext);
+            }, onError);
+            if (!decrypted) {
+                return;
+            }
+
+            bool removePreKey = loaded->preKeyRemoved();
+            sessionStore->storeSessionAsync(remoteAddress, loaded->sessionRecord(), [=]() {
+                if (removePreKey) {
+                    preKeyStore->removePreKeyAsync(preKeyId, [=]() {
+                        onDecrypted(plaintext);
+                    }, onError);
+                } else {
+                    onDecrypted(plaintext);
+                }
+            }, onError);
+        });
+    };
+
+    sessionStore->loadSessionAsync(remoteAddress, [=](SessionRecord *sessionRecord) {
+        if (preKeyId < (ulong)Medium::MAX_VALUE) {
+            preKeyStore->loadPreKeyAsync(preKeyId, [=](QSharedPointer<PreKeyRecord> preKey) {
+                process(sessionRecord, preKey);
+            }, onError);
+        } else {
+            process(sessionRecord, QSharedPointer<PreKeyRecord>());
+        }
+    }, onError);
+}
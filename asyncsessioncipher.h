@@ -0,0 +1,50 @@
+#ifndef ASYNCSESSIONCIPHER_H
+#define ASYNCSESSIONCIPHER_H
+
+#include <QSharedPointer>
+#include <QThreadPool>
+
+#include <functional>
+
+#include "state/asyncsessionstore.h"
+#include "state/asyncprekeystore.h"
+#include "state/signedprekeystore.h"
+#include "state/identitykeystore.h"
+#include "protocol/ciphertextmessage.h"
+#include "protocol/whispermessage.h"
+#include "protocol/prekeywhispermessage.h"
+#include "whisperexception.h"
+#include "axolotladdress.h"
+
+// Non-blocking counterpart of SessionCipher. Store round trips go through
+// the async store interfaces, the ratchet and AES work runs on cryptoPool.
+// Operations for the same remote address must not overlap, callers keep
+// them ordered (e.g. through SessionMailboxExecutor).
+//
+// Signed prekeys and identities are only touched when a PreKeyWhisperMessage
+// establishes a session; that path uses the blocking stores on cryptoPool.
+class AsyncSessionCipher
+{
+public:
+    typedef std::function<void(QSharedPointer<CiphertextMessage> ciphertext)> EncryptCallback;
+    typedef std::function<void(const QByteArray &plaintext)>                  DecryptCallback;
+    typedef std::function<void(const WhisperException &exception)>            ErrorCallback;
+
+    AsyncSessionCipher(QSharedPointer<AsyncSessionStore> sessionStore, QSharedPointer<AsyncPreKeyStore> preKeyStore,
+                       QSharedPointer<SignedPreKeyStore> signedPreKeyStore, QSharedPointer<IdentityKeyStore> identityKeyStore,
+                       const AxolotlAddress &remoteAddress, QThreadPool *cryptoPool = QThreadPool::globalInstance());
+
+    void encrypt(const QByteArray &paddedMessage, const EncryptCallback &onEncrypted, const ErrorCallback &onError);
+    void decrypt(QSharedPointer<WhisperMessage> ciphertext, const DecryptCallback &onDecrypted, const ErrorCallback &onError);
+    void decrypt(QSharedPointer<PreKeyWhisperMessage> ciphertext, const DecryptCallback &onDecrypted, const ErrorCallback &onError);
+
+private:
+    QSharedPointer<AsyncSessionStore> sessionStore;
+    QSharedPointer<AsyncPreKeyStore>  preKeyStore;
+    QSharedPointer<SignedPreKeyStore> signedPreKeyStore;
+    QSharedPointer<IdentityKeyStore>  identityKeyStore;
+    AxolotlAddress                    remoteAddress;
+    QThreadPool                      *cryptoPool;
+};
+
+#endif // ASYNCSESSIONCIPHER_H
@@ -0,0 +1,327 @@
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+#include <QMap>
+
+#include <atomic>
+#include <functional>
+#include <new>
+
+#include <stdlib.h>
+
+#include "sessioncipher.h"
+#include "sessionbuilder.h"
+#include "state/impl/inmemoryaxolotlstore.h"
+#include "state/prekeybundle.h"
+#include "protocol/whispermessage.h"
+#include "protocol/prekeywhispermessage.h"
+#include "groups/ratchet/senderchainkey.h"
+#include "kdf/hkdf.h"
+#include "ecc/curve.h"
+#include "util/keyhelper.h"
+
+// Counts heap allocations per library operation. With glibc every malloc,
+// calloc and realloc is intercepted (operator new ends up there too),
+// elsewhere only the global operator new is hooked.
+
+static std::atomic<bool>    counting(false);
+static std::atomic<quint64> allocationCount(0);
+static std::atomic<quint64> allocationBytes(0);
+
+static inline void recordAllocation(size_t size)
+{
+    if (counting.load(std::memory_order_relaxed)) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    recordAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    recordAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    recordAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+#else
+void *operator new(size_t size)
+{
+    recordAllocation(size);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+#endif
+
+struct AllocationResult {
+    double allocations;
+    double bytes;
+};
+
+static AllocationResult measure(int iterations, const std::function<void(int)> &operation)
+{
+    allocationCount = 0;
+    allocationBytes = 0;
+
+    counting = true;
+    for (int i = 0; i < iterations; i++) {
+        operation(i);
+    }
+    counting = false;
+
+    AllocationResult result;
+    result.allocations = (double)allocationCount.load() / iterations;
+    result.bytes       = (double)allocationBytes.load() / iterations;
+    return result;
+}
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context);
+    if (type != QtDebugMsg) {
+        QTextStream(stderr) << message << endl;
+    }
+}
+
+static QMap<QString, AllocationResult> readBaseline(const QString &path)
+{
+    QMap<QString, AllocationResult> baseline;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return baseline;
+    }
+
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        bool allocationsOk = false;
+        bool bytesOk       = false;
+        AllocationResult result;
+        if (fields.size() == 3) {
+            result.allocations = fields.at(1).toDouble(&allocationsOk);
+            result.bytes       = fields.at(2).toDouble(&bytesOk);
+        }
+        if (allocationsOk && bytesOk) {
+            baseline.insert(fields.at(0), result);
+        }
+    }
+    return baseline;
+}
+
+static bool writeBaseline(const QString &path, const QList<QPair<QString, AllocationResult> > &results)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "# Allocation baseline for benchmarks/allocations, one operation per line:\n"
+           << "#   <operation> <allocations per op> <bytes per op>\n";
+    for (int i = 0; i < results.size(); i++) {
+        stream << results.at(i).first << ' '
+               << QString::number(results.at(i).second.allocations, 'f', 2) << ' '
+               << QString::number(results.at(i).second.bytes, 'f', 1) << '\n';
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+
+    QString compareWith;
+    QString writeTo;
+    bool    fillMissing = false;
+    int     iterations  = 1000;
+    for (int i = 1; i < arguments.size(); i++) {
+        if (arguments.at(i) == "--compare" && i + 1 < arguments.size()) {
+            compareWith = arguments.at(++i);
+        } else if (arguments.at(i) == "--write-baseline" && i + 1 < arguments.size()) {
+            writeTo = arguments.at(++i);
+        } else if (arguments.at(i) == "--fill-missing") {
+            fillMissing = true;
+        } else if (arguments.at(i) == "--iterations" && i + 1 < arguments.size()) {
+            iterations = qMax(1, arguments.at(++i).toInt());
+        } else {
+            QTextStream(stderr) << "usage: allocations [--iterations N] [--compare FILE [--fill-missing]] [--write-baseline FILE]" << endl;
+            return 1;
+        }
+    }
+
+    qInstallMessageHandler(quietMessageHandler);
+
+    AxolotlAddress aliceAddress("+14151111111", 1);
+    AxolotlAddress bobAddress("+14152222222", 1);
+
+    IdentityKeyPair bobIdentity = KeyHelper::generateIdentityKeyPair();
+    QSharedPointer<InMemoryAxolotlStore> aliceStore(new InMemoryAxolotlStore(KeyHelper::generateIdentityKeyPair(),
+                                                                             KeyHelper::generateRegistrationId()));
+    QSharedPointer<InMemoryAxolotlStore> bobStore(new InMemoryAxolotlStore(bobIdentity,
+                                                                           KeyHelper::generateRegistrationId()));
+
+    ECKeyPair          bobPreKey       = Curve::generateKeyPair();
+    SignedPreKeyRecord bobSignedPreKey = KeyHelper::generateSignedPreKey(bobIdentity, 22);
+    bobStore->storePreKey(31337, PreKeyRecord(31337, bobPreKey));
+    bobStore->storeSignedPreKey(22, bobSignedPreKey);
+
+    PreKeyBundle bundle(bobStore->getLocalRegistrationId(), 1,
+                        31337, bobPreKey.getPublicKey(),
+                        22, bobSignedPreKey.getKeyPair().getPublicKey(), bobSignedPreKey.getSignature(),
+                        bobIdentity.getPublicKey());
+
+    SessionBuilder aliceBuilder(qSharedPointerCast<AxolotlStore>(aliceStore), bobAddress);
+    aliceBuilder.process(bundle);
+
+    SessionCipher aliceCipher(qSharedPointerCast<AxolotlStore>(aliceStore), bobAddress);
+    SessionCipher bobCipher(qSharedPointerCast<AxolotlStore>(bobStore), aliceAddress);
+
+    // Complete the handshake, so the measured messages are plain WhisperMessages
+    QSharedPointer<CiphertextMessage> hello = aliceCipher.encrypt("hello");
+    bobCipher.decrypt(QSharedPointer<PreKeyWhisperMessage>(new PreKeyWhisperMessage(hello->serialize())));
+    QSharedPointer<CiphertextMessage> reply = bobCipher.encrypt("hello back");
+    aliceCipher.decrypt(QSharedPointer<WhisperMessage>(new WhisperMessage(reply->serialize())));
+
+    QByteArray plaintext(160, 'x');
+    QList<QSharedPointer<WhisperMessage> > messages;
+
+    QList<QPair<QString, AllocationResult> > results;
+
+    results.append(qMakePair(QString("encrypt"), measure(iterations, [&](int) {
+        QSharedPointer<CiphertextMessage> message = aliceCipher.encrypt(plaintext);
+        counting = false;
+        messages.append(QSharedPointer<WhisperMessage>(new WhisperMessage(message->serialize())));
+        counting = true;
+    })));
+
+    results.append(qMakePair(QString("decrypt"), measure(iterations, [&](int i) {
+        bobCipher.decrypt(messages.at(i));
+    })));
+
+    QByteArray serializedRecord = aliceStore->loadSession(bobAddress)->serialize();
+    results.append(qMakePair(QString("record-serialize"), measure(iterations, [&](int) {
+        aliceStore->loadSession(bobAddress)->serialize();
+    })));
+
+    results.append(qMakePair(QString("record-parse"), measure(iterations, [&](int) {
+        SessionRecord record(serializedRecord);
+    })));
+
+    QByteArray inputKeyMaterial = KeyHelper::getRandomBytes(32);
+    HKDF       kdf(3);
+    results.append(qMakePair(QString("hkdf-derive"), measure(iterations, [&](int) {
+        kdf.deriveSecrets(inputKeyMaterial, QByteArray("WhisperMessageKeys"), 80);
+    })));
+
+    SenderChainKey senderChainKey(0, KeyHelper::getRandomBytes(32));
+    results.append(qMakePair(QString("group-chain-step"), measure(iterations, [&](int) {
+        senderChainKey.getSenderMessageKey();
+        senderChainKey = senderChainKey.getNext();
+    })));
+
+    QMap<QString, AllocationResult> baseline;
+    if (!compareWith.isEmpty()) {
+        baseline = readBaseline(compareWith);
+    }
+
+    // An operation without a measured baseline must not pass the comparison by default
+    QStringList unmeasured;
+    if (!compareWith.isEmpty()) {
+        for (int i = 0; i < results.size(); i++) {
+            if (!baseline.contains(results.at(i).first)) {
+                unmeasured.append(results.at(i).first);
+            }
+        }
+    }
+
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3").arg("operation", -18).arg("allocs/op", 12).arg("bytes/op", 12);
+    if (!baseline.isEmpty()) {
+        out << QString(" %1 %2").arg("baseline", 12).arg("delta", 10);
+    }
+    out << endl;
+
+    int regressions = 0;
+    for (int i = 0; i < results.size(); i++) {
+        const QString          &name   = results.at(i).first;
+        const AllocationResult &result = results.at(i).second;
+
+        out << QString("%1 %2 %3").arg(name, -18)
+                                  .arg(result.allocations, 12, 'f', 2)
+                                  .arg(result.bytes, 12, 'f', 1);
+        if (baseline.contains(name)) {
+            double reference = baseline.value(name).allocations;
+            out << QString(" %1 %2").arg(reference, 12, 'f', 2)
+                                    .arg(result.allocations - reference, 10, 'f', 2);
+            if (result.allocations > reference + 0.5) {
+                regressions++;
+            }
+        }
+        out << endl;
+    }
+
+    if (!writeTo.isEmpty() && !writeBaseline(writeTo, results)) {
+        QTextStream(stderr) << "Could not write " << writeTo << endl;
+        return 1;
+    }
+
+    // Record this run's numbers for the unmeasured operations only, measured ones keep their baseline
+    if (!unmeasured.isEmpty() && fillMissing) {
+        QList<QPair<QString, AllocationResult> > merged;
+        for (int i = 0; i < results.size(); i++) {
+            const QString &name = results.at(i).first;
+            merged.append(qMakePair(name, baseline.contains(name) ? baseline.value(name) : results.at(i).second));
+        }
+        if (!writeBaseline(compareWith, merged)) {
+            QTextStream(stderr) << "Could not write " << compareWith << endl;
+            return 1;
+        }
+        QTextStream(stderr) << "Recorded baseline in " << compareWith << " for: " << unmeasured.join(", ") << endl;
+        unmeasured.clear();
+    }
+
+    if (!unmeasured.isEmpty()) {
+        QTextStream(stderr) << "No baseline in " << compareWith << " for: " << unmeasured.join(", ") << endl;
+        return 3;
+    }
+
+    return regressions > 0 ? 2 : 0;
+}
@@ -0,0 +1,237 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <QDebug>
+
+#include <algorithm>
+#include <random>
+
+#include "state/sessionstate.h"
+#include "kdf/hkdf.h"
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+// Walks a million resident sessions in random order and fetches what
+// encrypt and decrypt read on every message: the root key, the sender chain
+// key and index, the session version and the previous counter. Once through
+// the SessionState accessors backed by the hot header, once by building
+// the same RootKey and ChainKey values from a plain protobuf
+// SessionStructure, the way SessionState did before the split.
+
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+        fd = -1;
+#ifdef Q_OS_LINUX
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#ifdef Q_OS_LINUX
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool isAvailable() const
+    {
+        return fd >= 0;
+    }
+
+    void start()
+    {
+#ifdef Q_OS_LINUX
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    qint64 stop()
+    {
+        qint64 count = -1;
+#ifdef Q_OS_LINUX
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            count = -1;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+static std::string randomBytes(std::mt19937 &rng, int length)
+{
+    std::string bytes(length, '\0');
+    for (int i = 0; i < length; i++) {
+        bytes[i] = (char)(rng() & 0xFF);
+    }
+    return bytes;
+}
+
+static textsecure::SessionStructure makeStructure(std::mt19937 &rng, int skippedKeys)
+{
+    textsecure::SessionStructure structure;
+    structure.set_sessionversion(3);
+    structure.set_localidentitypublic(randomBytes(rng, 33));
+    structure.set_remoteidentitypublic(randomBytes(rng, 33));
+    structure.set_rootkey(randomBytes(rng, 32));
+    structure.set_previouscounter(rng() % 1000);
+    structure.set_remoteregistrationid(rng() % 16380);
+    structure.set_localregistrationid(rng() % 16380);
+    structure.set_alicebasekey(randomBytes(rng, 33));
+
+    textsecure::SessionStructure::Chain *senderChain = structure.mutable_senderchain();
+    senderChain->set_senderratchetkey(randomBytes(rng, 33));
+    senderChain->set_senderratchetkeyprivate(randomBytes(rng, 32));
+    senderChain->mutable_chainkey()->set_key(randomBytes(rng, 32));
+    senderChain->mutable_chainkey()->set_index(rng() % 1000);
+
+    textsecure::SessionStructure::Chain *receiverChain = structure.add_receiverchains();
+    receiverChain->set_senderratchetkey(randomBytes(rng, 33));
+    receiverChain->mutable_chainkey()->set_key(randomBytes(rng, 32));
+    receiverChain->mutable_chainkey()->set_index(rng() % 1000);
+    for (int i = 0; i < skippedKeys; i++) {
+        textsecure::SessionStructure::Chain::MessageKey *messageKey = receiverChain->add_messagekeys();
+        messageKey->set_index(i);
+        messageKey->set_cipherkey(randomBytes(rng, 32));
+        messageKey->set_mackey(randomBytes(rng, 32));
+        messageKey->set_iv(randomBytes(rng, 16));
+    }
+
+    textsecure::SessionStructure::PendingKeyExchange *pending = structure.mutable_pendingkeyexchange();
+    pending->set_sequence(rng() % 65535);
+    pending->set_localbasekey(randomBytes(rng, 33));
+    pending->set_localbasekeyprivate(randomBytes(rng, 32));
+    pending->set_localratchetkey(randomBytes(rng, 33));
+    pending->set_localratchetkeyprivate(randomBytes(rng, 32));
+    pending->set_localidentitykey(randomBytes(rng, 33));
+    pending->set_localidentitykeyprivate(randomBytes(rng, 32));
+
+    structure.mutable_pendingprekey()->set_prekeyid(rng() % 65535);
+    structure.mutable_pendingprekey()->set_signedprekeyid(rng() % 65535);
+    structure.mutable_pendingprekey()->set_basekey(randomBytes(rng, 33));
+
+    return structure;
+}
+
+// Touches the key bytes, so neither side gets away with reading counters only
+static quint64 keyChecksum(const ChainKey &chainKey, const RootKey &rootKey)
+{
+    QByteArray chainBytes = chainKey.getKey();
+    QByteArray rootBytes  = rootKey.getKeyBytes();
+
+    return chainKey.getIndex() + (uchar)chainBytes.at(0) + (uchar)chainBytes.at(chainBytes.size() - 1)
+         + (uchar)rootBytes.at(0) + (uchar)rootBytes.at(rootBytes.size() - 1);
+}
+
+static void report(const char *name, qint64 nsecs, qint64 misses, int sessions, quint64 checksum)
+{
+    QString line = QString("%1 %2 ns/session").arg(name, -10).arg((double)nsecs / sessions, 8, 'f', 2);
+    if (misses >= 0) {
+        line += QString("  %1 cache misses/session").arg((double)misses / sessions, 6, 'f', 3);
+    }
+    line += QString("  (checksum %1)").arg(checksum);
+    qDebug().noquote() << line;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+
+    int sessions    = arguments.size() > 1 ? arguments.at(1).toInt() : 1000000;
+    int skippedKeys = arguments.size() > 2 ? arguments.at(2).toInt() : 8;
+    int rounds      = arguments.size() > 3 ? arguments.at(3).toInt() : 5;
+
+    std::mt19937 rng(0x5e55);
+
+    qDebug().noquote() << QString("Building %1 sessions with %2 skipped keys each").arg(sessions).arg(skippedKeys);
+
+    QVector<textsecure::SessionStructure*> structures;
+    QVector<SessionState*>                 states;
+    structures.reserve(sessions);
+    states.reserve(sessions);
+    for (int i = 0; i < sessions; i++) {
+        textsecure::SessionStructure structure = makeStructure(rng, skippedKeys);
+        structures.append(new textsecure::SessionStructure(structure));
+        states.append(new SessionState(structure));
+    }
+
+    QVector<int> order(sessions);
+    for (int i = 0; i < sessions; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    CacheMissCounter counter;
+    if (!counter.isAvailable()) {
+        qDebug().noquote() << "perf_event_open unavailable, reporting timings only";
+    }
+
+    QElapsedTimer timer;
+    for (int round = 0; round < rounds; round++) {
+        quint64 checksum = 0;
+
+        counter.start();
+        timer.start();
+        for (int i = 0; i < sessions; i++) {
+            const textsecure::SessionStructure        *structure   = structures.at(order.at(i));
+            const textsecure::SessionStructure::Chain &senderChain = structure->senderchain();
+            const ::std::string                       &chainBytes  = senderChain.chainkey().key();
+            const ::std::string                       &rootBytes   = structure->rootkey();
+
+            HKDF     kdf(structure->sessionversion());
+            ChainKey chainKey(kdf, QByteArray(chainBytes.data(), chainBytes.length()), senderChain.chainkey().index());
+            RootKey  rootKey(kdf, QByteArray(rootBytes.data(), rootBytes.length()));
+
+            checksum += keyChecksum(chainKey, rootKey);
+            checksum += structure->sessionversion();
+            checksum += structure->previouscounter();
+        }
+        qint64 nsecs  = timer.nsecsElapsed();
+        qint64 misses = counter.stop();
+        report("protobuf", nsecs, misses, sessions, checksum);
+
+        checksum = 0;
+        counter.start();
+        timer.start();
+        for (int i = 0; i < sessions; i++) {
+            const SessionState *state = states.at(order.at(i));
+
+            checksum += keyChecksum(state->getSenderChainKey(), state->getRootKey());
+            checksum += state->getSessionVersion();
+            checksum += state->getPreviousCounter();
+        }
+        nsecs  = timer.nsecsElapsed();
+        misses = counter.stop();
+        report("hot", nsecs, misses, sessions, checksum);
+    }
+
+    qDeleteAll(structures);
+    qDeleteAll(states);
+
+    return 0;
+}
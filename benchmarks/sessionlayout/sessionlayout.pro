@@ -0,0 +1,17 @@
+TEMPLATE = app
+
+TARGET = sessionlayout
+CONFIG += console c++11
+CONFIG -= app_bundle
+QT -= gui
+
+CONFIG += link_pkgconfig
+PKGCONFIG += openssl libssl libcrypto
+
+INCLUDEPATH += ../..
+LIBS += -L../.. -laxolotl
+LIBS += -L../../../libcurve25519 -lcurve25519
+LIBS += /usr/lib/libprotobuf.a
+
+SOURCES += \
+    main.cpp
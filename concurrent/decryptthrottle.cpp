@@ -0,0 +1,142 @@
+#include "decryptthrottle.h"
+#include "../decryptthrottledexception.h"
+
+#include <QMutexLocker>
+
+static const int MIN_SWEEP = 64;
+
+DecryptThrottle::DecryptThrottle(int windowMsecs, int maxRatchetSteps, int maxSkippedKeys)
+{
+    this->windowMsecs     = qMax(1, windowMsecs);
+    this->maxRatchetSteps = maxRatchetSteps;
+    this->maxSkippedKeys  = maxSkippedKeys;
+
+    for (int i = 0; i < STRIPES; i++) {
+        stripes[i].sweepAt = MIN_SWEEP;
+    }
+
+    clock.start();
+}
+
+void DecryptThrottle::check(const AxolotlAddress &remoteAddress) const
+{
+    qint64 wait = retryAfter(remoteAddress);
+    if (wait > 0) {
+        reject(remoteAddress, wait);
+    }
+}
+
+void DecryptThrottle::charge(const AxolotlAddress &remoteAddress, int ratchetSteps, int skippedKeys)
+{
+    if (ratchetSteps <= 0 && skippedKeys <= 0) {
+        return;
+    }
+
+    Stripe     &stripe = stripeFor(remoteAddress);
+    AddressKey  key    = AddressUtil::toKey(remoteAddress);
+    qint64      now    = clock.elapsed();
+    qint64      wait   = 0;
+    {
+        QMutexLocker locker(&stripe.mutex);
+
+        QHash<AddressKey, Usage>::iterator it = stripe.usage.find(key);
+        if (it == stripe.usage.end()) {
+            if (stripe.usage.size() >= stripe.sweepAt) {
+                sweep(stripe, now);
+                stripe.sweepAt = qMax(MIN_SWEEP, stripe.usage.size() * 2);
+            }
+            Usage fresh = { now, 0, 0, false };
+            it = stripe.usage.insert(key, fresh);
+        } else if (now - it->windowStart >= windowMsecs) {
+            it->windowStart  = now;
+            it->ratchetSteps = 0;
+            it->skippedKeys  = 0;
+            it->blocked      = false;
+        }
+
+        if (!it->blocked) {
+            it->ratchetSteps += ratchetSteps;
+            it->skippedKeys  += skippedKeys;
+            it->blocked       = it->ratchetSteps > maxRatchetSteps || it->skippedKeys > maxSkippedKeys;
+        }
+
+        wait = retryAfter(*it, now);
+    }
+
+    // The work that went over budget is refused as well
+    if (wait > 0) {
+        reject(remoteAddress, wait);
+    }
+}
+
+qint64 DecryptThrottle::retryAfter(const AxolotlAddress &remoteAddress) const
+{
+    Stripe &stripe = stripeFor(remoteAddress);
+    QMutexLocker locker(&stripe.mutex);
+
+    QHash<AddressKey, Usage>::const_iterator it = stripe.usage.constFind(AddressUtil::toKey(remoteAddress));
+    if (it == stripe.usage.constEnd()) {
+        return 0;
+    }
+    return retryAfter(*it, clock.elapsed());
+}
+
+void DecryptThrottle::reset(const AxolotlAddress &remoteAddress)
+{
+    Stripe &stripe = stripeFor(remoteAddress);
+    QMutexLocker locker(&stripe.mutex);
+    stripe.usage.remove(AddressUtil::toKey(remoteAddress));
+}
+
+int DecryptThrottle::purge()
+{
+    qint64 now    = clock.elapsed();
+    int    purged = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        purged += sweep(stripes[i], now);
+        stripes[i].sweepAt = qMax(MIN_SWEEP, stripes[i].usage.size() * 2);
+    }
+    return purged;
+}
+
+quint64 DecryptThrottle::rejectedCount() const
+{
+    return rejected.loadAcquire();
+}
+
+qint64 DecryptThrottle::retryAfter(const Usage &usage, qint64 now) const
+{
+    qint64 windowEnd = usage.windowStart + windowMsecs;
+    return usage.blocked && now < windowEnd ? windowEnd - now : 0;
+}
+
+void DecryptThrottle::reject(const AxolotlAddress &remoteAddress, qint64 retryAfter) const
+{
+    rejected.fetchAndAddRelaxed(1);
+    throw DecryptThrottledException(QString("Decrypt budget spent for %1, %2, retry in %3 ms")
+                                        .arg(remoteAddress.getName())
+                                        .arg(remoteAddress.getDeviceId())
+                                        .arg(retryAfter),
+                                    retryAfter);
+}
+
+// Drops senders whose window has ended, they would start from zero anyway
+int DecryptThrottle::sweep(Stripe &stripe, qint64 now)
+{
+    int swept = 0;
+    QMutableHashIterator<AddressKey, Usage> iterator(stripe.usage);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (now - iterator.value().windowStart >= windowMsecs) {
+            iterator.remove();
+            swept++;
+        }
+    }
+    return swept;
+}
+
+DecryptThrottle::Stripe &DecryptThrottle::stripeFor(const AxolotlAddress &remoteAddress) const
+{
+    return stripes[AddressUtil::stripe(remoteAddress.getName(), STRIPES)];
+}
@@ -0,0 +1,63 @@
+#ifndef DECRYPTTHROTTLE_H
+#define DECRYPTTHROTTLE_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QHash>
+
+#include "../axolotladdress.h"
+#include "../util/addresskey.h"
+
+// Per sender budget for the expensive parts of decryption. A message with
+// a new ratchet key costs two agreements and a key generation, a PreKey
+// message three or four agreements, and a far future counter up to 2000
+// skipped message keys, all before the MAC is checked. SessionCipher
+// charges that work here before doing it; a sender that spends its budget
+// for the current window is refused until the window ends, so forged
+// traffic from one peer can't tie up the decrypt workers.
+class DecryptThrottle
+{
+public:
+    static const int STRIPES = 64;
+
+    DecryptThrottle(int windowMsecs = 10000, int maxRatchetSteps = 64, int maxSkippedKeys = 8000);
+
+    // Throws DecryptThrottledException if remoteAddress is over budget
+    void check(const AxolotlAddress &remoteAddress) const;
+    void charge(const AxolotlAddress &remoteAddress, int ratchetSteps, int skippedKeys);
+
+    qint64 retryAfter(const AxolotlAddress &remoteAddress) const;
+    void reset(const AxolotlAddress &remoteAddress);
+    int purge();
+
+    quint64 rejectedCount() const;
+
+private:
+    struct Usage {
+        qint64 windowStart;
+        int    ratchetSteps;
+        int    skippedKeys;
+        bool   blocked;
+    };
+
+    struct Stripe {
+        QMutex                    mutex;
+        QHash<AddressKey, Usage>  usage;
+        int                       sweepAt;
+    };
+
+    qint64 retryAfter(const Usage &usage, qint64 now) const;
+    void reject(const AxolotlAddress &remoteAddress, qint64 retryAfter) const;
+    int sweep(Stripe &stripe, qint64 now);
+    Stripe &stripeFor(const AxolotlAddress &remoteAddress) const;
+
+    int                               windowMsecs;
+    int                               maxRatchetSteps;
+    int                               maxSkippedKeys;
+    QElapsedTimer                     clock;
+    mutable Stripe                    stripes[STRIPES];
+    mutable QAtomicInteger<quint64>   rejected;
+};
+
+#endif // DECRYPTTHROTTLE_H
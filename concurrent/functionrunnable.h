@@ -0,0 +1,28 @@
+#ifndef FUNCTIONRUNNABLE_H
+#define FUNCTIONRUNNABLE_H
+
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <functional>
+
+class FunctionRunnable : public QRunnable
+{
+public:
+    FunctionRunnable(const std::function<void()> &function) : function(function) {
+        setAutoDelete(true);
+    }
+
+    void run() {
+        function();
+    }
+
+    static void start(QThreadPool *pool, const std::function<void()> &function, int priority = 0) {
+        pool->start(new FunctionRunnable(function), priority);
+    }
+
+private:
+    std::function<void()> function;
+};
+
+#endif // FUNCTIONRUNNABLE_H
@@ -0,0 +1,232 @@
+#include "priorityscheduler.h"
+#include "functionrunnable.h"
+#include "../whisperexception.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <climits>
+#include <exception>
+
+PriorityScheduler::PriorityScheduler(int maxThreads)
+{
+    this->maxThreads  = qMax(1, maxThreads);
+    this->maxBulk     = qMax(1, this->maxThreads - 1);
+    this->running     = 0;
+    this->queued      = 0;
+    this->virtualTime = 0;
+    this->stopping    = false;
+
+    static const int weights[LaneCount]    = { 8, 3, 1 };
+    static const int capacities[LaneCount] = { 1024, 4096, 256 };
+
+    for (int i = 0; i < LaneCount; i++) {
+        lanes[i].weight     = weights[i];
+        lanes[i].capacity   = capacities[i];
+        lanes[i].maxRunning = this->maxThreads;
+        lanes[i].running    = 0;
+        lanes[i].pass       = 0;
+        lanes[i].rejected   = 0;
+    }
+
+    // Leave a thread for interactive work whenever there is more than one
+    lanes[Backlog].maxRunning     = qMax(1, this->maxThreads - 1);
+    lanes[Maintenance].maxRunning = qMax(1, this->maxThreads / 2);
+
+    pool.setMaxThreadCount(this->maxThreads);
+}
+
+PriorityScheduler::~PriorityScheduler()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        for (int i = 0; i < LaneCount; i++) {
+            lanes[i].notFull.wakeAll();
+        }
+    }
+
+    waitForDone();
+    pool.waitForDone();
+}
+
+void PriorityScheduler::setLaneWeight(Lane lane, int weight)
+{
+    QMutexLocker locker(&mutex);
+    lanes[lane].weight = qMax(1, weight);
+}
+
+void PriorityScheduler::setLaneCapacity(Lane lane, int capacity)
+{
+    QMutexLocker locker(&mutex);
+    lanes[lane].capacity = qMax(1, capacity);
+    lanes[lane].notFull.wakeAll();
+}
+
+void PriorityScheduler::setLaneConcurrency(Lane lane, int maxRunning)
+{
+    QMutexLocker locker(&mutex);
+    lanes[lane].maxRunning = qBound(1, maxRunning, maxThreads);
+    dispatch();
+}
+
+bool PriorityScheduler::trySubmit(Lane lane, const Task &task)
+{
+    QMutexLocker locker(&mutex);
+    LaneState   &state = lanes[lane];
+
+    if (stopping || state.tasks.size() >= state.capacity) {
+        state.rejected++;
+        return false;
+    }
+
+    enqueue(state, task);
+    dispatch();
+    return true;
+}
+
+bool PriorityScheduler::submit(Lane lane, const Task &task, int msecs)
+{
+    QMutexLocker locker(&mutex);
+    LaneState   &state = lanes[lane];
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (!stopping && state.tasks.size() >= state.capacity) {
+        qint64 remaining = msecs < 0 ? -1 : msecs - timer.elapsed();
+        if (msecs >= 0 && remaining <= 0) {
+            break;
+        }
+        state.notFull.wait(&mutex, remaining < 0 ? ULONG_MAX : (unsigned long)remaining);
+    }
+
+    if (stopping || state.tasks.size() >= state.capacity) {
+        state.rejected++;
+        return false;
+    }
+
+    enqueue(state, task);
+    dispatch();
+    return true;
+}
+
+bool PriorityScheduler::waitForDone(int msecs)
+{
+    QMutexLocker locker(&mutex);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (running > 0 || queued > 0) {
+        qint64 remaining = msecs < 0 ? -1 : msecs - timer.elapsed();
+        if (msecs >= 0 && remaining <= 0) {
+            return false;
+        }
+        idle.wait(&mutex, remaining < 0 ? ULONG_MAX : (unsigned long)remaining);
+    }
+
+    return true;
+}
+
+int PriorityScheduler::queuedCount(Lane lane) const
+{
+    QMutexLocker locker(&mutex);
+    return lanes[lane].tasks.size();
+}
+
+int PriorityScheduler::runningCount(Lane lane) const
+{
+    QMutexLocker locker(&mutex);
+    return lanes[lane].running;
+}
+
+quint64 PriorityScheduler::rejectedCount(Lane lane) const
+{
+    QMutexLocker locker(&mutex);
+    return lanes[lane].rejected;
+}
+
+void PriorityScheduler::enqueue(LaneState &state, const Task &task)
+{
+    // A lane that sat idle doesn't get to bank its share, it rejoins at the current pass
+    if (state.tasks.isEmpty() && state.running == 0) {
+        state.pass = qMax(state.pass, virtualTime);
+    }
+
+    state.tasks.enqueue(task);
+    queued++;
+}
+
+// The waiting lane with the lowest pass goes next
+int PriorityScheduler::nextLane() const
+{
+    // Backlog and Maintenance share one cap as well as their own, each
+    // alone leaving a thread free isn't enough once both are busy
+    bool bulkFull = running - lanes[Interactive].running >= maxBulk;
+
+    int next = -1;
+    for (int i = 0; i < LaneCount; i++) {
+        const LaneState &state = lanes[i];
+        if (state.tasks.isEmpty() || state.running >= state.maxRunning) {
+            continue;
+        }
+        if (i != Interactive && bulkFull) {
+            continue;
+        }
+        if (next < 0 || state.pass < lanes[next].pass) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+void PriorityScheduler::dispatch()
+{
+    while (running < maxThreads) {
+        int lane = nextLane();
+        if (lane < 0) {
+            return;
+        }
+
+        LaneState &state = lanes[lane];
+        Task       task  = state.tasks.dequeue();
+
+        virtualTime = state.pass;
+        state.pass += STRIDE / state.weight;
+        state.running++;
+        running++;
+        queued--;
+
+        state.notFull.wakeOne();
+
+        FunctionRunnable::start(&pool, [this, lane, task]() {
+            run(lane, task);
+        });
+    }
+}
+
+void PriorityScheduler::run(int lane, const Task &task)
+{
+    // Whatever the task throws, its lane slot has to be given back
+    try {
+        task();
+    } catch (const WhisperException &e) {
+        qWarning() << "Unhandled scheduler task error:" << e.errorType() << e.errorMessage();
+    } catch (const std::exception &e) {
+        qWarning() << "Unhandled scheduler task error:" << e.what();
+    } catch (...) {
+        qWarning() << "Unhandled scheduler task error of unknown type";
+    }
+
+    QMutexLocker locker(&mutex);
+    lanes[lane].running--;
+    running--;
+
+    dispatch();
+
+    if (running == 0 && queued == 0) {
+        idle.wakeAll();
+    }
+}
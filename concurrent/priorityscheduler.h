@@ -0,0 +1,88 @@
+#ifndef PRIORITYSCHEDULER_H
+#define PRIORITYSCHEDULER_H
+
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QMutex>
+#include <QQueue>
+
+#include <functional>
+
+// Runs crypto work from several lanes on one pool. Interactive encrypt and
+// decrypt, backlog drains after a reconnect and maintenance (prekey and
+// signed prekey generation, store compaction) each get a lane with its own
+// weight, queue bound and share of the threads. When several lanes have
+// work they are served in proportion to their weights (stride scheduling),
+// and with more than one thread the bulk lanes together never occupy all
+// of them, so a long backlog never holds up an interactive send for more
+// than one task.
+//
+// Queues are bounded: trySubmit() refuses work when a lane is full and
+// submit() blocks the producer until there is room, which pushes back on
+// whoever is feeding the backlog. Tasks in different lanes may run in any
+// order, keep work for one session in one lane or behind a
+// SessionMailboxExecutor.
+class PriorityScheduler
+{
+public:
+    enum Lane {
+        Interactive = 0,
+        Backlog     = 1,
+        Maintenance = 2,
+        LaneCount   = 3
+    };
+
+    typedef std::function<void()> Task;
+
+    PriorityScheduler(int maxThreads = QThread::idealThreadCount());
+    // Runs what is already queued, blocked submit() calls give up
+    ~PriorityScheduler();
+
+    void setLaneWeight(Lane lane, int weight);
+    void setLaneCapacity(Lane lane, int capacity);
+    void setLaneConcurrency(Lane lane, int maxRunning);
+
+    bool trySubmit(Lane lane, const Task &task);
+    bool submit(Lane lane, const Task &task, int msecs = -1);
+
+    bool waitForDone(int msecs = -1);
+
+    int queuedCount(Lane lane) const;
+    int runningCount(Lane lane) const;
+    quint64 rejectedCount(Lane lane) const;
+
+private:
+    static const quint64 STRIDE = 1 << 20;
+
+    struct LaneState {
+        QQueue<Task>   tasks;
+        QWaitCondition notFull;
+        int            weight;
+        int            capacity;
+        int            maxRunning;
+        int            running;
+        quint64        pass;
+        quint64        rejected;
+    };
+
+    PriorityScheduler(const PriorityScheduler &);
+    PriorityScheduler &operator=(const PriorityScheduler &);
+
+    void enqueue(LaneState &state, const Task &task);
+    int nextLane() const;
+    void dispatch();
+    void run(int lane, const Task &task);
+
+    mutable QMutex  mutex;
+    QWaitCondition  idle;
+    LaneState       lanes[LaneCount];
+    QThreadPool     pool;
+    int             maxThreads;
+    int             maxBulk;
+    int             running;
+    int             queued;
+    quint64         virtualTime;
+    bool            stopping;
+};
+
+#endif // PRIORITYSCHEDULER_H
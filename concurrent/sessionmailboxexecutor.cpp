@@ -0,0 +1,214 @@
+#include "sessionmailboxexecutor.h"
+
+#include "../decryptthrottledexception.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <exception>
+
+SessionMailboxExecutor::Mailbox::Mailbox(QSharedPointer<AxolotlStore> store, QSharedPointer<DecryptThrottle> throttle,
+                                         const AxolotlAddress &remoteAddress)
+    : cipher(store, remoteAddress)
+{
+    cipher.setDecryptThrottle(throttle);
+    scheduled = false;
+}
+
+SessionMailboxExecutor::MailboxRunner::MailboxRunner(SessionMailboxExecutor *executor, QSharedPointer<Mailbox> mailbox)
+{
+    this->executor = executor;
+    this->mailbox  = mailbox;
+    setAutoDelete(true);
+}
+
+void SessionMailboxExecutor::MailboxRunner::run()
+{
+    for (int i = 0; i < MAILBOX_BATCH; i++) {
+        Job job;
+        {
+            QMutexLocker locker(&mailbox->mutex);
+            if (mailbox->jobs.isEmpty()) {
+                mailbox->scheduled = false;
+                return;
+            }
+            job = mailbox->jobs.dequeue();
+        }
+
+        try {
+            job.task(mailbox->cipher);
+        } catch (const WhisperException &e) {
+            fail(job, e);
+        } catch (const std::exception &e) {
+            fail(job, WhisperException("UnknownException", QString::fromLocal8Bit(e.what())));
+        } catch (...) {
+            fail(job, WhisperException("UnknownException"));
+        }
+    }
+
+    // Requeue instead of draining forever, so a busy session can't starve the others
+    QMutexLocker locker(&mailbox->mutex);
+    if (mailbox->jobs.isEmpty()) {
+        mailbox->scheduled = false;
+    } else {
+        locker.unlock();
+        executor->schedule(mailbox);
+    }
+}
+
+// Whatever a task or its error callback throws, the mailbox has to keep running
+void SessionMailboxExecutor::MailboxRunner::fail(const Job &job, const WhisperException &exception)
+{
+    try {
+        if (job.onError) {
+            job.onError(exception);
+            return;
+        }
+    } catch (...) {
+    }
+    qWarning() << "Unhandled mailbox task error:" << exception.errorType() << exception.errorMessage();
+}
+
+SessionMailboxExecutor::SessionMailboxExecutor(QSharedPointer<AxolotlStore> store, int maxThreads)
+{
+    this->store = store;
+    pool.setMaxThreadCount(qMax(1, maxThreads));
+}
+
+SessionMailboxExecutor::~SessionMailboxExecutor()
+{
+    pool.waitForDone();
+}
+
+void SessionMailboxExecutor::post(const AxolotlAddress &remoteAddress, const Task &task, const ErrorCallback &onError)
+{
+    Job job;
+    job.task    = task;
+    job.onError = onError;
+
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripes[AddressUtil::stripe(remoteAddress.getName(), MAILBOX_STRIPES)];
+    bool       wake   = false;
+
+    // Enqueue under the stripe lock, so evictIdleMailboxes() can't drop the mailbox in between
+    QMutexLocker stripeLocker(&stripe.mutex);
+    QSharedPointer<Mailbox> mailbox = stripe.mailboxes.value(key);
+    if (mailbox.isNull()) {
+        mailbox = QSharedPointer<Mailbox>(new Mailbox(store, throttle, remoteAddress));
+        stripe.mailboxes.insert(key, mailbox);
+    }
+
+    mailbox->mutex.lock();
+    mailbox->jobs.enqueue(job);
+    if (!mailbox->scheduled) {
+        mailbox->scheduled = true;
+        wake = true;
+    }
+    mailbox->mutex.unlock();
+    stripeLocker.unlock();
+
+    if (wake) {
+        schedule(mailbox);
+    }
+}
+
+void SessionMailboxExecutor::encrypt(const AxolotlAddress &remoteAddress, const QByteArray &paddedMessage, const std::function<void (QSharedPointer<CiphertextMessage>)> &onEncrypted, const ErrorCallback &onError)
+{
+    post(remoteAddress, [paddedMessage, onEncrypted](SessionCipher &cipher) {
+        QSharedPointer<CiphertextMessage> ciphertext = cipher.encrypt(paddedMessage);
+        if (onEncrypted) {
+            onEncrypted(ciphertext);
+        }
+    }, onError);
+}
+
+void SessionMailboxExecutor::decrypt(const AxolotlAddress &remoteAddress, QSharedPointer<WhisperMessage> ciphertext, const std::function<void (const QByteArray &)> &onDecrypted, const ErrorCallback &onError)
+{
+    if (refuse(remoteAddress, onError)) {
+        return;
+    }
+
+    post(remoteAddress, [ciphertext, onDecrypted](SessionCipher &cipher) {
+        QByteArray plaintext = cipher.decrypt(ciphertext);
+        if (onDecrypted) {
+            onDecrypted(plaintext);
+        }
+    }, onError);
+}
+
+void SessionMailboxExecutor::decrypt(const AxolotlAddress &remoteAddress, QSharedPointer<PreKeyWhisperMessage> ciphertext, const std::function<void (const QByteArray &)> &onDecrypted, const ErrorCallback &onError)
+{
+    if (refuse(remoteAddress, onError)) {
+        return;
+    }
+
+    post(remoteAddress, [ciphertext, onDecrypted](SessionCipher &cipher) {
+        QByteArray plaintext = cipher.decrypt(ciphertext);
+        if (onDecrypted) {
+            onDecrypted(plaintext);
+        }
+    }, onError);
+}
+
+void SessionMailboxExecutor::setDecryptThrottle(QSharedPointer<DecryptThrottle> throttle)
+{
+    this->throttle = throttle;
+}
+
+bool SessionMailboxExecutor::waitForDone(int msecs)
+{
+    return pool.waitForDone(msecs);
+}
+
+int SessionMailboxExecutor::mailboxCount() const
+{
+    int count = 0;
+    for (int i = 0; i < MAILBOX_STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        count += stripes[i].mailboxes.size();
+    }
+    return count;
+}
+
+int SessionMailboxExecutor::evictIdleMailboxes()
+{
+    int evicted = 0;
+    for (int i = 0; i < MAILBOX_STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        QMutableHashIterator<AddressKey, QSharedPointer<Mailbox> > iterator(stripes[i].mailboxes);
+        while (iterator.hasNext()) {
+            iterator.next();
+            QSharedPointer<Mailbox> mailbox = iterator.value();
+            QMutexLocker mailboxLocker(&mailbox->mutex);
+            if (!mailbox->scheduled && mailbox->jobs.isEmpty()) {
+                mailboxLocker.unlock();
+                iterator.remove();
+                evicted++;
+            }
+        }
+    }
+    return evicted;
+}
+
+void SessionMailboxExecutor::schedule(QSharedPointer<Mailbox> mailbox)
+{
+    pool.start(new MailboxRunner(this, mailbox));
+}
+
+// Saves a queue slot and a store load for senders that are already blocked
+bool SessionMailboxExecutor::refuse(const AxolotlAddress &remoteAddress, const ErrorCallback &onError)
+{
+    if (!throttle) {
+        return false;
+    }
+
+    try {
+        throttle->check(remoteAddress);
+        return false;
+    } catch (const DecryptThrottledException &e) {
+        if (onError) {
+            onError(e);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef SESSIONMAILBOXEXECUTOR_H
+#define SESSIONMAILBOXEXECUTOR_H
+
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QMutex>
+#include <QQueue>
+#include <QHash>
+
+#include <functional>
+
+#include "../sessioncipher.h"
+#include "../state/axolotlstore.h"
+#include "../whisperexception.h"
+#include "decryptthrottle.h"
+#include "../util/addresskey.h"
+
+// Every AxolotlAddress gets its own mailbox with a resident SessionCipher.
+// Tasks posted to one mailbox run strictly in order, different mailboxes
+// run in parallel on the pool. The store must tolerate concurrent calls
+// for different addresses. With a DecryptThrottle set, senders over
+// budget are refused before their tasks reach a worker.
+class SessionMailboxExecutor
+{
+public:
+    typedef std::function<void(SessionCipher &cipher)> Task;
+    typedef std::function<void(const WhisperException &exception)> ErrorCallback;
+
+    static const int MAILBOX_STRIPES = 64;
+    static const int MAILBOX_BATCH   = 32;
+
+    SessionMailboxExecutor(QSharedPointer<AxolotlStore> store, int maxThreads = QThread::idealThreadCount());
+    ~SessionMailboxExecutor();
+
+    void post(const AxolotlAddress &remoteAddress, const Task &task, const ErrorCallback &onError = ErrorCallback());
+    void encrypt(const AxolotlAddress &remoteAddress, const QByteArray &paddedMessage,
+                 const std::function<void(QSharedPointer<CiphertextMessage>)> &onEncrypted,
+                 const ErrorCallback &onError = ErrorCallback());
+    void decrypt(const AxolotlAddress &remoteAddress, QSharedPointer<WhisperMessage> ciphertext,
+                 const std::function<void(const QByteArray &)> &onDecrypted,
+                 const ErrorCallback &onError = ErrorCallback());
+    void decrypt(const AxolotlAddress &remoteAddress, QSharedPointer<PreKeyWhisperMessage> ciphertext,
+                 const std::function<void(const QByteArray &)> &onDecrypted,
+                 const ErrorCallback &onError = ErrorCallback());
+
+    // Applies to mailboxes created afterwards, call it before posting
+    void setDecryptThrottle(QSharedPointer<DecryptThrottle> throttle);
+
+    bool waitForDone(int msecs = -1);
+    int mailboxCount() const;
+    int evictIdleMailboxes();
+
+private:
+    struct Job {
+        Task          task;
+        ErrorCallback onError;
+    };
+
+    class Mailbox
+    {
+    public:
+        Mailbox(QSharedPointer<AxolotlStore> store, QSharedPointer<DecryptThrottle> throttle,
+                const AxolotlAddress &remoteAddress);
+
+        SessionCipher cipher;
+        QMutex        mutex;
+        QQueue<Job>   jobs;
+        bool          scheduled;
+    };
+
+    class MailboxRunner : public QRunnable
+    {
+    public:
+        MailboxRunner(SessionMailboxExecutor *executor, QSharedPointer<Mailbox> mailbox);
+        void run();
+
+    private:
+        static void fail(const Job &job, const WhisperException &exception);
+
+        SessionMailboxExecutor  *executor;
+        QSharedPointer<Mailbox>  mailbox;
+    };
+
+    struct Stripe {
+        QMutex                                    mutex;
+        QHash<AddressKey, QSharedPointer<Mailbox>> mailboxes;
+    };
+
+    void schedule(QSharedPointer<Mailbox> mailbox);
+    bool refuse(const AxolotlAddress &remoteAddress, const ErrorCallback &onError);
+
+    QSharedPointer<AxolotlStore>    store;
+    QSharedPointer<DecryptThrottle> throttle;
+    QThreadPool                     pool;
+    mutable Stripe                  stripes[MAILBOX_STRIPES];
+};
+
+#endif // SESSIONMAILBOXEXECUTOR_H
@@ -0,0 +1,121 @@
+#include "cryptoworker.h"
+#include "sessioncipher.h"
+#include "whisperexception.h"
+
+#include <QTimer>
+
+CryptoWorker::CryptoWorker(QSharedPointer<AxolotlStore> store, QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<CryptoResult>("CryptoResult");
+    qRegisterMetaType<QList<CryptoResult> >("QList<CryptoResult>");
+
+    this->store = store;
+    batchSize   = 64;
+    flushTimer  = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(0);
+    connect(flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+int CryptoWorker::maxBatchSize() const
+{
+    return batchSize;
+}
+
+void CryptoWorker::setMaxBatchSize(int size)
+{
+    batchSize = qMax(1, size);
+}
+
+void CryptoWorker::encrypt(quint64 requestId, const QString &name, int deviceId, const QByteArray &paddedMessage)
+{
+    CryptoResult result;
+    result.requestId = requestId;
+    result.name      = name;
+    result.deviceId  = deviceId;
+
+    try {
+        SessionCipher cipher(store, AxolotlAddress(name, deviceId));
+        QSharedPointer<CiphertextMessage> ciphertext = cipher.encrypt(paddedMessage);
+        result.messageType = ciphertext->getType();
+        result.data        = ciphertext->serialize();
+        enqueue(pendingEncrypted, result);
+    } catch (const WhisperException &e) {
+        result.errorType    = e.errorType();
+        result.errorMessage = e.errorMessage();
+        enqueue(pendingFailed, result);
+    }
+}
+
+void CryptoWorker::decryptWhisperMessage(quint64 requestId, const QString &name, int deviceId, const QByteArray &serialized)
+{
+    CryptoResult result;
+    result.requestId   = requestId;
+    result.name        = name;
+    result.deviceId    = deviceId;
+    result.messageType = CiphertextMessage::WHISPER_TYPE;
+
+    try {
+        SessionCipher cipher(store, AxolotlAddress(name, deviceId));
+        result.data = cipher.decrypt(QSharedPointer<WhisperMessage>(new WhisperMessage(serialized)));
+        enqueue(pendingDecrypted, result);
+    } catch (const WhisperException &e) {
+        result.errorType    = e.errorType();
+        result.errorMessage = e.errorMessage();
+        enqueue(pendingFailed, result);
+    }
+}
+
+void CryptoWorker::decryptPreKeyWhisperMessage(quint64 requestId, const QString &name, int deviceId, const QByteArray &serialized)
+{
+    CryptoResult result;
+    result.requestId   = requestId;
+    result.name        = name;
+    result.deviceId    = deviceId;
+    result.messageType = CiphertextMessage::PREKEY_TYPE;
+
+    try {
+        SessionCipher cipher(store, AxolotlAddress(name, deviceId));
+        result.data = cipher.decrypt(QSharedPointer<PreKeyWhisperMessage>(new PreKeyWhisperMessage(serialized)));
+        enqueue(pendingDecrypted, result);
+    } catch (const WhisperException &e) {
+        result.errorType    = e.errorType();
+        result.errorMessage = e.errorMessage();
+        enqueue(pendingFailed, result);
+    }
+}
+
+void CryptoWorker::flush()
+{
+    flushTimer->stop();
+
+    if (!pendingEncrypted.isEmpty()) {
+        QList<CryptoResult> results;
+        results.swap(pendingEncrypted);
+        emit encrypted(results);
+    }
+
+    if (!pendingDecrypted.isEmpty()) {
+        QList<CryptoResult> results;
+        results.swap(pendingDecrypted);
+        emit decrypted(results);
+    }
+
+    if (!pendingFailed.isEmpty()) {
+        QList<CryptoResult> results;
+        results.swap(pendingFailed);
+        emit failed(results);
+    }
+}
+
+void CryptoWorker::enqueue(QList<CryptoResult> &pending, const CryptoResult &result)
+{
+    pending.append(result);
+
+    if (pending.size() >= batchSize) {
+        flush();
+    } else if (!flushTimer->isActive()) {
+        flushTimer->start();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef CRYPTOWORKER_H
+#define CRYPTOWORKER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QMetaType>
+
+#include "state/axolotlstore.h"
+
+class QTimer;
+
+struct CryptoResult
+{
+    CryptoResult() : requestId(0), deviceId(0), messageType(0) {}
+
+    quint64    requestId;
+    QString    name;
+    int        deviceId;
+    int        messageType;
+    QByteArray data;
+    QString    errorType;
+    QString    errorMessage;
+};
+
+Q_DECLARE_METATYPE(CryptoResult)
+Q_DECLARE_METATYPE(QList<CryptoResult>)
+
+// Owns the stores and runs SessionCipher off the caller's thread. Move it to
+// a QThread and invoke the slots through queued connections (or
+// QMetaObject::invokeMethod). Results are coalesced and emitted once per
+// event loop pass, or as soon as maxBatchSize results are pending.
+class CryptoWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CryptoWorker(QSharedPointer<AxolotlStore> store, QObject *parent = 0);
+
+    int maxBatchSize() const;
+    void setMaxBatchSize(int size);
+
+public slots:
+    void encrypt(quint64 requestId, const QString &name, int deviceId, const QByteArray &paddedMessage);
+    void decryptWhisperMessage(quint64 requestId, const QString &name, int deviceId, const QByteArray &serialized);
+    void decryptPreKeyWhisperMessage(quint64 requestId, const QString &name, int deviceId, const QByteArray &serialized);
+    void flush();
+
+signals:
+    void encrypted(const QList<CryptoResult> &results);
+    void decrypted(const QList<CryptoResult> &results);
+    void failed(const QList<CryptoResult> &results);
+
+private:
+    void enqueue(QList<CryptoResult> &pending, const CryptoResult &result);
+
+    QSharedPointer<AxolotlStore> store;
+    QTimer                      *flushTimer;
+    int                          batchSize;
+    QList<CryptoResult>          pendingEncrypted;
+    QList<CryptoResult>          pendingDecrypted;
+    QList<CryptoResult>          pendingFailed;
+};
+
+#endif // CRYPTOWORKER_H
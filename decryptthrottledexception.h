@@ -0,0 +1,22 @@
+#ifndef DECRYPTTHROTTLEDEXCEPTION_H
+#define DECRYPTTHROTTLEDEXCEPTION_H
+
+#include "whisperexception.h"
+
+class DecryptThrottledException : public WhisperException
+{
+public:
+    DecryptThrottledException(const QString &error, qint64 retryAfter)
+        : WhisperException("DecryptThrottledException", error) {
+        this->retryAfter = retryAfter;
+    }
+    // Milliseconds until the sender's budget is refilled
+    qint64 getRetryAfter() const {
+        return retryAfter;
+    }
+
+private:
+    qint64 retryAfter;
+};
+
+#endif // DECRYPTTHROTTLEDEXCEPTION_H
@@ -4,19 +4,13 @@
 
 #include "../libcurve25519/curve.h"
 
-#include <openssl/rand.h>
+#include "../util/randomsource.h"
 
 const int Curve::DJB_TYPE = 5;
 
 ECKeyPair Curve::generateKeyPair()
 {
-    RAND_poll();
-
-    unsigned char buff1[32];
-    memset(buff1, 0, 32);
-    RAND_bytes(buff1, 32);
-
-    QByteArray privateKey = QByteArray::fromRawData((const char*)buff1, 32);
+    QByteArray privateKey = RandomSource::instance()->getBytes(32);
     Curve25519::generatePrivateKey(privateKey.data());
     QByteArray publicKey(32, '\0');
     Curve25519::generatePublicKey(privateKey.constData(), publicKey.data());
@@ -59,7 +53,7 @@ QByteArray Curve::calculateAgreement(const DjbECPublicKey &publicKey, const DjbE
                                        sharedKey.data());
         return sharedKey;
     } else {
-        throw InvalidKeyException("Unknown type: " + publicKey.getType());
+        throw InvalidKeyException(QString("Unknown type: %1").arg(publicKey.getType()));
     }
 }
 
@@ -78,13 +72,7 @@ bool Curve::verifySignature(const DjbECPublicKey &signingKey, const QByteArray &
 QByteArray Curve::calculateSignature(const DjbECPrivateKey &signingKey, const QByteArray &message)
 {
     if (signingKey.getType() == DJB_TYPE) {
-        RAND_poll();
-
-        unsigned char buff1[64];
-        memset(buff1, 0, 64);
-        RAND_bytes(buff1, 64);
-
-        QByteArray random64 = QByteArray::fromRawData((const char*)buff1, 64);
+        QByteArray random64 = RandomSource::instance()->getBytes(64);
         QByteArray signature(64, '\0');
         Curve25519::calculateSignature((const unsigned char*)signingKey.getPrivateKey().constData(),
                                        (const unsigned char*)message.constData(),
@@ -93,6 +81,6 @@ QByteArray Curve::calculateSignature(const DjbECPrivateKey &signingKey, const QB
                                        (unsigned char*)signature.data());
         return signature;
     } else {
-        throw InvalidKeyException("Unknown type: " + signingKey.getType());
+        throw InvalidKeyException(QString("Unknown type: %1").arg(signingKey.getType()));
     }
 }
@@ -0,0 +1,24 @@
+#ifndef ASYNCSENDERKEYSTORE_H
+#define ASYNCSENDERKEYSTORE_H
+
+#include "senderkeyrecord.h"
+#include "groups/senderkeyname.h"
+#include "whisperexception.h"
+
+#include <QSharedPointer>
+
+#include <functional>
+
+class AsyncSenderKeyStore
+{
+public:
+    typedef std::function<void(QSharedPointer<SenderKeyRecord> record)> LoadCallback;
+    typedef std::function<void()>                                       DoneCallback;
+    typedef std::function<void(const WhisperException &exception)>      ErrorCallback;
+
+    virtual void storeSenderKeyAsync(const SenderKeyName &senderKeyName, const SenderKeyRecord &record, const DoneCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void loadSenderKeyAsync(const SenderKeyName &senderKeyName, const LoadCallback &callback, const ErrorCallback &onError) = 0;
+    virtual ~AsyncSenderKeyStore() {}
+};
+
+#endif // ASYNCSENDERKEYSTORE_H
@@ -0,0 +1,90 @@
+#include "senderkeycache.h"
+
+#include <QMutexLocker>
+
+SenderKeyCache::SenderKeyCache(QSharedPointer<SenderKeyStore> backingStore, int maxEntries)
+{
+    this->backingStore = backingStore;
+    this->generation   = 0;
+    records.setMaxCost(qMax(1, maxEntries));
+}
+
+void SenderKeyCache::storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record)
+{
+    backingStore->storeSenderKey(senderKeyName, record);
+
+    QMutexLocker locker(&mutex);
+    generation++;
+    records.insert(senderKeyName.serialize(), new SenderKeyRecord(record.serialize()));
+}
+
+SenderKeyRecord SenderKeyCache::loadSenderKey(const SenderKeyName &senderKeyName) const
+{
+    QString key = senderKeyName.serialize();
+    quint64 loadedAt;
+
+    {
+        QMutexLocker locker(&mutex);
+        SenderKeyRecord *record = records.object(key);
+        if (record) {
+            return SenderKeyRecord(record->serialize());
+        }
+        loadedAt = generation;
+    }
+
+    SenderKeyRecord loaded = backingStore->loadSenderKey(senderKeyName);
+
+    QMutexLocker locker(&mutex);
+    if (generation == loadedAt && !records.contains(key)) {
+        records.insert(key, new SenderKeyRecord(loaded.serialize()));
+    }
+    return loaded;
+}
+
+bool SenderKeyCache::prefetch(const SenderKeyName &senderKeyName)
+{
+    QString key = senderKeyName.serialize();
+    quint64 loadedAt;
+
+    {
+        QMutexLocker locker(&mutex);
+        if (records.contains(key)) {
+            return false;
+        }
+        loadedAt = generation;
+    }
+
+    SenderKeyRecord loaded = backingStore->loadSenderKey(senderKeyName);
+
+    // A store since the load may already have been evicted again, the loaded
+    // record could be older than the backing store's
+    QMutexLocker locker(&mutex);
+    if (generation != loadedAt || records.contains(key)) {
+        return false;
+    }
+    return records.insert(key, new SenderKeyRecord(loaded.serialize()));
+}
+
+bool SenderKeyCache::isCached(const SenderKeyName &senderKeyName) const
+{
+    QMutexLocker locker(&mutex);
+    return records.contains(senderKeyName.serialize());
+}
+
+void SenderKeyCache::evict(const SenderKeyName &senderKeyName)
+{
+    QMutexLocker locker(&mutex);
+    records.remove(senderKeyName.serialize());
+}
+
+int SenderKeyCache::size() const
+{
+    QMutexLocker locker(&mutex);
+    return records.size();
+}
+
+void SenderKeyCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    records.clear();
+}
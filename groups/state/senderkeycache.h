@@ -0,0 +1,33 @@
+#ifndef SENDERKEYCACHE_H
+#define SENDERKEYCACHE_H
+
+#include <QSharedPointer>
+#include <QMutex>
+#include <QCache>
+
+#include "senderkeystore.h"
+
+// SenderKeyRecord copies share their states, so the cache only ever stores
+// and hands out deep copies made through serialize().
+class SenderKeyCache : public SenderKeyStore
+{
+public:
+    SenderKeyCache(QSharedPointer<SenderKeyStore> backingStore, int maxEntries = 10000);
+
+    void storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record);
+    SenderKeyRecord loadSenderKey(const SenderKeyName &senderKeyName) const;
+
+    bool prefetch(const SenderKeyName &senderKeyName);
+    bool isCached(const SenderKeyName &senderKeyName) const;
+    void evict(const SenderKeyName &senderKeyName);
+    int size() const;
+    void clear();
+
+private:
+    QSharedPointer<SenderKeyStore>              backingStore;
+    mutable QMutex                              mutex;
+    mutable QCache<QString, SenderKeyRecord>    records;
+    quint64                                     generation;
+};
+
+#endif // SENDERKEYCACHE_H
@@ -73,3 +73,58 @@ bool SenderKeyRecord::isEmpty() const
 {
     return senderKeyStates.isEmpty();
 }
+
+SenderKeyRecordDiagnostics SenderKeyRecord::getDiagnostics() const
+{
+    SenderKeyRecordDiagnostics diagnostics;
+    textsecure::SenderKeyRecordStructure recordStructure;
+
+    foreach (SenderKeyState *senderKeyState, senderKeyStates) {
+        textsecure::SenderKeyStateStructure *structure = recordStructure.add_senderkeystates();
+        structure->CopyFrom(senderKeyState->getStructure());
+
+        SenderKeyStateDiagnostics state;
+        state.keyId       = structure->senderkeyid();
+        state.iteration   = structure->senderchainkey().iteration();
+        state.bytes       = structure->ByteSize();
+        state.skippedKeys = structure->sendermessagekeys_size();
+
+        for (int i = 0; i < structure->sendermessagekeys_size(); i++) {
+            quint32 iteration = structure->sendermessagekeys(i).iteration();
+            if (iteration < state.iteration) {
+                state.oldestSkippedDistance = qMax(state.oldestSkippedDistance, state.iteration - iteration);
+            }
+        }
+
+        diagnostics.skippedKeys           += state.skippedKeys;
+        diagnostics.oldestSkippedDistance  = qMax(diagnostics.oldestSkippedDistance, state.oldestSkippedDistance);
+        diagnostics.states.append(state);
+    }
+
+    diagnostics.serializedBytes = recordStructure.ByteSize();
+    return diagnostics;
+}
+
+CompactionStats SenderKeyRecord::compact(const CompactionPolicy &policy)
+{
+    CompactionStats stats;
+
+    // Copies of a record share their states, give this one its own before
+    // trimming so the copies keep theirs intact
+    QLinkedList<SenderKeyState*> ownStates;
+    foreach (SenderKeyState *senderKeyState, senderKeyStates) {
+        ownStates.append(new SenderKeyState(senderKeyState->getStructure()));
+    }
+    senderKeyStates = ownStates;
+
+    while (senderKeyStates.size() > qMax(1, policy.maxSenderKeyStates)) {
+        delete senderKeyStates.takeLast();
+        stats.senderKeyStatesDropped++;
+    }
+
+    foreach (SenderKeyState *senderKeyState, senderKeyStates) {
+        senderKeyState->compact(policy, stats);
+    }
+
+    return stats;
+}
@@ -7,6 +7,8 @@
 #include "senderkeystate.h"
 #include "ecc/djbec.h"
 #include "ecc/eckeypair.h"
+#include "state/recorddiagnostics.h"
+#include "state/compactionpolicy.h"
 
 class SenderKeyRecord
 {
@@ -21,6 +23,8 @@ public:
     void setSenderKeyState(int id, int iteration, const QByteArray &chainKey, const ECKeyPair &signatureKey);
     QByteArray serialize() const;
     bool isEmpty() const;
+    SenderKeyRecordDiagnostics getDiagnostics() const;
+    CompactionStats compact(const CompactionPolicy &policy);
 
 private:
     QLinkedList<SenderKeyState*> senderKeyStates;
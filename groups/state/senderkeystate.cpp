@@ -1,5 +1,13 @@
 #include "senderkeystate.h"
 #include "../../ecc/curve.h"
+#include "../../util/securearena.h"
+
+static void cleanseString(::std::string *value)
+{
+    if (!value->empty()) {
+        SecureArena::cleanse(&(*value)[0], value->size());
+    }
+}
 
 SenderKeyState::SenderKeyState()
 {
@@ -66,6 +74,15 @@ SenderKeyState::SenderKeyState(const textsecure::SenderKeyStateStructure &sender
     this->senderKeyStateStructure = senderKeyStateStructure;
 }
 
+SenderKeyState::~SenderKeyState()
+{
+    cleanseString(senderKeyStateStructure.mutable_senderchainkey()->mutable_seed());
+    cleanseString(senderKeyStateStructure.mutable_sendersigningkey()->mutable_private_());
+    for (int i = 0; i < senderKeyStateStructure.sendermessagekeys_size(); i++) {
+        cleanseString(senderKeyStateStructure.mutable_sendermessagekeys(i)->mutable_seed());
+    }
+}
+
 int SenderKeyState::getKeyId() const
 {
     return senderKeyStateStructure.senderkeyid();
@@ -131,11 +148,11 @@ SenderMessageKey SenderKeyState::removeSenderMessageKey(uint32_t iteration)
 {
     SenderMessageKey result;
     for (int i = 0; i < senderKeyStateStructure.sendermessagekeys_size(); i++) {
-        textsecure::SenderKeyStateStructure::SenderMessageKey *senderMessageKey = senderKeyStateStructure.mutable_sendermessagekeys(i);
-        if (senderMessageKey->iteration() == iteration) {
-            ::std::string senderMessageKeySeed = senderMessageKey->seed();
+        const textsecure::SenderKeyStateStructure::SenderMessageKey &senderMessageKey = senderKeyStateStructure.sendermessagekeys(i);
+        if (senderMessageKey.iteration() == iteration) {
+            ::std::string senderMessageKeySeed = senderMessageKey.seed();
             result = SenderMessageKey(iteration, QByteArray(senderMessageKeySeed.data(), senderMessageKeySeed.length()));
-            delete senderMessageKey;
+            senderKeyStateStructure.mutable_sendermessagekeys()->DeleteSubrange(i, 1);
             break;
         }
     }
@@ -147,3 +164,16 @@ textsecure::SenderKeyStateStructure SenderKeyState::getStructure() const
 {
     return senderKeyStateStructure;
 }
+
+void SenderKeyState::compact(const CompactionPolicy &policy, CompactionStats &stats)
+{
+    // Message keys are appended in order, the oldest come first
+    int excess = senderKeyStateStructure.sendermessagekeys_size() - qMax(0, policy.maxSenderMessageKeys);
+    if (excess > 0) {
+        for (int i = 0; i < excess; i++) {
+            cleanseString(senderKeyStateStructure.mutable_sendermessagekeys(i)->mutable_seed());
+        }
+        senderKeyStateStructure.mutable_sendermessagekeys()->DeleteSubrange(0, excess);
+        stats.skippedKeysDropped += excess;
+    }
+}
@@ -4,6 +4,7 @@
 #include "../../state/LocalStorageProtocol.pb.h"
 #include "../../ecc/eckeypair.h"
 #include "../ratchet/senderchainkey.h"
+#include "../../state/compactionpolicy.h"
 
 class SenderKeyState
 {
@@ -16,6 +17,7 @@ public:
     SenderKeyState(int id, int iteration, const QByteArray &chainKey,
                    const DjbECPublicKey &signatureKeyPublic, const DjbECPrivateKey &signatureKeyPrivate);
     SenderKeyState(const textsecure::SenderKeyStateStructure &senderKeyStateStructure);
+    ~SenderKeyState();
 
     int getKeyId() const;
     SenderChainKey getSenderChainKey() const;
@@ -26,6 +28,7 @@ public:
     void addSenderMessageKey(const SenderMessageKey &senderMessageKey);
     SenderMessageKey removeSenderMessageKey(uint32_t iteration);
     textsecure::SenderKeyStateStructure getStructure() const;
+    void compact(const CompactionPolicy &policy, CompactionStats &stats);
 
 private:
     textsecure::SenderKeyStateStructure senderKeyStateStructure;
@@ -32,3 +32,14 @@ DjbECPrivateKey IdentityKeyPair::getPrivateKey() const
 {
     return privateKey;
 }
+
+QByteArray IdentityKeyPair::serialize() const
+{
+    textsecure::IdentityKeyPairStructure structure;
+    QByteArray publickey = publicKey.serialize();
+    structure.set_publickey(publickey.constData(), publickey.size());
+    QByteArray privatekey = privateKey.serialize();
+    structure.set_privatekey(privatekey.constData(), privatekey.size());
+    ::std::string serialized = structure.SerializeAsString();
+    return QByteArray(serialized.data(), serialized.length());
+}
@@ -13,6 +13,7 @@ public:
 
     IdentityKey getPublicKey() const;
     DjbECPrivateKey getPrivateKey() const;
+    QByteArray serialize() const;
 
 private:
     IdentityKey publicKey;
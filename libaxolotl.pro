@@ -11,9 +11,17 @@ isEmpty(CURRENT_RPATH_DIR) {
 VERSION = 1.3.4
 INSTALLS += target
 
-CONFIG += plugin link_pkgconfig
+CONFIG += plugin link_pkgconfig c++11
 PKGCONFIG += openssl libssl libcrypto
+linux:packagesExist(liburing) {
+    PKGCONFIG += liburing
+    DEFINES += AXOLOTL_HAVE_IO_URING
+}
 DEFINES += LIBAXOLOTL_LIBRARY
+# DeterministicRandomSource is for the simulator and replay tools only, never in a release build
+deterministic_random {
+    DEFINES += AXOLOTL_DETERMINISTIC_RANDOM
+}
 
 LIBS += -L../libcurve25519 -lcurve25519
 LIBS += /usr/lib/libprotobuf.a
@@ -78,7 +86,49 @@ HEADERS += \
     groups/senderkeyname.h \
     groups/groupsessionbuilder.h \
     groups/groupcipher.h \
-    axolotladdress.h
+    axolotladdress.h \
+    util/addresskey.h \
+    concurrent/sessionmailboxexecutor.h \
+    concurrent/functionrunnable.h \
+    state/asyncsessionstore.h \
+    state/asyncprekeystore.h \
+    state/asyncstoreadapter.h \
+    groups/state/asyncsenderkeystore.h \
+    asyncsessioncipher.h \
+    cryptoworker.h \
+    state/sessioncache.h \
+    state/sessionprefetcher.h \
+    state/sessioncachesnapshot.h \
+    groups/state/senderkeycache.h \
+    util/securearena.h \
+    ratchet/batchratchetengine.h \
+    multirecipientcipher.h \
+    state/impl/inmemoryaxolotlstore.h \
+    util/tracer.h \
+    util/workloadrecorder.h \
+    util/randomsource.h \
+    state/recorddiagnostics.h \
+    state/recordscanner.h \
+    state/compactionpolicy.h \
+    state/storecompactor.h \
+    replication/changefeed.h \
+    replication/replicatingstore.h \
+    replication/changefeedapplier.h \
+    sessionconflictexception.h \
+    state/versionedsessionstore.h \
+    state/impl/inmemoryversionedsessionstore.h \
+    state/impl/sharedmemorysessionstore.h \
+    util/fileiobackend.h \
+    state/impl/asyncfilestore.h \
+    util/hashring.h \
+    state/shardedstore.h \
+    state/impl/concurrentaxolotlstore.h \
+    state/sessionmetadatastore.h \
+    state/sessionmetadataindex.h \
+    protocol/envelopevalidator.h \
+    concurrent/decryptthrottle.h \
+    decryptthrottledexception.h \
+    concurrent/priorityscheduler.h
 
 SOURCES += \
     ecc/curve.cpp \
@@ -119,4 +169,35 @@ SOURCES += \
     groups/senderkeyname.cpp \
     groups/groupsessionbuilder.cpp \
     groups/groupcipher.cpp \
-    axolotladdress.cpp
+    axolotladdress.cpp \
+    concurrent/sessionmailboxexecutor.cpp \
+    state/asyncstoreadapter.cpp \
+    asyncsessioncipher.cpp \
+    cryptoworker.cpp \
+    state/sessioncache.cpp \
+    state/sessionprefetcher.cpp \
+    state/sessioncachesnapshot.cpp \
+    groups/state/senderkeycache.cpp \
+    util/securearena.cpp \
+    ratchet/batchratchetengine.cpp \
+    multirecipientcipher.cpp \
+    state/impl/inmemoryaxolotlstore.cpp \
+    util/tracer.cpp \
+    util/workloadrecorder.cpp \
+    util/randomsource.cpp \
+    state/recordscanner.cpp \
+    state/storecompactor.cpp \
+    replication/changefeed.cpp \
+    replication/replicatingstore.cpp \
+    replication/changefeedapplier.cpp \
+    state/impl/inmemoryversionedsessionstore.cpp \
+    state/impl/sharedmemorysessionstore.cpp \
+    util/fileiobackend.cpp \
+    state/impl/asyncfilestore.cpp \
+    util/hashring.cpp \
+    state/shardedstore.cpp \
+    state/impl/concurrentaxolotlstore.cpp \
+    state/sessionmetadataindex.cpp \
+    protocol/envelopevalidator.cpp \
+    concurrent/decryptthrottle.cpp \
+    concurrent/priorityscheduler.cpp
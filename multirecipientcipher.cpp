@@ -0,0 +1,151 @@
+#include "multirecipientcipher.h"
+#include "sessioncipher.h"
+#include "protocol/whispermessage.h"
+#include "protocol/prekeywhispermessage.h"
+#include "state/versionedsessionstore.h"
+
+MultiRecipientCipher::MultiRecipientCipher(QSharedPointer<AxolotlStore> store)
+{
+    this->store          = store;
+    this->batchThreshold = DEFAULT_BATCH_THRESHOLD;
+}
+
+QList<QSharedPointer<CiphertextMessage> > MultiRecipientCipher::encrypt(const QList<AxolotlAddress> &recipients, const QByteArray &paddedMessage)
+{
+    QVector<QSharedPointer<CiphertextMessage> > results(recipients.size());
+
+    if (recipients.size() < batchThreshold) {
+        for (int i = 0; i < recipients.size(); i++) {
+            results[i] = encryptSingle(recipients.at(i), paddedMessage);
+        }
+        return results.toList();
+    }
+
+    VersionedSessionStore *versionedStore = dynamic_cast<VersionedSessionStore*>(store.data());
+    QList<Recipient>       batched;
+    QList<int>             fallback;
+
+    engine.clear();
+
+    for (int i = 0; i < recipients.size(); i++) {
+        QSharedPointer<SessionRecord> copy;
+        quint64                       version       = 0;
+        SessionRecord                *sessionRecord = 0;
+
+        if (versionedStore) {
+            copy          = QSharedPointer<SessionRecord>(versionedStore->loadSessionVersioned(recipients.at(i), &version));
+            sessionRecord = copy.data();
+        } else {
+            sessionRecord = store->loadSession(recipients.at(i));
+        }
+
+        SessionState *sessionState = sessionRecord->getSessionState();
+
+        if (!sessionState->hasSenderChain() || sessionState->getSessionVersion() < 3) {
+            fallback.append(i);
+            continue;
+        }
+
+        Recipient recipient;
+        recipient.position            = i;
+        recipient.record              = copy;
+        recipient.version             = version;
+        recipient.lane                = engine.addLane(sessionState->getSenderChainKey());
+        recipient.senderEphemeral     = sessionState->getSenderRatchetKey();
+        recipient.previousCounter     = sessionState->getPreviousCounter();
+        recipient.localIdentityKey    = sessionState->getLocalIdentityKey();
+        recipient.remoteIdentityKey   = sessionState->getRemoteIdentityKey();
+        recipient.unacknowledged      = sessionState->hasUnacknowledgedPreKeyMessage();
+        recipient.localRegistrationId = sessionState->getLocalRegistrationId();
+        recipient.preKeyId            = 0;
+        recipient.signedPreKeyId      = 0;
+        if (recipient.unacknowledged) {
+            UnacknowledgedPreKeyMessageItems items = sessionState->getUnacknowledgedPreKeyMessageItems();
+            recipient.preKeyId       = items.getPreKeyId();
+            recipient.signedPreKeyId = items.getSignedPreKeyId();
+            recipient.baseKey        = items.getBaseKey();
+        }
+        batched.append(recipient);
+    }
+
+    engine.deriveMessageKeys();
+
+    QList<uint> counters;
+    for (int i = 0; i < batched.size(); i++) {
+        const Recipient &recipient = batched.at(i);
+        uint             counter   = engine.getIndex(recipient.lane);
+        QByteArray       body      = engine.encrypt(recipient.lane, paddedMessage);
+
+        QSharedPointer<WhisperMessage> whisperMessage(new WhisperMessage(3, engine.getMacKey(recipient.lane),
+                                                                         recipient.senderEphemeral, counter,
+                                                                         recipient.previousCounter, body,
+                                                                         recipient.localIdentityKey,
+                                                                         recipient.remoteIdentityKey));
+        if (recipient.unacknowledged) {
+            results[recipient.position] = QSharedPointer<PreKeyWhisperMessage>(new PreKeyWhisperMessage(
+                                                                                   3, recipient.localRegistrationId,
+                                                                                   recipient.preKeyId, recipient.signedPreKeyId,
+                                                                                   recipient.baseKey, recipient.localIdentityKey,
+                                                                                   whisperMessage));
+        } else {
+            results[recipient.position] = whisperMessage;
+        }
+        counters.append(counter);
+    }
+
+    engine.advance();
+
+    for (int i = 0; i < batched.size(); i++) {
+        const Recipient      &recipient     = batched.at(i);
+        const AxolotlAddress &remoteAddress = recipients.at(recipient.position);
+
+        // Only succeeds if nobody wrote the record since we loaded it, otherwise our message would reuse keys
+        if (versionedStore) {
+            SessionRecord *sessionRecord = recipient.record.data();
+            sessionRecord->getSessionState()->setSenderChainKey(engine.getChainKey(recipient.lane));
+            if (!versionedStore->compareAndSetSession(remoteAddress, recipient.version, sessionRecord)) {
+                results[recipient.position] = encryptSingle(remoteAddress, paddedMessage);
+            }
+            continue;
+        }
+
+        SessionRecord *sessionRecord = store->loadSession(remoteAddress);
+        SessionState  *sessionState  = sessionRecord->getSessionState();
+
+        // Someone else ratcheted this session since we read it, our message would reuse keys
+        if (!sessionState->hasSenderChain() ||
+            sessionState->getSenderChainIndex() != counters.at(i) ||
+            sessionState->getSenderRatchetKey().serialize() != recipient.senderEphemeral.serialize())
+        {
+            results[recipient.position] = encryptSingle(remoteAddress, paddedMessage);
+            continue;
+        }
+
+        sessionState->setSenderChainKey(engine.getChainKey(recipient.lane));
+        store->storeSession(remoteAddress, sessionRecord);
+    }
+
+    engine.clear();
+
+    foreach (int position, fallback) {
+        results[position] = encryptSingle(recipients.at(position), paddedMessage);
+    }
+
+    return results.toList();
+}
+
+void MultiRecipientCipher::setBatchThreshold(int threshold)
+{
+    batchThreshold = qMax(1, threshold);
+}
+
+int MultiRecipientCipher::getBatchThreshold() const
+{
+    return batchThreshold;
+}
+
+QSharedPointer<CiphertextMessage> MultiRecipientCipher::encryptSingle(const AxolotlAddress &remoteAddress, const QByteArray &paddedMessage)
+{
+    SessionCipher cipher(store, remoteAddress);
+    return cipher.encrypt(paddedMessage);
+}
@@ -0,0 +1,59 @@
+#ifndef MULTIRECIPIENTCIPHER_H
+#define MULTIRECIPIENTCIPHER_H
+
+#include <QSharedPointer>
+#include <QList>
+
+#include "state/axolotlstore.h"
+#include "protocol/ciphertextmessage.h"
+#include "ratchet/batchratchetengine.h"
+#include "axolotladdress.h"
+
+// Encrypts one padded message for many sessions at once. Sender chains of
+// all version 3 sessions are stepped together by a BatchRatchetEngine,
+// anything else (legacy sessions, missing sender chains, records changed
+// underneath us) goes through a plain SessionCipher. Results are in the
+// order of the recipients list.
+//
+// With a VersionedSessionStore the advanced chains are written back by
+// compare-and-swap, so concurrent encrypts for the same recipients are
+// safe. Other stores, as with SessionCipher, need callers to keep
+// operations on one address from overlapping.
+class MultiRecipientCipher
+{
+public:
+    static const int DEFAULT_BATCH_THRESHOLD = 8;
+
+    MultiRecipientCipher(QSharedPointer<AxolotlStore> store);
+
+    QList<QSharedPointer<CiphertextMessage> > encrypt(const QList<AxolotlAddress> &recipients,
+                                                      const QByteArray &paddedMessage);
+
+    void setBatchThreshold(int threshold);
+    int getBatchThreshold() const;
+
+private:
+    struct Recipient {
+        QSharedPointer<SessionRecord> record;
+        quint64                       version;
+        int                           position;
+        int                           lane;
+        DjbECPublicKey                senderEphemeral;
+        int                           previousCounter;
+        IdentityKey                   localIdentityKey;
+        IdentityKey                   remoteIdentityKey;
+        bool                          unacknowledged;
+        int                           preKeyId;
+        int                           signedPreKeyId;
+        DjbECPublicKey                baseKey;
+        int                           localRegistrationId;
+    };
+
+    QSharedPointer<CiphertextMessage> encryptSingle(const AxolotlAddress &remoteAddress, const QByteArray &paddedMessage);
+
+    QSharedPointer<AxolotlStore> store;
+    BatchRatchetEngine           engine;
+    int                          batchThreshold;
+};
+
+#endif // MULTIRECIPIENTCIPHER_H
@@ -0,0 +1,258 @@
+#include "envelopevalidator.h"
+
+#include "ciphertextmessage.h"
+#include "whispermessage.h"
+#include "senderkeymessage.h"
+#include "../util/byteutil.h"
+
+// Serialized DjbECPublicKey: type byte plus 32 bytes
+static const int PUBLIC_KEY_LENGTH = 33;
+static const int MAX_FIELD_NUMBER  = 8;
+
+enum WireType {
+    Varint          = 0,
+    Fixed64         = 1,
+    LengthDelimited = 2,
+    Fixed32         = 5
+};
+
+struct FieldRule {
+    int number;
+    int wireType;
+    int exactLength;
+};
+
+struct FieldSpan {
+    const uchar *data;
+    int          length;
+};
+
+static const FieldRule WHISPER_MESSAGE_FIELDS[] = {
+    { 1, LengthDelimited, PUBLIC_KEY_LENGTH },
+    { 2, Varint,          -1 },
+    { 3, Varint,          -1 },
+    { 4, LengthDelimited, -1 }
+};
+
+static const FieldRule PREKEY_WHISPER_MESSAGE_FIELDS[] = {
+    { 1, Varint,          -1 },
+    { 2, LengthDelimited, PUBLIC_KEY_LENGTH },
+    { 3, LengthDelimited, PUBLIC_KEY_LENGTH },
+    { 4, LengthDelimited, -1 },
+    { 5, Varint,          -1 },
+    { 6, Varint,          -1 }
+};
+
+static const FieldRule SENDER_KEY_MESSAGE_FIELDS[] = {
+    { 1, Varint,          -1 },
+    { 2, Varint,          -1 },
+    { 3, LengthDelimited, -1 }
+};
+
+static bool readVarint(const uchar *&position, const uchar *end, quint64 *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && position < end; shift += 7) {
+        uchar byte = *position++;
+        *value |= (quint64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One pass over the message body. Sets a bit in seen for every field
+// number present and records where length delimited fields start.
+template <int N>
+static EnvelopeValidator::Result scanFields(const uchar *data, int length, const FieldRule (&rules)[N],
+                                            quint32 *seen, FieldSpan *spans)
+{
+    const uchar *position = data;
+    const uchar *end      = data + length;
+    *seen = 0;
+
+    while (position < end) {
+        quint64 tag;
+        if (!readVarint(position, end, &tag)) {
+            return EnvelopeValidator::Malformed;
+        }
+
+        quint64 number   = tag >> 3;
+        int     wireType = tag & 0x7;
+        if (number == 0) {
+            return EnvelopeValidator::Malformed;
+        }
+
+        const FieldRule *rule = 0;
+        for (int i = 0; i < N; i++) {
+            if ((quint64)rules[i].number == number) {
+                rule = &rules[i];
+                break;
+            }
+        }
+        if (rule && rule->wireType != wireType) {
+            return EnvelopeValidator::Malformed;
+        }
+
+        quint64 value;
+        switch (wireType) {
+        case Varint:
+            if (!readVarint(position, end, &value)) {
+                return EnvelopeValidator::Malformed;
+            }
+            break;
+        case Fixed64:
+        case Fixed32: {
+            int size = wireType == Fixed64 ? 8 : 4;
+            if (end - position < size) {
+                return EnvelopeValidator::Malformed;
+            }
+            position += size;
+            break;
+        }
+        case LengthDelimited:
+            if (!readVarint(position, end, &value) || value > (quint64)(end - position)) {
+                return EnvelopeValidator::Malformed;
+            }
+            if (rule && rule->exactLength >= 0 && value != (quint64)rule->exactLength) {
+                return EnvelopeValidator::Malformed;
+            }
+            if (number <= MAX_FIELD_NUMBER) {
+                spans[number].data   = position;
+                spans[number].length = value;
+            }
+            position += value;
+            break;
+        default:
+            // Groups are deprecated and never used by these messages
+            return EnvelopeValidator::Malformed;
+        }
+
+        if (number <= MAX_FIELD_NUMBER) {
+            *seen |= 1u << number;
+        }
+    }
+
+    return EnvelopeValidator::Valid;
+}
+
+static EnvelopeValidator::Result validateWhisperBody(const uchar *data, int length, int maxSize)
+{
+    if (length < 1 + WhisperMessage::MAC_LENGTH) {
+        return EnvelopeValidator::TooShort;
+    }
+    if (length > maxSize) {
+        return EnvelopeValidator::TooLong;
+    }
+
+    int version = ByteUtil::highBitsToInt(data[0]);
+    if (version <= CiphertextMessage::UNSUPPORTED_VERSION) {
+        return EnvelopeValidator::LegacyVersion;
+    }
+    if (version > CiphertextMessage::CURRENT_VERSION) {
+        return EnvelopeValidator::UnknownVersion;
+    }
+
+    quint32   seen;
+    FieldSpan spans[MAX_FIELD_NUMBER + 1];
+    EnvelopeValidator::Result result = scanFields(data + 1, length - 1 - WhisperMessage::MAC_LENGTH,
+                                                  WHISPER_MESSAGE_FIELDS, &seen, spans);
+    if (result != EnvelopeValidator::Valid) {
+        return result;
+    }
+
+    if ((seen & ((1u << 1) | (1u << 2) | (1u << 4))) != ((1u << 1) | (1u << 2) | (1u << 4))) {
+        return EnvelopeValidator::MissingField;
+    }
+
+    // Version 3 bodies are AES-CBC with PKCS#7 padding
+    if (version >= 3 && (spans[4].length == 0 || spans[4].length % 16 != 0)) {
+        return EnvelopeValidator::Malformed;
+    }
+
+    return EnvelopeValidator::Valid;
+}
+
+EnvelopeValidator::Result EnvelopeValidator::validateWhisperMessage(const QByteArray &serialized, int maxSize)
+{
+    return validateWhisperBody((const uchar*)serialized.constData(), serialized.size(), maxSize);
+}
+
+EnvelopeValidator::Result EnvelopeValidator::validatePreKeyWhisperMessage(const QByteArray &serialized, int maxSize)
+{
+    if (serialized.size() < 1) {
+        return TooShort;
+    }
+    if (serialized.size() > maxSize) {
+        return TooLong;
+    }
+
+    const uchar *data    = (const uchar*)serialized.constData();
+    int          version = ByteUtil::highBitsToInt(data[0]);
+    if (version <= CiphertextMessage::UNSUPPORTED_VERSION) {
+        return LegacyVersion;
+    }
+    if (version > CiphertextMessage::CURRENT_VERSION) {
+        return UnknownVersion;
+    }
+
+    quint32   seen;
+    FieldSpan spans[MAX_FIELD_NUMBER + 1];
+    Result    result = scanFields(data + 1, serialized.size() - 1, PREKEY_WHISPER_MESSAGE_FIELDS, &seen, spans);
+    if (result != Valid) {
+        return result;
+    }
+
+    quint32 required = (1u << 2) | (1u << 3) | (1u << 4) | (version == 2 ? (1u << 1) : (1u << 6));
+    if ((seen & required) != required) {
+        return MissingField;
+    }
+
+    result = validateWhisperBody(spans[4].data, spans[4].length, maxSize);
+    return result == LegacyVersion ? Malformed : result;
+}
+
+EnvelopeValidator::Result EnvelopeValidator::validateSenderKeyMessage(const QByteArray &serialized, int maxSize)
+{
+    if (serialized.size() < 1 + SenderKeyMessage::SIGNATURE_LENGTH) {
+        return TooShort;
+    }
+    if (serialized.size() > maxSize) {
+        return TooLong;
+    }
+
+    const uchar *data    = (const uchar*)serialized.constData();
+    int          version = ByteUtil::highBitsToInt(data[0]);
+    if (version < 3) {
+        return LegacyVersion;
+    }
+    if (version > CiphertextMessage::CURRENT_VERSION) {
+        return UnknownVersion;
+    }
+
+    quint32   seen;
+    FieldSpan spans[MAX_FIELD_NUMBER + 1];
+    Result    result = scanFields(data + 1, serialized.size() - 1 - SenderKeyMessage::SIGNATURE_LENGTH,
+                                  SENDER_KEY_MESSAGE_FIELDS, &seen, spans);
+    if (result != Valid) {
+        return result;
+    }
+
+    quint32 required = (1u << 1) | (1u << 2) | (1u << 3);
+    return (seen & required) == required ? Valid : MissingField;
+}
+
+QString EnvelopeValidator::describe(Result result)
+{
+    switch (result) {
+    case Valid:          return "Valid";
+    case TooShort:       return "Message too short";
+    case TooLong:        return "Message too long";
+    case LegacyVersion:  return "Legacy message version";
+    case UnknownVersion: return "Unknown message version";
+    case Malformed:      return "Malformed message";
+    case MissingField:   return "Incomplete message.";
+    }
+    return "Unknown validation result";
+}
@@ -0,0 +1,34 @@
+#ifndef ENVELOPEVALIDATOR_H
+#define ENVELOPEVALIDATOR_H
+
+#include <QByteArray>
+#include <QString>
+
+// Structural checks on serialized messages before they reach protobuf:
+// version byte, length bounds, and a single pass over the field tags that
+// checks wire types, required fields and key lengths. Nothing is
+// allocated, so floods of junk are cheap to drop. A Valid result doesn't
+// authenticate anything, the MAC or signature is still checked later.
+class EnvelopeValidator
+{
+public:
+    enum Result {
+        Valid,
+        TooShort,
+        TooLong,
+        LegacyVersion,
+        UnknownVersion,
+        Malformed,
+        MissingField
+    };
+
+    static const int MAX_MESSAGE_SIZE = 256 * 1024;
+
+    static Result validateWhisperMessage(const QByteArray &serialized, int maxSize = MAX_MESSAGE_SIZE);
+    static Result validatePreKeyWhisperMessage(const QByteArray &serialized, int maxSize = MAX_MESSAGE_SIZE);
+    static Result validateSenderKeyMessage(const QByteArray &serialized, int maxSize = MAX_MESSAGE_SIZE);
+
+    static QString describe(Result result);
+};
+
+#endif // ENVELOPEVALIDATOR_H
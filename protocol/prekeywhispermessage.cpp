@@ -6,18 +6,26 @@
 
 #include "../util/byteutil.h"
 #include "../ecc/curve.h"
+#include "../util/tracer.h"
 #include "WhisperTextProtocol.pb.h"
+#include "envelopevalidator.h"
 
 #include <QDebug>
 
 PreKeyWhisperMessage::PreKeyWhisperMessage(const QByteArray &serialized)
 {
+    TRACE_SCOPE("message.parse");
+
+    EnvelopeValidator::Result validation = EnvelopeValidator::validatePreKeyWhisperMessage(serialized);
+    if (validation == EnvelopeValidator::UnknownVersion) {
+        throw InvalidVersionException(QString("Unknown version: %1").arg(ByteUtil::highBitsToInt(serialized[0])));
+    }
+    if (validation != EnvelopeValidator::Valid) {
+        throw InvalidMessageException(EnvelopeValidator::describe(validation));
+    }
+
     try {
         this->version = ByteUtil::highBitsToInt(serialized[0]);
-
-        if (this->version > CiphertextMessage::CURRENT_VERSION) {
-            throw InvalidVersionException("Unknown version: " + this->version);
-        }
         textsecure::PreKeyWhisperMessage preKeyWhisperMessage;
         QByteArray serializedMessage = serialized.mid(1);
         preKeyWhisperMessage.ParseFromArray(serializedMessage.constData(), serializedMessage.size());
@@ -31,11 +31,11 @@ SenderKeyDistributionMessage::SenderKeyDistributionMessage(const QByteArray &ser
     QByteArray message = serialized.mid(1);
 
     if (ByteUtil::highBitsToInt(version) < CiphertextMessage::CURRENT_VERSION) {
-        throw LegacyMessageException("Legacy message: " + ByteUtil::highBitsToInt(version));
+        throw LegacyMessageException(QString("Legacy message: %1").arg(ByteUtil::highBitsToInt(version)));
     }
 
     if (ByteUtil::highBitsToInt(version) > CURRENT_VERSION) {
-        throw InvalidMessageException("Unknown version: " + ByteUtil::highBitsToInt(version));
+        throw InvalidMessageException(QString("Unknown version: %1").arg(ByteUtil::highBitsToInt(version)));
     }
 
     textsecure::SenderKeyDistributionMessage senderKeyDistributionMessage;
@@ -4,6 +4,7 @@
 #include "../legacymessageexception.h"
 #include "../invalidmessageexception.h"
 #include "WhisperTextProtocol.pb.h"
+#include "envelopevalidator.h"
 #include "../ecc/curve.h"
 #include "../invalidkeyexception.h"
 
@@ -11,18 +12,18 @@
 
 SenderKeyMessage::SenderKeyMessage(const QByteArray &serialized)
 {
+    EnvelopeValidator::Result validation = EnvelopeValidator::validateSenderKeyMessage(serialized);
+    if (validation == EnvelopeValidator::LegacyVersion) {
+        throw LegacyMessageException(QString("Legacy message: %1").arg(ByteUtil::highBitsToInt(serialized[0])));
+    }
+    if (validation != EnvelopeValidator::Valid) {
+        throw InvalidMessageException(EnvelopeValidator::describe(validation));
+    }
+
     quint8     version             = serialized[0];
     QByteArray message             = serialized.mid(1, serialized.size() - 1 - SIGNATURE_LENGTH);
     //QByteArray signature           = serialized.right(SIGNATURE_LENGTH);
 
-    if (ByteUtil::highBitsToInt(version) < 3) {
-        throw LegacyMessageException("Legacy message: " + ByteUtil::highBitsToInt(version));
-    }
-
-    if (ByteUtil::highBitsToInt(version) > CURRENT_VERSION) {
-        throw InvalidMessageException("Unknown version: " + ByteUtil::highBitsToInt(version));
-    }
-
     textsecure::SenderKeyMessage senderKeyMessage;
     senderKeyMessage.ParseFromArray(message.constData(), message.size());
 
@@ -3,7 +3,9 @@
 #include "../invalidmessageexception.h"
 #include "../legacymessageexception.h"
 #include "WhisperTextProtocol.pb.h"
+#include "envelopevalidator.h"
 #include "../ecc/curve.h"
+#include "../util/tracer.h"
 
 #include <QMessageAuthenticationCode>
 
@@ -16,6 +18,16 @@ WhisperMessage::WhisperMessage()
 
 WhisperMessage::WhisperMessage(const QByteArray &serialized)
 {
+    TRACE_SCOPE("message.parse");
+
+    EnvelopeValidator::Result validation = EnvelopeValidator::validateWhisperMessage(serialized);
+    if (validation == EnvelopeValidator::LegacyVersion) {
+        throw LegacyMessageException(QString("Legacy message: %1").arg(ByteUtil::highBitsToInt(serialized[0])));
+    }
+    if (validation != EnvelopeValidator::Valid) {
+        throw InvalidMessageException(EnvelopeValidator::describe(validation));
+    }
+
     try {
         //QList<QByteArray> messageParts = ByteUtil::split(serialized, 1, serialized.size() - 1 - MAC_LENGTH, MAC_LENGTH);
         qint8     version      = serialized[0];
@@ -23,14 +35,6 @@ WhisperMessage::WhisperMessage(const QByteArray &serialized)
         QByteArray   mac       = serialized.right(MAC_LENGTH);
         //qDebug() << "serialized size:" << serialized.size() << "message size:" << message.size();
 
-        if (ByteUtil::highBitsToInt(version) <= CiphertextMessage::UNSUPPORTED_VERSION) {
-            throw LegacyMessageException("Legacy message: " + ByteUtil::highBitsToInt(version));
-        }
-
-        if (ByteUtil::highBitsToInt(version) > CURRENT_VERSION) {
-            throw InvalidMessageException("Unknown version: " + ByteUtil::highBitsToInt(version));
-        }
-
         textsecure::WhisperMessage whisperMessage;
         whisperMessage.ParsePartialFromArray(message.constData(), message.size());
 
@@ -60,6 +64,8 @@ WhisperMessage::WhisperMessage(const QByteArray &serialized)
 
 WhisperMessage::WhisperMessage(int messageVersion, const QByteArray &macKey, const DjbECPublicKey &senderRatchetKey, uint counter, uint previousCounter, const QByteArray &ciphertext, const IdentityKey &senderIdentityKey, const IdentityKey &receiverIdentityKey)
 {
+    TRACE_SCOPE("message.serialize");
+
     textsecure::WhisperMessage whisperMessage;
     QByteArray ratchetKey = senderRatchetKey.serialize();
     whisperMessage.set_ratchetkey(ratchetKey.constData(), ratchetKey.size());
@@ -95,6 +101,11 @@ uint WhisperMessage::getCounter() const
     return counter;
 }
 
+uint WhisperMessage::getPreviousCounter() const
+{
+    return previousCounter;
+}
+
 QByteArray WhisperMessage::getBody() const
 {
     return ciphertext;
@@ -26,6 +26,7 @@ public:
     DjbECPublicKey getSenderRatchetKey() const;
     int getMessageVersion() const;
     uint getCounter() const;
+    uint getPreviousCounter() const;
     QByteArray getBody() const;
     QByteArray serialize() const;
     int getType() const;
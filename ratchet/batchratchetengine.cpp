@@ -0,0 +1,178 @@
+#include "batchratchetengine.h"
+#include "../kdf/hkdf.h"
+#include "../invalidkeyexception.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <string.h>
+
+static const unsigned char MESSAGE_KEY_SEED = 0x01;
+static const unsigned char CHAIN_KEY_SEED   = 0x02;
+static const char          MESSAGE_KEYS_INFO[] = "WhisperMessageKeys";
+
+static void hmacSha256(const unsigned char *key, int keyLength,
+                       const unsigned char *data, size_t dataLength,
+                       unsigned char *out)
+{
+    unsigned int outLength = 0;
+    HMAC(EVP_sha256(), key, keyLength, data, dataLength, out, &outLength);
+}
+
+BatchRatchetEngine::BatchRatchetEngine(int expectedLanes)
+    : keyArena(KEY_LENGTH, qMax(64, expectedLanes)),
+      secretsArena(SECRETS_LENGTH, qMax(64, expectedLanes))
+{
+    chainKeys.reserve(expectedLanes);
+    secrets.reserve(expectedLanes);
+    indices.reserve(expectedLanes);
+}
+
+BatchRatchetEngine::~BatchRatchetEngine()
+{
+    clear();
+}
+
+int BatchRatchetEngine::addLane(const ChainKey &chainKey)
+{
+    QByteArray key = chainKey.getKey();
+    if (key.size() != KEY_LENGTH) {
+        throw InvalidKeyException(QString("Bad chain key length: %1").arg(key.size()));
+    }
+
+    unsigned char *keySlot = keyArena.allocate();
+    memcpy(keySlot, key.constData(), KEY_LENGTH);
+    SecureArena::cleanse(key.data(), key.size());
+
+    chainKeys.append(keySlot);
+    secrets.append(secretsArena.allocate());
+    indices.append(chainKey.getIndex());
+
+    return indices.size() - 1;
+}
+
+int BatchRatchetEngine::laneCount() const
+{
+    return indices.size();
+}
+
+void BatchRatchetEngine::clear()
+{
+    chainKeys.clear();
+    secrets.clear();
+    indices.clear();
+    keyArena.wipe();
+    secretsArena.wipe();
+}
+
+void BatchRatchetEngine::deriveMessageKeys()
+{
+    int lanes = indices.size();
+    if (lanes == 0) {
+        return;
+    }
+
+    // Each stage runs over every lane before the next one starts, so the
+    // per-lane state stays in a few contiguous scratch rows
+    SecureArena   scratch(KEY_LENGTH * lanes, 1);
+    unsigned char *inputKeyMaterial = scratch.allocate();
+    unsigned char *prk              = scratch.allocate();
+    unsigned char  salt[KEY_LENGTH];
+    memset(salt, 0, sizeof(salt));
+
+    for (int lane = 0; lane < lanes; lane++) {
+        hmacSha256(chainKeys.at(lane), KEY_LENGTH, &MESSAGE_KEY_SEED, 1,
+                   inputKeyMaterial + lane * KEY_LENGTH);
+    }
+
+    for (int lane = 0; lane < lanes; lane++) {
+        hmacSha256(salt, KEY_LENGTH, inputKeyMaterial + lane * KEY_LENGTH, KEY_LENGTH,
+                   prk + lane * KEY_LENGTH);
+    }
+
+    // HKDF expand for message version 3: T(i) = HMAC(prk, T(i-1) | info | i), i starting at 1
+    const int infoLength = sizeof(MESSAGE_KEYS_INFO) - 1;
+    unsigned char message[KEY_LENGTH + infoLength + 1];
+    unsigned char step[KEY_LENGTH];
+
+    for (int lane = 0; lane < lanes; lane++) {
+        unsigned char *out       = secrets.at(lane);
+        int            remaining = SECRETS_LENGTH;
+        int            mixin     = 0;
+
+        for (int i = 1; remaining > 0; i++) {
+            size_t length = 0;
+            memcpy(message, step, mixin);
+            length += mixin;
+            memcpy(message + length, MESSAGE_KEYS_INFO, infoLength);
+            length += infoLength;
+            message[length++] = (unsigned char)i;
+
+            hmacSha256(prk + lane * KEY_LENGTH, KEY_LENGTH, message, length, step);
+
+            int stepSize = qMin(remaining, KEY_LENGTH);
+            memcpy(out, step, stepSize);
+            out       += stepSize;
+            remaining -= stepSize;
+            mixin      = KEY_LENGTH;
+        }
+    }
+
+    SecureArena::cleanse(message, sizeof(message));
+    SecureArena::cleanse(step, sizeof(step));
+}
+
+void BatchRatchetEngine::advance()
+{
+    unsigned char nextKey[KEY_LENGTH];
+
+    for (int lane = 0; lane < indices.size(); lane++) {
+        hmacSha256(chainKeys.at(lane), KEY_LENGTH, &CHAIN_KEY_SEED, 1, nextKey);
+        memcpy(chainKeys[lane], nextKey, KEY_LENGTH);
+        indices[lane]++;
+    }
+
+    SecureArena::cleanse(nextKey, sizeof(nextKey));
+}
+
+uint BatchRatchetEngine::getIndex(int lane) const
+{
+    return indices.at(lane);
+}
+
+ChainKey BatchRatchetEngine::getChainKey(int lane) const
+{
+    return ChainKey(HKDF(3), QByteArray((const char*)chainKeys.at(lane), KEY_LENGTH), indices.at(lane));
+}
+
+MessageKeys BatchRatchetEngine::getMessageKeys(int lane) const
+{
+    const char *laneSecrets = (const char*)secrets.at(lane);
+    return MessageKeys(QByteArray(laneSecrets, 32),
+                       QByteArray(laneSecrets + 32, 32),
+                       QByteArray(laneSecrets + 64, 16),
+                       indices.at(lane));
+}
+
+QByteArray BatchRatchetEngine::getMacKey(int lane) const
+{
+    return QByteArray((const char*)secrets.at(lane) + 32, 32);
+}
+
+QByteArray BatchRatchetEngine::encrypt(int lane, const QByteArray &paddedMessage) const
+{
+    const unsigned char *laneSecrets = secrets.at(lane);
+    QByteArray out(paddedMessage.size() + EVP_MAX_BLOCK_LENGTH, '\0');
+    int outLength   = 0;
+    int finalLength = 0;
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), 0, laneSecrets, laneSecrets + 64);
+    EVP_EncryptUpdate(ctx, (unsigned char*)out.data(), &outLength,
+                      (const unsigned char*)paddedMessage.constData(), paddedMessage.size());
+    EVP_EncryptFinal_ex(ctx, (unsigned char*)out.data() + outLength, &finalLength);
+    EVP_CIPHER_CTX_free(ctx);
+
+    out.resize(outLength + finalLength);
+    return out;
+}
@@ -0,0 +1,48 @@
+#ifndef BATCHRATCHETENGINE_H
+#define BATCHRATCHETENGINE_H
+
+#include <QVector>
+#include <QByteArray>
+
+#include "chainkey.h"
+#include "messagekeys.h"
+#include "../util/securearena.h"
+
+// Steps many version 3 sender chains in lockstep. Chain keys, indices and
+// derived message secrets are kept as parallel arrays in SecureArena slots,
+// and every step runs the same HMAC/HKDF sequence over all lanes without
+// QByteArray temporaries. Not thread-safe.
+class BatchRatchetEngine
+{
+public:
+    static const int KEY_LENGTH     = 32;
+    static const int SECRETS_LENGTH = 80;
+
+    BatchRatchetEngine(int expectedLanes = 256);
+    ~BatchRatchetEngine();
+
+    int addLane(const ChainKey &chainKey);
+    int laneCount() const;
+    void clear();
+
+    void deriveMessageKeys();
+    void advance();
+
+    uint getIndex(int lane) const;
+    ChainKey getChainKey(int lane) const;
+    MessageKeys getMessageKeys(int lane) const;
+    QByteArray getMacKey(int lane) const;
+    QByteArray encrypt(int lane, const QByteArray &paddedMessage) const;
+
+private:
+    BatchRatchetEngine(const BatchRatchetEngine &);
+    BatchRatchetEngine &operator=(const BatchRatchetEngine &);
+
+    SecureArena              keyArena;
+    SecureArena              secretsArena;
+    QVector<unsigned char*>  chainKeys;
+    QVector<unsigned char*>  secrets;
+    QVector<uint>            indices;
+};
+
+#endif // BATCHRATCHETENGINE_H
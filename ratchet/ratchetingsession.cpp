@@ -2,6 +2,7 @@
 #include "../util/byteutil.h"
 #include "../ecc/curve.h"
 #include "../ecc/djbec.h"
+#include "../util/tracer.h"
 
 #include <QDebug>
 
@@ -25,6 +26,8 @@ void RatchetingSession::initializeSession(SessionState *sessionState, int sessio
 
 void RatchetingSession::initializeSession(SessionState *sessionState, int sessionVersion, const AliceAxolotlParameters &parameters)
 {
+    TRACE_SCOPE("ratchet.initialize");
+
     sessionState->setSessionVersion(sessionVersion);
     sessionState->setRemoteIdentityKey(parameters.getTheirIdentityKey());
     sessionState->setLocalIdentityKey(parameters.getOurIdentityKey().getPublicKey());
@@ -58,6 +61,8 @@ void RatchetingSession::initializeSession(SessionState *sessionState, int sessio
 
 void RatchetingSession::initializeSession(SessionState *sessionState, int sessionVersion, const BobAxolotlParameters &parameters)
 {
+    TRACE_SCOPE("ratchet.initialize");
+
     sessionState->setSessionVersion(sessionVersion);
     sessionState->setRemoteIdentityKey(parameters.getTheirIdentityKey());
     sessionState->setLocalIdentityKey(parameters.getOurIdentityKey().getPublicKey());
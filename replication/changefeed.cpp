@@ -0,0 +1,212 @@
+#include "changefeed.h"
+
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QFileDevice>
+#include <QtEndian>
+#include <QDebug>
+
+IODeviceChangeFeedSink::IODeviceChangeFeedSink(QIODevice *device, int writeTimeoutMsecs)
+{
+    this->device            = device;
+    this->writeTimeoutMsecs = writeTimeoutMsecs;
+    this->broken            = false;
+}
+
+bool IODeviceChangeFeedSink::write(const QList<ChangeRecord> &batch)
+{
+    QMutexLocker locker(&mutex);
+    if (broken) {
+        return false;
+    }
+
+    // Length and frame in one buffer and one write, so a failure can't fall between them
+    QByteArray frame = ChangeFeed::encodeBatch(batch);
+    QByteArray buffer;
+    buffer.reserve(sizeof(quint32) + frame.size());
+    buffer.resize(sizeof(quint32));
+    qToBigEndian<quint32>(frame.size(), (uchar*)buffer.data());
+    buffer.append(frame);
+
+    if (device->write(buffer) != buffer.size()) {
+        qWarning() << "Change feed write failed, reconnect needed:" << device->errorString();
+        broken = true;
+        return false;
+    }
+
+    // Files and sockets buffer internally, push the batch out before reporting success
+    QFileDevice *file = qobject_cast<QFileDevice*>(device);
+    if (file) {
+        if (!file->flush()) {
+            qWarning() << "Change feed flush failed, reconnect needed:" << file->errorString();
+            broken = true;
+            return false;
+        }
+        return true;
+    }
+
+    while (device->bytesToWrite() > 0) {
+        if (!device->waitForBytesWritten(writeTimeoutMsecs)) {
+            qWarning() << "Change feed write timed out, reconnect needed:" << device->errorString();
+            broken = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IODeviceChangeFeedSink::isBroken()
+{
+    QMutexLocker locker(&mutex);
+    return broken;
+}
+
+void IODeviceChangeFeedSink::reconnect(QIODevice *device)
+{
+    QMutexLocker locker(&mutex);
+    this->device = device;
+    this->broken = false;
+}
+
+ChangeFeed::ChangeFeed(QSharedPointer<ChangeFeedSink> sink, int maxBatchSize, int maxPending)
+{
+    this->sink         = sink;
+    this->maxBatchSize = qMax(1, maxBatchSize);
+    this->maxPending   = qMax(this->maxBatchSize, maxPending);
+    this->lastSequence = 0;
+    this->dropped      = 0;
+}
+
+ChangeFeed::~ChangeFeed()
+{
+    flush();
+}
+
+quint64 ChangeFeed::publish(ChangeRecord change, const std::function<void()> &apply)
+{
+    bool full = false;
+    {
+        QMutexLocker locker(&mutex);
+
+        // A mutation that throws is not published
+        apply();
+
+        change.sequence = ++lastSequence;
+        pending.append(change);
+        dropOverflowLocked();
+
+        full = pending.size() >= maxBatchSize;
+    }
+
+    // A flusher that already found pending empty may still hold flushMutex
+    // and make the tryLock fail, so whoever flushes looks again after
+    // unlocking: either it sees this batch or the next tryLock succeeds
+    while (full && flushMutex.tryLock()) {
+        bool written = flushPending();
+        flushMutex.unlock();
+        if (!written) {
+            break;
+        }
+
+        QMutexLocker locker(&mutex);
+        full = pending.size() >= maxBatchSize;
+    }
+    return change.sequence;
+}
+
+bool ChangeFeed::flush()
+{
+    QMutexLocker flushLocker(&flushMutex);
+    return flushPending();
+}
+
+// Called with flushMutex held, one flusher at a time keeps the batches in order
+bool ChangeFeed::flushPending()
+{
+    forever {
+        QList<ChangeRecord> batch;
+        {
+            QMutexLocker locker(&mutex);
+            if (pending.isEmpty()) {
+                return true;
+            }
+            batch.swap(pending);
+        }
+
+        // Failed batches go back in front and out again, in order, with the next one
+        if (!sink->write(batch)) {
+            QMutexLocker locker(&mutex);
+            pending = batch + pending;
+            dropOverflowLocked();
+            return false;
+        }
+    }
+}
+
+void ChangeFeed::dropOverflowLocked()
+{
+    if (pending.size() <= maxPending) {
+        return;
+    }
+
+    qWarning() << "Change feed dropped" << pending.size() << "changes up to" << pending.last().sequence
+               << ", the standby needs a resync";
+    dropped += pending.size();
+    pending.clear();
+}
+
+quint64 ChangeFeed::getLastSequence()
+{
+    QMutexLocker locker(&mutex);
+    return lastSequence;
+}
+
+int ChangeFeed::pendingCount()
+{
+    QMutexLocker locker(&mutex);
+    return pending.size();
+}
+
+quint64 ChangeFeed::droppedCount()
+{
+    QMutexLocker locker(&mutex);
+    return dropped;
+}
+
+QByteArray ChangeFeed::encodeBatch(const QList<ChangeRecord> &batch)
+{
+    QByteArray  frame;
+    QDataStream stream(&frame, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << MAGIC << VERSION << (quint32)batch.size();
+
+    foreach (const ChangeRecord &change, batch) {
+        stream << change.sequence << change.type << change.name << change.deviceId
+               << change.groupId << change.id << change.payload;
+    }
+    return frame;
+}
+
+bool ChangeFeed::decodeBatch(const QByteArray &frame, QList<ChangeRecord> &batch)
+{
+    QDataStream stream(frame);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic   = 0;
+    quint32 version = 0;
+    quint32 count   = 0;
+    stream >> magic >> version >> count;
+    if (magic != MAGIC || version != VERSION) {
+        return false;
+    }
+
+    batch.clear();
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        ChangeRecord change;
+        stream >> change.sequence >> change.type >> change.name >> change.deviceId
+               >> change.groupId >> change.id >> change.payload;
+        batch.append(change);
+    }
+
+    return stream.status() == QDataStream::Ok && (quint32)batch.size() == count;
+}
@@ -0,0 +1,115 @@
+#ifndef CHANGEFEED_H
+#define CHANGEFEED_H
+
+#include <QSharedPointer>
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QMutex>
+#include <QList>
+
+#include <functional>
+
+// One store mutation. Records and keys travel in their serialized form,
+// so a feed carries private key material and must only go to trusted
+// replicas.
+struct ChangeRecord
+{
+    enum Type {
+        StoreSession        = 1,
+        DeleteSession       = 2,
+        DeleteAllSessions   = 3,
+        StorePreKey         = 4,
+        RemovePreKey        = 5,
+        StoreSignedPreKey   = 6,
+        RemoveSignedPreKey  = 7,
+        StoreLocalData      = 8,
+        SaveIdentity        = 9,
+        RemoveIdentity      = 10,
+        StoreSenderKey      = 11
+    };
+
+    quint64    sequence = 0;
+    quint8     type     = 0;
+    QString    name;
+    qint32     deviceId = 0;
+    QString    groupId;
+    quint64    id       = 0;
+    QByteArray payload;
+};
+
+class ChangeFeedSink
+{
+public:
+    virtual ~ChangeFeedSink() {}
+    virtual bool write(const QList<ChangeRecord> &batch) = 0;
+};
+
+// Writes batches as length prefixed frames to any open QIODevice: a
+// QFile for a log, a QLocalSocket or QTcpSocket for a standby. A write
+// that fails part way leaves a torn frame on the other side, so the sink
+// then refuses every batch until reconnect() gives it a new device and the
+// standby has dropped what it buffered from the old one.
+class IODeviceChangeFeedSink : public ChangeFeedSink
+{
+public:
+    IODeviceChangeFeedSink(QIODevice *device, int writeTimeoutMsecs = 30000);
+
+    bool write(const QList<ChangeRecord> &batch);
+
+    bool isBroken();
+    void reconnect(QIODevice *device);
+
+private:
+    QMutex     mutex;
+    QIODevice *device;
+    int        writeTimeoutMsecs;
+    bool       broken;
+};
+
+// Orders the mutations of one or more replicating stores. publish() applies
+// a mutation and assigns its sequence number under one lock, so the feed
+// order is the order the primary applied them in. Records are handed to
+// the sink in batches of maxBatchSize, or earlier on flush(). The sink is
+// written outside that lock by one flusher at a time: the publisher that
+// fills a batch, unless another flush is already running.
+//
+// While the sink is failing, records queue up to maxPending. Past that
+// they are dropped and counted in droppedCount(); the standby then sees a
+// gap and has to be resynced from a snapshot.
+class ChangeFeed
+{
+public:
+    static const quint32 MAGIC   = 0x41584346;
+    static const quint32 VERSION = 1;
+
+    ChangeFeed(QSharedPointer<ChangeFeedSink> sink, int maxBatchSize = 64, int maxPending = 16384);
+    ~ChangeFeed();
+
+    quint64 publish(ChangeRecord change, const std::function<void()> &apply);
+    bool flush();
+    quint64 getLastSequence();
+    int pendingCount();
+    quint64 droppedCount();
+
+    static QByteArray encodeBatch(const QList<ChangeRecord> &batch);
+    static bool decodeBatch(const QByteArray &frame, QList<ChangeRecord> &batch);
+
+private:
+    ChangeFeed(const ChangeFeed &);
+    ChangeFeed &operator=(const ChangeFeed &);
+
+    bool flushPending();
+    void dropOverflowLocked();
+
+    QSharedPointer<ChangeFeedSink> sink;
+    int                            maxBatchSize;
+    int                            maxPending;
+    QMutex                         flushMutex;
+    QMutex                         mutex;
+    quint64                        lastSequence;
+    quint64                        dropped;
+    QList<ChangeRecord>            pending;
+};
+
+#endif // CHANGEFEED_H
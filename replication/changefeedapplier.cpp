@@ -0,0 +1,147 @@
+#include "changefeedapplier.h"
+
+#include "../groups/senderkeyname.h"
+#include "../whisperexception.h"
+
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QDebug>
+
+ChangeFeedApplier::ChangeFeedApplier(QSharedPointer<AxolotlStore> store, QSharedPointer<SenderKeyStore> senderKeyStore)
+{
+    this->store           = store;
+    this->senderKeyStore  = senderKeyStore;
+    this->appliedSequence = 0;
+}
+
+ChangeFeedApplier::Result ChangeFeedApplier::apply(const QList<ChangeRecord> &batch)
+{
+    QMutexLocker locker(&mutex);
+
+    foreach (const ChangeRecord &change, batch) {
+        if (change.sequence <= appliedSequence) {
+            continue;
+        }
+        if (change.sequence != appliedSequence + 1) {
+            qWarning() << "Change feed gap after" << appliedSequence << "got" << change.sequence;
+            return Gap;
+        }
+
+        try {
+            applyOne(change);
+        } catch (const WhisperException &e) {
+            qWarning() << "Can't apply change" << change.sequence << e.errorType() << e.errorMessage();
+            return Corrupt;
+        }
+        appliedSequence = change.sequence;
+    }
+
+    return Applied;
+}
+
+ChangeFeedApplier::Result ChangeFeedApplier::readFrom(QIODevice *device)
+{
+    buffer.append(device->readAll());
+
+    while (buffer.size() >= (int)sizeof(quint32)) {
+        quint32     length = 0;
+        QDataStream stream(buffer);
+        stream >> length;
+
+        if (buffer.size() - (int)sizeof(quint32) < (int)length) {
+            break;
+        }
+
+        QList<ChangeRecord> batch;
+        if (!ChangeFeed::decodeBatch(buffer.mid(sizeof(quint32), length), batch)) {
+            buffer.clear();
+            return Corrupt;
+        }
+        buffer.remove(0, sizeof(quint32) + length);
+
+        Result result = apply(batch);
+        if (result != Applied) {
+            return result;
+        }
+    }
+
+    return Applied;
+}
+
+void ChangeFeedApplier::resetStream()
+{
+    buffer.clear();
+}
+
+quint64 ChangeFeedApplier::getAppliedSequence()
+{
+    QMutexLocker locker(&mutex);
+    return appliedSequence;
+}
+
+void ChangeFeedApplier::setAppliedSequence(quint64 sequence)
+{
+    QMutexLocker locker(&mutex);
+    appliedSequence = sequence;
+}
+
+void ChangeFeedApplier::applyOne(const ChangeRecord &change)
+{
+    switch (change.type) {
+    case ChangeRecord::StoreSession: {
+        SessionRecord record(change.payload);
+        store->storeSession(AxolotlAddress(change.name, change.deviceId), &record);
+        break;
+    }
+    case ChangeRecord::DeleteSession:
+        store->deleteSession(AxolotlAddress(change.name, change.deviceId));
+        break;
+    case ChangeRecord::DeleteAllSessions:
+        store->deleteAllSessions(change.name);
+        break;
+    case ChangeRecord::StorePreKey:
+        store->storePreKey(change.id, PreKeyRecord(change.payload));
+        break;
+    case ChangeRecord::RemovePreKey:
+        store->removePreKey(change.id);
+        break;
+    case ChangeRecord::StoreSignedPreKey:
+        store->storeSignedPreKey(change.id, SignedPreKeyRecord(change.payload));
+        break;
+    case ChangeRecord::RemoveSignedPreKey:
+        store->removeSignedPreKey(change.id);
+        break;
+    case ChangeRecord::StoreLocalData:
+        store->storeLocalData(change.id, IdentityKeyPair(change.payload));
+        break;
+    case ChangeRecord::SaveIdentity:
+        store->saveIdentity(change.name, IdentityKey(change.payload, 0));
+        break;
+    case ChangeRecord::RemoveIdentity:
+        store->removeIdentity(change.name);
+        break;
+    case ChangeRecord::StoreSenderKey:
+        if (!senderKeyStore) {
+            throw WhisperException("ChangeFeedApplier", "No sender key store for sender key change");
+        }
+        senderKeyStore->storeSenderKey(SenderKeyName(change.groupId, AxolotlAddress(change.name, change.deviceId)),
+                                       SenderKeyRecord(change.payload));
+        break;
+    default:
+        throw WhisperException("ChangeFeedApplier", QString("Unknown change type: %1").arg(change.type));
+    }
+}
+
+LocalChangeFeedSink::LocalChangeFeedSink(QSharedPointer<ChangeFeedApplier> applier)
+{
+    this->applier = applier;
+}
+
+bool LocalChangeFeedSink::write(const QList<ChangeRecord> &batch)
+{
+    QList<ChangeRecord> decoded;
+    if (!ChangeFeed::decodeBatch(ChangeFeed::encodeBatch(batch), decoded)) {
+        return false;
+    }
+    return applier->apply(decoded) == ChangeFeedApplier::Applied;
+}
@@ -0,0 +1,62 @@
+#ifndef CHANGEFEEDAPPLIER_H
+#define CHANGEFEEDAPPLIER_H
+
+#include <QSharedPointer>
+#include <QByteArray>
+#include <QIODevice>
+#include <QMutex>
+
+#include "changefeed.h"
+#include "../state/axolotlstore.h"
+#include "../groups/state/senderkeystore.h"
+
+// Replays a change feed into replica stores. Changes at or below the
+// applied sequence number are skipped, so a feed can be resent after a
+// reconnect; a gap stops the applier, and the replica has to be resynced
+// from a snapshot and setAppliedSequence() before it continues. The
+// replica stores must copy the records passed to storeSession(). When the
+// primary reconnects, resetStream() drops the torn frame the old
+// connection may have left in the read buffer.
+class ChangeFeedApplier
+{
+public:
+    enum Result {
+        Applied,
+        Gap,
+        Corrupt
+    };
+
+    ChangeFeedApplier(QSharedPointer<AxolotlStore> store,
+                      QSharedPointer<SenderKeyStore> senderKeyStore = QSharedPointer<SenderKeyStore>());
+
+    Result apply(const QList<ChangeRecord> &batch);
+    Result readFrom(QIODevice *device);
+    void resetStream();
+
+    quint64 getAppliedSequence();
+    void setAppliedSequence(quint64 sequence);
+
+private:
+    void applyOne(const ChangeRecord &change);
+
+    QSharedPointer<AxolotlStore>   store;
+    QSharedPointer<SenderKeyStore> senderKeyStore;
+    QMutex                         mutex;
+    quint64                        appliedSequence;
+    QByteArray                     buffer;
+};
+
+// Hands batches straight to an in-process applier, through the wire
+// encoding, for tests and for a standby running in the same process.
+class LocalChangeFeedSink : public ChangeFeedSink
+{
+public:
+    LocalChangeFeedSink(QSharedPointer<ChangeFeedApplier> applier);
+
+    bool write(const QList<ChangeRecord> &batch);
+
+private:
+    QSharedPointer<ChangeFeedApplier> applier;
+};
+
+#endif // CHANGEFEEDAPPLIER_H
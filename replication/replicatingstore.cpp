@@ -0,0 +1,183 @@
+#include "replicatingstore.h"
+
+ReplicatingAxolotlStore::ReplicatingAxolotlStore(QSharedPointer<AxolotlStore> store, QSharedPointer<ChangeFeed> feed)
+{
+    this->store = store;
+    this->feed  = feed;
+}
+
+IdentityKeyPair ReplicatingAxolotlStore::getIdentityKeyPair()
+{
+    return store->getIdentityKeyPair();
+}
+
+uint ReplicatingAxolotlStore::getLocalRegistrationId()
+{
+    return store->getLocalRegistrationId();
+}
+
+void ReplicatingAxolotlStore::storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair)
+{
+    ChangeRecord change;
+    change.type    = ChangeRecord::StoreLocalData;
+    change.id      = registrationId;
+    change.payload = identityKeyPair.serialize();
+    feed->publish(change, [&]() { store->storeLocalData(registrationId, identityKeyPair); });
+}
+
+void ReplicatingAxolotlStore::saveIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    ChangeRecord change;
+    change.type    = ChangeRecord::SaveIdentity;
+    change.name    = name;
+    change.payload = identityKey.serialize();
+    feed->publish(change, [&]() { store->saveIdentity(name, identityKey); });
+}
+
+bool ReplicatingAxolotlStore::isTrustedIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    return store->isTrustedIdentity(name, identityKey);
+}
+
+void ReplicatingAxolotlStore::removeIdentity(const QString &name)
+{
+    ChangeRecord change;
+    change.type = ChangeRecord::RemoveIdentity;
+    change.name = name;
+    feed->publish(change, [&]() { store->removeIdentity(name); });
+}
+
+PreKeyRecord ReplicatingAxolotlStore::loadPreKey(qulonglong preKeyId)
+{
+    return store->loadPreKey(preKeyId);
+}
+
+void ReplicatingAxolotlStore::storePreKey(qulonglong preKeyId, const PreKeyRecord &record)
+{
+    ChangeRecord change;
+    change.type    = ChangeRecord::StorePreKey;
+    change.id      = preKeyId;
+    change.payload = record.serialize();
+    feed->publish(change, [&]() { store->storePreKey(preKeyId, record); });
+}
+
+bool ReplicatingAxolotlStore::containsPreKey(qulonglong preKeyId)
+{
+    return store->containsPreKey(preKeyId);
+}
+
+void ReplicatingAxolotlStore::removePreKey(qulonglong preKeyId)
+{
+    ChangeRecord change;
+    change.type = ChangeRecord::RemovePreKey;
+    change.id   = preKeyId;
+    feed->publish(change, [&]() { store->removePreKey(preKeyId); });
+}
+
+int ReplicatingAxolotlStore::countPreKeys()
+{
+    return store->countPreKeys();
+}
+
+SessionRecord *ReplicatingAxolotlStore::loadSession(const AxolotlAddress &remoteAddress)
+{
+    return store->loadSession(remoteAddress);
+}
+
+QList<int> ReplicatingAxolotlStore::getSubDeviceSessions(const QString &name)
+{
+    return store->getSubDeviceSessions(name);
+}
+
+void ReplicatingAxolotlStore::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    ChangeRecord change;
+    change.type     = ChangeRecord::StoreSession;
+    change.name     = remoteAddress.getName();
+    change.deviceId = remoteAddress.getDeviceId();
+    change.payload  = record->serialize();
+    feed->publish(change, [&]() { store->storeSession(remoteAddress, record); });
+}
+
+bool ReplicatingAxolotlStore::containsSession(const AxolotlAddress &remoteAddress)
+{
+    return store->containsSession(remoteAddress);
+}
+
+void ReplicatingAxolotlStore::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    ChangeRecord change;
+    change.type     = ChangeRecord::DeleteSession;
+    change.name     = remoteAddress.getName();
+    change.deviceId = remoteAddress.getDeviceId();
+    feed->publish(change, [&]() { store->deleteSession(remoteAddress); });
+}
+
+void ReplicatingAxolotlStore::deleteAllSessions(const QString &name)
+{
+    ChangeRecord change;
+    change.type = ChangeRecord::DeleteAllSessions;
+    change.name = name;
+    feed->publish(change, [&]() { store->deleteAllSessions(name); });
+}
+
+SignedPreKeyRecord ReplicatingAxolotlStore::loadSignedPreKey(qulonglong signedPreKeyId)
+{
+    return store->loadSignedPreKey(signedPreKeyId);
+}
+
+QList<SignedPreKeyRecord> ReplicatingAxolotlStore::loadSignedPreKeys()
+{
+    return store->loadSignedPreKeys();
+}
+
+void ReplicatingAxolotlStore::storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record)
+{
+    ChangeRecord change;
+    change.type    = ChangeRecord::StoreSignedPreKey;
+    change.id      = signedPreKeyId;
+    change.payload = record.serialize();
+    feed->publish(change, [&]() { store->storeSignedPreKey(signedPreKeyId, record); });
+}
+
+bool ReplicatingAxolotlStore::containsSignedPreKey(qulonglong signedPreKeyId)
+{
+    return store->containsSignedPreKey(signedPreKeyId);
+}
+
+void ReplicatingAxolotlStore::removeSignedPreKey(qulonglong signedPreKeyId)
+{
+    ChangeRecord change;
+    change.type = ChangeRecord::RemoveSignedPreKey;
+    change.id   = signedPreKeyId;
+    feed->publish(change, [&]() { store->removeSignedPreKey(signedPreKeyId); });
+}
+
+QSharedPointer<AxolotlStore> ReplicatingAxolotlStore::getStore() const
+{
+    return store;
+}
+
+ReplicatingSenderKeyStore::ReplicatingSenderKeyStore(QSharedPointer<SenderKeyStore> store, QSharedPointer<ChangeFeed> feed)
+{
+    this->store = store;
+    this->feed  = feed;
+}
+
+void ReplicatingSenderKeyStore::storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record)
+{
+    AxolotlAddress sender = senderKeyName.getSender();
+
+    ChangeRecord change;
+    change.type     = ChangeRecord::StoreSenderKey;
+    change.groupId  = senderKeyName.getGroupId();
+    change.name     = sender.getName();
+    change.deviceId = sender.getDeviceId();
+    change.payload  = record.serialize();
+    feed->publish(change, [&]() { store->storeSenderKey(senderKeyName, record); });
+}
+
+SenderKeyRecord ReplicatingSenderKeyStore::loadSenderKey(const SenderKeyName &senderKeyName) const
+{
+    return store->loadSenderKey(senderKeyName);
+}
@@ -0,0 +1,64 @@
+#ifndef REPLICATINGSTORE_H
+#define REPLICATINGSTORE_H
+
+#include <QSharedPointer>
+
+#include "changefeed.h"
+#include "../state/axolotlstore.h"
+#include "../groups/state/senderkeystore.h"
+
+// Decorates an AxolotlStore: every mutation is applied to the wrapped store
+// and published to the ChangeFeed, reads go straight through. Mutations
+// are serialized by the feed so the replica sees them in the same order.
+class ReplicatingAxolotlStore : public AxolotlStore
+{
+public:
+    ReplicatingAxolotlStore(QSharedPointer<AxolotlStore> store, QSharedPointer<ChangeFeed> feed);
+
+    IdentityKeyPair getIdentityKeyPair();
+    uint getLocalRegistrationId();
+    void storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair);
+    void saveIdentity(const QString &name, const IdentityKey &identityKey);
+    bool isTrustedIdentity(const QString &name, const IdentityKey &identityKey);
+    void removeIdentity(const QString &name);
+
+    PreKeyRecord loadPreKey(qulonglong preKeyId);
+    void storePreKey(qulonglong preKeyId, const PreKeyRecord &record);
+    bool containsPreKey(qulonglong preKeyId);
+    void removePreKey(qulonglong preKeyId);
+    int countPreKeys();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    SignedPreKeyRecord loadSignedPreKey(qulonglong signedPreKeyId);
+    QList<SignedPreKeyRecord> loadSignedPreKeys();
+    void storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record);
+    bool containsSignedPreKey(qulonglong signedPreKeyId);
+    void removeSignedPreKey(qulonglong signedPreKeyId);
+
+    QSharedPointer<AxolotlStore> getStore() const;
+
+private:
+    QSharedPointer<AxolotlStore> store;
+    QSharedPointer<ChangeFeed>   feed;
+};
+
+class ReplicatingSenderKeyStore : public SenderKeyStore
+{
+public:
+    ReplicatingSenderKeyStore(QSharedPointer<SenderKeyStore> store, QSharedPointer<ChangeFeed> feed);
+
+    void storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record);
+    SenderKeyRecord loadSenderKey(const SenderKeyName &senderKeyName) const;
+
+private:
+    QSharedPointer<SenderKeyStore> store;
+    QSharedPointer<ChangeFeed>     feed;
+};
+
+#endif // REPLICATINGSTORE_H
@@ -10,6 +10,8 @@
 #include "ratchet/ratchetingsession.h"
 #include "util/medium.h"
 #include "util/keyhelper.h"
+#include "util/tracer.h"
+#include "util/workloadrecorder.h"
 
 #include <QtMath>
 #include <QDebug>
@@ -44,6 +46,8 @@ void SessionBuilder::init(QSharedPointer<SessionStore> sessionStore, QSharedPoin
 
 ulong SessionBuilder::process(SessionRecord *sessionRecord, QSharedPointer<PreKeyWhisperMessage> message)
 {
+    TRACE_MESSAGE("SessionBuilder::processPreKeyMessage");
+
     int         messageVersion   = message->getMessageVersion();
     IdentityKey theirIdentityKey = message->getIdentityKey();
 
@@ -57,7 +61,7 @@ ulong SessionBuilder::process(SessionRecord *sessionRecord, QSharedPointer<PreKe
     switch (messageVersion) {
         case 2:  unsignedPreKeyId = processV2(sessionRecord, message); break;
         case 3:  unsignedPreKeyId = processV3(sessionRecord, message); break;
-        default: throw InvalidMessageException("Unknown version: " + messageVersion);
+        default: throw InvalidMessageException(QString("Unknown version: %1").arg(messageVersion));
     }
 
     identityKeyStore->saveIdentity(remoteAddress.getName(), theirIdentityKey);
@@ -141,6 +145,8 @@ ulong SessionBuilder::processV2(SessionRecord *sessionRecord, QSharedPointer<Pre
 
 void SessionBuilder::process(const PreKeyBundle &preKey)
 {
+    TRACE_MESSAGE("SessionBuilder::processPreKeyBundle");
+
     if (!identityKeyStore->isTrustedIdentity(remoteAddress.getName(), preKey.getIdentityKey())) {
         throw UntrustedIdentityException(QString("Untrusted identity: %1").arg(remoteAddress.getName()));
     }
@@ -191,10 +197,17 @@ void SessionBuilder::process(const PreKeyBundle &preKey)
 
     sessionStore->storeSession(remoteAddress, sessionRecord);
     identityKeyStore->saveIdentity(remoteAddress.getName(), preKey.getIdentityKey());
+
+    WorkloadRecorder *recorder = WorkloadRecorder::instance();
+    if (recorder) {
+        recorder->recordSessionSetup(remoteAddress);
+    }
 }
 
 KeyExchangeMessage SessionBuilder::process(QSharedPointer<KeyExchangeMessage> message)
 {
+    TRACE_MESSAGE("SessionBuilder::processKeyExchange");
+
     if (!identityKeyStore->isTrustedIdentity(remoteAddress.getName(), message->getIdentityKey())) {
         throw UntrustedIdentityException(QString("Untrusted identity: %1").arg(remoteAddress.getName()));
     }
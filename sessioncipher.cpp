@@ -3,11 +3,17 @@
 #include "invalidmessageexception.h"
 #include "invalidkeyexception.h"
 #include "duplicatemessageexception.h"
+#include "sessionconflictexception.h"
+#include "decryptthrottledexception.h"
+#include "util/tracer.h"
+#include "util/workloadrecorder.h"
 
 #include <QListIterator>
 #include <QMutableListIterator>
 #include <QByteArray>
 #include <QPair>
+#include <QScopedPointer>
+#include <QThread>
 #include <QDebug>
 
 #include <openssl/aes.h>
@@ -62,25 +68,91 @@ SessionCipher::SessionCipher(QSharedPointer<AxolotlStore> store, const AxolotlAd
 void SessionCipher::init(QSharedPointer<SessionStore> sessionStore, QSharedPointer<PreKeyStore> preKeyStore, QSharedPointer<SignedPreKeyStore> signedPreKeyStore, QSharedPointer<IdentityKeyStore> identityKeyStore, const AxolotlAddress &remoteAddress)
 {
     this->sessionStore   = sessionStore;
+    this->versionedStore = dynamic_cast<VersionedSessionStore*>(sessionStore.data());
+    this->metadataStore  = dynamic_cast<SessionMetadataStore*>(sessionStore.data());
     this->remoteAddress  = remoteAddress;
     this->preKeyStore    = preKeyStore;
     this->sessionBuilder = SessionBuilder(sessionStore, preKeyStore, signedPreKeyStore,
                                           identityKeyStore, remoteAddress);
 }
 
+template <typename T>
+T SessionCipher::updateSession(const std::function<T(SessionRecord*)> &update)
+{
+    if (!versionedStore) {
+        SessionRecord *sessionRecord;
+        {
+            TRACE_SCOPE("store.load");
+            sessionRecord = sessionStore->loadSession(remoteAddress);
+        }
+
+        T result = update(sessionRecord);
+        {
+            TRACE_SCOPE("store.store");
+            sessionStore->storeSession(remoteAddress, sessionRecord);
+        }
+        return result;
+    }
+
+    // Another node may write the record between our load and store, then we start over from its version
+    for (int attempt = 0; attempt < MAX_CONFLICT_RETRIES; attempt++) {
+        quint64                       version = 0;
+        QScopedPointer<SessionRecord> sessionRecord;
+        {
+            TRACE_SCOPE("store.load");
+            sessionRecord.reset(versionedStore->loadSessionVersioned(remoteAddress, &version));
+        }
+
+        T result = update(sessionRecord.data());
+        {
+            TRACE_SCOPE("store.store");
+            if (versionedStore->compareAndSetSession(remoteAddress, version, sessionRecord.data())) {
+                return result;
+            }
+        }
+
+        QThread::yieldCurrentThread();
+    }
+
+    throw SessionConflictException(QString("Session for %1, %2 kept changing")
+                                       .arg(remoteAddress.getName()).arg(remoteAddress.getDeviceId()));
+}
+
 QSharedPointer<CiphertextMessage> SessionCipher::encrypt(const QByteArray &paddedMessage)
 {
-    QSharedPointer<CiphertextMessage> result;
+    TRACE_MESSAGE("SessionCipher::encrypt");
+
+    QSharedPointer<CiphertextMessage> result = updateSession<QSharedPointer<CiphertextMessage> >(
+                [&](SessionRecord *sessionRecord) { return encrypt(sessionRecord, paddedMessage); });
+
+    WorkloadRecorder *recorder = WorkloadRecorder::instance();
+    if (recorder) {
+        QSharedPointer<WhisperMessage> whisperMessage = result->getType() == CiphertextMessage::PREKEY_TYPE
+                ? qSharedPointerCast<PreKeyWhisperMessage>(result)->getWhisperMessage()
+                : qSharedPointerCast<WhisperMessage>(result);
+        recorder->recordEncrypt(remoteAddress, paddedMessage.size(), whisperMessage->getCounter(),
+                                whisperMessage->getPreviousCounter(), whisperMessage->getSenderRatchetKey().serialize());
+    }
 
-    SessionRecord *sessionRecord   = sessionStore->loadSession(remoteAddress);
+    return result;
+}
+
+QSharedPointer<CiphertextMessage> SessionCipher::encrypt(SessionRecord *sessionRecord, const QByteArray &paddedMessage)
+{
+    QSharedPointer<CiphertextMessage> result;
     SessionState  *sessionState    = sessionRecord->getSessionState();
     ChainKey       chainKey        = sessionState->getSenderChainKey();
-    MessageKeys    messageKeys     = chainKey.getMessageKeys();
+    MessageKeys    messageKeys;
+    {
+        TRACE_SCOPE("chain.messageKeys");
+        messageKeys = chainKey.getMessageKeys();
+    }
     DjbECPublicKey senderEphemeral = sessionState->getSenderRatchetKey();
     int            previousCounter = sessionState->getPreviousCounter();
     int            sessionVersion  = sessionState->getSessionVersion();
 
     QByteArray     ciphertextBody  = getCiphertext(sessionVersion, messageKeys, paddedMessage);
+
     QSharedPointer<WhisperMessage> whisperMessage(new WhisperMessage(sessionVersion, messageKeys.getMacKey(),
                                                                      senderEphemeral, chainKey.getIndex(),
                                                                      previousCounter, ciphertextBody,
@@ -103,49 +175,91 @@ QSharedPointer<CiphertextMessage> SessionCipher::encrypt(const QByteArray &padde
     }
 
     sessionState->setSenderChainKey(chainKey.getNextChainKey());
-    sessionStore->storeSession(remoteAddress, sessionRecord);
 
     return result;
 }
 
 QByteArray SessionCipher::decrypt(QSharedPointer<PreKeyWhisperMessage> ciphertext)
 {
-    SessionRecord    *sessionRecord    = sessionStore->loadSession(remoteAddress);
-    qulonglong        unsignedPreKeyId = sessionBuilder.process(sessionRecord, ciphertext);
-    QByteArray        plaintext        = decrypt(sessionRecord, ciphertext->getWhisperMessage());
+    TRACE_MESSAGE("SessionCipher::decryptPreKey");
+
+    // Setting up the session costs about as much as a ratchet step, and its
+    // new receiver chain starts at 0. That covers the current state, any
+    // archived state tried after it is charged as it is tried.
+    if (throttle) {
+        uint counter = ciphertext->getWhisperMessage()->getCounter();
+        throttle->charge(remoteAddress, 1, counter <= MAX_SKIPPED_KEYS ? counter : 0);
+    }
 
-    sessionStore->storeSession(remoteAddress, sessionRecord);
+    qulonglong unsignedPreKeyId = -1;
+    int        chargedStates    = 1;
+    QByteArray plaintext        = updateSession<QByteArray>([&](SessionRecord *sessionRecord) -> QByteArray {
+        unsignedPreKeyId = sessionBuilder.process(sessionRecord, ciphertext);
+        return decrypt(sessionRecord, ciphertext->getWhisperMessage(), &chargedStates);
+    });
 
     if (unsignedPreKeyId != -1) {
         preKeyStore->removePreKey(unsignedPreKeyId);
     }
 
+    // Only messages that decrypted and were stored, a replay must see the same session states
+    WorkloadRecorder *recorder = WorkloadRecorder::instance();
+    if (recorder) {
+        QSharedPointer<WhisperMessage> whisperMessage = ciphertext->getWhisperMessage();
+        recorder->recordDecrypt(remoteAddress, true, whisperMessage->getBody().size(),
+                                whisperMessage->getCounter(), whisperMessage->getPreviousCounter(),
+                                whisperMessage->getSenderRatchetKey().serialize());
+    }
+
     return plaintext;
 }
 
 QByteArray SessionCipher::decrypt(QSharedPointer<WhisperMessage> ciphertext)
 {
+    TRACE_MESSAGE("SessionCipher::decrypt");
+
+    if (throttle) {
+        throttle->check(remoteAddress);
+    }
+
     if (!sessionStore->containsSession(remoteAddress)) {
         qDebug() << "No session for" << remoteAddress.getName() << remoteAddress.getDeviceId();
         throw NoSessionException(QString("No session for: %1, %2").arg(remoteAddress.getName()).arg(remoteAddress.getDeviceId()));
     }
 
-    SessionRecord *sessionRecord = sessionStore->loadSession(remoteAddress);
-    QByteArray     plaintext     = decrypt(sessionRecord, ciphertext);
-
-    sessionStore->storeSession(remoteAddress, sessionRecord);
+    // Each state is charged before it is tried; a CAS retry only pays for
+    // states past those an earlier attempt already charged
+    int        chargedStates = 0;
+    QByteArray plaintext     = updateSession<QByteArray>([&](SessionRecord *sessionRecord) {
+        return decrypt(sessionRecord, ciphertext, &chargedStates);
+    });
+
+    WorkloadRecorder *recorder = WorkloadRecorder::instance();
+    if (recorder) {
+        recorder->recordDecrypt(remoteAddress, false, ciphertext->getBody().size(),
+                                ciphertext->getCounter(), ciphertext->getPreviousCounter(),
+                                ciphertext->getSenderRatchetKey().serialize());
+    }
 
     return plaintext;
 }
 
 QByteArray SessionCipher::decrypt(SessionRecord *sessionRecord, QSharedPointer<WhisperMessage> ciphertext)
+{
+    int chargedStates = 0;
+    return decrypt(sessionRecord, ciphertext, &chargedStates);
+}
+
+QByteArray SessionCipher::decrypt(SessionRecord *sessionRecord, QSharedPointer<WhisperMessage> ciphertext, int *chargedStates)
 {
     QList<SessionState*> previousStatesList = sessionRecord->getPreviousSessionStates();
     QMutableListIterator<SessionState*> previousStates(previousStatesList);
     QList<WhisperException> exceptions;
+    int                     tried = 0;
 
     try {
         SessionState *sessionState = sessionRecord->getSessionState();
+        chargeDecrypt(sessionState, ciphertext, tried++, chargedStates);
         QByteArray    plaintext    = decrypt(sessionState, ciphertext);
 
         sessionRecord->setState(sessionState);
@@ -157,6 +271,7 @@ QByteArray SessionCipher::decrypt(SessionRecord *sessionRecord, QSharedPointer<W
     while (previousStates.hasNext()) {
         try {
             SessionState *promotedState = previousStates.next();
+            chargeDecrypt(promotedState, ciphertext, tried++, chargedStates);
             QByteArray    plaintext     = decrypt(promotedState, ciphertext);
 
             previousStates.remove();
@@ -186,14 +301,24 @@ QByteArray SessionCipher::decrypt(SessionState *sessionState, QSharedPointer<Whi
     int            messageVersion    = ciphertextMessage->getMessageVersion();
     DjbECPublicKey theirEphemeral    = ciphertextMessage->getSenderRatchetKey();
     uint           counter           = ciphertextMessage->getCounter();
-    ChainKey       chainKey          = getOrCreateChainKey(sessionState, theirEphemeral);
-    MessageKeys    messageKeys       = getOrCreateMessageKeys(sessionState, theirEphemeral,
-                                                              chainKey, counter);
+    ChainKey       chainKey;
+    MessageKeys    messageKeys;
 
-    ciphertextMessage->verifyMac(messageVersion,
-                                 sessionState->getRemoteIdentityKey(),
-                                 sessionState->getLocalIdentityKey(),
-                                 messageKeys.getMacKey());
+    {
+        TRACE_SCOPE("chain.create");
+        chainKey = getOrCreateChainKey(sessionState, theirEphemeral);
+    }
+    {
+        TRACE_SCOPE("chain.skippedKeys");
+        messageKeys = getOrCreateMessageKeys(sessionState, theirEphemeral, chainKey, counter);
+    }
+    {
+        TRACE_SCOPE("mac.verify");
+        ciphertextMessage->verifyMac(messageVersion,
+                                     sessionState->getRemoteIdentityKey(),
+                                     sessionState->getLocalIdentityKey(),
+                                     messageKeys.getMacKey());
+    }
 
     QByteArray plaintext = getPlaintext(messageVersion, messageKeys, ciphertextMessage->getBody());
 
@@ -204,12 +329,22 @@ QByteArray SessionCipher::decrypt(SessionState *sessionState, QSharedPointer<Whi
 
 int SessionCipher::getRemoteRegistrationId()
 {
+    SessionMetadata metadata;
+    if (metadataStore && metadataStore->loadSessionMetadata(remoteAddress, &metadata)) {
+        return metadata.remoteRegistrationId;
+    }
+
     SessionRecord *record = sessionStore->loadSession(remoteAddress);
     return record->getSessionState()->getRemoteRegistrationId();
 }
 
 int SessionCipher::getSessionVersion()
 {
+    SessionMetadata metadata;
+    if (metadataStore && metadataStore->loadSessionMetadata(remoteAddress, &metadata)) {
+        return metadata.sessionVersion;
+    }
+
     if (!sessionStore->containsSession(remoteAddress)) {
         qDebug() << "No session for" << remoteAddress.getName() << remoteAddress.getDeviceId();
         throw NoSessionException(QString("No session for (%1, %2)!").arg(remoteAddress.getName()).arg(remoteAddress.getDeviceId()));
@@ -219,6 +354,29 @@ int SessionCipher::getSessionVersion()
     return record->getSessionState()->getSessionVersion();
 }
 
+// States before chargedStates were paid for by an earlier attempt at the same message
+void SessionCipher::chargeDecrypt(SessionState *sessionState, QSharedPointer<WhisperMessage> ciphertext,
+                                  int state, int *chargedStates)
+{
+    if (!throttle || state < *chargedStates) {
+        return;
+    }
+    *chargedStates = state + 1;
+
+    DjbECPublicKey theirEphemeral = ciphertext->getSenderRatchetKey();
+    uint           counter        = ciphertext->getCounter();
+
+    bool ratchetStep = !sessionState->hasReceiverChain(theirEphemeral);
+    uint chainIndex  = ratchetStep ? 0 : sessionState->getReceiverChainKey(theirEphemeral).getIndex();
+    uint skipped     = counter > chainIndex ? counter - chainIndex : 0;
+    throttle->charge(remoteAddress, ratchetStep ? 1 : 0, skipped <= MAX_SKIPPED_KEYS ? skipped : 0);
+}
+
+void SessionCipher::setDecryptThrottle(QSharedPointer<DecryptThrottle> throttle)
+{
+    this->throttle = throttle;
+}
+
 ChainKey SessionCipher::getOrCreateChainKey(SessionState *sessionState, const DjbECPublicKey &theirEphemeral)
 {
     try {
@@ -255,8 +413,8 @@ MessageKeys SessionCipher::getOrCreateMessageKeys(SessionState *sessionState, co
         }
     }
 
-    if (counter - chainKey.getIndex() > 2000) {
-        throw InvalidMessageException("Over 2000 messages into the future!");
+    if (counter - chainKey.getIndex() > MAX_SKIPPED_KEYS) {
+        throw InvalidMessageException(QString("Over %1 messages into the future!").arg(MAX_SKIPPED_KEYS));
     }
 
     ChainKey nowChainKey = chainKey;
@@ -272,6 +430,7 @@ MessageKeys SessionCipher::getOrCreateMessageKeys(SessionState *sessionState, co
 
 QByteArray SessionCipher::getCiphertext(int version, const MessageKeys &messageKeys, const QByteArray &plaintext)
 {
+    TRACE_SCOPE("aes.encrypt");
     AES_KEY enc_key;
     QByteArray key = messageKeys.getCipherKey();
     if (version >= 3) {
@@ -307,6 +466,7 @@ QByteArray SessionCipher::getCiphertext(int version, const MessageKeys &messageK
 
 QByteArray SessionCipher::getPlaintext(int version, const MessageKeys &messageKeys, const QByteArray &cipherText)
 {
+    TRACE_SCOPE("aes.decrypt");
     qDebug() << version << cipherText.toHex();
     AES_KEY dec_key;
     QByteArray key = messageKeys.getCipherKey();
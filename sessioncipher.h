@@ -3,14 +3,22 @@
 
 #include <QSharedPointer>
 
+#include <functional>
+
 #include "state/sessionstore.h"
+#include "state/versionedsessionstore.h"
+#include "state/sessionmetadatastore.h"
 #include "sessionbuilder.h"
+#include "concurrent/decryptthrottle.h"
 #include "ratchet/messagekeys.h"
 #include "axolotladdress.h"
 
 class SessionCipher
 {
 public:
+    static const int  MAX_CONFLICT_RETRIES = 16;
+    static const uint MAX_SKIPPED_KEYS     = 2000;
+
     SessionCipher(QSharedPointer<SessionStore> sessionStore, QSharedPointer<PreKeyStore> preKeyStore,
                   QSharedPointer<SignedPreKeyStore> signedPreKeyStore, QSharedPointer<IdentityKeyStore> identityKeyStore,
                   const AxolotlAddress &remoteAddress);
@@ -22,11 +30,17 @@ public:
     QByteArray decrypt(SessionState *sessionState, QSharedPointer<WhisperMessage> ciphertextMessage);
     int getRemoteRegistrationId();
     int getSessionVersion() ;
+    void setDecryptThrottle(QSharedPointer<DecryptThrottle> throttle);
 
 private:
     void init(QSharedPointer<SessionStore> sessionStore, QSharedPointer<PreKeyStore> preKeyStore,
               QSharedPointer<SignedPreKeyStore> signedPreKeyStore, QSharedPointer<IdentityKeyStore> identityKeyStore,
               const AxolotlAddress &remoteAddress);
+    template <typename T> T updateSession(const std::function<T(SessionRecord*)> &update);
+    QSharedPointer<CiphertextMessage> encrypt(SessionRecord *sessionRecord, const QByteArray &paddedMessage);
+    QByteArray decrypt(SessionRecord *sessionRecord, QSharedPointer<WhisperMessage> ciphertext, int *chargedStates);
+    void chargeDecrypt(SessionState *sessionState, QSharedPointer<WhisperMessage> ciphertext,
+                       int state, int *chargedStates);
     ChainKey getOrCreateChainKey(SessionState *sessionState, const DjbECPublicKey &theirEphemeral);
     MessageKeys getOrCreateMessageKeys(SessionState *sessionState,
                                        const DjbECPublicKey &theirEphemeral,
@@ -34,10 +48,13 @@ private:
     QByteArray getCiphertext(int version, const MessageKeys &messageKeys, const QByteArray &plaintext);
     QByteArray getPlaintext(int version, const MessageKeys &messageKeys, const QByteArray &cipherText);
 
-    QSharedPointer<SessionStore>   sessionStore;
-    SessionBuilder                 sessionBuilder;
-    QSharedPointer<PreKeyStore>    preKeyStore;
-    AxolotlAddress                 remoteAddress;
+    QSharedPointer<SessionStore>    sessionStore;
+    VersionedSessionStore          *versionedStore;
+    SessionMetadataStore           *metadataStore;
+    SessionBuilder                  sessionBuilder;
+    QSharedPointer<PreKeyStore>     preKeyStore;
+    QSharedPointer<DecryptThrottle> throttle;
+    AxolotlAddress                  remoteAddress;
 };
 
 #endif // SESSIONCIPHER_H
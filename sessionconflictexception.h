@@ -0,0 +1,12 @@
+#ifndef SESSIONCONFLICTEXCEPTION_H
+#define SESSIONCONFLICTEXCEPTION_H
+
+#include "whisperexception.h"
+
+class SessionConflictException : public WhisperException
+{
+public:
+    SessionConflictException(const QString &error) : WhisperException("SessionConflictException", error) {}
+};
+
+#endif // SESSIONCONFLICTEXCEPTION_H
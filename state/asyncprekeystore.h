@@ -0,0 +1,28 @@
+#ifndef ASYNCPREKEYSTORE_H
+#define ASYNCPREKEYSTORE_H
+
+#include "prekeyrecord.h"
+
+#include "../whisperexception.h"
+
+#include <QSharedPointer>
+
+#include <functional>
+
+class AsyncPreKeyStore
+{
+public:
+    // A null record means the prekey is not in the store
+    typedef std::function<void(QSharedPointer<PreKeyRecord> record)> LoadCallback;
+    typedef std::function<void(bool result)>                         BoolCallback;
+    typedef std::function<void()>                                    DoneCallback;
+    typedef std::function<void(const WhisperException &exception)>   ErrorCallback;
+
+    virtual void loadPreKeyAsync(qulonglong preKeyId, const LoadCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void storePreKeyAsync(qulonglong preKeyId, const PreKeyRecord &record, const DoneCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void containsPreKeyAsync(qulonglong preKeyId, const BoolCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void removePreKeyAsync(qulonglong preKeyId, const DoneCallback &callback, const ErrorCallback &onError) = 0;
+    virtual ~AsyncPreKeyStore() {}
+};
+
+#endif // ASYNCPREKEYSTORE_H
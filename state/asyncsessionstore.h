@@ -0,0 +1,29 @@
+#ifndef ASYNCSESSIONSTORE_H
+#define ASYNCSESSIONSTORE_H
+
+#include "sessionrecord.h"
+
+#include "../axolotladdress.h"
+#include "../whisperexception.h"
+
+#include <functional>
+
+// Callbacks may run on any thread, the record handed out follows the same
+// ownership rules as SessionStore::loadSession(). An operation ends in
+// exactly one of its callback or onError.
+class AsyncSessionStore
+{
+public:
+    typedef std::function<void(SessionRecord *record)>               LoadCallback;
+    typedef std::function<void(bool result)>                         BoolCallback;
+    typedef std::function<void()>                                    DoneCallback;
+    typedef std::function<void(const WhisperException &exception)>   ErrorCallback;
+
+    virtual void loadSessionAsync(const AxolotlAddress &remoteAddress, const LoadCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void storeSessionAsync(const AxolotlAddress &remoteAddress, SessionRecord *record, const DoneCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void containsSessionAsync(const AxolotlAddress &remoteAddress, const BoolCallback &callback, const ErrorCallback &onError) = 0;
+    virtual void deleteSessionAsync(const AxolotlAddress &remoteAddress, const DoneCallback &callback, const ErrorCallback &onError) = 0;
+    virtual ~AsyncSessionStore() {}
+};
+
+#endif // ASYNCSESSIONSTORE_H
@@ -0,0 +1,180 @@
+#include "asyncstoreadapter.h"
+
+#include "../concurrent/functionrunnable.h"
+#include "../invalidkeyidexception.h"
+
+#include <QDebug>
+
+#include <exception>
+
+typedef std::function<void(const WhisperException &exception)> ErrorCallback;
+
+static void fail(const ErrorCallback &onError, const WhisperException &exception)
+{
+    try {
+        if (onError) {
+            onError(exception);
+            return;
+        }
+    } catch (...) {
+    }
+    qWarning() << "Unhandled async store error:" << exception.errorType() << exception.errorMessage();
+}
+
+// Runs operation on an I/O thread, nothing it throws may reach the pool
+static bool attempt(const std::function<void()> &operation, const ErrorCallback &onError)
+{
+    try {
+        operation();
+        return true;
+    } catch (const WhisperException &e) {
+        fail(onError, e);
+    } catch (const std::exception &e) {
+        fail(onError, WhisperException("UnknownException", QString::fromLocal8Bit(e.what())));
+    } catch (...) {
+        fail(onError, WhisperException("UnknownException"));
+    }
+    return false;
+}
+
+// The operation already succeeded, so a throwing callback is only logged
+static void notify(const std::function<void()> &callback)
+{
+    try {
+        callback();
+    } catch (const WhisperException &e) {
+        qWarning() << "Async store callback threw:" << e.errorType() << e.errorMessage();
+    } catch (const std::exception &e) {
+        qWarning() << "Async store callback threw:" << e.what();
+    } catch (...) {
+        qWarning() << "Async store callback threw";
+    }
+}
+
+AsyncStoreAdapter::AsyncStoreAdapter(QSharedPointer<SessionStore> sessionStore, QSharedPointer<PreKeyStore> preKeyStore, QSharedPointer<SenderKeyStore> senderKeyStore, int ioThreads)
+{
+    this->sessionStore   = sessionStore;
+    this->preKeyStore    = preKeyStore;
+    this->senderKeyStore = senderKeyStore;
+    ioPool.setMaxThreadCount(qMax(1, ioThreads));
+}
+
+AsyncStoreAdapter::~AsyncStoreAdapter()
+{
+    ioPool.waitForDone();
+}
+
+void AsyncStoreAdapter::loadSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::LoadCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    QSharedPointer<SessionStore> store = sessionStore;
+    FunctionRunnable::start(&ioPool, [store, remoteAddress, callback, onError]() {
+        SessionRecord *record = 0;
+        if (attempt([&]() { record = store->loadSession(remoteAddress); }, onError)) {
+            notify([&]() { callback(record); });
+        }
+    });
+}
+
+void AsyncStoreAdapter::storeSessionAsync(const AxolotlAddress &remoteAddress, SessionRecord *record, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    QSharedPointer<SessionStore> store = sessionStore;
+    FunctionRunnable::start(&ioPool, [store, remoteAddress, record, callback, onError]() {
+        if (attempt([&]() { store->storeSession(remoteAddress, record); }, onError) && callback) {
+            notify(callback);
+        }
+    });
+}
+
+void AsyncStoreAdapter::containsSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::BoolCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    QSharedPointer<SessionStore> store = sessionStore;
+    FunctionRunnable::start(&ioPool, [store, remoteAddress, callback, onError]() {
+        bool result = false;
+        if (attempt([&]() { result = store->containsSession(remoteAddress); }, onError)) {
+            notify([&]() { callback(result); });
+        }
+    });
+}
+
+void AsyncStoreAdapter::deleteSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    QSharedPointer<SessionStore> store = sessionStore;
+    FunctionRunnable::start(&ioPool, [store, remoteAddress, callback, onError]() {
+        if (attempt([&]() { store->deleteSession(remoteAddress); }, onError) && callback) {
+            notify(callback);
+        }
+    });
+}
+
+void AsyncStoreAdapter::loadPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::LoadCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    QSharedPointer<PreKeyStore> store = preKeyStore;
+    FunctionRunnable::start(&ioPool, [store, preKeyId, callback, onError]() {
+        QSharedPointer<PreKeyRecord> record;
+        bool loaded = attempt([&]() {
+            if (store->containsPreKey(preKeyId)) {
+                try {
+                    record = QSharedPointer<PreKeyRecord>(new PreKeyRecord(store->loadPreKey(preKeyId)));
+                } catch (const InvalidKeyIdException &) {
+                    record.clear();
+                }
+            }
+        }, onError);
+
+        if (loaded) {
+            notify([&]() { callback(record); });
+        }
+    });
+}
+
+void AsyncStoreAdapter::storePreKeyAsync(qulonglong preKeyId, const PreKeyRecord &record, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    QSharedPointer<PreKeyStore> store = preKeyStore;
+    FunctionRunnable::start(&ioPool, [store, preKeyId, record, callback, onError]() {
+        if (attempt([&]() { store->storePreKey(preKeyId, record); }, onError) && callback) {
+            notify(callback);
+        }
+    });
+}
+
+void AsyncStoreAdapter::containsPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::BoolCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    QSharedPointer<PreKeyStore> store = preKeyStore;
+    FunctionRunnable::start(&ioPool, [store, preKeyId, callback, onError]() {
+        bool result = false;
+        if (attempt([&]() { result = store->containsPreKey(preKeyId); }, onError)) {
+            notify([&]() { callback(result); });
+        }
+    });
+}
+
+void AsyncStoreAdapter::removePreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    QSharedPointer<PreKeyStore> store = preKeyStore;
+    FunctionRunnable::start(&ioPool, [store, preKeyId, callback, onError]() {
+        if (attempt([&]() { store->removePreKey(preKeyId); }, onError) && callback) {
+            notify(callback);
+        }
+    });
+}
+
+void AsyncStoreAdapter::storeSenderKeyAsync(const SenderKeyName &senderKeyName, const SenderKeyRecord &record, const AsyncSenderKeyStore::DoneCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError)
+{
+    QSharedPointer<SenderKeyStore> store = senderKeyStore;
+    FunctionRunnable::start(&ioPool, [store, senderKeyName, record, callback, onError]() {
+        if (attempt([&]() { store->storeSenderKey(senderKeyName, record); }, onError) && callback) {
+            notify(callback);
+        }
+    });
+}
+
+void AsyncStoreAdapter::loadSenderKeyAsync(const SenderKeyName &senderKeyName, const AsyncSenderKeyStore::LoadCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError)
+{
+    QSharedPointer<SenderKeyStore> store = senderKeyStore;
+    FunctionRunnable::start(&ioPool, [store, senderKeyName, callback, onError]() {
+        QSharedPointer<SenderKeyRecord> record;
+        if (attempt([&]() { record = QSharedPointer<SenderKeyRecord>(new SenderKeyRecord(store->loadSenderKey(senderKeyName))); }, onError)) {
+            notify([&]() { callback(record); });
+        }
+    });
+}
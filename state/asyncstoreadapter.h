@@ -0,0 +1,46 @@
+#ifndef ASYNCSTOREADAPTER_H
+#define ASYNCSTOREADAPTER_H
+
+#include <QSharedPointer>
+#include <QThreadPool>
+
+#include "asyncsessionstore.h"
+#include "asyncprekeystore.h"
+#include "sessionstore.h"
+#include "prekeystore.h"
+#include "../groups/state/asyncsenderkeystore.h"
+#include "../groups/state/senderkeystore.h"
+
+// Runs a blocking store on a dedicated I/O pool, so callers of the async
+// interfaces never block their own threads. Anything the blocking store
+// throws goes to onError, a missing onError only logs it.
+class AsyncStoreAdapter : public AsyncSessionStore, public AsyncPreKeyStore, public AsyncSenderKeyStore
+{
+public:
+    AsyncStoreAdapter(QSharedPointer<SessionStore> sessionStore,
+                      QSharedPointer<PreKeyStore> preKeyStore,
+                      QSharedPointer<SenderKeyStore> senderKeyStore = QSharedPointer<SenderKeyStore>(),
+                      int ioThreads = 4);
+    ~AsyncStoreAdapter();
+
+    void loadSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::LoadCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+    void storeSessionAsync(const AxolotlAddress &remoteAddress, SessionRecord *record, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+    void containsSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::BoolCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+    void deleteSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+
+    void loadPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::LoadCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+    void storePreKeyAsync(qulonglong preKeyId, const PreKeyRecord &record, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+    void containsPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::BoolCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+    void removePreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+
+    void storeSenderKeyAsync(const SenderKeyName &senderKeyName, const SenderKeyRecord &record, const AsyncSenderKeyStore::DoneCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError);
+    void loadSenderKeyAsync(const SenderKeyName &senderKeyName, const AsyncSenderKeyStore::LoadCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError);
+
+private:
+    QSharedPointer<SessionStore>   sessionStore;
+    QSharedPointer<PreKeyStore>    preKeyStore;
+    QSharedPointer<SenderKeyStore> senderKeyStore;
+    QThreadPool                    ioPool;
+};
+
+#endif // ASYNCSTOREADAPTER_H
@@ -0,0 +1,41 @@
+#ifndef COMPACTIONPOLICY_H
+#define COMPACTIONPOLICY_H
+
+#include <QtGlobal>
+
+// What compaction keeps of a record. The current session state keeps its
+// sender chain and its newest receiver chains, so it can still decrypt
+// everything that is in flight; only keys older than these limits go.
+struct CompactionPolicy
+{
+    int     maxArchivedStates      = 10;
+    int     maxReceiverChains      = 5;
+    int     maxSkippedKeys         = 2000;
+    // Skipped keys this many messages behind their chain are dropped, 0 keeps them all
+    quint32 maxSkippedKeyDistance  = 2000;
+    int     maxSenderKeyStates     = 5;
+    int     maxSenderMessageKeys   = 2000;
+};
+
+struct CompactionStats
+{
+    int archivedStatesDropped  = 0;
+    int receiverChainsDropped  = 0;
+    int skippedKeysDropped     = 0;
+    int senderKeyStatesDropped = 0;
+
+    CompactionStats &operator+=(const CompactionStats &other) {
+        archivedStatesDropped  += other.archivedStatesDropped;
+        receiverChainsDropped  += other.receiverChainsDropped;
+        skippedKeysDropped     += other.skippedKeysDropped;
+        senderKeyStatesDropped += other.senderKeyStatesDropped;
+        return *this;
+    }
+
+    bool isEmpty() const {
+        return archivedStatesDropped == 0 && receiverChainsDropped == 0
+            && skippedKeysDropped == 0 && senderKeyStatesDropped == 0;
+    }
+};
+
+#endif // COMPACTIONPOLICY_H
@@ -0,0 +1,539 @@
+#include "asyncfilestore.h"
+
+#include "../../whisperexception.h"
+
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#include <exception>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static const quint32 RECORD_MAGIC       = 0x41584652;
+static const int     RECORD_HEADER_SIZE = 16;
+static const quint16 RECORD_DELETED     = 0x0001;
+
+// Parses a loaded payload on the backend's completion thread, a corrupt
+// record has to end up in onError rather than unwind through the backend
+static bool parse(const std::function<void()> &operation, const std::function<void(const WhisperException &)> &onError)
+{
+    try {
+        operation();
+        return true;
+    } catch (const WhisperException &e) {
+        if (onError) onError(e);
+    } catch (const std::exception &e) {
+        if (onError) onError(WhisperException("AsyncFileStore", QString::fromLocal8Bit(e.what())));
+    } catch (...) {
+        if (onError) onError(WhisperException("AsyncFileStore", "Can't parse stored record"));
+    }
+    return false;
+}
+
+// qHash() is seeded per process, shard placement has to survive restarts
+static quint32 shardHash(const QByteArray &key)
+{
+    quint32 hash = 0x811C9DC5;
+    for (int i = 0; i < key.size(); i++) {
+        hash = (hash ^ (quint8)key.at(i)) * 0x01000193;
+    }
+    return hash;
+}
+
+AsyncFileStore::AsyncFileStore(const QString &path, int shardCount, int maxCachedSessions, FileIoBackend *backend)
+    : backend(backend)
+{
+    this->path = path;
+    sessions.setMaxCost(qMax(64, maxCachedSessions));
+
+    QDir directory(path);
+    if (!directory.exists() && !directory.mkpath(".")) {
+        throw WhisperException("AsyncFileStore", "Can't create store directory " + path);
+    }
+
+    QStringList existing = directory.entryList(QStringList() << "shard-*.log", QDir::Files, QDir::Name);
+    int         count    = existing.isEmpty() ? qMax(1, shardCount) : existing.size();
+
+    for (int i = 0; i < count; i++) {
+        Shard *shard = new Shard();
+        shards.append(shard);
+        openShard(shard, directory.filePath(QString("shard-%1.log").arg(i, 3, 10, QChar('0'))));
+    }
+}
+
+AsyncFileStore::~AsyncFileStore()
+{
+    flush();
+    backend.reset();
+
+    foreach (Shard *shard, shards) {
+        if (shard->fd >= 0) {
+            close(shard->fd);
+        }
+    }
+    qDeleteAll(shards);
+}
+
+void AsyncFileStore::openShard(Shard *shard, const QString &fileName)
+{
+    shard->fd = open(QFile::encodeName(fileName).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (shard->fd < 0) {
+        throw WhisperException("AsyncFileStore", QString("Can't open %1: %2").arg(fileName).arg(strerror(errno)));
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw WhisperException("AsyncFileStore", "Can't read " + fileName);
+    }
+
+    // A torn tail is a record cut short by the end of the file, or zeros
+    // where the file was extended but the data never made it to disk
+    qint64 offset   = 0;
+    bool   tornTail = true;
+    for (;;) {
+        QByteArray header = file.read(RECORD_HEADER_SIZE);
+        if (header.size() < RECORD_HEADER_SIZE) {
+            break;
+        }
+
+        quint32     magic;
+        quint16     flags, keyLength, checksum, reserved;
+        quint32     payloadLength;
+        QDataStream stream(header);
+        stream >> magic >> flags >> keyLength >> payloadLength >> checksum >> reserved;
+        if (magic != RECORD_MAGIC) {
+            tornTail = (header + file.readAll()).count('\0') == file.size() - offset;
+            break;
+        }
+
+        QByteArray body = file.read(keyLength + (qint64)payloadLength);
+        if (body.size() != keyLength + (qint64)payloadLength) {
+            break;
+        }
+        if (qChecksum(body.constData(), body.size()) != checksum) {
+            tornTail = file.atEnd();
+            break;
+        }
+
+        QByteArray key    = body.left(keyLength);
+        int        length = RECORD_HEADER_SIZE + body.size();
+        if (flags & RECORD_DELETED) {
+            shard->index.remove(key);
+        } else {
+            Location location;
+            location.offset = offset;
+            location.length = length;
+            shard->index.insert(key, location);
+        }
+        offset += length;
+    }
+
+    if (offset < file.size()) {
+        // Anything else is damage in the middle of the log, cutting there
+        // would silently lose every record after it
+        if (!tornTail) {
+            throw WhisperException("AsyncFileStore", QString("Corrupt record in %1 at offset %2, refusing to open")
+                                                     .arg(fileName).arg(offset));
+        }
+
+        qWarning() << "Cutting off torn tail of" << fileName << "at" << offset;
+        if (ftruncate(shard->fd, offset) != 0) {
+            throw WhisperException("AsyncFileStore", QString("Can't truncate %1: %2").arg(fileName).arg(strerror(errno)));
+        }
+    }
+    shard->tail = offset;
+}
+
+AsyncFileStore::Shard *AsyncFileStore::shardFor(const QByteArray &key) const
+{
+    return shards.at(shardHash(key) % shards.size());
+}
+
+void AsyncFileStore::put(const QByteArray &key, const QByteArray &payload, bool deleted, const std::function<void()> &callback, const ErrorCallback &onError)
+{
+    Shard *shard = shardFor(key);
+
+    QMutexLocker locker(&shard->mutex);
+    if (shard->failed) {
+        locker.unlock();
+        if (onError) {
+            onError(WhisperException("AsyncFileStore", "Shard is read-only after a failed commit"));
+        }
+        return;
+    }
+
+    QByteArray record = encodeRecord(key, payload, deleted);
+
+    BatchEntry entry;
+    entry.key      = key;
+    entry.sequence = ++sequence;
+    entry.deleted  = deleted;
+    entry.offset   = shard->tail + shard->batch.size();
+    entry.length   = record.size();
+
+    PendingValue value;
+    value.sequence = entry.sequence;
+    value.deleted  = deleted;
+    value.payload  = payload;
+
+    Completion completion;
+    completion.done    = callback;
+    completion.onError = onError;
+
+    shard->pending.insert(key, value);
+    shard->batch.append(record);
+    shard->batchEntries.append(entry);
+    shard->batchCompletions.append(completion);
+
+    if (!shard->committing) {
+        commit(shard);
+    }
+}
+
+void AsyncFileStore::commit(Shard *shard)
+{
+    QByteArray         data        = shard->batch;
+    QList<BatchEntry>  entries     = shard->batchEntries;
+    QList<Completion>  completions = shard->batchCompletions;
+    qint64             offset      = shard->tail;
+
+    shard->batch.clear();
+    shard->batchEntries.clear();
+    shard->batchCompletions.clear();
+    shard->tail      += data.size();
+    shard->committing = true;
+    ++commits;
+
+    backend->writeAndSync(shard->fd, offset, data, [this, shard, entries, completions](bool ok) {
+        committed(shard, entries, completions, ok);
+    });
+}
+
+void AsyncFileStore::committed(Shard *shard, QList<BatchEntry> entries, QList<Completion> completions, bool ok)
+{
+    {
+        QMutexLocker locker(&shard->mutex);
+
+        if (ok) {
+            foreach (const BatchEntry &entry, entries) {
+                if (entry.deleted) {
+                    shard->index.remove(entry.key);
+                } else {
+                    Location location;
+                    location.offset = entry.offset;
+                    location.length = entry.length;
+                    shard->index.insert(entry.key, location);
+                }
+
+                if (shard->pending.value(entry.key).sequence == entry.sequence) {
+                    shard->pending.remove(entry.key);
+                }
+            }
+        } else if (!shard->failed) {
+            // Refuse further writes, what the log has stays consistent and
+            // the failed records are still served from memory until restart
+            qCritical() << "Group commit failed in" << path << "shard" << shards.indexOf(shard);
+            shard->failed = true;
+        }
+
+        // The batch queued behind a failed one never reaches the disk either
+        shard->committing = false;
+        if (shard->failed) {
+            ok = false;
+            completions += shard->batchCompletions;
+            shard->batch.clear();
+            shard->batchEntries.clear();
+            shard->batchCompletions.clear();
+        } else if (!shard->batch.isEmpty()) {
+            commit(shard);
+        }
+
+        if (!shard->committing) {
+            shard->idle.wakeAll();
+        }
+    }
+
+    WhisperException failure("AsyncFileStore", "Group commit failed, the record is not durable");
+    foreach (const Completion &completion, completions) {
+        if (ok && completion.done) {
+            completion.done();
+        } else if (!ok && completion.onError) {
+            completion.onError(failure);
+        }
+    }
+}
+
+void AsyncFileStore::get(const QByteArray &key, const ValueCallback &callback, const ErrorCallback &onError)
+{
+    Shard   *shard = shardFor(key);
+    Location location;
+
+    {
+        QMutexLocker locker(&shard->mutex);
+        if (shard->pending.contains(key)) {
+            PendingValue value = shard->pending.value(key);
+            locker.unlock();
+            callback(!value.deleted, value.payload);
+            return;
+        }
+
+        if (!shard->index.contains(key)) {
+            locker.unlock();
+            callback(false, QByteArray());
+            return;
+        }
+        location = shard->index.value(key);
+    }
+
+    // An unreadable record is an error, not a missing one: a fresh session
+    // in its place would silently start over
+    backend->read(shard->fd, location.offset, location.length, [key, callback, onError](bool ok, const QByteArray &data) {
+        QByteArray payload;
+        if (!ok || !decodeRecord(data, key, &payload)) {
+            qWarning() << "Unreadable record in file store";
+            if (onError) {
+                onError(WhisperException("AsyncFileStore", "Unreadable record"));
+            }
+            return;
+        }
+        callback(true, payload);
+    });
+}
+
+bool AsyncFileStore::contains(const QByteArray &key)
+{
+    Shard *shard = shardFor(key);
+
+    QMutexLocker locker(&shard->mutex);
+    if (shard->pending.contains(key)) {
+        return !shard->pending.value(key).deleted;
+    }
+    return shard->index.contains(key);
+}
+
+void AsyncFileStore::flush()
+{
+    foreach (Shard *shard, shards) {
+        QMutexLocker locker(&shard->mutex);
+        while (shard->committing) {
+            shard->idle.wait(&shard->mutex);
+        }
+    }
+}
+
+void AsyncFileStore::loadSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::LoadCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    AddressKey key = AddressUtil::toKey(remoteAddress);
+
+    {
+        QMutexLocker locker(&sessionMutex);
+        supersededSessions.remove(key);
+
+        Record record = currentSession(key);
+        if (record) {
+            pinnedSessions.insert(key, record);
+            locker.unlock();
+            callback(record.data());
+            return;
+        }
+    }
+
+    get(sessionKey(remoteAddress), [this, key, callback, onError](bool found, const QByteArray &payload) {
+        Record loaded;
+        if (!parse([&]() { loaded = Record(found ? new SessionRecord(payload) : new SessionRecord()); }, onError)) {
+            return;
+        }
+
+        QMutexLocker locker(&sessionMutex);
+        Record record = currentSession(key);
+        if (!record) {
+            record = loaded;
+            sessions.insert(key, new Record(record));
+        }
+        pinnedSessions.insert(key, record);
+        locker.unlock();
+
+        callback(record.data());
+    }, onError);
+}
+
+void AsyncFileStore::storeSessionAsync(const AxolotlAddress &remoteAddress, SessionRecord *record, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    QByteArray serialized = record->serialize();
+
+    {
+        QMutexLocker locker(&sessionMutex);
+        AddressKey   key     = AddressUtil::toKey(remoteAddress);
+        Record       current = currentSession(key);
+        if (current.data() == record) {
+            record->setFresh(false);
+            pinnedSessions.remove(key);
+            if (!sessions.contains(key)) {
+                sessions.insert(key, new Record(current));
+            }
+        } else {
+            // Never adopt a caller owned record, keep a private copy instead
+            Record copy(new SessionRecord(serialized));
+            supersedeSession(key);
+            sessions.insert(key, new Record(copy));
+        }
+    }
+
+    put(sessionKey(remoteAddress), serialized, false, callback, onError);
+}
+
+void AsyncFileStore::containsSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::BoolCallback &callback, const AsyncSessionStore::ErrorCallback &)
+{
+    callback(contains(sessionKey(remoteAddress)));
+}
+
+void AsyncFileStore::deleteSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError)
+{
+    {
+        QMutexLocker locker(&sessionMutex);
+        supersedeSession(AddressUtil::toKey(remoteAddress));
+    }
+
+    put(sessionKey(remoteAddress), QByteArray(), true, callback, onError);
+}
+
+// The current record for key, a checked out one wins over the cached one
+AsyncFileStore::Record AsyncFileStore::currentSession(const AddressKey &key)
+{
+    Record record = pinnedSessions.value(key);
+    if (record) {
+        return record;
+    }
+
+    Record *cached = sessions.object(key);
+    return cached ? *cached : Record();
+}
+
+// Drops key's current record, keeping a checked out one alive for its holder
+void AsyncFileStore::supersedeSession(const AddressKey &key)
+{
+    Record pinned = pinnedSessions.take(key);
+    if (pinned) {
+        supersededSessions.insert(key, pinned);
+    }
+    sessions.remove(key);
+}
+
+void AsyncFileStore::loadPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::LoadCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    get(recordKey(PreKeyKind, QByteArray::number(preKeyId)), [callback, onError](bool found, const QByteArray &payload) {
+        QSharedPointer<PreKeyRecord> record;
+        if (found && !parse([&]() { record = QSharedPointer<PreKeyRecord>(new PreKeyRecord(payload)); }, onError)) {
+            return;
+        }
+        callback(record);
+    }, onError);
+}
+
+void AsyncFileStore::storePreKeyAsync(qulonglong preKeyId, const PreKeyRecord &record, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    put(recordKey(PreKeyKind, QByteArray::number(preKeyId)), record.serialize(), false, callback, onError);
+}
+
+void AsyncFileStore::containsPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::BoolCallback &callback, const AsyncPreKeyStore::ErrorCallback &)
+{
+    callback(contains(recordKey(PreKeyKind, QByteArray::number(preKeyId))));
+}
+
+void AsyncFileStore::removePreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError)
+{
+    put(recordKey(PreKeyKind, QByteArray::number(preKeyId)), QByteArray(), true, callback, onError);
+}
+
+void AsyncFileStore::storeSenderKeyAsync(const SenderKeyName &senderKeyName, const SenderKeyRecord &record, const AsyncSenderKeyStore::DoneCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError)
+{
+    put(senderKeyKey(senderKeyName), record.serialize(), false, callback, onError);
+}
+
+void AsyncFileStore::loadSenderKeyAsync(const SenderKeyName &senderKeyName, const AsyncSenderKeyStore::LoadCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError)
+{
+    get(senderKeyKey(senderKeyName), [callback, onError](bool found, const QByteArray &payload) {
+        QSharedPointer<SenderKeyRecord> record;
+        if (parse([&]() { record = QSharedPointer<SenderKeyRecord>(found ? new SenderKeyRecord(payload) : new SenderKeyRecord()); }, onError)) {
+            callback(record);
+        }
+    }, onError);
+}
+
+QString AsyncFileStore::backendName() const
+{
+    return backend->name();
+}
+
+int AsyncFileStore::shardCount() const
+{
+    return shards.size();
+}
+
+quint64 AsyncFileStore::commitCount() const
+{
+    return commits.load();
+}
+
+QByteArray AsyncFileStore::recordKey(Kind kind, const QByteArray &key)
+{
+    return QByteArray(1, (char)kind) + key;
+}
+
+QByteArray AsyncFileStore::sessionKey(const AxolotlAddress &remoteAddress)
+{
+    return recordKey(SessionKind, remoteAddress.getName().toUtf8() + '\0' + QByteArray::number(remoteAddress.getDeviceId()));
+}
+
+QByteArray AsyncFileStore::senderKeyKey(const SenderKeyName &senderKeyName)
+{
+    AxolotlAddress sender = senderKeyName.getSender();
+    return recordKey(SenderKeyKind, senderKeyName.getGroupId().toUtf8() + '\0' + sender.getName().toUtf8()
+                                    + '\0' + QByteArray::number(sender.getDeviceId()));
+}
+
+QByteArray AsyncFileStore::encodeRecord(const QByteArray &key, const QByteArray &payload, bool deleted)
+{
+    QByteArray body = key + payload;
+    QByteArray record;
+    record.reserve(RECORD_HEADER_SIZE + body.size());
+
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream << RECORD_MAGIC
+           << (quint16)(deleted ? RECORD_DELETED : 0)
+           << (quint16)key.size()
+           << (quint32)payload.size()
+           << qChecksum(body.constData(), body.size())
+           << (quint16)0;
+
+    record.append(body);
+    return record;
+}
+
+bool AsyncFileStore::decodeRecord(const QByteArray &data, const QByteArray &key, QByteArray *payload)
+{
+    if (data.size() < RECORD_HEADER_SIZE) {
+        return false;
+    }
+
+    quint32     magic, payloadLength;
+    quint16     flags, keyLength, checksum, reserved;
+    QDataStream stream(data);
+    stream >> magic >> flags >> keyLength >> payloadLength >> checksum >> reserved;
+
+    QByteArray body = data.mid(RECORD_HEADER_SIZE);
+    if (magic != RECORD_MAGIC || (flags & RECORD_DELETED) || body.size() != keyLength + (qint64)payloadLength
+            || body.left(keyLength) != key || qChecksum(body.constData(), body.size()) != checksum)
+    {
+        return false;
+    }
+
+    *payload = body.mid(keyLength);
+    return true;
+}
@@ -0,0 +1,135 @@
+#ifndef ASYNCFILESTORE_H
+#define ASYNCFILESTORE_H
+
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QAtomicInteger>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+
+#include "../asyncsessionstore.h"
+#include "../asyncprekeystore.h"
+#include "../../groups/state/asyncsenderkeystore.h"
+#include "../../util/fileiobackend.h"
+#include "../../util/addresskey.h"
+
+// Single host store keeping session, prekey and sender key records in a
+// directory of append-only shard logs. Every shard has one write in flight
+// at a time: stores arriving meanwhile are appended to the next batch, which
+// goes out as a single write plus fdatasync once the previous one is durable
+// (group commit). Done callbacks run once the record is on disk, a failed
+// commit ends in onError instead and leaves the shard read-only; loads see
+// a stored record right away.
+//
+// The in-memory index is rebuilt from the logs on open and a torn tail left
+// by a crash is cut off. A damaged record anywhere else fails the open. Logs are never rewritten, superseded records keep
+// taking space until the directory is rebuilt offline. Session records are
+// owned by a cache of parsed records, see SessionCache for the caveats.
+class AsyncFileStore : public AsyncSessionStore, public AsyncPreKeyStore, public AsyncSenderKeyStore
+{
+public:
+    // The shard count of an existing directory wins over shardCount
+    AsyncFileStore(const QString &path, int shardCount = 16, int maxCachedSessions = 100000,
+                   FileIoBackend *backend = FileIoBackend::create());
+    ~AsyncFileStore();
+
+    void loadSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::LoadCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+    void storeSessionAsync(const AxolotlAddress &remoteAddress, SessionRecord *record, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+    void containsSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::BoolCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+    void deleteSessionAsync(const AxolotlAddress &remoteAddress, const AsyncSessionStore::DoneCallback &callback, const AsyncSessionStore::ErrorCallback &onError);
+
+    void loadPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::LoadCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+    void storePreKeyAsync(qulonglong preKeyId, const PreKeyRecord &record, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+    void containsPreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::BoolCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+    void removePreKeyAsync(qulonglong preKeyId, const AsyncPreKeyStore::DoneCallback &callback, const AsyncPreKeyStore::ErrorCallback &onError);
+
+    void storeSenderKeyAsync(const SenderKeyName &senderKeyName, const SenderKeyRecord &record, const AsyncSenderKeyStore::DoneCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError);
+    void loadSenderKeyAsync(const SenderKeyName &senderKeyName, const AsyncSenderKeyStore::LoadCallback &callback, const AsyncSenderKeyStore::ErrorCallback &onError);
+
+    // Blocks until every store issued so far is durable
+    void flush();
+
+    QString backendName() const;
+    int shardCount() const;
+    quint64 commitCount() const;
+
+private:
+    enum Kind {
+        SessionKind   = 1,
+        PreKeyKind    = 2,
+        SenderKeyKind = 3
+    };
+
+    struct Location {
+        qint64  offset = 0;
+        int     length = 0;
+    };
+
+    struct PendingValue {
+        quint64    sequence = 0;
+        bool       deleted  = false;
+        QByteArray payload;
+    };
+
+    struct Completion {
+        std::function<void()>                                   done;
+        std::function<void(const WhisperException &exception)>  onError;
+    };
+
+    struct BatchEntry {
+        QByteArray key;
+        quint64    sequence;
+        bool       deleted;
+        qint64     offset;
+        int        length;
+    };
+
+    struct Shard {
+        int                                 fd         = -1;
+        qint64                              tail       = 0;
+        bool                                committing = false;
+        bool                                failed     = false;
+        QMutex                              mutex;
+        QWaitCondition                      idle;
+        QHash<QByteArray, Location>         index;
+        QHash<QByteArray, PendingValue>     pending;
+        QByteArray                          batch;
+        QList<BatchEntry>                   batchEntries;
+        QList<Completion>                   batchCompletions;
+    };
+
+    typedef std::function<void(bool found, const QByteArray &payload)> ValueCallback;
+    typedef std::function<void(const WhisperException &exception)>     ErrorCallback;
+    typedef QSharedPointer<SessionRecord>                              Record;
+
+    Shard *shardFor(const QByteArray &key) const;
+    void openShard(Shard *shard, const QString &fileName);
+    void put(const QByteArray &key, const QByteArray &payload, bool deleted, const std::function<void()> &callback, const ErrorCallback &onError);
+    void get(const QByteArray &key, const ValueCallback &callback, const ErrorCallback &onError);
+    bool contains(const QByteArray &key);
+    Record currentSession(const AddressKey &key);
+    void supersedeSession(const AddressKey &key);
+    void commit(Shard *shard);
+    void committed(Shard *shard, QList<BatchEntry> entries, QList<Completion> completions, bool ok);
+
+    static QByteArray recordKey(Kind kind, const QByteArray &key);
+    static QByteArray sessionKey(const AxolotlAddress &remoteAddress);
+    static QByteArray senderKeyKey(const SenderKeyName &senderKeyName);
+    static QByteArray encodeRecord(const QByteArray &key, const QByteArray &payload, bool deleted);
+    static bool decodeRecord(const QByteArray &data, const QByteArray &key, QByteArray *payload);
+
+    QString                            path;
+    QScopedPointer<FileIoBackend>      backend;
+    QList<Shard*>                      shards;
+    QAtomicInteger<quint64>            sequence;
+    QAtomicInteger<quint64>            commits;
+    QMutex                             sessionMutex;
+    QCache<AddressKey, Record>         sessions;
+    QHash<AddressKey, Record>          pinnedSessions;
+    QHash<AddressKey, Record>          supersededSessions;
+};
+
+#endif // ASYNCFILESTORE_H
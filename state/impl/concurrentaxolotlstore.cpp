@@ -0,0 +1,441 @@
+#include "concurrentaxolotlstore.h"
+#include "../../invalidkeyidexception.h"
+#include "../../util/addresskey.h"
+
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFile>
+#include <QDebug>
+
+enum SnapshotTag {
+    SnapshotEnd        = 0,
+    SnapshotIdentity   = 1,
+    SnapshotSession    = 2
+};
+
+ConcurrentAxolotlStore::ConcurrentAxolotlStore(const IdentityKeyPair &identityKeyPair, uint localRegistrationId)
+{
+    this->identityKeyPair     = identityKeyPair;
+    this->localRegistrationId = localRegistrationId;
+}
+
+ConcurrentAxolotlStore::Stripe &ConcurrentAxolotlStore::stripeFor(const QString &name) const
+{
+    return stripes[AddressUtil::stripe(name, STRIPES)];
+}
+
+IdentityKeyPair ConcurrentAxolotlStore::getIdentityKeyPair()
+{
+    QMutexLocker locker(&localMutex);
+    return identityKeyPair;
+}
+
+uint ConcurrentAxolotlStore::getLocalRegistrationId()
+{
+    QMutexLocker locker(&localMutex);
+    return localRegistrationId;
+}
+
+void ConcurrentAxolotlStore::storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair)
+{
+    QMutexLocker locker(&localMutex);
+    this->localRegistrationId = registrationId;
+    this->identityKeyPair     = identityKeyPair;
+}
+
+void ConcurrentAxolotlStore::saveIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    QByteArray serialized = identityKey.serialize();
+    Stripe    &stripe     = stripeFor(name);
+
+    QMutexLocker locker(&stripe.mutex);
+    stripe.trustedKeys.insert(name, serialized);
+}
+
+bool ConcurrentAxolotlStore::isTrustedIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    QByteArray serialized = identityKey.serialize();
+    Stripe    &stripe     = stripeFor(name);
+
+    QMutexLocker locker(&stripe.mutex);
+    QHash<QString, QByteArray>::const_iterator it = stripe.trustedKeys.constFind(name);
+    return it == stripe.trustedKeys.constEnd() || it.value() == serialized;
+}
+
+void ConcurrentAxolotlStore::removeIdentity(const QString &name)
+{
+    Stripe &stripe = stripeFor(name);
+
+    QMutexLocker locker(&stripe.mutex);
+    stripe.trustedKeys.remove(name);
+}
+
+PreKeyRecord ConcurrentAxolotlStore::loadPreKey(qulonglong preKeyId)
+{
+    QMutexLocker locker(&localMutex);
+    if (!preKeys.contains(preKeyId)) {
+        throw InvalidKeyIdException(QString("No such prekeyrecord! %1").arg(preKeyId));
+    }
+    return PreKeyRecord(preKeys.value(preKeyId));
+}
+
+void ConcurrentAxolotlStore::storePreKey(qulonglong preKeyId, const PreKeyRecord &record)
+{
+    QByteArray serialized = record.serialize();
+
+    QMutexLocker locker(&localMutex);
+    preKeys.insert(preKeyId, serialized);
+}
+
+bool ConcurrentAxolotlStore::containsPreKey(qulonglong preKeyId)
+{
+    QMutexLocker locker(&localMutex);
+    return preKeys.contains(preKeyId);
+}
+
+void ConcurrentAxolotlStore::removePreKey(qulonglong preKeyId)
+{
+    QMutexLocker locker(&localMutex);
+    preKeys.remove(preKeyId);
+}
+
+int ConcurrentAxolotlStore::countPreKeys()
+{
+    QMutexLocker locker(&localMutex);
+    return preKeys.size();
+}
+
+SessionRecord *ConcurrentAxolotlStore::loadSession(const AxolotlAddress &remoteAddress)
+{
+    Stripe &stripe = stripeFor(remoteAddress.getName());
+
+    QMutexLocker locker(&stripe.mutex);
+    stripe.superseded.remove(AddressUtil::toKey(remoteAddress));
+
+    Entry &entry = stripe.sessions[remoteAddress.getName()][remoteAddress.getDeviceId()];
+    if (!entry.record) {
+        // Fresh records are kept too, so the pointer stays valid until storeSession()
+        entry.record = Record(new SessionRecord());
+    }
+    entry.checkedOut = true;
+    return entry.record.data();
+}
+
+QList<int> ConcurrentAxolotlStore::getSubDeviceSessions(const QString &name)
+{
+    Stripe    &stripe = stripeFor(name);
+    QList<int> deviceIds;
+
+    QMutexLocker locker(&stripe.mutex);
+    QHash<QString, Devices>::const_iterator devices = stripe.sessions.constFind(name);
+    if (devices == stripe.sessions.constEnd()) {
+        return deviceIds;
+    }
+
+    for (Devices::const_iterator it = devices->constBegin(); it != devices->constEnd(); ++it) {
+        if (it.key() != 1 && it.value().version > 0) {
+            deviceIds.append(it.key());
+        }
+    }
+    return deviceIds;
+}
+
+void ConcurrentAxolotlStore::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    Stripe &stripe = stripeFor(remoteAddress.getName());
+
+    // Serialize outside the stripe lock, a record can take a while
+    QByteArray serialized = record->serialize();
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        QHash<QString, Devices>::iterator devices = stripe.sessions.find(remoteAddress.getName());
+        if (devices != stripe.sessions.end()) {
+            Devices::iterator entry = devices->find(remoteAddress.getDeviceId());
+            if (entry != devices->end() && entry->record.data() == record) {
+                record->setFresh(false);
+                entry->version    = ++lastVersion;
+                entry->checkedOut = false;
+                entry->serialized = serialized;
+                metadataIndex.publish(remoteAddress, SessionMetadataIndex::describe(record));
+                return;
+            }
+        }
+    }
+
+    SessionRecord *copy = new SessionRecord(serialized);
+
+    QMutexLocker locker(&stripe.mutex);
+    install(stripe, remoteAddress, copy, serialized);
+}
+
+bool ConcurrentAxolotlStore::containsSession(const AxolotlAddress &remoteAddress)
+{
+    Stripe &stripe = stripeFor(remoteAddress.getName());
+
+    QMutexLocker locker(&stripe.mutex);
+    return stripe.sessions.value(remoteAddress.getName()).value(remoteAddress.getDeviceId()).version > 0;
+}
+
+void ConcurrentAxolotlStore::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    Stripe &stripe = stripeFor(remoteAddress.getName());
+
+    QMutexLocker locker(&stripe.mutex);
+    QHash<QString, Devices>::iterator devices = stripe.sessions.find(remoteAddress.getName());
+    if (devices == stripe.sessions.end()) {
+        return;
+    }
+
+    supersede(stripe, remoteAddress, devices->take(remoteAddress.getDeviceId()));
+    if (devices->isEmpty()) {
+        stripe.sessions.erase(devices);
+    }
+    metadataIndex.remove(remoteAddress);
+}
+
+void ConcurrentAxolotlStore::deleteAllSessions(const QString &name)
+{
+    Stripe &stripe = stripeFor(name);
+
+    QMutexLocker locker(&stripe.mutex);
+    Devices devices = stripe.sessions.take(name);
+    for (Devices::const_iterator it = devices.constBegin(); it != devices.constEnd(); ++it) {
+        supersede(stripe, AxolotlAddress(name, it.key()), it.value());
+        metadataIndex.remove(AxolotlAddress(name, it.key()));
+    }
+}
+
+SignedPreKeyRecord ConcurrentAxolotlStore::loadSignedPreKey(qulonglong signedPreKeyId)
+{
+    QMutexLocker locker(&localMutex);
+    if (!signedPreKeys.contains(signedPreKeyId)) {
+        throw InvalidKeyIdException(QString("No such signedprekeyrecord! %1").arg(signedPreKeyId));
+    }
+    return SignedPreKeyRecord(signedPreKeys.value(signedPreKeyId));
+}
+
+QList<SignedPreKeyRecord> ConcurrentAxolotlStore::loadSignedPreKeys()
+{
+    QMutexLocker locker(&localMutex);
+    QList<SignedPreKeyRecord> results;
+    foreach (const QByteArray &serialized, signedPreKeys.values()) {
+        results.append(SignedPreKeyRecord(serialized));
+    }
+    return results;
+}
+
+void ConcurrentAxolotlStore::storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record)
+{
+    QByteArray serialized = record.serialize();
+
+    QMutexLocker locker(&localMutex);
+    signedPreKeys.insert(signedPreKeyId, serialized);
+}
+
+bool ConcurrentAxolotlStore::containsSignedPreKey(qulonglong signedPreKeyId)
+{
+    QMutexLocker locker(&localMutex);
+    return signedPreKeys.contains(signedPreKeyId);
+}
+
+void ConcurrentAxolotlStore::removeSignedPreKey(qulonglong signedPreKeyId)
+{
+    QMutexLocker locker(&localMutex);
+    signedPreKeys.remove(signedPreKeyId);
+}
+
+SessionRecord *ConcurrentAxolotlStore::loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version)
+{
+    Stripe    &stripe = stripeFor(remoteAddress.getName());
+    QByteArray serialized;
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        Entry entry = stripe.sessions.value(remoteAddress.getName()).value(remoteAddress.getDeviceId());
+        *version   = entry.version;
+        serialized = entry.serialized;
+    }
+
+    return serialized.isEmpty() ? new SessionRecord() : new SessionRecord(serialized);
+}
+
+bool ConcurrentAxolotlStore::compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion, SessionRecord *record)
+{
+    Stripe        &stripe     = stripeFor(remoteAddress.getName());
+    QByteArray     serialized = record->serialize();
+    SessionRecord *copy       = new SessionRecord(serialized);
+
+    QMutexLocker locker(&stripe.mutex);
+    if (stripe.sessions.value(remoteAddress.getName()).value(remoteAddress.getDeviceId()).version != expectedVersion) {
+        locker.unlock();
+        delete copy;
+        return false;
+    }
+
+    install(stripe, remoteAddress, copy, serialized);
+    return true;
+}
+
+bool ConcurrentAxolotlStore::loadSessionMetadata(const AxolotlAddress &remoteAddress, SessionMetadata *metadata) const
+{
+    return metadataIndex.lookup(remoteAddress, metadata);
+}
+
+int ConcurrentAxolotlStore::sessionCount() const
+{
+    int count = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        foreach (const Devices &devices, stripes[i].sessions) {
+            count += devices.size();
+        }
+    }
+    return count;
+}
+
+void ConcurrentAxolotlStore::install(Stripe &stripe, const AxolotlAddress &remoteAddress, SessionRecord *copy, const QByteArray &serialized)
+{
+    copy->setFresh(false);
+
+    Entry &entry = stripe.sessions[remoteAddress.getName()][remoteAddress.getDeviceId()];
+    supersede(stripe, remoteAddress, entry);
+    entry.record     = Record(copy);
+    entry.version    = ++lastVersion;
+    entry.checkedOut = false;
+    entry.serialized = serialized;
+
+    metadataIndex.publish(remoteAddress, SessionMetadataIndex::describe(copy));
+}
+
+// Keeps a replaced record alive for whoever checked it out
+void ConcurrentAxolotlStore::supersede(Stripe &stripe, const AxolotlAddress &remoteAddress, const Entry &entry)
+{
+    if (entry.record && entry.checkedOut) {
+        stripe.superseded.insert(AddressUtil::toKey(remoteAddress), entry.record);
+    }
+}
+
+int ConcurrentAxolotlStore::save(const QString &path) const
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write store snapshot" << path << file.errorString();
+        return -1;
+    }
+
+    // The snapshot holds the identity key and every session's keys
+    if (!file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)) {
+        qWarning() << "Can't restrict store snapshot" << path << file.errorString();
+        file.cancelWriting();
+        return -1;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << SNAPSHOT_MAGIC << SNAPSHOT_VERSION;
+
+    {
+        QMutexLocker locker(&localMutex);
+        stream << (quint32)localRegistrationId << identityKeyPair.serialize() << preKeys << signedPreKeys;
+    }
+
+    int count = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+
+        for (QHash<QString, QByteArray>::const_iterator it = stripes[i].trustedKeys.constBegin(); it != stripes[i].trustedKeys.constEnd(); ++it) {
+            stream << (quint8)SnapshotIdentity << it.key() << it.value();
+        }
+
+        for (QHash<QString, Devices>::const_iterator devices = stripes[i].sessions.constBegin(); devices != stripes[i].sessions.constEnd(); ++devices) {
+            for (Devices::const_iterator it = devices->constBegin(); it != devices->constEnd(); ++it) {
+                if (it.value().version > 0) {
+                    stream << (quint8)SnapshotSession << devices.key() << (qint32)it.key() << it.value().serialized;
+                    count++;
+                }
+            }
+        }
+    }
+    stream << (quint8)SnapshotEnd;
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Can't write store snapshot" << path << file.errorString();
+        return -1;
+    }
+
+    return count;
+}
+
+int ConcurrentAxolotlStore::restore(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32                        magic, version, registrationId;
+    QByteArray                     serializedIdentity;
+    QHash<qulonglong, QByteArray>  snapshotPreKeys, snapshotSignedPreKeys;
+    stream >> magic >> version >> registrationId >> serializedIdentity >> snapshotPreKeys >> snapshotSignedPreKeys;
+
+    if (stream.status() != QDataStream::Ok || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) {
+        qWarning() << "Ignoring incompatible store snapshot" << path;
+        return -1;
+    }
+
+    storeLocalData(registrationId, IdentityKeyPair(serializedIdentity));
+    {
+        QMutexLocker locker(&localMutex);
+        for (QHash<qulonglong, QByteArray>::const_iterator it = snapshotPreKeys.constBegin(); it != snapshotPreKeys.constEnd(); ++it) {
+            preKeys.insert(it.key(), it.value());
+        }
+        for (QHash<qulonglong, QByteArray>::const_iterator it = snapshotSignedPreKeys.constBegin(); it != snapshotSignedPreKeys.constEnd(); ++it) {
+            signedPreKeys.insert(it.key(), it.value());
+        }
+    }
+
+    int count = 0;
+    for (;;) {
+        quint8     tag = SnapshotEnd;
+        QString    name;
+        qint32     deviceId = 0;
+        QByteArray serialized;
+
+        stream >> tag;
+        if (tag == SnapshotIdentity) {
+            stream >> name >> serialized;
+        } else if (tag == SnapshotSession) {
+            stream >> name >> deviceId >> serialized;
+        }
+
+        if (stream.status() != QDataStream::Ok) {
+            qWarning() << "Truncated store snapshot" << path << "after" << count << "sessions";
+            break;
+        }
+        if (tag == SnapshotEnd) {
+            break;
+        }
+
+        Stripe &stripe = stripeFor(name);
+        if (tag == SnapshotIdentity) {
+            QMutexLocker locker(&stripe.mutex);
+            stripe.trustedKeys.insert(name, serialized);
+        } else if (tag == SnapshotSession) {
+            SessionRecord *copy = new SessionRecord(serialized);
+
+            QMutexLocker locker(&stripe.mutex);
+            install(stripe, AxolotlAddress(name, deviceId), copy, serialized);
+            count++;
+        } else {
+            qWarning() << "Unknown entry in store snapshot" << path;
+            break;
+        }
+    }
+
+    return count;
+}
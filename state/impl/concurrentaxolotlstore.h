@@ -0,0 +1,117 @@
+#ifndef CONCURRENTAXOLOTLSTORE_H
+#define CONCURRENTAXOLOTLSTORE_H
+
+#include <QAtomicInteger>
+#include <QSharedPointer>
+#include <QHash>
+#include <QMutex>
+
+#include "../axolotlstore.h"
+#include "../versionedsessionstore.h"
+#include "../sessionmetadataindex.h"
+#include "../../util/addresskey.h"
+
+// Resident AxolotlStore for servers holding millions of sessions. Sessions
+// and identities are spread over STRIPES lock stripes by remote name, and
+// each stripe keeps a name -> device map, so getSubDeviceSessions() and
+// deleteAllSessions() only touch the devices of that name. The local
+// identity and prekeys sit behind their own lock.
+//
+// Records returned from loadSession() stay owned by the store. When one is
+// replaced by a foreign record, a CAS or a delete before it was stored
+// back, it is kept alive until the next loadSession() for its address,
+// like in SessionCache. Every write also keeps the record's serialized
+// form, which save() and loadSessionVersioned() read instead of a record
+// a caller may be changing. Versions come from one counter for the whole
+// store, so a CAS can't be fooled by a session that was deleted and
+// recreated in between.
+//
+// Session metadata is published to a SessionMetadataIndex whenever a write
+// changes it, so metadata queries never wait on the stripe locks.
+//
+// save() and restore() write and read a full snapshot, readable by the
+// owner only. save() locks one stripe at a time, so take it once traffic
+// has stopped for an exact copy.
+class ConcurrentAxolotlStore : public AxolotlStore, public VersionedSessionStore, public SessionMetadataStore
+{
+public:
+    static const int     STRIPES          = 256;
+    static const quint32 SNAPSHOT_MAGIC   = 0x41584d53;
+    static const quint32 SNAPSHOT_VERSION = 1;
+
+    ConcurrentAxolotlStore(const IdentityKeyPair &identityKeyPair, uint localRegistrationId);
+
+    IdentityKeyPair getIdentityKeyPair();
+    uint getLocalRegistrationId();
+    void storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair);
+    void saveIdentity(const QString &name, const IdentityKey &identityKey);
+    bool isTrustedIdentity(const QString &name, const IdentityKey &identityKey);
+    void removeIdentity(const QString &name);
+
+    PreKeyRecord loadPreKey(qulonglong preKeyId);
+    void storePreKey(qulonglong preKeyId, const PreKeyRecord &record);
+    bool containsPreKey(qulonglong preKeyId);
+    void removePreKey(qulonglong preKeyId);
+    int countPreKeys();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    SignedPreKeyRecord loadSignedPreKey(qulonglong signedPreKeyId);
+    QList<SignedPreKeyRecord> loadSignedPreKeys();
+    void storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record);
+    bool containsSignedPreKey(qulonglong signedPreKeyId);
+    void removeSignedPreKey(qulonglong signedPreKeyId);
+
+    SessionRecord *loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version);
+    bool compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion, SessionRecord *record);
+
+    bool loadSessionMetadata(const AxolotlAddress &remoteAddress, SessionMetadata *metadata) const;
+
+    int sessionCount() const;
+
+    // Returns the number of sessions written, -1 on error
+    int save(const QString &path) const;
+    // Adds the snapshot to the store, replacing what is there for the same keys
+    int restore(const QString &path);
+
+private:
+    typedef QSharedPointer<SessionRecord> Record;
+
+    // version 0 is a fresh record nobody stored yet
+    struct Entry {
+        Record      record;
+        quint64     version    = 0;
+        bool        checkedOut = false;
+        QByteArray  serialized;
+    };
+
+    typedef QHash<int, Entry> Devices;
+
+    struct Stripe {
+        QMutex                       mutex;
+        QHash<QString, Devices>      sessions;
+        QHash<QString, QByteArray>   trustedKeys;
+        QHash<AddressKey, Record>    superseded;
+    };
+
+    Stripe &stripeFor(const QString &name) const;
+    void install(Stripe &stripe, const AxolotlAddress &remoteAddress, SessionRecord *copy, const QByteArray &serialized);
+    static void supersede(Stripe &stripe, const AxolotlAddress &remoteAddress, const Entry &entry);
+
+    mutable Stripe                 stripes[STRIPES];
+    QAtomicInteger<quint64>        lastVersion;
+    SessionMetadataIndex           metadataIndex;
+
+    mutable QMutex                 localMutex;
+    IdentityKeyPair                identityKeyPair;
+    uint                           localRegistrationId;
+    QHash<qulonglong, QByteArray>  preKeys;
+    QHash<qulonglong, QByteArray>  signedPreKeys;
+};
+
+#endif // CONCURRENTAXOLOTLSTORE_H
@@ -0,0 +1,193 @@
+#include "inmemoryaxolotlstore.h"
+#include "../../invalidkeyidexception.h"
+
+#include <QMutexLocker>
+
+InMemoryAxolotlStore::InMemoryAxolotlStore(const IdentityKeyPair &identityKeyPair, uint localRegistrationId)
+{
+    this->identityKeyPair     = identityKeyPair;
+    this->localRegistrationId = localRegistrationId;
+}
+
+InMemoryAxolotlStore::~InMemoryAxolotlStore()
+{
+    qDeleteAll(sessions);
+}
+
+IdentityKeyPair InMemoryAxolotlStore::getIdentityKeyPair()
+{
+    QMutexLocker locker(&mutex);
+    return identityKeyPair;
+}
+
+uint InMemoryAxolotlStore::getLocalRegistrationId()
+{
+    QMutexLocker locker(&mutex);
+    return localRegistrationId;
+}
+
+void InMemoryAxolotlStore::storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair)
+{
+    QMutexLocker locker(&mutex);
+    this->localRegistrationId = registrationId;
+    this->identityKeyPair     = identityKeyPair;
+}
+
+void InMemoryAxolotlStore::saveIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    QMutexLocker locker(&mutex);
+    trustedKeys.insert(name, identityKey.serialize());
+}
+
+bool InMemoryAxolotlStore::isTrustedIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    QMutexLocker locker(&mutex);
+    if (!trustedKeys.contains(name)) {
+        return true;
+    }
+    return trustedKeys.value(name) == identityKey.serialize();
+}
+
+void InMemoryAxolotlStore::removeIdentity(const QString &name)
+{
+    QMutexLocker locker(&mutex);
+    trustedKeys.remove(name);
+}
+
+PreKeyRecord InMemoryAxolotlStore::loadPreKey(qulonglong preKeyId)
+{
+    QMutexLocker locker(&mutex);
+    if (!preKeys.contains(preKeyId)) {
+        throw InvalidKeyIdException(QString("No such prekeyrecord! %1").arg(preKeyId));
+    }
+    return PreKeyRecord(preKeys.value(preKeyId));
+}
+
+void InMemoryAxolotlStore::storePreKey(qulonglong preKeyId, const PreKeyRecord &record)
+{
+    QMutexLocker locker(&mutex);
+    preKeys.insert(preKeyId, record.serialize());
+}
+
+bool InMemoryAxolotlStore::containsPreKey(qulonglong preKeyId)
+{
+    QMutexLocker locker(&mutex);
+    return preKeys.contains(preKeyId);
+}
+
+void InMemoryAxolotlStore::removePreKey(qulonglong preKeyId)
+{
+    QMutexLocker locker(&mutex);
+    preKeys.remove(preKeyId);
+}
+
+int InMemoryAxolotlStore::countPreKeys()
+{
+    QMutexLocker locker(&mutex);
+    return preKeys.size();
+}
+
+SessionRecord *InMemoryAxolotlStore::loadSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    AddressKey     key    = AddressUtil::toKey(remoteAddress);
+    SessionRecord *record = sessions.value(key);
+    if (!record) {
+        // Fresh records are kept too, so the pointer stays valid until storeSession()
+        record = new SessionRecord();
+        sessions.insert(key, record);
+    }
+    return record;
+}
+
+QList<int> InMemoryAxolotlStore::getSubDeviceSessions(const QString &name)
+{
+    QMutexLocker locker(&mutex);
+    QList<int> deviceIds;
+    QHashIterator<AddressKey, SessionRecord*> iterator(sessions);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (iterator.key().first == name && iterator.key().second != 1 && !iterator.value()->isFresh()) {
+            deviceIds.append(iterator.key().second);
+        }
+    }
+    return deviceIds;
+}
+
+void InMemoryAxolotlStore::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    QMutexLocker locker(&mutex);
+    AddressKey     key    = AddressUtil::toKey(remoteAddress);
+    SessionRecord *stored = sessions.value(key);
+    if (stored == record) {
+        stored->setFresh(false);
+        return;
+    }
+
+    SessionRecord *copy = new SessionRecord(record->serialize());
+    delete stored;
+    sessions.insert(key, copy);
+}
+
+bool InMemoryAxolotlStore::containsSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    SessionRecord *record = sessions.value(AddressUtil::toKey(remoteAddress));
+    return record && !record->isFresh();
+}
+
+void InMemoryAxolotlStore::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    delete sessions.take(AddressUtil::toKey(remoteAddress));
+}
+
+void InMemoryAxolotlStore::deleteAllSessions(const QString &name)
+{
+    QMutexLocker locker(&mutex);
+    QMutableHashIterator<AddressKey, SessionRecord*> iterator(sessions);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (iterator.key().first == name) {
+            delete iterator.value();
+            iterator.remove();
+        }
+    }
+}
+
+SignedPreKeyRecord InMemoryAxolotlStore::loadSignedPreKey(qulonglong signedPreKeyId)
+{
+    QMutexLocker locker(&mutex);
+    if (!signedPreKeys.contains(signedPreKeyId)) {
+        throw InvalidKeyIdException(QString("No such signedprekeyrecord! %1").arg(signedPreKeyId));
+    }
+    return SignedPreKeyRecord(signedPreKeys.value(signedPreKeyId));
+}
+
+QList<SignedPreKeyRecord> InMemoryAxolotlStore::loadSignedPreKeys()
+{
+    QMutexLocker locker(&mutex);
+    QList<SignedPreKeyRecord> results;
+    foreach (const QByteArray &serialized, signedPreKeys.values()) {
+        results.append(SignedPreKeyRecord(serialized));
+    }
+    return results;
+}
+
+void InMemoryAxolotlStore::storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record)
+{
+    QMutexLocker locker(&mutex);
+    signedPreKeys.insert(signedPreKeyId, record.serialize());
+}
+
+bool InMemoryAxolotlStore::containsSignedPreKey(qulonglong signedPreKeyId)
+{
+    QMutexLocker locker(&mutex);
+    return signedPreKeys.contains(signedPreKeyId);
+}
+
+void InMemoryAxolotlStore::removeSignedPreKey(qulonglong signedPreKeyId)
+{
+    QMutexLocker locker(&mutex);
+    signedPreKeys.remove(signedPreKeyId);
+}
@@ -0,0 +1,54 @@
+#ifndef INMEMORYAXOLOTLSTORE_H
+#define INMEMORYAXOLOTLSTORE_H
+
+#include <QHash>
+#include <QMutex>
+
+#include "../axolotlstore.h"
+#include "../../util/addresskey.h"
+
+// Volatile AxolotlStore for tools, benchmarks and tests. Records returned
+// from loadSession() stay owned by the store until the session is deleted.
+class InMemoryAxolotlStore : public AxolotlStore
+{
+public:
+    InMemoryAxolotlStore(const IdentityKeyPair &identityKeyPair, uint localRegistrationId);
+    ~InMemoryAxolotlStore();
+
+    IdentityKeyPair getIdentityKeyPair();
+    uint getLocalRegistrationId();
+    void storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair);
+    void saveIdentity(const QString &name, const IdentityKey &identityKey);
+    bool isTrustedIdentity(const QString &name, const IdentityKey &identityKey);
+    void removeIdentity(const QString &name);
+
+    PreKeyRecord loadPreKey(qulonglong preKeyId);
+    void storePreKey(qulonglong preKeyId, const PreKeyRecord &record);
+    bool containsPreKey(qulonglong preKeyId);
+    void removePreKey(qulonglong preKeyId);
+    int countPreKeys();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    SignedPreKeyRecord loadSignedPreKey(qulonglong signedPreKeyId);
+    QList<SignedPreKeyRecord> loadSignedPreKeys();
+    void storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record);
+    bool containsSignedPreKey(qulonglong signedPreKeyId);
+    void removeSignedPreKey(qulonglong signedPreKeyId);
+
+private:
+    QMutex                               mutex;
+    IdentityKeyPair                      identityKeyPair;
+    uint                                 localRegistrationId;
+    QHash<QString, QByteArray>           trustedKeys;
+    QHash<qulonglong, QByteArray>        preKeys;
+    QHash<qulonglong, QByteArray>        signedPreKeys;
+    QHash<AddressKey, SessionRecord*>    sessions;
+};
+
+#endif // INMEMORYAXOLOTLSTORE_H
@@ -0,0 +1,134 @@
+#include "inmemoryversionedsessionstore.h"
+
+#include <QMutexLocker>
+
+InMemoryVersionedSessionStore::InMemoryVersionedSessionStore()
+{
+    lastVersion = 0;
+    conflicts   = 0;
+}
+
+InMemoryVersionedSessionStore::~InMemoryVersionedSessionStore()
+{
+}
+
+SessionRecord *InMemoryVersionedSessionStore::loadSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    AddressKey   key = AddressUtil::toKey(remoteAddress);
+    superseded.remove(key);
+
+    QHash<AddressKey, Entry>::iterator entry = sessions.find(key);
+    if (entry == sessions.end()) {
+        Entry created;
+        created.record  = Record(new SessionRecord());
+        created.version = 0;
+        entry = sessions.insert(key, created);
+    }
+    entry->checkedOut = true;
+    return entry->record.data();
+}
+
+QList<int> InMemoryVersionedSessionStore::getSubDeviceSessions(const QString &name)
+{
+    QMutexLocker locker(&mutex);
+    QList<int> deviceIds;
+    QHashIterator<AddressKey, Entry> iterator(sessions);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (iterator.key().first == name && iterator.key().second != 1 && iterator.value().version > 0) {
+            deviceIds.append(iterator.key().second);
+        }
+    }
+    return deviceIds;
+}
+
+void InMemoryVersionedSessionStore::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    QMutexLocker locker(&mutex);
+    replace(AddressUtil::toKey(remoteAddress), record);
+}
+
+bool InMemoryVersionedSessionStore::containsSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    return sessions.value(AddressUtil::toKey(remoteAddress)).version > 0;
+}
+
+void InMemoryVersionedSessionStore::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    AddressKey   key = AddressUtil::toKey(remoteAddress);
+    supersede(key, sessions.take(key));
+}
+
+void InMemoryVersionedSessionStore::deleteAllSessions(const QString &name)
+{
+    QMutexLocker locker(&mutex);
+    QMutableHashIterator<AddressKey, Entry> iterator(sessions);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (iterator.key().first == name) {
+            supersede(iterator.key(), iterator.value());
+            iterator.remove();
+        }
+    }
+}
+
+SessionRecord *InMemoryVersionedSessionStore::loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version)
+{
+    QMutexLocker locker(&mutex);
+    Entry entry = sessions.value(AddressUtil::toKey(remoteAddress));
+
+    if (entry.version == 0) {
+        *version = 0;
+        return new SessionRecord();
+    }
+
+    *version = entry.version;
+    return new SessionRecord(*entry.record);
+}
+
+bool InMemoryVersionedSessionStore::compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion, SessionRecord *record)
+{
+    QMutexLocker locker(&mutex);
+    AddressKey   key = AddressUtil::toKey(remoteAddress);
+
+    if (sessions.value(key).version != expectedVersion) {
+        conflicts++;
+        return false;
+    }
+
+    replace(key, record);
+    return true;
+}
+
+quint64 InMemoryVersionedSessionStore::getConflictCount() const
+{
+    QMutexLocker locker(&mutex);
+    return conflicts;
+}
+
+void InMemoryVersionedSessionStore::replace(const AddressKey &key, SessionRecord *record)
+{
+    Entry entry = sessions.value(key);
+    entry.version = ++lastVersion;
+
+    // Never adopt a caller owned record, keep a private copy instead
+    if (entry.record.data() != record) {
+        supersede(key, entry);
+        entry.record = Record(new SessionRecord(*record));
+    }
+    entry.record->setFresh(false);
+    entry.checkedOut = false;
+
+    sessions.insert(key, entry);
+}
+
+// Keeps a record loadSession() handed out alive for its holder
+void InMemoryVersionedSessionStore::supersede(const AddressKey &key, const Entry &entry)
+{
+    if (entry.record && entry.checkedOut) {
+        superseded.insert(key, entry.record);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef INMEMORYVERSIONEDSESSIONSTORE_H
+#define INMEMORYVERSIONEDSESSIONSTORE_H
+
+#include <QSharedPointer>
+#include <QHash>
+#include <QMutex>
+
+#include "../sessionstore.h"
+#include "../versionedsessionstore.h"
+#include "../../util/addresskey.h"
+
+// Reference VersionedSessionStore: what a database row with a version
+// column gives several nodes, for tests and the simulator. Plain
+// storeSession() overwrites unconditionally and bumps the version.
+// Versions come from one store-wide counter, so a session deleted and
+// created again never repeats a version a writer may still hold. A record
+// handed out by loadSession() that gets replaced or deleted stays alive
+// until the next loadSession() for its address.
+class InMemoryVersionedSessionStore : public SessionStore, public VersionedSessionStore
+{
+public:
+    InMemoryVersionedSessionStore();
+    ~InMemoryVersionedSessionStore();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    SessionRecord *loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version);
+    bool compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion, SessionRecord *record);
+
+    quint64 getConflictCount() const;
+
+private:
+    typedef QSharedPointer<SessionRecord> Record;
+
+    struct Entry {
+        Record  record;
+        quint64 version    = 0;
+        bool    checkedOut = false;
+    };
+
+    void replace(const AddressKey &key, SessionRecord *record);
+    void supersede(const AddressKey &key, const Entry &entry);
+
+    mutable QMutex             mutex;
+    QHash<AddressKey, Entry>   sessions;
+    QHash<AddressKey, Record>  superseded;
+    quint64                    lastVersion;
+    quint64                    conflicts;
+};
+
+#endif // INMEMORYVERSIONEDSESSIONSTORE_H
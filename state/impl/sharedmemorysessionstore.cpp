@@ -0,0 +1,546 @@
+#include "sharedmemorysessionstore.h"
+
+#include "../../whisperexception.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QThread>
+#include <QDebug>
+
+#include <atomic>
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <signal.h>
+#endif
+
+static const quint32 SEGMENT_MAGIC   = 0x41585353;
+static const quint32 SEGMENT_VERSION = 2;
+
+// Arena blocks are 64 << sizeClass bytes, freed blocks go on a free list
+// per class and are handed out again before the arena grows
+static const int     ARENA_CLASSES   = 32;
+static const quint64 FREE_LIST_END   = ~0ULL;
+
+enum SlotState {
+    SlotEmpty   = 0,
+    SlotLive    = 1,
+    SlotRemoved = 2
+};
+
+struct SharedMemorySessionStore::SegmentHeader
+{
+    quint32               magic;
+    quint32               version;
+    quint32               slotCount;
+    quint32               slotSize;
+    quint64               slotsOffset;
+    quint64               arenaOffset;
+    quint64               arenaSize;
+    std::atomic<quint64>  arenaTop;
+    std::atomic<quint64>  arenaFree;
+    std::atomic<qint32>   arenaOwner;
+    quint64               freeLists[ARENA_CLASSES];
+    std::atomic<quint32>  ready;
+};
+
+struct alignas(64) SharedMemorySessionStore::Slot
+{
+    std::atomic<qint32> owner;
+    quint8              state;
+    quint8              writing;
+    quint16             nameLength;
+    qint32              deviceId;
+    quint32             dataLength;
+    quint32             dataCapacity;
+    quint64             hash;
+    quint64             version;
+    quint64             dataOffset;
+    char                name[MAX_NAME_LENGTH];
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "Shared memory locks need address-free atomics");
+
+static quint64 alignUp(quint64 value, quint64 alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static int blockClass(quint64 length)
+{
+    int sizeClass = 0;
+    while ((64ULL << sizeClass) < length) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+// qHash() is seeded per process, every process has to agree on slot positions
+static quint64 addressHash(const QByteArray &name, int deviceId)
+{
+    quint64 hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < name.size(); i++) {
+        hash = (hash ^ (quint8)name.at(i)) * 0x100000001B3ULL;
+    }
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((quint32)deviceId >> (8 * i) & 0xFF)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static bool processAlive(qint32 pid)
+{
+#ifdef Q_OS_UNIX
+    return kill(pid, 0) == 0 || errno != ESRCH;
+#else
+    Q_UNUSED(pid);
+    return true;
+#endif
+}
+
+SharedMemorySessionStore::SharedMemorySessionStore(const QString &key, int slotCount, qint64 arenaSize, int maxCachedRecords)
+    : sharedMemory(key)
+{
+    pid = (qint32)QCoreApplication::applicationPid();
+    cache.setMaxCost(qMax(64, maxCachedRecords));
+
+    quint64 slotsOffset = alignUp(sizeof(SegmentHeader), 64);
+    quint64 arenaOffset = alignUp(slotsOffset + (quint64)qMax(1, slotCount) * sizeof(Slot), 64);
+    quint64 totalSize   = arenaOffset + (quint64)qMax((qint64)4096, arenaSize);
+
+    if (sharedMemory.create(totalSize)) {
+        base   = (char*)sharedMemory.data();
+        header = (SegmentHeader*)base;
+        memset(base, 0, arenaOffset);
+
+        header->magic       = SEGMENT_MAGIC;
+        header->version     = SEGMENT_VERSION;
+        header->slotCount   = qMax(1, slotCount);
+        header->slotSize    = sizeof(Slot);
+        header->slotsOffset = slotsOffset;
+        header->arenaOffset = arenaOffset;
+        header->arenaSize   = totalSize - arenaOffset;
+        header->arenaTop.store(0);
+        header->arenaFree.store(0);
+        header->arenaOwner.store(0);
+        for (int i = 0; i < ARENA_CLASSES; i++) {
+            header->freeLists[i] = FREE_LIST_END;
+        }
+        header->ready.store(1, std::memory_order_release);
+        return;
+    }
+
+    if (sharedMemory.error() != QSharedMemory::AlreadyExists || !sharedMemory.attach()) {
+        throw WhisperException("SharedMemorySessionStore", sharedMemory.errorString());
+    }
+
+    // The creator may still be laying out the segment
+    base   = (char*)sharedMemory.data();
+    header = (SegmentHeader*)base;
+    while (header->ready.load(std::memory_order_acquire) == 0) {
+        QThread::yieldCurrentThread();
+    }
+
+    if (header->magic != SEGMENT_MAGIC || header->version != SEGMENT_VERSION || header->slotSize != sizeof(Slot)) {
+        sharedMemory.detach();
+        throw WhisperException("SharedMemorySessionStore", "Incompatible shared session segment " + key);
+    }
+}
+
+SharedMemorySessionStore::~SharedMemorySessionStore()
+{
+    sharedMemory.detach();
+}
+
+SharedMemorySessionStore::Slot *SharedMemorySessionStore::slotAt(quint32 index) const
+{
+    return (Slot*)(base + header->slotsOffset) + index;
+}
+
+void SharedMemorySessionStore::acquire(std::atomic<qint32> &owner)
+{
+    int spins = 0;
+
+    for (;;) {
+        qint32 holder = 0;
+        if (owner.compare_exchange_weak(holder, pid, std::memory_order_acquire)) {
+            return;
+        }
+
+        spins++;
+        if (holder != 0 && spins % 4096 == 0 && !processAlive(holder)
+                && owner.compare_exchange_strong(holder, pid, std::memory_order_acquire))
+        {
+            qWarning() << "Took over shared session lock from dead process" << holder;
+            return;
+        }
+
+        if (spins > 64) {
+            QThread::yieldCurrentThread();
+        }
+    }
+}
+
+void SharedMemorySessionStore::lockSlot(Slot *slot)
+{
+    acquire(slot->owner);
+
+    // Whoever held it before died in the middle of writeRecord()
+    if (slot->writing) {
+        dropRecord(slot);
+        slot->writing = 0;
+        slot->version++;
+    }
+}
+
+void SharedMemorySessionStore::unlockSlot(Slot *slot)
+{
+    slot->owner.store(0, std::memory_order_release);
+}
+
+SharedMemorySessionStore::Slot *SharedMemorySessionStore::findSlot(const AxolotlAddress &remoteAddress, bool create)
+{
+    QByteArray name = remoteAddress.getName().toUtf8();
+    if (name.size() > MAX_NAME_LENGTH) {
+        throw WhisperException("SharedMemorySessionStore", "Name too long for shared session slot");
+    }
+
+    quint64 hash  = addressHash(name, remoteAddress.getDeviceId());
+    quint32 count = header->slotCount;
+
+    for (quint32 probe = 0; probe < count; probe++) {
+        Slot *slot = slotAt((hash + probe) % count);
+        lockSlot(slot);
+
+        if (slot->state == SlotEmpty) {
+            // Slots are never emptied again, so the address is not further down the chain
+            if (!create) {
+                unlockSlot(slot);
+                return 0;
+            }
+
+            slot->state      = SlotRemoved;
+            slot->hash       = hash;
+            slot->deviceId   = remoteAddress.getDeviceId();
+            slot->nameLength = name.size();
+            memcpy(slot->name, name.constData(), name.size());
+            return slot;
+        }
+
+        if (slot->hash == hash && slot->deviceId == remoteAddress.getDeviceId()
+                && slot->nameLength == name.size() && memcmp(slot->name, name.constData(), name.size()) == 0)
+        {
+            return slot;
+        }
+
+        unlockSlot(slot);
+    }
+
+    if (create) {
+        throw WhisperException("SharedMemorySessionStore", "Shared session table is full");
+    }
+    return 0;
+}
+
+// Pops a free block of sizeClass or, once the arena is exhausted, of the
+// smallest larger class that has one. Pushing and popping each publish
+// with a single store, so a process dying in between only leaks a block.
+quint64 SharedMemorySessionStore::allocateBlock(int sizeClass, quint64 *capacity)
+{
+    char   *arena  = base + header->arenaOffset;
+    quint64 offset = FREE_LIST_END;
+
+    acquire(header->arenaOwner);
+
+    quint64 top = header->arenaTop.load();
+    if (header->freeLists[sizeClass] != FREE_LIST_END) {
+        offset = header->freeLists[sizeClass];
+    } else if (top + (64ULL << sizeClass) <= header->arenaSize) {
+        header->arenaTop.store(top + (64ULL << sizeClass));
+        *capacity = 64ULL << sizeClass;
+        header->arenaOwner.store(0, std::memory_order_release);
+        return top;
+    } else {
+        for (sizeClass++; sizeClass < ARENA_CLASSES; sizeClass++) {
+            if (header->freeLists[sizeClass] != FREE_LIST_END) {
+                offset = header->freeLists[sizeClass];
+                break;
+            }
+        }
+    }
+
+    if (offset != FREE_LIST_END) {
+        quint64 next;
+        memcpy(&next, arena + offset, sizeof(next));
+        header->freeLists[sizeClass] = next;
+        header->arenaFree.fetch_sub(64ULL << sizeClass);
+        *capacity = 64ULL << sizeClass;
+    }
+
+    header->arenaOwner.store(0, std::memory_order_release);
+    return offset;
+}
+
+void SharedMemorySessionStore::releaseBlock(quint64 offset, quint64 capacity)
+{
+    if (capacity == 0) {
+        return;
+    }
+
+    int sizeClass = blockClass(capacity);
+
+    acquire(header->arenaOwner);
+    memcpy(base + header->arenaOffset + offset, &header->freeLists[sizeClass], sizeof(quint64));
+    header->freeLists[sizeClass] = offset;
+    header->arenaFree.fetch_add(capacity);
+    header->arenaOwner.store(0, std::memory_order_release);
+}
+
+void SharedMemorySessionStore::writeRecord(Slot *slot, const QByteArray &serialized)
+{
+    quint32 length = serialized.size();
+
+    if (length > slot->dataCapacity) {
+        // Leave room to grow, records get a little bigger with every ratchet step
+        quint64 capacity = 0;
+        quint64 offset   = allocateBlock(blockClass(length + length / 4), &capacity);
+        if (offset == FREE_LIST_END) {
+            throw WhisperException("SharedMemorySessionStore", "Shared session arena is full");
+        }
+
+        // From here on a process dying drops the record along with its new block
+        slot->writing = 1;
+
+        quint64 oldOffset   = slot->dataOffset;
+        quint64 oldCapacity = slot->dataCapacity;
+        slot->dataOffset    = offset;
+        slot->dataCapacity  = capacity;
+        releaseBlock(oldOffset, oldCapacity);
+    }
+
+    slot->writing = 1;
+    memcpy(base + header->arenaOffset + slot->dataOffset, serialized.constData(), length);
+    slot->dataLength = length;
+    slot->state      = SlotLive;
+    slot->writing    = 0;
+    slot->version++;
+}
+
+QByteArray SharedMemorySessionStore::readRecord(Slot *slot) const
+{
+    return QByteArray(base + header->arenaOffset + slot->dataOffset, slot->dataLength);
+}
+
+void SharedMemorySessionStore::dropRecord(Slot *slot)
+{
+    releaseBlock(slot->dataOffset, slot->dataCapacity);
+    slot->state        = SlotRemoved;
+    slot->dataOffset   = 0;
+    slot->dataLength   = 0;
+    slot->dataCapacity = 0;
+}
+
+// Called with cacheMutex held, keeps a checked out record alive for its holder
+void SharedMemorySessionStore::supersede(const AddressKey &key)
+{
+    Record record = pinned.take(key);
+    if (record) {
+        superseded.insert(key, record);
+    }
+    cache.remove(key);
+}
+
+SessionRecord *SharedMemorySessionStore::loadSession(const AxolotlAddress &remoteAddress)
+{
+    AddressKey key     = AddressUtil::toKey(remoteAddress);
+    quint64    version = 0;
+    QByteArray serialized;
+
+    {
+        // The previous holder of key's record is done with it by now
+        QMutexLocker locker(&cacheMutex);
+        superseded.remove(key);
+    }
+
+    Slot *slot = findSlot(remoteAddress, false);
+    if (slot) {
+        version = slot->version;
+        if (slot->state == SlotLive) {
+            QMutexLocker locker(&cacheMutex);
+            CachedRecord *cached = cache.object(key);
+            if (cached && cached->version == version && !cached->record->isFresh()) {
+                unlockSlot(slot);
+                pinned.insert(key, cached->record);
+                return cached->record.data();
+            }
+            locker.unlock();
+
+            serialized = readRecord(slot);
+        }
+        unlockSlot(slot);
+    }
+
+    Record record(serialized.isEmpty() ? new SessionRecord() : new SessionRecord(serialized));
+
+    QMutexLocker  locker(&cacheMutex);
+    CachedRecord *cached = cache.object(key);
+    if (cached && cached->record->isFresh() && record->isFresh()) {
+        // Keep handing out the same fresh record until it is stored
+        record = cached->record;
+    } else {
+        CachedRecord *replacement = new CachedRecord;
+        replacement->record  = record;
+        replacement->version = version;
+        cache.insert(key, replacement);
+    }
+
+    pinned.insert(key, record);
+    return record.data();
+}
+
+QList<int> SharedMemorySessionStore::getSubDeviceSessions(const QString &name)
+{
+    QByteArray utf8Name = name.toUtf8();
+    QList<int> deviceIds;
+
+    for (quint32 i = 0; i < header->slotCount; i++) {
+        Slot *slot = slotAt(i);
+        lockSlot(slot);
+        if (slot->state == SlotLive && slot->deviceId != 1 && slot->nameLength == utf8Name.size()
+                && memcmp(slot->name, utf8Name.constData(), utf8Name.size()) == 0)
+        {
+            deviceIds.append(slot->deviceId);
+        }
+        unlockSlot(slot);
+    }
+
+    return deviceIds;
+}
+
+void SharedMemorySessionStore::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    QByteArray serialized = record->serialize();
+
+    Slot *slot = findSlot(remoteAddress, true);
+    try {
+        writeRecord(slot, serialized);
+    } catch (...) {
+        unlockSlot(slot);
+        throw;
+    }
+    quint64 version = slot->version;
+    unlockSlot(slot);
+
+    QMutexLocker locker(&cacheMutex);
+    AddressKey   key = AddressUtil::toKey(remoteAddress);
+    if (pinned.value(key).data() == record) {
+        record->setFresh(false);
+
+        CachedRecord *cached = cache.object(key);
+        if (cached && cached->record.data() == record) {
+            cached->version = version;
+        } else {
+            cached = new CachedRecord;
+            cached->record  = pinned.value(key);
+            cached->version = version;
+            cache.insert(key, cached);
+        }
+        pinned.remove(key);
+    } else {
+        // A caller owned record, the next load parses what was written
+        supersede(key);
+    }
+}
+
+bool SharedMemorySessionStore::containsSession(const AxolotlAddress &remoteAddress)
+{
+    Slot *slot = findSlot(remoteAddress, false);
+    if (!slot) {
+        return false;
+    }
+
+    bool live = slot->state == SlotLive;
+    unlockSlot(slot);
+    return live;
+}
+
+void SharedMemorySessionStore::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    Slot *slot = findSlot(remoteAddress, false);
+    if (slot) {
+        if (slot->state == SlotLive) {
+            dropRecord(slot);
+            slot->version++;
+        }
+        unlockSlot(slot);
+    }
+
+    QMutexLocker locker(&cacheMutex);
+    supersede(AddressUtil::toKey(remoteAddress));
+}
+
+void SharedMemorySessionStore::deleteAllSessions(const QString &name)
+{
+    deleteSession(AxolotlAddress(name, 1));
+    foreach (int deviceId, getSubDeviceSessions(name)) {
+        deleteSession(AxolotlAddress(name, deviceId));
+    }
+}
+
+SessionRecord *SharedMemorySessionStore::loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version)
+{
+    QByteArray serialized;
+    *version = 0;
+
+    Slot *slot = findSlot(remoteAddress, false);
+    if (slot) {
+        *version = slot->version;
+        if (slot->state == SlotLive) {
+            serialized = readRecord(slot);
+        }
+        unlockSlot(slot);
+    }
+
+    return serialized.isEmpty() ? new SessionRecord() : new SessionRecord(serialized);
+}
+
+bool SharedMemorySessionStore::compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion, SessionRecord *record)
+{
+    QByteArray serialized = record->serialize();
+
+    Slot *slot = findSlot(remoteAddress, true);
+    if (slot->version != expectedVersion) {
+        unlockSlot(slot);
+        return false;
+    }
+
+    try {
+        writeRecord(slot, serialized);
+    } catch (...) {
+        unlockSlot(slot);
+        throw;
+    }
+    unlockSlot(slot);
+    return true;
+}
+
+SharedMemorySessionStore::Usage SharedMemorySessionStore::getUsage()
+{
+    Usage usage;
+    usage.slots       = header->slotCount;
+    usage.liveRecords = 0;
+    usage.arenaSize   = header->arenaSize;
+    usage.arenaUsed   = header->arenaTop.load();
+    usage.arenaFree   = header->arenaFree.load();
+
+    for (quint32 i = 0; i < header->slotCount; i++) {
+        // A racy count is good enough for monitoring
+        if (slotAt(i)->state == SlotLive) {
+            usage.liveRecords++;
+        }
+    }
+
+    return usage;
+}
@@ -0,0 +1,99 @@
+#ifndef SHAREDMEMORYSESSIONSTORE_H
+#define SHAREDMEMORYSESSIONSTORE_H
+
+#include <QSharedMemory>
+#include <QSharedPointer>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+
+#include <atomic>
+
+#include "../sessionstore.h"
+#include "../versionedsessionstore.h"
+#include "../../util/addresskey.h"
+
+// SessionStore shared by the processes of one host through a QSharedMemory
+// segment: an open addressing table of fixed-size slots, each guarded by
+// its own spinlock, in front of an arena holding the serialized records.
+// Every worker constructs its own instance with the same key after forking.
+//
+// A slot stays bound to its address once claimed, deleting a session only
+// drops the record, so probe chains never break. Arena blocks come in
+// power of two sizes: a record that outgrows its block moves to a bigger
+// one and the old block, like that of a deleted record, goes on a free
+// list for its size. A lock held by a process that died is taken over,
+// and a record it was halfway through writing is dropped.
+//
+// Parsed records are cached per process, up to maxCachedRecords, and
+// reparsed when another process stored a newer version. A record handed
+// out by loadSession() is pinned until it is stored back; when a reparse,
+// a foreign store or a delete replaces it first, it is kept alive until
+// the next loadSession() for its address. Compare-and-swap on the slot
+// version makes this a VersionedSessionStore too.
+class SharedMemorySessionStore : public SessionStore, public VersionedSessionStore
+{
+public:
+    static const int MAX_NAME_LENGTH = 80;
+
+    struct Usage {
+        int    slots;
+        int    liveRecords;
+        qint64 arenaSize;
+        qint64 arenaUsed;
+        qint64 arenaFree;
+    };
+
+    SharedMemorySessionStore(const QString &key, int slotCount = 65536, qint64 arenaSize = 256 * 1024 * 1024,
+                             int maxCachedRecords = 100000);
+    ~SharedMemorySessionStore();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    SessionRecord *loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version);
+    bool compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion, SessionRecord *record);
+
+    Usage getUsage();
+
+private:
+    SharedMemorySessionStore(const SharedMemorySessionStore &);
+    SharedMemorySessionStore &operator=(const SharedMemorySessionStore &);
+
+    struct Slot;
+    struct SegmentHeader;
+
+    typedef QSharedPointer<SessionRecord> Record;
+
+    struct CachedRecord {
+        Record   record;
+        quint64  version = 0;
+    };
+
+    Slot *findSlot(const AxolotlAddress &remoteAddress, bool create);
+    Slot *slotAt(quint32 index) const;
+    void acquire(std::atomic<qint32> &owner);
+    void lockSlot(Slot *slot);
+    void unlockSlot(Slot *slot);
+    quint64 allocateBlock(int sizeClass, quint64 *capacity);
+    void releaseBlock(quint64 offset, quint64 capacity);
+    void writeRecord(Slot *slot, const QByteArray &serialized);
+    QByteArray readRecord(Slot *slot) const;
+    void dropRecord(Slot *slot);
+    void supersede(const AddressKey &key);
+
+    QSharedMemory                              sharedMemory;
+    char                                      *base;
+    SegmentHeader                             *header;
+    qint32                                     pid;
+    QMutex                                     cacheMutex;
+    QCache<AddressKey, CachedRecord>           cache;
+    QHash<AddressKey, Record>                  pinned;
+    QHash<AddressKey, Record>                  superseded;
+};
+
+#endif // SHAREDMEMORYSESSIONSTORE_H
@@ -0,0 +1,62 @@
+#ifndef RECORDDIAGNOSTICS_H
+#define RECORDDIAGNOSTICS_H
+
+#include <QList>
+#include <QString>
+
+// Size and skipped-key breakdowns of stored records, for finding
+// pathological sessions. Byte counts are protobuf encoded sizes of each
+// component. Records do not timestamp skipped keys, so their age is given
+// as a counter distance: how many messages the chain has advanced past the
+// oldest key still kept.
+
+struct ChainDiagnostics
+{
+    quint32 index                 = 0;
+    int     skippedKeys           = 0;
+    int     bytes                 = 0;
+    quint32 oldestSkippedDistance = 0;
+};
+
+struct SessionStateDiagnostics
+{
+    int                     sessionVersion        = 0;
+    int                     totalBytes            = 0;
+    int                     headerBytes           = 0;
+    int                     senderChainBytes      = 0;
+    int                     receiverChainBytes    = 0;
+    int                     pendingBytes          = 0;
+    int                     skippedKeys           = 0;
+    quint32                 oldestSkippedDistance = 0;
+    QList<ChainDiagnostics> receiverChains;
+};
+
+struct SessionRecordDiagnostics
+{
+    int                     serializedBytes       = 0;
+    SessionStateDiagnostics currentState;
+    int                     archivedStates        = 0;
+    int                     archivedBytes         = 0;
+    int                     archivedSkippedKeys   = 0;
+    int                     skippedKeys           = 0;
+    quint32                 oldestSkippedDistance = 0;
+};
+
+struct SenderKeyStateDiagnostics
+{
+    quint32 keyId                 = 0;
+    quint32 iteration             = 0;
+    int     bytes                 = 0;
+    int     skippedKeys           = 0;
+    quint32 oldestSkippedDistance = 0;
+};
+
+struct SenderKeyRecordDiagnostics
+{
+    int                              serializedBytes       = 0;
+    int                              skippedKeys           = 0;
+    quint32                          oldestSkippedDistance = 0;
+    QList<SenderKeyStateDiagnostics> states;
+};
+
+#endif // RECORDDIAGNOSTICS_H
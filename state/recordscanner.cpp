@@ -0,0 +1,159 @@
+#include "recordscanner.h"
+
+#include <QTextStream>
+
+static const int SIZE_BUCKETS = 16;
+
+RecordScanner::RecordScanner(int keepLargest)
+{
+    this->keepLargest = qMax(0, keepLargest);
+}
+
+RecordScanReport RecordScanner::scanSessions(SessionStore *store, const QList<AxolotlAddress> &addresses)
+{
+    RecordScanReport report;
+
+    foreach (const AxolotlAddress &address, addresses) {
+        if (!store->containsSession(address)) {
+            report.missing++;
+            continue;
+        }
+
+        SessionRecordDiagnostics diagnostics = store->loadSession(address)->getDiagnostics();
+
+        ScannedRecord record;
+        record.name                  = QString("%1.%2").arg(address.getName()).arg(address.getDeviceId());
+        record.serializedBytes       = diagnostics.serializedBytes;
+        record.states                = 1 + diagnostics.archivedStates;
+        record.receiverChains        = diagnostics.currentState.receiverChains.size();
+        record.skippedKeys           = diagnostics.skippedKeys;
+        record.oldestSkippedDistance = diagnostics.oldestSkippedDistance;
+
+        report.archivedBytes += diagnostics.archivedBytes;
+        add(report, record);
+    }
+
+    return report;
+}
+
+RecordScanReport RecordScanner::scanSessions(SessionStore *store, const QStringList &names)
+{
+    QList<AxolotlAddress> addresses;
+
+    foreach (const QString &name, names) {
+        // getSubDeviceSessions() leaves out the primary device
+        addresses.append(AxolotlAddress(name, 1));
+        foreach (int deviceId, store->getSubDeviceSessions(name)) {
+            if (deviceId != 1) {
+                addresses.append(AxolotlAddress(name, deviceId));
+            }
+        }
+    }
+
+    return scanSessions(store, addresses);
+}
+
+RecordScanReport RecordScanner::scanSenderKeys(SenderKeyStore *store, const QList<SenderKeyName> &senderKeyNames)
+{
+    RecordScanReport report;
+
+    foreach (const SenderKeyName &senderKeyName, senderKeyNames) {
+        SenderKeyRecord senderKeyRecord = store->loadSenderKey(senderKeyName);
+        if (senderKeyRecord.isEmpty()) {
+            report.missing++;
+            continue;
+        }
+
+        SenderKeyRecordDiagnostics diagnostics = senderKeyRecord.getDiagnostics();
+
+        ScannedRecord record;
+        record.name                  = senderKeyName.serialize();
+        record.serializedBytes       = diagnostics.serializedBytes;
+        record.states                = diagnostics.states.size();
+        record.skippedKeys           = diagnostics.skippedKeys;
+        record.oldestSkippedDistance = diagnostics.oldestSkippedDistance;
+
+        foreach (const SenderKeyStateDiagnostics &state, diagnostics.states.mid(1)) {
+            report.archivedBytes += state.bytes;
+        }
+        add(report, record);
+    }
+
+    return report;
+}
+
+void RecordScanner::add(RecordScanReport &report, const ScannedRecord &record)
+{
+    report.scanned++;
+    report.totalBytes         += record.serializedBytes;
+    report.skippedKeys        += record.skippedKeys;
+    report.maxBytes            = qMax(report.maxBytes, record.serializedBytes);
+    report.maxSkippedKeys      = qMax(report.maxSkippedKeys, record.skippedKeys);
+    report.maxSkippedDistance  = qMax(report.maxSkippedDistance, record.oldestSkippedDistance);
+
+    if (report.sizeBuckets.isEmpty()) {
+        for (int i = 0; i < SIZE_BUCKETS; i++) {
+            report.sizeBuckets.append(0);
+        }
+    }
+
+    int bucket = 0;
+    while (bucket < SIZE_BUCKETS - 1 && record.serializedBytes >= (256 << bucket)) {
+        bucket++;
+    }
+    report.sizeBuckets[bucket]++;
+
+    if (keepLargest == 0) {
+        return;
+    }
+
+    if (report.largest.size() == keepLargest
+            && report.largest.last().serializedBytes >= record.serializedBytes)
+    {
+        return;
+    }
+
+    int position = report.largest.size();
+    while (position > 0 && report.largest.at(position - 1).serializedBytes < record.serializedBytes) {
+        position--;
+    }
+    report.largest.insert(position, record);
+
+    if (report.largest.size() > keepLargest) {
+        report.largest.removeLast();
+    }
+}
+
+QString RecordScanner::format(const RecordScanReport &report)
+{
+    QString     text;
+    QTextStream out(&text);
+
+    out << QString("%1 records, %2 missing, %3 bytes total, %4 archived, %5 skipped keys")
+           .arg(report.scanned).arg(report.missing).arg(report.totalBytes)
+           .arg(report.archivedBytes).arg(report.skippedKeys)
+        << endl;
+    out << QString("largest %1 bytes, most skipped keys %2, oldest skipped key %3 messages behind")
+           .arg(report.maxBytes).arg(report.maxSkippedKeys).arg(report.maxSkippedDistance)
+        << endl;
+
+    for (int i = 0; i < report.sizeBuckets.size(); i++) {
+        if (report.sizeBuckets.at(i) == 0) {
+            continue;
+        }
+        if (i == report.sizeBuckets.size() - 1) {
+            out << QString(" >= %1 bytes: %2").arg(256 << (i - 1), 8).arg(report.sizeBuckets.at(i)) << endl;
+        } else {
+            out << QString("  < %1 bytes: %2").arg(256 << i, 8).arg(report.sizeBuckets.at(i)) << endl;
+        }
+    }
+
+    foreach (const ScannedRecord &record, report.largest) {
+        out << QString("  %1  %2 bytes  %3 states  %4 receiver chains  %5 skipped keys  oldest %6 behind")
+               .arg(record.name).arg(record.serializedBytes).arg(record.states)
+               .arg(record.receiverChains).arg(record.skippedKeys).arg(record.oldestSkippedDistance)
+            << endl;
+    }
+
+    return text;
+}
@@ -0,0 +1,59 @@
+#ifndef RECORDSCANNER_H
+#define RECORDSCANNER_H
+
+#include <QStringList>
+#include <QList>
+
+#include "sessionstore.h"
+#include "recorddiagnostics.h"
+#include "../axolotladdress.h"
+#include "../groups/state/senderkeystore.h"
+#include "../groups/senderkeyname.h"
+
+struct ScannedRecord
+{
+    QString name;
+    int     serializedBytes       = 0;
+    int     states                = 0;
+    int     receiverChains        = 0;
+    int     skippedKeys           = 0;
+    quint32 oldestSkippedDistance = 0;
+};
+
+struct RecordScanReport
+{
+    int                  scanned               = 0;
+    int                  missing               = 0;
+    qint64               totalBytes            = 0;
+    qint64               archivedBytes         = 0;
+    qint64               skippedKeys           = 0;
+    int                  maxBytes              = 0;
+    int                  maxSkippedKeys        = 0;
+    quint32              maxSkippedDistance    = 0;
+    // Record sizes in powers of two, bucket i holds < 2^(i+8) bytes, the last one the rest
+    QList<int>           sizeBuckets;
+    // The heaviest records, largest first
+    QList<ScannedRecord> largest;
+};
+
+// Aggregates SessionRecord and SenderKeyRecord diagnostics over a store.
+// Stores cannot enumerate themselves, so callers pass the addresses, names
+// or sender key names to look at.
+class RecordScanner
+{
+public:
+    RecordScanner(int keepLargest = 20);
+
+    RecordScanReport scanSessions(SessionStore *store, const QList<AxolotlAddress> &addresses);
+    RecordScanReport scanSessions(SessionStore *store, const QStringList &names);
+    RecordScanReport scanSenderKeys(SenderKeyStore *store, const QList<SenderKeyName> &senderKeyNames);
+
+    static QString format(const RecordScanReport &report);
+
+private:
+    void add(RecordScanReport &report, const ScannedRecord &record);
+
+    int keepLargest;
+};
+
+#endif // RECORDSCANNER_H
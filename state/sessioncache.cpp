@@ -0,0 +1,293 @@
+#include "sessioncache.h"
+
+#include <QMutexLocker>
+
+SessionCache::SessionCache(QSharedPointer<SessionStore> backingStore, int maxEntries)
+{
+    this->backingStore = backingStore;
+    this->capacity     = maxEntries;
+
+    for (int i = 0; i < CACHE_STRIPES; i++) {
+        stripes[i].records.setMaxCost(qMax(64, maxEntries / CACHE_STRIPES));
+    }
+}
+
+SessionCache::~SessionCache()
+{
+    clear();
+}
+
+SessionRecord *SessionCache::loadSession(const AxolotlAddress &remoteAddress)
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        stripe.superseded.remove(key);
+
+        Record record = lookup(stripe, key, true);
+        if (record) {
+            stripe.pinned.insert(key, record);
+            return record.data();
+        }
+    }
+
+    // Misses and unverified snapshot entries both take the backing store's record
+    Record loaded(loadFromBackingStore(remoteAddress));
+
+    QMutexLocker locker(&stripe.mutex);
+    Record record = lookup(stripe, key, true);
+    if (!record) {
+        record = loaded;
+        stripe.records.insert(key, new Entry { record, true });
+    }
+
+    stripe.pinned.insert(key, record);
+    return record.data();
+}
+
+QList<int> SessionCache::getSubDeviceSessions(const QString &name)
+{
+    return backingStore->getSubDeviceSessions(name);
+}
+
+void SessionCache::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    backingStore->storeSession(remoteAddress, record);
+
+    QMutexLocker locker(&stripe.mutex);
+    stripe.generation++;
+
+    Record current = lookup(stripe, key);
+    if (current.data() == record) {
+        record->setFresh(false);
+        stripe.pinned.remove(key);
+        if (!stripe.records.contains(key)) {
+            stripe.records.insert(key, new Entry { current, true });
+        }
+        return;
+    }
+
+    // Never adopt a caller owned record, keep a private copy instead
+    Record copy(new SessionRecord(record->serialize()));
+    supersede(stripe, key);
+    stripe.records.insert(key, new Entry { copy, true });
+}
+
+bool SessionCache::containsSession(const AxolotlAddress &remoteAddress)
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        Record record = lookup(stripe, key, true);
+        if (record) {
+            return !record->isFresh();
+        }
+    }
+
+    return backingStore->containsSession(remoteAddress);
+}
+
+void SessionCache::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        supersede(stripe, key);
+    }
+
+    backingStore->deleteSession(remoteAddress);
+
+    // Drop anything a prefetch read from the backing store before the delete
+    QMutexLocker locker(&stripe.mutex);
+    stripe.generation++;
+    supersede(stripe, key);
+}
+
+void SessionCache::deleteAllSessions(const QString &name)
+{
+    Stripe &stripe = stripes[AddressUtil::stripe(name, CACHE_STRIPES)];
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        QList<AddressKey> keys = stripe.records.keys() + stripe.pinned.keys();
+        foreach (const AddressKey &key, keys) {
+            if (key.first == name) {
+                supersede(stripe, key);
+            }
+        }
+    }
+
+    backingStore->deleteAllSessions(name);
+
+    QMutexLocker locker(&stripe.mutex);
+    stripe.generation++;
+    foreach (const AddressKey &key, stripe.records.keys()) {
+        if (key.first == name) {
+            supersede(stripe, key);
+        }
+    }
+}
+
+bool SessionCache::prefetch(const AxolotlAddress &remoteAddress)
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+    quint64    loadedAt;
+
+    {
+        QMutexLocker locker(&stripe.mutex);
+        if (lookup(stripe, key, true)) {
+            return false;
+        }
+        loadedAt = stripe.generation;
+    }
+
+    SessionRecord *loaded = loadFromBackingStore(remoteAddress);
+
+    // A store since the load may already have been evicted again, the loaded
+    // record could then be older than the backing store's
+    QMutexLocker locker(&stripe.mutex);
+    if (stripe.generation != loadedAt || lookup(stripe, key, true)) {
+        delete loaded;
+        return false;
+    }
+
+    return stripe.records.insert(key, new Entry { Record(loaded), true });
+}
+
+bool SessionCache::cacheRecord(const AxolotlAddress &remoteAddress, SessionRecord *record, bool verified)
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    // A verified record may replace an unverified one, nothing else is replaced
+    QMutexLocker locker(&stripe.mutex);
+    if (lookup(stripe, key, verified)) {
+        delete record;
+        return false;
+    }
+
+    return stripe.records.insert(key, new Entry { Record(record), verified });
+}
+
+bool SessionCache::isCached(const AxolotlAddress &remoteAddress) const
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    QMutexLocker locker(&stripe.mutex);
+    return !lookup(stripe, key, true).isNull();
+}
+
+// Only drops the cache's reference, a checked out record stays pinned
+void SessionCache::evict(const AxolotlAddress &remoteAddress)
+{
+    Stripe &stripe = stripeFor(remoteAddress);
+
+    QMutexLocker locker(&stripe.mutex);
+    stripe.records.remove(AddressUtil::toKey(remoteAddress));
+}
+
+QList<AxolotlAddress> SessionCache::getCachedAddresses() const
+{
+    QList<AxolotlAddress> addresses;
+    for (int i = 0; i < CACHE_STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        foreach (const AddressKey &key, stripes[i].records.keys()) {
+            addresses.append(AddressUtil::toAddress(key));
+        }
+    }
+    return addresses;
+}
+
+QByteArray SessionCache::serializeCached(const AxolotlAddress &remoteAddress) const
+{
+    AddressKey key    = AddressUtil::toKey(remoteAddress);
+    Stripe    &stripe = stripeFor(remoteAddress);
+
+    // A pinned record may be mid update on another thread, the backing store has its last stored state
+    QMutexLocker locker(&stripe.mutex);
+    if (stripe.pinned.contains(key)) {
+        return QByteArray();
+    }
+
+    Entry *entry = stripe.records.object(key);
+    return (entry && !entry->record->isFresh()) ? entry->record->serialize() : QByteArray();
+}
+
+int SessionCache::size() const
+{
+    int count = 0;
+    for (int i = 0; i < CACHE_STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        count += stripes[i].records.size();
+    }
+    return count;
+}
+
+int SessionCache::maxEntries() const
+{
+    return capacity;
+}
+
+// Checked out records stay pinned until they are stored back
+void SessionCache::clear()
+{
+    for (int i = 0; i < CACHE_STRIPES; i++) {
+        QMutexLocker locker(&stripes[i].mutex);
+        stripes[i].records.clear();
+    }
+}
+
+QSharedPointer<SessionStore> SessionCache::getBackingStore() const
+{
+    return backingStore;
+}
+
+SessionCache::Stripe &SessionCache::stripeFor(const AxolotlAddress &remoteAddress) const
+{
+    return stripes[AddressUtil::stripe(remoteAddress.getName(), CACHE_STRIPES)];
+}
+
+SessionRecord *SessionCache::loadFromBackingStore(const AxolotlAddress &remoteAddress)
+{
+    SessionRecord *record = backingStore->loadSession(remoteAddress);
+
+    if (record->isFresh()) {
+        return new SessionRecord();
+    }
+
+    // The backing store keeps ownership of what it returns, parse a private copy
+    return new SessionRecord(record->serialize());
+}
+
+// The current record for key, a checked out one wins over the cached one
+SessionCache::Record SessionCache::lookup(Stripe &stripe, const AddressKey &key, bool verifiedOnly)
+{
+    Record record = stripe.pinned.value(key);
+    if (record) {
+        return record;
+    }
+
+    Entry *entry = stripe.records.object(key);
+    return entry && (entry->verified || !verifiedOnly) ? entry->record : Record();
+}
+
+// Drops key's current record, keeping a checked out one alive for its holder
+void SessionCache::supersede(Stripe &stripe, const AddressKey &key)
+{
+    Record pinned = stripe.pinned.take(key);
+    if (pinned) {
+        stripe.superseded.insert(key, pinned);
+    }
+    stripe.records.remove(key);
+}
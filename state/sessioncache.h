@@ -0,0 +1,75 @@
+#ifndef SESSIONCACHE_H
+#define SESSIONCACHE_H
+
+#include <QSharedPointer>
+#include <QMutex>
+#include <QCache>
+#include <QHash>
+#include <QList>
+
+#include "sessionstore.h"
+#include "../util/addresskey.h"
+
+// Write-through LRU cache of parsed SessionRecords in front of another
+// SessionStore. A record handed out by loadSession() is pinned until it is
+// stored back, eviction only drops records nobody has checked out. When a
+// pinned record is replaced (a foreign storeSession(), a delete) it is kept
+// alive until the next loadSession() for its address, relying on the usual
+// rule that operations on one address don't overlap. The backing store
+// must not keep the record pointer passed to storeSession().
+class SessionCache : public SessionStore
+{
+public:
+    static const int CACHE_STRIPES = 16;
+
+    SessionCache(QSharedPointer<SessionStore> backingStore, int maxEntries = 100000);
+    virtual ~SessionCache();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    bool prefetch(const AxolotlAddress &remoteAddress);
+    bool cacheRecord(const AxolotlAddress &remoteAddress, SessionRecord *record, bool verified = true);
+    bool isCached(const AxolotlAddress &remoteAddress) const;
+    void evict(const AxolotlAddress &remoteAddress);
+    QList<AxolotlAddress> getCachedAddresses() const;
+    QByteArray serializeCached(const AxolotlAddress &remoteAddress) const;
+    int size() const;
+    int maxEntries() const;
+    void clear();
+    QSharedPointer<SessionStore> getBackingStore() const;
+
+private:
+    typedef QSharedPointer<SessionRecord> Record;
+
+    // Unverified entries come from a snapshot and are checked against the
+    // backing store on first load
+    struct Entry {
+        Record record;
+        bool   verified;
+    };
+
+    // generation counts writes, a prefetch that raced one is dropped
+    struct Stripe {
+        QMutex                       mutex;
+        QCache<AddressKey, Entry>    records;
+        QHash<AddressKey, Record>    pinned;
+        QHash<AddressKey, Record>    superseded;
+        quint64                      generation = 0;
+    };
+
+    Stripe &stripeFor(const AxolotlAddress &remoteAddress) const;
+    SessionRecord *loadFromBackingStore(const AxolotlAddress &remoteAddress);
+    static Record lookup(Stripe &stripe, const AddressKey &key, bool verifiedOnly = false);
+    static void supersede(Stripe &stripe, const AddressKey &key);
+
+    QSharedPointer<SessionStore> backingStore;
+    int                          capacity;
+    mutable Stripe               stripes[CACHE_STRIPES];
+};
+
+#endif // SESSIONCACHE_H
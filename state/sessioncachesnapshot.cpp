@@ -0,0 +1,138 @@
+#include "sessioncachesnapshot.h"
+
+#include "../concurrent/functionrunnable.h"
+#include "../whisperexception.h"
+
+#include <QSaveFile>
+#include <QFile>
+#include <QDataStream>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QDebug>
+
+struct SnapshotEntry {
+    QString    name;
+    qint32     deviceId;
+    QByteArray serialized;
+};
+
+int SessionCacheSnapshot::save(QSharedPointer<SessionCache> cache, const QString &path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write session snapshot" << path << file.errorString();
+        return -1;
+    }
+    file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+
+    QList<AxolotlAddress> addresses = cache->getCachedAddresses();
+    QList<SnapshotEntry>  entries;
+
+    foreach (const AxolotlAddress &address, addresses) {
+        SnapshotEntry entry;
+        entry.name       = address.getName();
+        entry.deviceId   = address.getDeviceId();
+        entry.serialized = cache->serializeCached(address);
+        if (!entry.serialized.isEmpty()) {
+            entries.append(entry);
+        }
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << MAGIC << VERSION << (quint32)entries.size();
+
+    foreach (const SnapshotEntry &entry, entries) {
+        stream << entry.name << entry.deviceId << entry.serialized;
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Can't write session snapshot" << path << file.errorString();
+        return -1;
+    }
+
+    return entries.size();
+}
+
+SessionCacheSnapshot::RestoreResult SessionCacheSnapshot::restore(QSharedPointer<SessionCache> cache, const QString &path, Validation validation, int threads)
+{
+    RestoreResult result;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return result;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version, count;
+    stream >> magic >> version >> count;
+
+    if (stream.status() != QDataStream::Ok || magic != MAGIC || version != VERSION) {
+        qWarning() << "Ignoring incompatible session snapshot" << path;
+        return result;
+    }
+
+    QList<SnapshotEntry> entries;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        SnapshotEntry entry;
+        stream >> entry.name >> entry.deviceId >> entry.serialized;
+        if (stream.status() == QDataStream::Ok) {
+            entries.append(entry);
+        }
+    }
+
+    result.entries = entries.size();
+
+    // Leave room in the cache for live traffic
+    int limit = qMin(entries.size(), cache->maxEntries() / 2);
+
+    QAtomicInt  restored, reloaded, dropped;
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, threads));
+
+    int chunk = qMax(1, limit / (pool.maxThreadCount() * 4));
+    for (int start = 0; start < limit; start += chunk) {
+        int end = qMin(limit, start + chunk);
+        FunctionRunnable::start(&pool, [&, start, end]() {
+            QSharedPointer<SessionStore> backingStore = cache->getBackingStore();
+
+            for (int i = start; i < end; i++) {
+                const SnapshotEntry &entry = entries.at(i);
+                AxolotlAddress address(entry.name, entry.deviceId);
+
+                try {
+                    if (validation != VerifyAgainstStore) {
+                        cache->cacheRecord(address, new SessionRecord(entry.serialized),
+                                           validation == TrustSnapshot);
+                        restored.fetchAndAddRelaxed(1);
+                        continue;
+                    }
+
+                    SessionRecord *stored = backingStore->loadSession(address);
+                    if (stored->isFresh()) {
+                        dropped.fetchAndAddRelaxed(1);
+                        continue;
+                    }
+
+                    QByteArray current = stored->serialize();
+                    cache->cacheRecord(address, new SessionRecord(current));
+
+                    if (current == entry.serialized) restored.fetchAndAddRelaxed(1);
+                    else                             reloaded.fetchAndAddRelaxed(1);
+                } catch (const WhisperException &e) {
+                    qWarning() << "Dropping snapshot entry:" << e.errorType() << e.errorMessage();
+                    dropped.fetchAndAddRelaxed(1);
+                }
+            }
+        });
+    }
+
+    pool.waitForDone();
+
+    result.restored = restored.load();
+    result.reloaded = reloaded.load();
+    result.dropped  = dropped.load() + (entries.size() - limit);
+    return result;
+}
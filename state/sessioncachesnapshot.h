@@ -0,0 +1,48 @@
+#ifndef SESSIONCACHESNAPSHOT_H
+#define SESSIONCACHESNAPSHOT_H
+
+#include <QSharedPointer>
+#include <QString>
+
+#include "sessioncache.h"
+
+// Dumps the resident part of a SessionCache on shutdown and warms a new
+// cache from it on startup. Take the snapshot once cipher traffic has
+// stopped, otherwise records can change while they are written. The file
+// holds session keys and is only readable by its owner.
+class SessionCacheSnapshot
+{
+public:
+    enum Validation {
+        // Insert snapshot records without touching the backing store. The
+        // SessionStore interface has no cheap version check, so the first
+        // load of each entry still reads the full record from the store:
+        // this only shortens the restore itself, not the first loads.
+        VerifyOnFirstUse,
+        // Compare every entry with the backing store up front and load the
+        // store's version where they differ. Restored entries are served
+        // without another trip to the store.
+        VerifyAgainstStore,
+        // Insert snapshot records as they are. Only safe if nothing else
+        // wrote to the backing store after the snapshot was taken.
+        TrustSnapshot
+    };
+
+    struct RestoreResult {
+        RestoreResult() : entries(0), restored(0), reloaded(0), dropped(0) {}
+
+        int entries;
+        int restored;
+        int reloaded;
+        int dropped;
+    };
+
+    static const quint32 MAGIC   = 0x41584353;
+    static const quint32 VERSION = 1;
+
+    static int save(QSharedPointer<SessionCache> cache, const QString &path);
+    static RestoreResult restore(QSharedPointer<SessionCache> cache, const QString &path,
+                                 Validation validation = VerifyAgainstStore, int threads = 4);
+};
+
+#endif // SESSIONCACHESNAPSHOT_H
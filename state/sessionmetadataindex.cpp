@@ -0,0 +1,300 @@
+#include "sessionmetadataindex.h"
+
+#include <QMutexLocker>
+
+SessionMetadataIndex::SessionMetadataIndex(int buckets)
+{
+    int size = WRITE_STRIPES;
+    while (size < buckets) {
+        size <<= 1;
+    }
+
+    table.store(createTable(size));
+
+    // Zero marks an idle reader slot
+    globalEpoch.store(1);
+}
+
+SessionMetadataIndex::~SessionMetadataIndex()
+{
+    freeTable(table.load());
+    foreach (const Retired &entry, retired) {
+        freeChain(entry.chain);
+        freeTable(entry.table);
+    }
+}
+
+bool SessionMetadataIndex::lookup(const AxolotlAddress &remoteAddress, SessionMetadata *metadata) const
+{
+    AddressKey key  = AddressUtil::toKey(remoteAddress);
+    uint       hash = qHash(key);
+    int        slot = readerSlot();
+
+    if (slot < 0) {
+        // grow() takes every stripe, so the table stays put while this one is held
+        QMutexLocker locker(&writeMutexes[stripeFor(hash)]);
+        Table *current = table.loadAcquire();
+        for (Node *node = current->buckets[hash & current->mask].loadAcquire(); node; node = node->next) {
+            if (node->key == key) {
+                *metadata = node->metadata;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The full barrier orders the slot store before the table load, see reclaim()
+    readers[slot].epoch.fetchAndStoreOrdered(globalEpoch.loadAcquire());
+
+    Table *current = table.loadAcquire();
+    bool   found   = false;
+    for (Node *node = current->buckets[hash & current->mask].loadAcquire(); node; node = node->next) {
+        if (node->key == key) {
+            *metadata = node->metadata;
+            found     = true;
+            break;
+        }
+    }
+
+    readers[slot].epoch.storeRelease(0);
+    return found;
+}
+
+void SessionMetadataIndex::publish(const AxolotlAddress &remoteAddress, const SessionMetadata &metadata)
+{
+    replace(AddressUtil::toKey(remoteAddress), &metadata);
+}
+
+void SessionMetadataIndex::remove(const AxolotlAddress &remoteAddress)
+{
+    replace(AddressUtil::toKey(remoteAddress), 0);
+}
+
+SessionMetadata SessionMetadataIndex::describe(SessionRecord *record)
+{
+    SessionState   *state = record->getSessionState();
+    SessionMetadata metadata;
+
+    metadata.sessionVersion       = state->getSessionVersion();
+    metadata.remoteRegistrationId = state->getRemoteRegistrationId();
+    metadata.localRegistrationId  = state->getLocalRegistrationId();
+    if (state->hasRemoteIdentityKey()) {
+        metadata.remoteIdentityKey = state->getRemoteIdentityKey().serialize();
+    }
+
+    return metadata;
+}
+
+SessionMetadataIndex::Table *SessionMetadataIndex::createTable(int size)
+{
+    Table *created   = new Table;
+    created->mask    = size - 1;
+    created->buckets = new QAtomicPointer<Node>[size];
+    return created;
+}
+
+void SessionMetadataIndex::freeTable(Table *freed)
+{
+    if (!freed) {
+        return;
+    }
+    for (uint i = 0; i <= freed->mask; i++) {
+        freeChain(freed->buckets[i].load());
+    }
+    delete[] freed->buckets;
+    delete freed;
+}
+
+// Tables are a power of two no smaller than WRITE_STRIPES, so equal
+// buckets imply equal stripes whatever the table size
+uint SessionMetadataIndex::stripeFor(uint hash)
+{
+    return hash & (WRITE_STRIPES - 1);
+}
+
+int SessionMetadataIndex::readerSlot() const
+{
+    if (!threadReader.hasLocalData()) {
+        ReaderLease *lease = new ReaderLease;
+        lease->index = this;
+        lease->slot  = claimReaderSlot();
+        threadReader.setLocalData(lease);
+    }
+    return threadReader.localData()->slot;
+}
+
+int SessionMetadataIndex::claimReaderSlot() const
+{
+    QMutexLocker locker(&readerMutex);
+    if (!freeReaders.isEmpty()) {
+        return freeReaders.takeLast();
+    }
+    if (nextReader.loadAcquire() < MAX_READERS) {
+        return nextReader.fetchAndAddOrdered(1);
+    }
+    return -1;
+}
+
+// A released slot is idle (epoch 0), reclaim() can keep scanning it
+void SessionMetadataIndex::releaseReaderSlot(int slot) const
+{
+    QMutexLocker locker(&readerMutex);
+    freeReaders.append(slot);
+}
+
+SessionMetadataIndex::ReaderLease::~ReaderLease()
+{
+    if (slot >= 0) {
+        index->releaseReaderSlot(slot);
+    }
+}
+
+void SessionMetadataIndex::replace(const AddressKey &key, const SessionMetadata *metadata)
+{
+    uint  hash = qHash(key);
+    Node *head = 0;
+    bool  full = false;
+
+    {
+        QMutexLocker locker(&writeMutexes[stripeFor(hash)]);
+        Table                *current = table.loadAcquire();
+        QAtomicPointer<Node> &bucket  = current->buckets[hash & current->mask];
+        head = bucket.loadAcquire();
+
+        Node *existing = 0;
+        for (Node *node = head; node && !existing; node = node->next) {
+            if (node->key == key) {
+                existing = node;
+            }
+        }
+        if (!existing && !metadata) {
+            return;
+        }
+        // Most writes only advance the ratchet, leaving nothing to publish
+        if (existing && metadata && sameMetadata(existing->metadata, *metadata)) {
+            return;
+        }
+
+        // Readers may be walking the old chain, so it is copied rather than edited
+        Node  *chain = 0;
+        Node **tail  = &chain;
+        if (metadata) {
+            chain = new Node { key, *metadata, 0 };
+            tail  = &chain->next;
+        }
+        for (Node *node = head; node; node = node->next) {
+            if (node->key != key) {
+                *tail = new Node { node->key, node->metadata, 0 };
+                tail  = &(*tail)->next;
+            }
+        }
+
+        bucket.fetchAndStoreOrdered(chain);
+
+        if (!existing) {
+            full = entries.fetchAndAddOrdered(1) + 1 > LOAD_FACTOR * int(current->mask + 1);
+        } else if (!metadata) {
+            entries.fetchAndAddOrdered(-1);
+        }
+    }
+
+    retire(head, 0);
+
+    if (full) {
+        grow();
+    }
+}
+
+void SessionMetadataIndex::grow()
+{
+    // In stripe order; writers only ever hold one
+    for (int i = 0; i < WRITE_STRIPES; i++) {
+        writeMutexes[i].lock();
+    }
+
+    Table *current = table.loadAcquire();
+    uint   size    = current->mask + 1;
+
+    if (entries.loadAcquire() > LOAD_FACTOR * int(size)) {
+        Table *grown = createTable(size * 2);
+        for (uint i = 0; i < size; i++) {
+            for (Node *node = current->buckets[i].loadAcquire(); node; node = node->next) {
+                QAtomicPointer<Node> &bucket = grown->buckets[qHash(node->key) & grown->mask];
+                bucket.store(new Node { node->key, node->metadata, bucket.load() });
+            }
+        }
+        table.fetchAndStoreOrdered(grown);
+    } else {
+        current = 0;
+    }
+
+    for (int i = WRITE_STRIPES - 1; i >= 0; i--) {
+        writeMutexes[i].unlock();
+    }
+
+    // Readers that entered before the swap may still be walking the old table
+    retire(0, current);
+}
+
+void SessionMetadataIndex::retire(Node *chain, Table *replaced)
+{
+    if (!chain && !replaced) {
+        return;
+    }
+
+    QMutexLocker locker(&retireMutex);
+
+    Retired entry;
+    entry.chain = chain;
+    entry.table = replaced;
+    entry.epoch = globalEpoch.loadAcquire();
+    retired.append(entry);
+
+    if (retired.size() >= RECLAIM_BATCH) {
+        reclaim();
+    }
+}
+
+void SessionMetadataIndex::reclaim()
+{
+    // A reader that could still see a retired chain entered at or before
+    // the epoch it was retired in; later readers only find its replacement
+    globalEpoch.fetchAndAddOrdered(1);
+
+    quint64 oldest = Q_UINT64_C(0xFFFFFFFFFFFFFFFF);
+    int     slots  = qMin(nextReader.loadAcquire(), MAX_READERS);
+    for (int i = 0; i < slots; i++) {
+        quint64 epoch = readers[i].epoch.loadAcquire();
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    QList<Retired>::iterator it = retired.begin();
+    while (it != retired.end()) {
+        if (it->epoch < oldest) {
+            freeChain(it->chain);
+            freeTable(it->table);
+            it = retired.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool SessionMetadataIndex::sameMetadata(const SessionMetadata &a, const SessionMetadata &b)
+{
+    return a.sessionVersion       == b.sessionVersion &&
+           a.remoteRegistrationId == b.remoteRegistrationId &&
+           a.localRegistrationId  == b.localRegistrationId &&
+           a.remoteIdentityKey    == b.remoteIdentityKey;
+}
+
+void SessionMetadataIndex::freeChain(Node *chain)
+{
+    while (chain) {
+        Node *next = chain->next;
+        delete chain;
+        chain = next;
+    }
+}
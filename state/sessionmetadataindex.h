@@ -0,0 +1,110 @@
+#ifndef SESSIONMETADATAINDEX_H
+#define SESSIONMETADATAINDEX_H
+
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QThreadStorage>
+#include <QVector>
+#include <QMutex>
+#include <QList>
+
+#include "sessionmetadatastore.h"
+#include "sessionrecord.h"
+#include "../util/addresskey.h"
+
+// Read-mostly map of SessionMetadata for stores to keep next to their
+// records. Entries are immutable: a writer builds a new copy of the bucket
+// chain and swaps it in, so lookups never take a lock and never wait for
+// writers. Replaced chains are freed once every reader that could still
+// see them has left (epoch based reclamation).
+//
+// Each reading thread claims one of MAX_READERS epoch slots on first use
+// and hands it back when it exits; while all are taken, further threads
+// fall back to locking the bucket.
+//
+// A write that leaves an address's metadata as it was publishes nothing.
+// The bucket table doubles once it holds more than two entries per
+// bucket, so chains, and what a write copies, stay short.
+class SessionMetadataIndex
+{
+public:
+    static const int MAX_READERS   = 256;
+    static const int WRITE_STRIPES = 64;
+    static const int RECLAIM_BATCH = 64;
+    static const int LOAD_FACTOR   = 2;
+
+    SessionMetadataIndex(int buckets = 1 << 10);
+    ~SessionMetadataIndex();
+
+    bool lookup(const AxolotlAddress &remoteAddress, SessionMetadata *metadata) const;
+    void publish(const AxolotlAddress &remoteAddress, const SessionMetadata &metadata);
+    void remove(const AxolotlAddress &remoteAddress);
+
+    static SessionMetadata describe(SessionRecord *record);
+
+private:
+    struct Node {
+        AddressKey       key;
+        SessionMetadata  metadata;
+        Node            *next;
+    };
+
+    // Never smaller than WRITE_STRIPES, so keys sharing a bucket always
+    // share a write stripe too
+    struct Table {
+        uint                   mask;
+        QAtomicPointer<Node>  *buckets;
+    };
+
+    // Either a replaced chain or a whole replaced table
+    struct Retired {
+        Node    *chain;
+        Table   *table;
+        quint64  epoch;
+    };
+
+    struct alignas(64) ReaderSlot {
+        QAtomicInteger<quint64> epoch;
+    };
+
+    // Owned by the reading thread's QThreadStorage, so thread exit releases the slot.
+    // Leases outliving the index are never deleted, QThreadStorage drops them.
+    struct ReaderLease {
+        const SessionMetadataIndex *index;
+        int                         slot;
+
+        ~ReaderLease();
+    };
+
+    SessionMetadataIndex(const SessionMetadataIndex &);
+    SessionMetadataIndex &operator=(const SessionMetadataIndex &);
+
+    static Table *createTable(int size);
+    static void freeTable(Table *freed);
+    static uint stripeFor(uint hash);
+    int readerSlot() const;
+    int claimReaderSlot() const;
+    void releaseReaderSlot(int slot) const;
+    void replace(const AddressKey &key, const SessionMetadata *metadata);
+    void grow();
+    void retire(Node *chain, Table *replaced);
+    void reclaim();
+    static void freeChain(Node *chain);
+    static bool sameMetadata(const SessionMetadata &a, const SessionMetadata &b);
+
+    QAtomicPointer<Table>                   table;
+    QAtomicInt                              entries;
+    mutable QMutex                          writeMutexes[WRITE_STRIPES];
+
+    mutable ReaderSlot                      readers[MAX_READERS];
+    mutable QAtomicInt                      nextReader;
+    mutable QMutex                          readerMutex;
+    mutable QVector<int>                    freeReaders;
+    mutable QThreadStorage<ReaderLease*>    threadReader;
+    QAtomicInteger<quint64>                 globalEpoch;
+
+    QMutex                                  retireMutex;
+    QList<Retired>                          retired;
+};
+
+#endif // SESSIONMETADATAINDEX_H
@@ -0,0 +1,29 @@
+#ifndef SESSIONMETADATASTORE_H
+#define SESSIONMETADATASTORE_H
+
+#include <QByteArray>
+
+#include "../axolotladdress.h"
+
+// The stable fields of the current session state, as of the last store
+struct SessionMetadata {
+    int        sessionVersion       = 0;
+    int        remoteRegistrationId = 0;
+    int        localRegistrationId  = 0;
+    QByteArray remoteIdentityKey;
+};
+
+// Optional contract for session stores that can answer metadata queries
+// without loading the record. SessionCipher uses it for
+// getRemoteRegistrationId() and getSessionVersion() when its SessionStore
+// also implements this interface.
+class SessionMetadataStore
+{
+public:
+    virtual ~SessionMetadataStore() {}
+
+    // False if there is no stored session
+    virtual bool loadSessionMetadata(const AxolotlAddress &remoteAddress, SessionMetadata *metadata) const = 0;
+};
+
+#endif // SESSIONMETADATASTORE_H
@@ -0,0 +1,72 @@
+#include "sessionprefetcher.h"
+
+#include "../concurrent/functionrunnable.h"
+#include "../whisperexception.h"
+
+#include <QSet>
+#include <QDebug>
+
+SessionPrefetcher::SessionPrefetcher(QSharedPointer<SessionCache> sessionCache, QSharedPointer<SenderKeyCache> senderKeyCache, int threads)
+{
+    this->sessionCache   = sessionCache;
+    this->senderKeyCache = senderKeyCache;
+    pool.setMaxThreadCount(qMax(1, threads));
+}
+
+SessionPrefetcher::~SessionPrefetcher()
+{
+    pool.waitForDone();
+}
+
+void SessionPrefetcher::prefetch(const QList<AxolotlAddress> &remoteAddresses)
+{
+    QSet<AddressKey> seen;
+    QSharedPointer<SessionCache> cache = sessionCache;
+
+    foreach (const AxolotlAddress &remoteAddress, remoteAddresses) {
+        AddressKey key = AddressUtil::toKey(remoteAddress);
+        if (seen.contains(key) || cache->isCached(remoteAddress)) {
+            continue;
+        }
+        seen.insert(key);
+
+        FunctionRunnable::start(&pool, [cache, remoteAddress]() {
+            try {
+                cache->prefetch(remoteAddress);
+            } catch (const WhisperException &e) {
+                qWarning() << "Session prefetch failed:" << e.errorType() << e.errorMessage();
+            }
+        });
+    }
+}
+
+void SessionPrefetcher::prefetchSenderKeys(const QList<SenderKeyName> &senderKeyNames)
+{
+    if (senderKeyCache.isNull()) {
+        return;
+    }
+
+    QSet<QString> seen;
+    QSharedPointer<SenderKeyCache> cache = senderKeyCache;
+
+    foreach (const SenderKeyName &senderKeyName, senderKeyNames) {
+        QString key = senderKeyName.serialize();
+        if (seen.contains(key) || cache->isCached(senderKeyName)) {
+            continue;
+        }
+        seen.insert(key);
+
+        FunctionRunnable::start(&pool, [cache, senderKeyName]() {
+            try {
+                cache->prefetch(senderKeyName);
+            } catch (const WhisperException &e) {
+                qWarning() << "Sender key prefetch failed:" << e.errorType() << e.errorMessage();
+            }
+        });
+    }
+}
+
+bool SessionPrefetcher::waitForDone(int msecs)
+{
+    return pool.waitForDone(msecs);
+}
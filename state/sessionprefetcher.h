@@ -0,0 +1,31 @@
+#ifndef SESSIONPREFETCHER_H
+#define SESSIONPREFETCHER_H
+
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QList>
+
+#include "sessioncache.h"
+#include "../groups/state/senderkeycache.h"
+
+// Loads and parses the records for an upcoming batch of envelopes on a
+// background pool, so SessionCipher finds them resident in the cache.
+class SessionPrefetcher
+{
+public:
+    SessionPrefetcher(QSharedPointer<SessionCache> sessionCache,
+                      QSharedPointer<SenderKeyCache> senderKeyCache = QSharedPointer<SenderKeyCache>(),
+                      int threads = 2);
+    ~SessionPrefetcher();
+
+    void prefetch(const QList<AxolotlAddress> &remoteAddresses);
+    void prefetchSenderKeys(const QList<SenderKeyName> &senderKeyNames);
+    bool waitForDone(int msecs = -1);
+
+private:
+    QSharedPointer<SessionCache>   sessionCache;
+    QSharedPointer<SenderKeyCache> senderKeyCache;
+    QThreadPool                    pool;
+};
+
+#endif // SESSIONPREFETCHER_H
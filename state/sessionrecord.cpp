@@ -1,31 +1,59 @@
 #include "sessionrecord.h"
+#include "../util/tracer.h"
 
 const int SessionRecord::ARCHIVED_STATES_MAX_LENGTH = 50;
 
 SessionRecord::SessionRecord()
 {
+    keyArena = new SecureArena(sizeof(SessionHotState), HOT_STATES_PER_BLOCK);
     fresh = true;
-    this->sessionState = new SessionState();
+    this->sessionState = new SessionState(keyArena);
 }
 
 SessionRecord::SessionRecord(SessionState *sessionState)
 {
+    keyArena = new SecureArena(sizeof(SessionHotState), HOT_STATES_PER_BLOCK);
     this->sessionState = sessionState;
     fresh = false;
 }
 
 SessionRecord::SessionRecord(const QByteArray &serialized)
 {
+    TRACE_SCOPE("record.parse");
+
     textsecure::RecordStructure record;
     record.ParsePartialFromArray(serialized.constData(), serialized.size());
-    sessionState = new SessionState(record.currentsession());
+    keyArena     = new SecureArena(sizeof(SessionHotState), HOT_STATES_PER_BLOCK);
+    sessionState = new SessionState(record.currentsession(), keyArena);
     fresh = false;
 
     for (int i = 0; i < record.previoussessions_size(); i++) {
-        previousStates.append(new SessionState(record.previoussessions(i)));
+        previousStates.append(new SessionState(record.previoussessions(i), keyArena));
+    }
+
+    wipeRecord(&record);
+}
+
+SessionRecord::SessionRecord(const SessionRecord &copy)
+{
+    keyArena     = new SecureArena(sizeof(SessionHotState), HOT_STATES_PER_BLOCK);
+    sessionState = new SessionState(*copy.sessionState, keyArena);
+    fresh        = copy.fresh;
+
+    foreach (SessionState *previousState, copy.previousStates) {
+        previousStates.append(new SessionState(*previousState, keyArena));
     }
 }
 
+SessionRecord::~SessionRecord()
+{
+    // States wipe their key material on destruction, freeing the arena zeroizes all of it at once
+    previousStates.removeAll(sessionState);
+    delete sessionState;
+    qDeleteAll(previousStates);
+    delete keyArena;
+}
+
 bool SessionRecord::hasSessionState(int version, const QByteArray &aliceBaseKey)
 {
     if (sessionState->getSessionVersion() == version
@@ -60,18 +88,24 @@ bool SessionRecord::isFresh() const
     return fresh;
 }
 
+void SessionRecord::setFresh(bool fresh)
+{
+    this->fresh = fresh;
+}
+
 void SessionRecord::promoteState(SessionState *promotedState)
 {
-    previousStates.insert(0, promotedState);
+    previousStates.removeAll(promotedState);
+    previousStates.insert(0, sessionState);
     sessionState = promotedState;
-    if (previousStates.size() > ARCHIVED_STATES_MAX_LENGTH) {
-        previousStates.removeLast();
+    while (previousStates.size() > ARCHIVED_STATES_MAX_LENGTH) {
+        delete previousStates.takeLast();
     }
 }
 
 void SessionRecord::archiveCurrentState()
 {
-    promoteState(new SessionState());
+    promoteState(new SessionState(keyArena));
 }
 
 void SessionRecord::setState(SessionState *sessionState)
@@ -81,13 +115,121 @@ void SessionRecord::setState(SessionState *sessionState)
 
 QByteArray SessionRecord::serialize() const
 {
+    TRACE_SCOPE("record.serialize");
+
     textsecure::RecordStructure record;
-    record.mutable_currentsession()->CopyFrom(sessionState->getStructure());
+    sessionState->copyStructureTo(record.mutable_currentsession());
 
     foreach (SessionState *previousState, previousStates) {
-        record.add_previoussessions()->CopyFrom(previousState->getStructure());
+        previousState->copyStructureTo(record.add_previoussessions());
     }
 
     ::std::string serialized = record.SerializeAsString();
-    return QByteArray(serialized.data(), serialized.length());
+    QByteArray    bytes(serialized.data(), serialized.length());
+
+    wipeRecord(&record);
+    SecureArena::cleanse(&serialized[0], serialized.size());
+    return bytes;
+}
+
+SessionRecordDiagnostics SessionRecord::getDiagnostics() const
+{
+    SessionRecordDiagnostics diagnostics;
+    textsecure::RecordStructure record;
+
+    sessionState->copyStructureTo(record.mutable_currentsession());
+    diagnostics.currentState          = getStateDiagnostics(record.currentsession());
+    diagnostics.skippedKeys           = diagnostics.currentState.skippedKeys;
+    diagnostics.oldestSkippedDistance = diagnostics.currentState.oldestSkippedDistance;
+
+    foreach (SessionState *previousState, previousStates) {
+        textsecure::SessionStructure *structure = record.add_previoussessions();
+        previousState->copyStructureTo(structure);
+
+        SessionStateDiagnostics state = getStateDiagnostics(*structure);
+        diagnostics.archivedStates++;
+        diagnostics.archivedBytes         += state.totalBytes;
+        diagnostics.archivedSkippedKeys   += state.skippedKeys;
+        diagnostics.skippedKeys           += state.skippedKeys;
+        diagnostics.oldestSkippedDistance  = qMax(diagnostics.oldestSkippedDistance, state.oldestSkippedDistance);
+    }
+
+    diagnostics.serializedBytes = record.ByteSize();
+
+    wipeRecord(&record);
+    return diagnostics;
+}
+
+void SessionRecord::wipeRecord(textsecure::RecordStructure *record)
+{
+    SessionState::wipeStructure(record->mutable_currentsession());
+    for (int i = 0; i < record->previoussessions_size(); i++) {
+        SessionState::wipeStructure(record->mutable_previoussessions(i));
+    }
+}
+
+SessionStateDiagnostics SessionRecord::getStateDiagnostics(const textsecure::SessionStructure &structure)
+{
+    SessionStateDiagnostics diagnostics;
+    diagnostics.sessionVersion = structure.sessionversion();
+    diagnostics.totalBytes     = structure.ByteSize();
+
+    if (structure.has_senderchain()) {
+        diagnostics.senderChainBytes = structure.senderchain().ByteSize();
+    }
+    if (structure.has_pendingkeyexchange()) {
+        diagnostics.pendingBytes += structure.pendingkeyexchange().ByteSize();
+    }
+    if (structure.has_pendingprekey()) {
+        diagnostics.pendingBytes += structure.pendingprekey().ByteSize();
+    }
+
+    for (int i = 0; i < structure.receiverchains_size(); i++) {
+        const textsecure::SessionStructure::Chain &receiverChain = structure.receiverchains(i);
+
+        ChainDiagnostics chain;
+        chain.index       = receiverChain.chainkey().index();
+        chain.skippedKeys = receiverChain.messagekeys_size();
+        chain.bytes       = receiverChain.ByteSize();
+
+        for (int j = 0; j < receiverChain.messagekeys_size(); j++) {
+            quint32 keyIndex = receiverChain.messagekeys(j).index();
+            if (keyIndex < chain.index) {
+                chain.oldestSkippedDistance = qMax(chain.oldestSkippedDistance, chain.index - keyIndex);
+            }
+        }
+
+        diagnostics.receiverChainBytes    += chain.bytes;
+        diagnostics.skippedKeys           += chain.skippedKeys;
+        diagnostics.oldestSkippedDistance  = qMax(diagnostics.oldestSkippedDistance, chain.oldestSkippedDistance);
+        diagnostics.receiverChains.append(chain);
+    }
+
+    diagnostics.headerBytes = diagnostics.totalBytes - diagnostics.senderChainBytes
+                            - diagnostics.receiverChainBytes - diagnostics.pendingBytes;
+    return diagnostics;
+}
+
+CompactionStats SessionRecord::compact(const CompactionPolicy &policy)
+{
+    CompactionStats stats;
+    sessionState->compact(policy, stats);
+
+    QList<SessionState*> kept;
+    foreach (SessionState *previousState, previousStates) {
+        if (previousState == sessionState) {
+            continue;
+        }
+
+        // States left behind by archiveCurrentState() on a fresh record hold nothing
+        if (kept.size() < qMax(0, policy.maxArchivedStates) && previousState->compact(policy, stats)) {
+            kept.append(previousState);
+        } else {
+            stats.archivedStatesDropped++;
+            delete previousState;
+        }
+    }
+    previousStates = kept;
+
+    return stats;
 }
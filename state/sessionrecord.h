@@ -2,6 +2,7 @@
 #define SESSIONRECORD_H
 
 #include "sessionstate.h"
+#include "recorddiagnostics.h"
 
 #include <QList>
 #include <QByteArray>
@@ -12,18 +13,30 @@ public:
     SessionRecord();
     SessionRecord(SessionState *sessionState);
     SessionRecord(const QByteArray &serialized);
+    SessionRecord(const SessionRecord &copy);
+    ~SessionRecord();
 
     bool hasSessionState(int version, const QByteArray &aliceBaseKey);
     SessionState *getSessionState();
     QList<SessionState*> getPreviousSessionStates();
     bool isFresh() const;
+    void setFresh(bool fresh);
     void promoteState(SessionState *promotedState);
     void archiveCurrentState();
     void setState(SessionState *sessionState);
     QByteArray serialize() const;
+    SessionRecordDiagnostics getDiagnostics() const;
+    CompactionStats compact(const CompactionPolicy &policy);
 
 private:
+    SessionRecord &operator=(const SessionRecord &);
+
+    static SessionStateDiagnostics getStateDiagnostics(const textsecure::SessionStructure &structure);
+    static void wipeRecord(textsecure::RecordStructure *record);
+
     static const int ARCHIVED_STATES_MAX_LENGTH;
+    static const int HOT_STATES_PER_BLOCK = 4;
+    SecureArena  *keyArena;
     SessionState *sessionState;
     QList<SessionState*> previousStates;
     bool fresh;
@@ -1,9 +1,12 @@
 #include "sessionstate.h"
 #include "../ecc/curve.h"
 #include "../invalidkeyexception.h"
+#include "../util/securearena.h"
 
 #include <QPair>
 
+#include <string.h>
+
 UnacknowledgedPreKeyMessageItems::UnacknowledgedPreKeyMessageItems(int preKeyId, int signedPreKeyId, const DjbECPublicKey &baseKey)
 {
     this->preKeyId       = preKeyId;
@@ -26,46 +29,198 @@ DjbECPublicKey UnacknowledgedPreKeyMessageItems::getBaseKey() const
     return baseKey;
 }
 
-SessionState::SessionState()
+SessionState::SessionState(SecureArena *arena)
+{
+    this->sessionStructure = new textsecure::SessionStructure();
+    allocateHotState(arena);
+    loadHotState();
+}
+
+SessionState::SessionState(const textsecure::SessionStructure &sessionSctucture, SecureArena *arena)
 {
-    this->sessionStructure.Clear();
+    this->sessionStructure = new textsecure::SessionStructure(sessionSctucture);
+    allocateHotState(arena);
+    loadHotState();
+}
+
+SessionState::SessionState(const SessionState &copy, SecureArena *arena)
+{
+    this->sessionStructure = new textsecure::SessionStructure(*copy.sessionStructure);
+    allocateHotState(arena);
+    memcpy(hot, copy.hot, sizeof(SessionHotState));
+}
+
+SessionState::~SessionState()
+{
+    wipe();
+    delete sessionStructure;
+
+    arena->release(reinterpret_cast<unsigned char*>(hot));
+    delete ownedArena;
+}
+
+SessionState &SessionState::operator=(const SessionState &copy)
+{
+    if (this != &copy) {
+        wipe();
+        this->sessionStructure->CopyFrom(*copy.sessionStructure);
+        memcpy(hot, copy.hot, sizeof(SessionHotState));
+    }
+    return *this;
 }
 
-SessionState::SessionState(const textsecure::SessionStructure &sessionSctucture)
+// A state outside of a SessionRecord gets an arena of its own
+void SessionState::allocateHotState(SecureArena *arena)
 {
-    this->sessionStructure.CopyFrom(sessionSctucture);
+    this->ownedArena = arena ? 0 : new SecureArena(sizeof(SessionHotState), 1);
+    this->arena      = arena ? arena : ownedArena;
+    this->hot        = reinterpret_cast<SessionHotState*>(this->arena->allocate());
+
+    Q_ASSERT(((quintptr)hot & (SecureArena::CACHE_LINE_SIZE - 1)) == 0);
 }
 
-SessionState::SessionState(const SessionState &copy)
+void SessionState::loadHotState()
 {
-    this->sessionStructure.CopyFrom(copy.getStructure());
+    memset(hot, 0, sizeof(SessionHotState));
+
+    hot->sessionVersion       = sessionStructure->sessionversion();
+    hot->previousCounter      = sessionStructure->previouscounter();
+    hot->remoteRegistrationId = sessionStructure->remoteregistrationid();
+    hot->localRegistrationId  = sessionStructure->localregistrationid();
+
+    const ::std::string &rootkey = sessionStructure->rootkey();
+    if (rootkey.size() <= (size_t)SessionHotState::KEY_LENGTH) {
+        memcpy(hot->rootKey, rootkey.data(), rootkey.size());
+        hot->rootKeyLength = rootkey.size();
+    } else {
+        hot->flags |= SessionHotState::RootKeyCold;
+    }
+
+    if (sessionStructure->has_senderchain()) {
+        const textsecure::SessionStructure::Chain &senderChain = sessionStructure->senderchain();
+        const ::std::string &chainkey         = senderChain.chainkey().key();
+        const ::std::string &senderratchetkey = senderChain.senderratchetkey();
+
+        hot->flags |= SessionHotState::HasSenderChain;
+        hot->senderChainIndex = senderChain.chainkey().index();
+
+        if (chainkey.size() <= (size_t)SessionHotState::KEY_LENGTH &&
+            senderratchetkey.size() <= (size_t)SessionHotState::PUBLIC_KEY_LENGTH)
+        {
+            memcpy(hot->senderChainKey, chainkey.data(), chainkey.size());
+            memcpy(hot->senderRatchetKey, senderratchetkey.data(), senderratchetkey.size());
+            hot->senderChainKeyLength   = chainkey.size();
+            hot->senderRatchetKeyLength = senderratchetkey.size();
+        } else {
+            hot->flags |= SessionHotState::SenderChainCold;
+        }
+    }
+}
+
+void SessionState::flushHotState() const
+{
+    if (!(hot->flags & SessionHotState::DirtyMask)) {
+        return;
+    }
+
+    if (hot->flags & SessionHotState::RootKeyDirty) {
+        sessionStructure->set_rootkey((const char*)hot->rootKey, hot->rootKeyLength);
+    }
+
+    if (hot->flags & SessionHotState::SenderChainDirty) {
+        textsecure::SessionStructure::Chain *senderChain = sessionStructure->mutable_senderchain();
+        if (hot->senderRatchetKeyLength > 0) {
+            senderChain->set_senderratchetkey((const char*)hot->senderRatchetKey, hot->senderRatchetKeyLength);
+        }
+        senderChain->mutable_chainkey()->set_key((const char*)hot->senderChainKey, hot->senderChainKeyLength);
+        senderChain->mutable_chainkey()->set_index(hot->senderChainIndex);
+    }
+
+    if (hot->flags & SessionHotState::SessionVersionDirty) {
+        sessionStructure->set_sessionversion(hot->sessionVersion);
+    }
+
+    if (hot->flags & SessionHotState::PreviousCounterDirty) {
+        sessionStructure->set_previouscounter(hot->previousCounter);
+    }
+
+    if (hot->flags & SessionHotState::RemoteRegistrationDirty) {
+        sessionStructure->set_remoteregistrationid(hot->remoteRegistrationId);
+    }
+
+    if (hot->flags & SessionHotState::LocalRegistrationDirty) {
+        sessionStructure->set_localregistrationid(hot->localRegistrationId);
+    }
+
+    hot->flags &= ~SessionHotState::DirtyMask;
+}
+
+void SessionState::setSenderChainHot(const QByteArray &senderRatchetKey, const QByteArray &chainKey, uint index)
+{
+    bool updateRatchetKey = !senderRatchetKey.isNull();
+    bool fits             = chainKey.size() <= SessionHotState::KEY_LENGTH &&
+                            (updateRatchetKey ? senderRatchetKey.size() <= SessionHotState::PUBLIC_KEY_LENGTH
+                                              : !(hot->flags & SessionHotState::SenderChainCold));
+
+    hot->flags |= SessionHotState::HasSenderChain;
+
+    if (fits) {
+        memcpy(hot->senderChainKey, chainKey.constData(), chainKey.size());
+        hot->senderChainKeyLength = chainKey.size();
+        if (updateRatchetKey) {
+            memcpy(hot->senderRatchetKey, senderRatchetKey.constData(), senderRatchetKey.size());
+            hot->senderRatchetKeyLength = senderRatchetKey.size();
+        }
+        hot->senderChainIndex = index;
+        hot->flags &= ~SessionHotState::SenderChainCold;
+        hot->flags |= SessionHotState::SenderChainDirty;
+    } else {
+        flushHotState();
+
+        textsecure::SessionStructure::Chain *senderChain = sessionStructure->mutable_senderchain();
+        if (updateRatchetKey) {
+            senderChain->set_senderratchetkey(senderRatchetKey.constData(), senderRatchetKey.size());
+        }
+        senderChain->mutable_chainkey()->set_key(chainKey.constData(), chainKey.size());
+        senderChain->mutable_chainkey()->set_index(index);
+        hot->senderChainIndex = index;
+        hot->flags |= SessionHotState::SenderChainCold;
+    }
 }
 
 textsecure::SessionStructure SessionState::getStructure() const
 {
-    return sessionStructure;
+    flushHotState();
+    return *sessionStructure;
+}
+
+void SessionState::copyStructureTo(textsecure::SessionStructure *structure) const
+{
+    flushHotState();
+    structure->CopyFrom(*sessionStructure);
 }
 
 QByteArray SessionState::getAliceBaseKey() const
 {
-    ::std::string alicebasekey = sessionStructure.alicebasekey();
+    ::std::string alicebasekey = sessionStructure->alicebasekey();
     QByteArray bytes(alicebasekey.data(), alicebasekey.size());
     return bytes;
 }
 
 void SessionState::setAliceBaseKey(const QByteArray &aliceBaseKey)
 {
-    sessionStructure.set_alicebasekey(aliceBaseKey.constData(), aliceBaseKey.size());
+    sessionStructure->set_alicebasekey(aliceBaseKey.constData(), aliceBaseKey.size());
 }
 
 void SessionState::setSessionVersion(int version)
 {
-    sessionStructure.set_sessionversion(version);
+    hot->sessionVersion = version;
+    hot->flags |= SessionHotState::SessionVersionDirty;
 }
 
 int SessionState::getSessionVersion() const
 {
-    int sessionVersion = sessionStructure.sessionversion();
+    int sessionVersion = hot->sessionVersion;
 
     if (sessionVersion == 0) return 2;
     else                     return sessionVersion;
@@ -74,69 +229,88 @@ int SessionState::getSessionVersion() const
 void SessionState::setRemoteIdentityKey(const IdentityKey &identityKey)
 {
     QByteArray byteKey = identityKey.serialize();
-    sessionStructure.set_remoteidentitypublic(byteKey.constData(), byteKey.size());
+    sessionStructure->set_remoteidentitypublic(byteKey.constData(), byteKey.size());
 }
 
 void SessionState::setLocalIdentityKey(const IdentityKey &identityKey)
 {
     QByteArray byteKey = identityKey.serialize();
-    sessionStructure.set_localidentitypublic(byteKey.constData(), byteKey.size());
+    sessionStructure->set_localidentitypublic(byteKey.constData(), byteKey.size());
 }
 
 bool SessionState::hasRemoteIdentityKey() const
 {
-    return sessionStructure.has_remoteidentitypublic();
+    return sessionStructure->has_remoteidentitypublic();
 }
 
 IdentityKey SessionState::getRemoteIdentityKey() const
 {
-    if (!sessionStructure.has_remoteidentitypublic()) {
+    if (!sessionStructure->has_remoteidentitypublic()) {
         throw InvalidKeyException("No RemoteIdentityKey");
     }
     else {
-        ::std::string remoteidentitypublic = sessionStructure.remoteidentitypublic();
+        ::std::string remoteidentitypublic = sessionStructure->remoteidentitypublic();
         return IdentityKey(QByteArray(remoteidentitypublic.data(), remoteidentitypublic.length()), 0);
     }
 }
 
 IdentityKey SessionState::getLocalIdentityKey() const
 {
-    ::std::string localidentitypublic = sessionStructure.localidentitypublic();
+    ::std::string localidentitypublic = sessionStructure->localidentitypublic();
     return IdentityKey(QByteArray(localidentitypublic.data(), localidentitypublic.length()), 0);
 }
 
 int SessionState::getPreviousCounter() const
 {
-    return sessionStructure.previouscounter();
+    return hot->previousCounter;
 }
 
 void SessionState::setPreviousCounter(int previousCounter)
 {
-    sessionStructure.set_previouscounter(previousCounter);
+    hot->previousCounter = previousCounter;
+    hot->flags |= SessionHotState::PreviousCounterDirty;
 }
 
 RootKey SessionState::getRootKey() const
 {
-    ::std::string rootkey = sessionStructure.rootkey();
-    return RootKey(HKDF(getSessionVersion()), QByteArray(rootkey.data(), rootkey.length()));
+    if (hot->flags & SessionHotState::RootKeyCold) {
+        ::std::string rootkey = sessionStructure->rootkey();
+        return RootKey(HKDF(getSessionVersion()), QByteArray(rootkey.data(), rootkey.length()));
+    }
+
+    return RootKey(HKDF(getSessionVersion()), QByteArray((const char*)hot->rootKey, hot->rootKeyLength));
 }
 
 void SessionState::setRootKey(const RootKey &rootKey)
 {
     QByteArray bytesKey = rootKey.getKeyBytes();
-    sessionStructure.set_rootkey(bytesKey.constData(), bytesKey.size());
+
+    if (bytesKey.size() <= SessionHotState::KEY_LENGTH) {
+        memcpy(hot->rootKey, bytesKey.constData(), bytesKey.size());
+        hot->rootKeyLength = bytesKey.size();
+        hot->flags &= ~SessionHotState::RootKeyCold;
+        hot->flags |= SessionHotState::RootKeyDirty;
+    } else {
+        sessionStructure->set_rootkey(bytesKey.constData(), bytesKey.size());
+        hot->flags |= SessionHotState::RootKeyCold;
+        hot->flags &= ~SessionHotState::RootKeyDirty;
+    }
 }
 
 DjbECPublicKey SessionState::getSenderRatchetKey() const
 {
-    ::std::string senderratchetkey = sessionStructure.senderchain().senderratchetkey();
-    return Curve::decodePoint(QByteArray(senderratchetkey.data(), senderratchetkey.length()), 0);
+    if (hot->flags & SessionHotState::SenderChainCold) {
+        ::std::string senderratchetkey = sessionStructure->senderchain().senderratchetkey();
+        return Curve::decodePoint(QByteArray(senderratchetkey.data(), senderratchetkey.length()), 0);
+    }
+
+    return Curve::decodePoint(QByteArray((const char*)hot->senderRatchetKey, hot->senderRatchetKeyLength), 0);
 }
 
 ECKeyPair SessionState::getSenderRatchetKeyPair() const
 {
     DjbECPublicKey  publicKey  = getSenderRatchetKey();
-    ::std::string senderratchetkeyprivate = sessionStructure.senderchain().senderratchetkeyprivate();
+    ::std::string senderratchetkeyprivate = sessionStructure->senderchain().senderratchetkeyprivate();
     DjbECPrivateKey privateKey = Curve::decodePrivatePoint(QByteArray(senderratchetkeyprivate.data(),
                                                                    senderratchetkeyprivate.length()));
 
@@ -150,13 +324,13 @@ bool SessionState::hasReceiverChain(const DjbECPublicKey &senderEphemeral)
 
 bool SessionState::hasSenderChain() const
 {
-    return sessionStructure.has_senderchain();
+    return hot->flags & SessionHotState::HasSenderChain;
 }
 
 int SessionState::getReceiverChain(const DjbECPublicKey &senderEphemeral)
 {
-    for (int i = 0; i < sessionStructure.receiverchains_size(); i++) {
-        textsecure::SessionStructure::Chain *receiverChain = sessionStructure.mutable_receiverchains(i);
+    for (int i = 0; i < sessionStructure->receiverchains_size(); i++) {
+        textsecure::SessionStructure::Chain *receiverChain = sessionStructure->mutable_receiverchains(i);
         if (receiverChain && receiverChain->has_senderratchetkey()) {
             ::std::string senderratchetkey = receiverChain->senderratchetkey();
             QByteArray senderratchetkeybytes(senderratchetkey.data(), senderratchetkey.length());
@@ -179,7 +353,7 @@ ChainKey SessionState::getReceiverChainKey(const DjbECPublicKey &senderEphemeral
     if (receiverChainIndex == -1) {
         throw InvalidKeyException("ReceiverChain empty");
     } else {
-        textsecure::SessionStructure::Chain receiverChain = sessionStructure.receiverchains(receiverChainIndex);
+        textsecure::SessionStructure::Chain receiverChain = sessionStructure->receiverchains(receiverChainIndex);
         ::std::string keyfromchain = receiverChain.chainkey().key();
         return ChainKey(HKDF(getSessionVersion()),
                         QByteArray(keyfromchain.data(), keyfromchain.length()),
@@ -196,12 +370,12 @@ void SessionState::addReceiverChain(const DjbECPublicKey &senderRatchetKey, cons
 
     QByteArray byteRatchet = senderRatchetKey.serialize();
 
-    textsecure::SessionStructure::Chain* chain = sessionStructure.add_receiverchains();
+    textsecure::SessionStructure::Chain* chain = sessionStructure->add_receiverchains();
     chain->mutable_chainkey()->CopyFrom(chainKeyStructure);
     chain->set_senderratchetkey(byteRatchet.constData(), byteRatchet.size());
 
-    if (sessionStructure.receiverchains_size() > 5) {
-        delete sessionStructure.mutable_receiverchains(0);
+    if (sessionStructure->receiverchains_size() > MAX_RECEIVER_CHAINS) {
+        sessionStructure->mutable_receiverchains()->DeleteSubrange(0, 1);
     }
 }
 
@@ -209,49 +383,34 @@ void SessionState::setSenderChain(const ECKeyPair &senderRatchetKeyPair, const C
 {
     QByteArray serializedPublicKey = senderRatchetKeyPair.getPublicKey().serialize();
     QByteArray serializedPrivateKey = senderRatchetKeyPair.getPrivateKey().serialize();
-    QByteArray serializedChainKey = chainKey.getKey();
-
-    sessionStructure.mutable_senderchain()->set_senderratchetkey(serializedPublicKey.constData(), serializedPublicKey.size());
-    sessionStructure.mutable_senderchain()->set_senderratchetkeyprivate(serializedPrivateKey.constData(), serializedPrivateKey.size());
-    sessionStructure.mutable_senderchain()->mutable_chainkey()->set_key(serializedChainKey.constData(), serializedChainKey.size());
-    sessionStructure.mutable_senderchain()->mutable_chainkey()->set_index(chainKey.getIndex());
-
-    /*textsecure::SessionStructure::Chain::ChainKey chainKeyStructure;
-    chainKeyStructure.set_key(chainKey.getKey().constData());
-    chainKeyStructure.set_index(chainKey.getIndex());
 
-    textsecure::SessionStructure::Chain senderChain;
-    senderChain.set_senderratchetkey(senderRatchetKeyPair.getPublicKey().serialize().constData());
-    senderChain.set_senderratchetkeyprivate(senderRatchetKeyPair.getPrivateKey().serialize().constData());
-    senderChain.mutable_chainkey()->CopyFrom(chainKeyStructure);
-
-    sessionStructure.mutable_senderchain()->CopyFrom(senderChain);*/
+    sessionStructure->mutable_senderchain()->set_senderratchetkeyprivate(serializedPrivateKey.constData(), serializedPrivateKey.size());
+    setSenderChainHot(serializedPublicKey, chainKey.getKey(), chainKey.getIndex());
 }
 
 ChainKey SessionState::getSenderChainKey() const
 {
-    textsecure::SessionStructure::Chain::ChainKey chainKeyStructure = sessionStructure.senderchain().chainkey();
-    ::std::string key = chainKeyStructure.key();
+    if (hot->flags & SessionHotState::SenderChainCold) {
+        textsecure::SessionStructure::Chain::ChainKey chainKeyStructure = sessionStructure->senderchain().chainkey();
+        ::std::string key = chainKeyStructure.key();
+        return ChainKey(HKDF(getSessionVersion()),
+                        QByteArray(key.data(), key.length()),
+                        chainKeyStructure.index());
+    }
+
     return ChainKey(HKDF(getSessionVersion()),
-                    QByteArray(key.data(), key.length()),
-                    chainKeyStructure.index());
+                    QByteArray((const char*)hot->senderChainKey, hot->senderChainKeyLength),
+                    hot->senderChainIndex);
 }
 
-void SessionState::setSenderChainKey(const ChainKey &nextChainKey)
+uint SessionState::getSenderChainIndex() const
 {
-    QByteArray serializedChainKey = nextChainKey.getKey();
-
-    sessionStructure.mutable_senderchain()->mutable_chainkey()->set_key(serializedChainKey.constData(), serializedChainKey.size());
-    sessionStructure.mutable_senderchain()->mutable_chainkey()->set_index(nextChainKey.getIndex());
-
-    /*textsecure::SessionStructure::Chain::ChainKey chainKey;
-    chainKey.set_key(nextChainKey.getKey().constData());
-    chainKey.set_index(nextChainKey.getIndex());
-
-    textsecure::SessionStructure::Chain chain = sessionStructure.senderchain();
-    chain.mutable_chainkey()->CopyFrom(chainKey);
+    return hot->senderChainIndex;
+}
 
-    sessionStructure.mutable_senderchain()->CopyFrom(chain);*/
+void SessionState::setSenderChainKey(const ChainKey &nextChainKey)
+{
+    setSenderChainHot(QByteArray(), nextChainKey.getKey(), nextChainKey.getIndex());
 }
 
 bool SessionState::hasMessageKeys(const DjbECPublicKey &senderEphemeral, uint counter)
@@ -262,7 +421,7 @@ bool SessionState::hasMessageKeys(const DjbECPublicKey &senderEphemeral, uint co
         return false;
     }
 
-    textsecure::SessionStructure::Chain receiverChain = sessionStructure.receiverchains(chainIndex);
+    textsecure::SessionStructure::Chain receiverChain = sessionStructure->receiverchains(chainIndex);
     for (int i = 0; i < receiverChain.messagekeys_size(); i++) {
         textsecure::SessionStructure::Chain::MessageKey messageKey = receiverChain.messagekeys(i);
         if (messageKey.index() == counter) {
@@ -281,28 +440,24 @@ MessageKeys SessionState::removeMessageKeys(const DjbECPublicKey &senderEphemera
         throw InvalidKeyException("ReceiverChain empty");
     }
 
-    textsecure::SessionStructure::Chain chain = sessionStructure.receiverchains(chainIndex);
+    textsecure::SessionStructure::Chain *chain = sessionStructure->mutable_receiverchains(chainIndex);
     MessageKeys result;
 
-    for (int i = 0; i < chain.messagekeys_size(); i++) {
-        textsecure::SessionStructure::Chain::MessageKey *messageKey = chain.mutable_messagekeys(i);
-        if (messageKey->index() == counter) {
-            ::std::string cipherkey = messageKey->cipherkey();
-            ::std::string mackey = messageKey->mackey();
-            ::std::string iv = messageKey->iv();
+    for (int i = 0; i < chain->messagekeys_size(); i++) {
+        const textsecure::SessionStructure::Chain::MessageKey &messageKey = chain->messagekeys(i);
+        if (messageKey.index() == counter) {
+            ::std::string cipherkey = messageKey.cipherkey();
+            ::std::string mackey = messageKey.mackey();
+            ::std::string iv = messageKey.iv();
             result = MessageKeys(QByteArray(cipherkey.data(), cipherkey.length()),
                                  QByteArray(mackey.data(), mackey.length()),
                                  QByteArray(iv.data(), iv.length()),
-                                 messageKey->index());
-            delete messageKey;
+                                 messageKey.index());
+            chain->mutable_messagekeys()->DeleteSubrange(i, 1);
             break;
         }
     }
 
-    textsecure::SessionStructure::Chain *updatedChain = sessionStructure.mutable_receiverchains(chainIndex);
-    updatedChain->clear_messagekeys();
-    updatedChain->CopyFrom(chain);
-
     return result;
 }
 
@@ -310,7 +465,7 @@ void SessionState::setMessageKeys(const DjbECPublicKey &senderEphemeral, const M
 {
     int chainIndex = getReceiverChain(senderEphemeral);
 
-    textsecure::SessionStructure::Chain *chain = (chainIndex == -1) ? sessionStructure.add_receiverchains() : sessionStructure.mutable_receiverchains(chainIndex);
+    textsecure::SessionStructure::Chain *chain = (chainIndex == -1) ? sessionStructure->add_receiverchains() : sessionStructure->mutable_receiverchains(chainIndex);
     textsecure::SessionStructure::Chain::MessageKey *messageKeyStructure = chain->add_messagekeys();
     QByteArray byteCipher = messageKeys.getCipherKey();
     messageKeyStructure->set_cipherkey(byteCipher.constData(), byteCipher.size());
@@ -328,7 +483,7 @@ void SessionState::setMessageKeys(const DjbECPublicKey &senderEphemeral, const M
 void SessionState::setReceiverChainKey(const DjbECPublicKey &senderEphemeral, const ChainKey &chainKey)
 {
     int chainIndex = getReceiverChain(senderEphemeral);
-    textsecure::SessionStructure::Chain *chain =  (chainIndex == -1) ? sessionStructure.add_receiverchains() : sessionStructure.mutable_receiverchains(chainIndex);
+    textsecure::SessionStructure::Chain *chain =  (chainIndex == -1) ? sessionStructure->add_receiverchains() : sessionStructure->mutable_receiverchains(chainIndex);
 
     QByteArray serializedChainKey = chainKey.getKey();
 
@@ -344,18 +499,18 @@ void SessionState::setReceiverChainKey(const DjbECPublicKey &senderEphemeral, co
 
 void SessionState::setPendingKeyExchange(int sequence, const ECKeyPair &ourBaseKey, const ECKeyPair &ourRatchetKey, const IdentityKeyPair &ourIdentityKey)
 {
-    sessionStructure.mutable_pendingkeyexchange()->set_sequence(sequence);
-    sessionStructure.mutable_pendingkeyexchange()->set_localbasekey(ourBaseKey.getPublicKey().serialize().constData(),
+    sessionStructure->mutable_pendingkeyexchange()->set_sequence(sequence);
+    sessionStructure->mutable_pendingkeyexchange()->set_localbasekey(ourBaseKey.getPublicKey().serialize().constData(),
                                                                     ourBaseKey.getPublicKey().serialize().size());
-    sessionStructure.mutable_pendingkeyexchange()->set_localbasekeyprivate(ourBaseKey.getPrivateKey().serialize().constData(),
+    sessionStructure->mutable_pendingkeyexchange()->set_localbasekeyprivate(ourBaseKey.getPrivateKey().serialize().constData(),
                                                                            ourBaseKey.getPrivateKey().serialize().size());
-    sessionStructure.mutable_pendingkeyexchange()->set_localratchetkey(ourRatchetKey.getPublicKey().serialize().constData(),
+    sessionStructure->mutable_pendingkeyexchange()->set_localratchetkey(ourRatchetKey.getPublicKey().serialize().constData(),
                                                                        ourRatchetKey.getPublicKey().serialize().size());
-    sessionStructure.mutable_pendingkeyexchange()->set_localratchetkeyprivate(ourRatchetKey.getPrivateKey().serialize().constData(),
+    sessionStructure->mutable_pendingkeyexchange()->set_localratchetkeyprivate(ourRatchetKey.getPrivateKey().serialize().constData(),
                                                                               ourRatchetKey.getPrivateKey().serialize().size());
-    sessionStructure.mutable_pendingkeyexchange()->set_localidentitykey(ourIdentityKey.getPublicKey().serialize().constData(),
+    sessionStructure->mutable_pendingkeyexchange()->set_localidentitykey(ourIdentityKey.getPublicKey().serialize().constData(),
                                                                         ourIdentityKey.getPublicKey().serialize().size());
-    sessionStructure.mutable_pendingkeyexchange()->set_localidentitykeyprivate(ourIdentityKey.getPrivateKey().serialize().constData(),
+    sessionStructure->mutable_pendingkeyexchange()->set_localidentitykeyprivate(ourIdentityKey.getPrivateKey().serialize().constData(),
                                                                                ourIdentityKey.getPrivateKey().serialize().size());
 
 
@@ -367,19 +522,19 @@ void SessionState::setPendingKeyExchange(int sequence, const ECKeyPair &ourBaseK
     structure.set_localratchetkeyprivate(ourRatchetKey.getPrivateKey().serialize().constData());
     structure.set_localidentitykey(ourIdentityKey.getPublicKey().serialize().constData());
     structure.set_localidentitykeyprivate(ourIdentityKey.getPrivateKey().serialize().constData());
-    sessionStructure.mutable_pendingkeyexchange()->CopyFrom(structure);*/
+    sessionStructure->mutable_pendingkeyexchange()->CopyFrom(structure);*/
 }
 
 int SessionState::getPendingKeyExchangeSequence() const
 {
-    return sessionStructure.pendingkeyexchange().sequence();
+    return sessionStructure->pendingkeyexchange().sequence();
 }
 
 ECKeyPair SessionState::getPendingKeyExchangeBaseKey() const
 {
-    ::std::string localbasekey = sessionStructure.pendingkeyexchange().localbasekey();
+    ::std::string localbasekey = sessionStructure->pendingkeyexchange().localbasekey();
     DjbECPublicKey publicKey   = Curve::decodePoint(QByteArray(localbasekey.data(), localbasekey.length()), 0);
-    ::std::string localbasekeyprivate = sessionStructure.pendingkeyexchange().localbasekeyprivate();
+    ::std::string localbasekeyprivate = sessionStructure->pendingkeyexchange().localbasekeyprivate();
     DjbECPrivateKey privateKey = Curve::decodePrivatePoint(QByteArray(localbasekeyprivate.data(), localbasekeyprivate.length()));
 
     return ECKeyPair(publicKey, privateKey);
@@ -387,9 +542,9 @@ ECKeyPair SessionState::getPendingKeyExchangeBaseKey() const
 
 ECKeyPair SessionState::getPendingKeyExchangeRatchetKey() const
 {
-    ::std::string localratchetkey = sessionStructure.pendingkeyexchange().localratchetkey();
+    ::std::string localratchetkey = sessionStructure->pendingkeyexchange().localratchetkey();
     DjbECPublicKey publicKey   = Curve::decodePoint(QByteArray(localratchetkey.data(), localratchetkey.length()), 0);
-    ::std::string localratchetkeyprivate = sessionStructure.pendingkeyexchange().localratchetkeyprivate();
+    ::std::string localratchetkeyprivate = sessionStructure->pendingkeyexchange().localratchetkeyprivate();
     DjbECPrivateKey privateKey = Curve::decodePrivatePoint(QByteArray(localratchetkeyprivate.data(), localratchetkeyprivate.length()));
 
     return ECKeyPair(publicKey, privateKey);
@@ -397,78 +552,179 @@ ECKeyPair SessionState::getPendingKeyExchangeRatchetKey() const
 
 IdentityKeyPair SessionState::getPendingKeyExchangeIdentityKey() const
 {
-    IdentityKey publicKey(QByteArray(sessionStructure.pendingkeyexchange().localidentitykey().data(),
-                                     sessionStructure.pendingkeyexchange().localidentitykey().length()), 0);
+    IdentityKey publicKey(QByteArray(sessionStructure->pendingkeyexchange().localidentitykey().data(),
+                                     sessionStructure->pendingkeyexchange().localidentitykey().length()), 0);
 
-    DjbECPrivateKey privateKey = Curve::decodePrivatePoint(QByteArray(sessionStructure.pendingkeyexchange().localidentitykeyprivate().data(),
-                                                                   sessionStructure.pendingkeyexchange().localidentitykeyprivate().length()));
+    DjbECPrivateKey privateKey = Curve::decodePrivatePoint(QByteArray(sessionStructure->pendingkeyexchange().localidentitykeyprivate().data(),
+                                                                   sessionStructure->pendingkeyexchange().localidentitykeyprivate().length()));
 
     return IdentityKeyPair(publicKey, privateKey);
 }
 
 bool SessionState::hasPendingKeyExchange() const
 {
-    return sessionStructure.has_pendingkeyexchange();
+    return sessionStructure->has_pendingkeyexchange();
 }
 
 void SessionState::setUnacknowledgedPreKeyMessage(int preKeyId, int signedPreKeyId, const DjbECPublicKey &baseKey)
 {
-    sessionStructure.mutable_pendingprekey()->set_signedprekeyid(signedPreKeyId);
+    sessionStructure->mutable_pendingprekey()->set_signedprekeyid(signedPreKeyId);
     QByteArray byteKey = baseKey.serialize();
-    sessionStructure.mutable_pendingprekey()->set_basekey(byteKey.constData(), byteKey.size());
+    sessionStructure->mutable_pendingprekey()->set_basekey(byteKey.constData(), byteKey.size());
 
     if (preKeyId > -1) {
-        sessionStructure.mutable_pendingprekey()->set_prekeyid(preKeyId);
+        sessionStructure->mutable_pendingprekey()->set_prekeyid(preKeyId);
     }
 }
 
 bool SessionState::hasUnacknowledgedPreKeyMessage() const
 {
-    return sessionStructure.has_pendingprekey();
+    return sessionStructure->has_pendingprekey();
 }
 
 UnacknowledgedPreKeyMessageItems SessionState::getUnacknowledgedPreKeyMessageItems() const
 {
     int preKeyId = -1;
 
-    if (sessionStructure.pendingprekey().has_prekeyid()) {
-        preKeyId = sessionStructure.pendingprekey().prekeyid();
+    if (sessionStructure->pendingprekey().has_prekeyid()) {
+        preKeyId = sessionStructure->pendingprekey().prekeyid();
     }
 
-    ::std::string basekey = sessionStructure.pendingprekey().basekey();
+    ::std::string basekey = sessionStructure->pendingprekey().basekey();
     return UnacknowledgedPreKeyMessageItems(preKeyId,
-                                            sessionStructure.pendingprekey().signedprekeyid(),
+                                            sessionStructure->pendingprekey().signedprekeyid(),
                                             Curve::decodePoint(QByteArray(basekey.data(),
                                                                           basekey.length()), 0));
 }
 
 void SessionState::clearUnacknowledgedPreKeyMessage()
 {
-    sessionStructure.clear_pendingprekey();
+    sessionStructure->clear_pendingprekey();
 }
 
 void SessionState::setRemoteRegistrationId(int registrationId)
 {
-    sessionStructure.set_remoteregistrationid(registrationId);
+    hot->remoteRegistrationId = registrationId;
+    hot->flags |= SessionHotState::RemoteRegistrationDirty;
 }
 
 int SessionState::getRemoteRegistrationId() const
 {
-    return sessionStructure.remoteregistrationid();
+    return hot->remoteRegistrationId;
 }
 
 void SessionState::setLocalRegistrationId(int registrationId)
 {
-    sessionStructure.set_localregistrationid(registrationId);
+    hot->localRegistrationId = registrationId;
+    hot->flags |= SessionHotState::LocalRegistrationDirty;
 }
 
 int SessionState::getLocalRegistrationId() const
 {
-    return sessionStructure.localregistrationid();
+    return hot->localRegistrationId;
 }
 
 QByteArray SessionState::serialize() const
 {
-    ::std::string serialized = sessionStructure.SerializeAsString();
-    return QByteArray(serialized.data(), serialized.length());
+    flushHotState();
+    ::std::string serialized = sessionStructure->SerializeAsString();
+    QByteArray    bytes(serialized.data(), serialized.length());
+
+    SecureArena::cleanse(&serialized[0], serialized.size());
+    return bytes;
+}
+
+static void cleanseString(::std::string *value)
+{
+    if (!value->empty()) {
+        SecureArena::cleanse(&(*value)[0], value->size());
+    }
+}
+
+static void cleanseChain(textsecure::SessionStructure::Chain *chain)
+{
+    cleanseString(chain->mutable_senderratchetkeyprivate());
+    cleanseString(chain->mutable_chainkey()->mutable_key());
+
+    for (int i = 0; i < chain->messagekeys_size(); i++) {
+        textsecure::SessionStructure::Chain::MessageKey *messageKey = chain->mutable_messagekeys(i);
+        cleanseString(messageKey->mutable_cipherkey());
+        cleanseString(messageKey->mutable_mackey());
+        cleanseString(messageKey->mutable_iv());
+    }
+}
+
+void SessionState::wipe()
+{
+    wipeStructure(sessionStructure);
+
+    SecureArena::cleanse(hot, sizeof(SessionHotState));
+    memset(hot, 0, sizeof(SessionHotState));
+}
+
+void SessionState::wipeStructure(textsecure::SessionStructure *structure)
+{
+    cleanseString(structure->mutable_rootkey());
+
+    if (structure->has_senderchain()) {
+        cleanseChain(structure->mutable_senderchain());
+    }
+
+    for (int i = 0; i < structure->receiverchains_size(); i++) {
+        cleanseChain(structure->mutable_receiverchains(i));
+    }
+
+    if (structure->has_pendingkeyexchange()) {
+        textsecure::SessionStructure::PendingKeyExchange *pending = structure->mutable_pendingkeyexchange();
+        cleanseString(pending->mutable_localbasekeyprivate());
+        cleanseString(pending->mutable_localratchetkeyprivate());
+        cleanseString(pending->mutable_localidentitykeyprivate());
+    }
+
+    structure->Clear();
+}
+
+bool SessionState::compact(const CompactionPolicy &policy, CompactionStats &stats)
+{
+    // Receiver chains are appended as the ratchet steps, the oldest come first
+    int excessChains = sessionStructure->receiverchains_size() - qMax(1, policy.maxReceiverChains);
+    for (int i = 0; i < excessChains; i++) {
+        cleanseChain(sessionStructure->mutable_receiverchains(i));
+    }
+    if (excessChains > 0) {
+        sessionStructure->mutable_receiverchains()->DeleteSubrange(0, excessChains);
+        stats.receiverChainsDropped += excessChains;
+    }
+
+    for (int i = 0; i < sessionStructure->receiverchains_size(); i++) {
+        textsecure::SessionStructure::Chain *chain = sessionStructure->mutable_receiverchains(i);
+        quint32 index = chain->chainkey().index();
+        int     kept  = 0;
+
+        for (int j = 0; j < chain->messagekeys_size(); j++) {
+            textsecure::SessionStructure::Chain::MessageKey *messageKey = chain->mutable_messagekeys(j);
+            bool tooOld  = policy.maxSkippedKeyDistance > 0 && messageKey->index() < index
+                        && index - messageKey->index() > policy.maxSkippedKeyDistance;
+            bool tooMany = chain->messagekeys_size() - j > qMax(0, policy.maxSkippedKeys);
+
+            if (tooOld || tooMany) {
+                cleanseString(messageKey->mutable_cipherkey());
+                cleanseString(messageKey->mutable_mackey());
+                cleanseString(messageKey->mutable_iv());
+                stats.skippedKeysDropped++;
+            } else {
+                if (kept != j) {
+                    chain->mutable_messagekeys()->SwapElements(kept, j);
+                }
+                kept++;
+            }
+        }
+
+        if (kept < chain->messagekeys_size()) {
+            chain->mutable_messagekeys()->DeleteSubrange(kept, chain->messagekeys_size() - kept);
+        }
+    }
+
+    return hasSenderChain() || sessionStructure->receiverchains_size() > 0
+        || sessionStructure->has_pendingkeyexchange() || sessionStructure->has_pendingprekey();
 }
@@ -7,6 +7,8 @@
 #include "../ratchet/chainkey.h"
 #include "../identitykeypair.h"
 #include "../ecc/djbec.h"
+#include "compactionpolicy.h"
+#include "../util/securearena.h"
 
 class UnacknowledgedPreKeyMessageItems
 {
@@ -22,16 +24,61 @@ private:
     DjbECPublicKey baseKey;
 };
 
+// Fields touched on every encrypt/decrypt, packed into two aligned cache
+// lines of a SecureArena slot. They are authoritative while the state is in memory
+// and get written back into the cold SessionStructure only when the state
+// is serialized.
+struct alignas(64) SessionHotState
+{
+    enum Flags {
+        HasSenderChain           = 0x0001,
+        RootKeyCold              = 0x0002,
+        SenderChainCold          = 0x0004,
+        RootKeyDirty             = 0x0010,
+        SenderChainDirty         = 0x0020,
+        SessionVersionDirty      = 0x0040,
+        PreviousCounterDirty     = 0x0080,
+        RemoteRegistrationDirty  = 0x0100,
+        LocalRegistrationDirty   = 0x0200,
+        DirtyMask                = 0x03F0
+    };
+
+    static const int KEY_LENGTH         = 32;
+    static const int PUBLIC_KEY_LENGTH  = 33;
+
+    quint8  rootKey[KEY_LENGTH];
+    quint8  senderChainKey[KEY_LENGTH];
+    quint8  senderRatchetKey[PUBLIC_KEY_LENGTH];
+    quint8  rootKeyLength;
+    quint8  senderChainKeyLength;
+    quint8  senderRatchetKeyLength;
+    quint16 flags;
+    quint32 senderChainIndex;
+    quint32 sessionVersion;
+    quint32 previousCounter;
+    quint32 remoteRegistrationId;
+    quint32 localRegistrationId;
+};
+
+Q_STATIC_ASSERT(sizeof(SessionHotState) == 2 * SecureArena::CACHE_LINE_SIZE);
+
 class SessionState
 {
 public:
     static const int MAX_MESSAGE_KEYS = 2000;
+    static const int MAX_RECEIVER_CHAINS = 5;
 
-    SessionState();
-    SessionState(const textsecure::SessionStructure &sessionSctucture);
-    SessionState(const SessionState &copy);
+    // The hot header, keys included, lives in a slot of arena, e.g. the one
+    // of the owning SessionRecord. Without one the state makes its own.
+    explicit SessionState(SecureArena *arena = 0);
+    SessionState(const textsecure::SessionStructure &sessionSctucture, SecureArena *arena = 0);
+    SessionState(const SessionState &copy, SecureArena *arena = 0);
+    ~SessionState();
+    SessionState &operator=(const SessionState &copy);
 
+    // Returns a copy holding key material, wipe it with wipeStructure()
     textsecure::SessionStructure getStructure() const;
+    void copyStructureTo(textsecure::SessionStructure *structure) const;
     QByteArray getAliceBaseKey() const;
     void setAliceBaseKey(const QByteArray &aliceBaseKey);
     void setSessionVersion(int version);
@@ -54,6 +101,7 @@ public:
     void addReceiverChain(const DjbECPublicKey &senderRatchetKey, const ChainKey &chainKey);
     void setSenderChain(const ECKeyPair &senderRatchetKeyPair, const ChainKey &chainKey);
     ChainKey getSenderChainKey() const;
+    uint getSenderChainIndex() const;
     void setSenderChainKey(const ChainKey &nextChainKey);
     bool hasMessageKeys(const DjbECPublicKey &senderEphemeral, uint counter);
     MessageKeys removeMessageKeys(const DjbECPublicKey &senderEphemeral, uint counter);
@@ -77,9 +125,20 @@ public:
     void setLocalRegistrationId(int registrationId);
     int getLocalRegistrationId() const;
     QByteArray serialize() const;
+    void wipe();
+    static void wipeStructure(textsecure::SessionStructure *structure);
+    bool compact(const CompactionPolicy &policy, CompactionStats &stats);
 
 private:
-    textsecure::SessionStructure sessionStructure;
+    void allocateHotState(SecureArena *arena);
+    void loadHotState();
+    void flushHotState() const;
+    void setSenderChainHot(const QByteArray &senderRatchetKey, const QByteArray &chainKey, uint index);
+
+    SessionHotState               *hot;
+    SecureArena                   *arena;
+    SecureArena                   *ownedArena;
+    textsecure::SessionStructure  *sessionStructure;
 
 };
 
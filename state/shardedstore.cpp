@@ -0,0 +1,309 @@
+#include "shardedstore.h"
+
+#include "../util/addresskey.h"
+#include "../whisperexception.h"
+
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QWriteLocker>
+
+const ShardedAxolotlStore::Shard &ShardedAxolotlStore::Layout::shardFor(const QString &name) const
+{
+    return shards.constFind(ring.nodeFor(name)).value();
+}
+
+ShardedAxolotlStore::Route::Route(const ShardedAxolotlStore *router, const QString &name)
+    : layoutLocker(&router->layoutLock)
+{
+    this->moved            = false;
+    this->migratedSessions = 0;
+    this->stripe           = 0;
+
+    shard = router->current->shardFor(name);
+    if (!router->previous) {
+        return;
+    }
+
+    previousShard = router->previous->shardFor(name);
+    if (previousShard.id == shard.id) {
+        return;
+    }
+
+    moved  = true;
+    stripe = &router->current->stripes[AddressUtil::stripe(name, MIGRATION_STRIPES)];
+    stripe->mutex.lock();
+
+    // The destructor doesn't run for a constructor that throws
+    try {
+        if (!stripe->migrated.contains(name)) {
+            migratedSessions = router->migrateSessions(name, previousShard, shard);
+            stripe->migrated.insert(name);
+        }
+    } catch (...) {
+        stripe->mutex.unlock();
+        throw;
+    }
+}
+
+ShardedAxolotlStore::Route::~Route()
+{
+    if (stripe) {
+        stripe->mutex.unlock();
+    }
+}
+
+ShardedAxolotlStore::ShardedAxolotlStore(const QList<Shard> &shards, int virtualNodes)
+{
+    this->virtualNodes = virtualNodes;
+    this->current      = buildLayout(shards);
+}
+
+IdentityKeyPair ShardedAxolotlStore::getIdentityKeyPair()
+{
+    return primary().store->getIdentityKeyPair();
+}
+
+uint ShardedAxolotlStore::getLocalRegistrationId()
+{
+    return primary().store->getLocalRegistrationId();
+}
+
+void ShardedAxolotlStore::storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair)
+{
+    primary().store->storeLocalData(registrationId, identityKeyPair);
+}
+
+void ShardedAxolotlStore::saveIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    primary().store->saveIdentity(name, identityKey);
+}
+
+bool ShardedAxolotlStore::isTrustedIdentity(const QString &name, const IdentityKey &identityKey)
+{
+    return primary().store->isTrustedIdentity(name, identityKey);
+}
+
+void ShardedAxolotlStore::removeIdentity(const QString &name)
+{
+    primary().store->removeIdentity(name);
+}
+
+PreKeyRecord ShardedAxolotlStore::loadPreKey(qulonglong preKeyId)
+{
+    return primary().store->loadPreKey(preKeyId);
+}
+
+void ShardedAxolotlStore::storePreKey(qulonglong preKeyId, const PreKeyRecord &record)
+{
+    primary().store->storePreKey(preKeyId, record);
+}
+
+bool ShardedAxolotlStore::containsPreKey(qulonglong preKeyId)
+{
+    return primary().store->containsPreKey(preKeyId);
+}
+
+void ShardedAxolotlStore::removePreKey(qulonglong preKeyId)
+{
+    primary().store->removePreKey(preKeyId);
+}
+
+int ShardedAxolotlStore::countPreKeys()
+{
+    return primary().store->countPreKeys();
+}
+
+SessionRecord *ShardedAxolotlStore::loadSession(const AxolotlAddress &remoteAddress)
+{
+    Route route(this, remoteAddress.getName());
+    return route.shard.store->loadSession(remoteAddress);
+}
+
+QList<int> ShardedAxolotlStore::getSubDeviceSessions(const QString &name)
+{
+    Route route(this, name);
+    return route.shard.store->getSubDeviceSessions(name);
+}
+
+void ShardedAxolotlStore::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    Route route(this, remoteAddress.getName());
+    route.shard.store->storeSession(remoteAddress, record);
+}
+
+bool ShardedAxolotlStore::containsSession(const AxolotlAddress &remoteAddress)
+{
+    Route route(this, remoteAddress.getName());
+    return route.shard.store->containsSession(remoteAddress);
+}
+
+void ShardedAxolotlStore::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    Route route(this, remoteAddress.getName());
+    route.shard.store->deleteSession(remoteAddress);
+}
+
+void ShardedAxolotlStore::deleteAllSessions(const QString &name)
+{
+    Route route(this, name);
+    route.shard.store->deleteAllSessions(name);
+}
+
+SignedPreKeyRecord ShardedAxolotlStore::loadSignedPreKey(qulonglong signedPreKeyId)
+{
+    return primary().store->loadSignedPreKey(signedPreKeyId);
+}
+
+QList<SignedPreKeyRecord> ShardedAxolotlStore::loadSignedPreKeys()
+{
+    return primary().store->loadSignedPreKeys();
+}
+
+void ShardedAxolotlStore::storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record)
+{
+    primary().store->storeSignedPreKey(signedPreKeyId, record);
+}
+
+bool ShardedAxolotlStore::containsSignedPreKey(qulonglong signedPreKeyId)
+{
+    return primary().store->containsSignedPreKey(signedPreKeyId);
+}
+
+void ShardedAxolotlStore::removeSignedPreKey(qulonglong signedPreKeyId)
+{
+    primary().store->removeSignedPreKey(signedPreKeyId);
+}
+
+void ShardedAxolotlStore::storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record)
+{
+    Route route(this, senderKeyName.getSender().getName());
+    if (!route.shard.senderKeyStore) {
+        throw WhisperException("ShardedAxolotlStore", "No sender key store on shard " + route.shard.id);
+    }
+    route.shard.senderKeyStore->storeSenderKey(senderKeyName, record);
+}
+
+SenderKeyRecord ShardedAxolotlStore::loadSenderKey(const SenderKeyName &senderKeyName) const
+{
+    Route route(this, senderKeyName.getSender().getName());
+    if (!route.shard.senderKeyStore) {
+        throw WhisperException("ShardedAxolotlStore", "No sender key store on shard " + route.shard.id);
+    }
+
+    // Sender keys not moved yet are still read from their previous shard
+    SenderKeyRecord record = route.shard.senderKeyStore->loadSenderKey(senderKeyName);
+    if (record.isEmpty() && route.moved && route.previousShard.senderKeyStore) {
+        record = route.previousShard.senderKeyStore->loadSenderKey(senderKeyName);
+    }
+    return record;
+}
+
+void ShardedAxolotlStore::setShards(const QList<Shard> &shards)
+{
+    LayoutPointer layout = buildLayout(shards);
+
+    QWriteLocker locker(&layoutLock);
+    if (previous) {
+        throw WhisperException("ShardedAxolotlStore", "Finish the running rebalance first");
+    }
+    if (layout->primary.id != current->primary.id) {
+        throw WhisperException("ShardedAxolotlStore", "The primary shard can't change");
+    }
+
+    previous = current;
+    current  = layout;
+}
+
+int ShardedAxolotlStore::rebalance(const QStringList &names)
+{
+    int moved = 0;
+    foreach (const QString &name, names) {
+        Route route(this, name);
+        moved += route.migratedSessions;
+    }
+    return moved;
+}
+
+int ShardedAxolotlStore::rebalanceSenderKeys(const QList<SenderKeyName> &senderKeyNames)
+{
+    int moved = 0;
+    foreach (const SenderKeyName &senderKeyName, senderKeyNames) {
+        Route route(this, senderKeyName.getSender().getName());
+        if (!route.moved || !route.shard.senderKeyStore || !route.previousShard.senderKeyStore) {
+            continue;
+        }
+
+        // SenderKeyStore has no delete, the old copy stays behind unused
+        SenderKeyRecord record = route.previousShard.senderKeyStore->loadSenderKey(senderKeyName);
+        if (!record.isEmpty() && route.shard.senderKeyStore->loadSenderKey(senderKeyName).isEmpty()) {
+            route.shard.senderKeyStore->storeSenderKey(senderKeyName, record);
+            moved++;
+        }
+    }
+    return moved;
+}
+
+void ShardedAxolotlStore::finishRebalance()
+{
+    QWriteLocker locker(&layoutLock);
+    previous.clear();
+}
+
+bool ShardedAxolotlStore::isRebalancing() const
+{
+    QReadLocker locker(&layoutLock);
+    return !previous.isNull();
+}
+
+QString ShardedAxolotlStore::shardFor(const QString &name) const
+{
+    QReadLocker locker(&layoutLock);
+    return current->shardFor(name).id;
+}
+
+ShardedAxolotlStore::LayoutPointer ShardedAxolotlStore::buildLayout(const QList<Shard> &shards) const
+{
+    if (shards.isEmpty()) {
+        throw WhisperException("ShardedAxolotlStore", "No shards");
+    }
+
+    QSharedPointer<Layout> layout(new Layout(virtualNodes));
+    foreach (const Shard &shard, shards) {
+        if (shard.id.isEmpty() || !shard.store || layout->shards.contains(shard.id)) {
+            throw WhisperException("ShardedAxolotlStore", "Invalid or duplicate shard " + shard.id);
+        }
+        layout->ring.addNode(shard.id);
+        layout->shards.insert(shard.id, shard);
+    }
+    layout->primary = shards.first();
+
+    return layout;
+}
+
+ShardedAxolotlStore::Shard ShardedAxolotlStore::primary() const
+{
+    QReadLocker locker(&layoutLock);
+    return current->primary;
+}
+
+int ShardedAxolotlStore::migrateSessions(const QString &name, const Shard &from, const Shard &to) const
+{
+    QList<int> deviceIds = from.store->getSubDeviceSessions(name);
+    if (from.store->containsSession(AxolotlAddress(name, 1))) {
+        deviceIds.prepend(1);
+    }
+
+    int moved = 0;
+    foreach (int deviceId, deviceIds) {
+        AxolotlAddress address(name, deviceId);
+
+        // A session written to the new shard already is the newer one
+        if (!to.store->containsSession(address)) {
+            to.store->storeSession(address, from.store->loadSession(address));
+            moved++;
+        }
+        from.store->deleteSession(address);
+    }
+
+    return moved;
+}
@@ -0,0 +1,130 @@
+#ifndef SHARDEDSTORE_H
+#define SHARDEDSTORE_H
+
+#include <QSharedPointer>
+#include <QStringList>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <QList>
+
+#include "axolotlstore.h"
+#include "../groups/state/senderkeystore.h"
+#include "../util/hashring.h"
+
+// Routes sessions and sender keys to one of several backend stores by the
+// remote name on a consistent hash ring, so all devices of a name, and
+// getSubDeviceSessions() / deleteAllSessions() for it, land on one shard.
+// Identities, the local identity and prekeys can't be enumerated or moved
+// and stay on the primary shard, the first one in the list.
+//
+// setShards() switches to a new layout and starts a rebalance: until
+// finishRebalance() the previous layout is consulted, and the sessions of
+// a name that changed shards are moved over on first use. rebalance()
+// moves the names the caller knows about up front. Every routed call holds
+// the layout for its whole duration, so setShards() and finishRebalance()
+// wait for the calls still working with the old one.
+class ShardedAxolotlStore : public AxolotlStore, public SenderKeyStore
+{
+public:
+    static const int MIGRATION_STRIPES = 64;
+
+    struct Shard {
+        QString                        id;
+        QSharedPointer<AxolotlStore>   store;
+        QSharedPointer<SenderKeyStore> senderKeyStore;
+    };
+
+    ShardedAxolotlStore(const QList<Shard> &shards, int virtualNodes = 128);
+
+    IdentityKeyPair getIdentityKeyPair();
+    uint getLocalRegistrationId();
+    void storeLocalData(qulonglong registrationId, const IdentityKeyPair identityKeyPair);
+    void saveIdentity(const QString &name, const IdentityKey &identityKey);
+    bool isTrustedIdentity(const QString &name, const IdentityKey &identityKey);
+    void removeIdentity(const QString &name);
+
+    PreKeyRecord loadPreKey(qulonglong preKeyId);
+    void storePreKey(qulonglong preKeyId, const PreKeyRecord &record);
+    bool containsPreKey(qulonglong preKeyId);
+    void removePreKey(qulonglong preKeyId);
+    int countPreKeys();
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    SignedPreKeyRecord loadSignedPreKey(qulonglong signedPreKeyId);
+    QList<SignedPreKeyRecord> loadSignedPreKeys();
+    void storeSignedPreKey(qulonglong signedPreKeyId, const SignedPreKeyRecord &record);
+    bool containsSignedPreKey(qulonglong signedPreKeyId);
+    void removeSignedPreKey(qulonglong signedPreKeyId);
+
+    void storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record);
+    SenderKeyRecord loadSenderKey(const SenderKeyName &senderKeyName) const;
+
+    // The primary shard has to stay first
+    void setShards(const QList<Shard> &shards);
+    int rebalance(const QStringList &names);
+    int rebalanceSenderKeys(const QList<SenderKeyName> &senderKeyNames);
+    void finishRebalance();
+    bool isRebalancing() const;
+
+    QString shardFor(const QString &name) const;
+
+private:
+    struct MigrationStripe {
+        QMutex          mutex;
+        QSet<QString>   migrated;
+    };
+
+    struct Layout {
+        Layout(int virtualNodes) : ring(virtualNodes) {}
+
+        HashRing                 ring;
+        QHash<QString, Shard>    shards;
+        Shard                    primary;
+
+        // Names already moved into this layout during a rebalance
+        mutable MigrationStripe  stripes[MIGRATION_STRIPES];
+
+        const Shard &shardFor(const QString &name) const;
+    };
+
+    typedef QSharedPointer<const Layout> LayoutPointer;
+
+    // Resolves the owner of a name and keeps the layout from changing until
+    // the route goes out of scope. While a rebalance is running and the
+    // name changed shards, its sessions are moved over first and the name
+    // stays locked as well.
+    class Route
+    {
+    public:
+        Route(const ShardedAxolotlStore *router, const QString &name);
+        ~Route();
+
+        Shard shard;
+        Shard previousShard;
+        bool  moved;
+        int   migratedSessions;
+
+    private:
+        QReadLocker      layoutLocker;
+        MigrationStripe *stripe;
+    };
+
+    LayoutPointer buildLayout(const QList<Shard> &shards) const;
+    Shard primary() const;
+    int migrateSessions(const QString &name, const Shard &from, const Shard &to) const;
+
+    int                      virtualNodes;
+    mutable QReadWriteLock   layoutLock;
+    LayoutPointer            current;
+    LayoutPointer            previous;
+};
+
+#endif // SHARDEDSTORE_H
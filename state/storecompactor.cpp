@@ -0,0 +1,203 @@
+#include "storecompactor.h"
+#include "versionedsessionstore.h"
+
+#include "../concurrent/functionrunnable.h"
+#include "../whisperexception.h"
+
+#include <QMutexLocker>
+#include <QScopedPointer>
+#include <QThreadPool>
+#include <QThread>
+#include <QDebug>
+
+CompactionReport &CompactionReport::operator+=(const CompactionReport &other)
+{
+    scanned     += other.scanned;
+    rewritten   += other.rewritten;
+    failed      += other.failed;
+    conflicts   += other.conflicts;
+    bytesBefore += other.bytesBefore;
+    bytesAfter  += other.bytesAfter;
+    stats       += other.stats;
+    return *this;
+}
+
+StoreCompactor::StoreCompactor(const CompactionPolicy &policy, int threads, bool dryRun)
+{
+    this->policy  = policy;
+    this->threads = threads > 0 ? threads : QThread::idealThreadCount();
+    this->dryRun  = dryRun;
+    this->offline = false;
+}
+
+void StoreCompactor::setOffline(bool offline)
+{
+    this->offline = offline;
+}
+
+CompactionReport StoreCompactor::compactSessions(SessionStore *store, const QList<AxolotlAddress> &addresses)
+{
+    CompactionReport report;
+
+    VersionedSessionStore *versionedStore = dynamic_cast<VersionedSessionStore*>(store);
+    if (versionedStore) {
+        forEachChunk(addresses.size(), [&](int i, CompactionReport &chunkReport) {
+            const AxolotlAddress &address = addresses.at(i);
+            quint64               version = 0;
+
+            QScopedPointer<SessionRecord> record;
+            {
+                QMutexLocker locker(&storeMutex);
+                record.reset(versionedStore->loadSessionVersioned(address, &version));
+            }
+            if (record->isFresh()) {
+                return;
+            }
+
+            QByteArray      before = record->serialize();
+            CompactionStats stats  = record->compact(policy);
+
+            chunkReport.scanned++;
+            chunkReport.bytesBefore += before.size();
+
+            if (stats.isEmpty()) {
+                chunkReport.bytesAfter += before.size();
+                return;
+            }
+
+            if (!dryRun) {
+                // Live traffic wrote a newer version, that one gets compacted next time
+                QMutexLocker locker(&storeMutex);
+                if (!versionedStore->compareAndSetSession(address, version, record.data())) {
+                    chunkReport.bytesAfter += before.size();
+                    chunkReport.conflicts++;
+                    return;
+                }
+            }
+
+            chunkReport.bytesAfter += record->serialize().size();
+            chunkReport.stats      += stats;
+            chunkReport.rewritten++;
+        }, report);
+
+        return report;
+    }
+
+    if (!offline) {
+        throw WhisperException("StoreCompactor", "Only a VersionedSessionStore can be compacted while online");
+    }
+
+    forEachChunk(addresses.size(), [&](int i, CompactionReport &chunkReport) {
+        const AxolotlAddress &address = addresses.at(i);
+        SessionRecord        *record  = 0;
+
+        {
+            QMutexLocker locker(&storeMutex);
+            if (!store->containsSession(address)) {
+                return;
+            }
+            record = store->loadSession(address);
+        }
+
+        QByteArray      before = record->serialize();
+        SessionRecord   copy(before);
+        CompactionStats stats  = copy.compact(policy);
+
+        chunkReport.scanned++;
+        chunkReport.bytesBefore += before.size();
+
+        if (stats.isEmpty()) {
+            chunkReport.bytesAfter += before.size();
+            return;
+        }
+
+        chunkReport.bytesAfter += copy.serialize().size();
+        chunkReport.stats      += stats;
+        chunkReport.rewritten++;
+
+        if (!dryRun) {
+            // Nothing else uses an offline store, its own record can be compacted in place
+            QMutexLocker locker(&storeMutex);
+            record->compact(policy);
+            store->storeSession(address, record);
+        }
+    }, report);
+
+    return report;
+}
+
+CompactionReport StoreCompactor::compactSenderKeys(SenderKeyStore *store, const QList<SenderKeyName> &senderKeyNames)
+{
+    CompactionReport report;
+
+    if (!offline) {
+        throw WhisperException("StoreCompactor", "Sender key stores can only be compacted offline");
+    }
+
+    forEachChunk(senderKeyNames.size(), [&](int i, CompactionReport &chunkReport) {
+        const SenderKeyName &senderKeyName = senderKeyNames.at(i);
+        QByteArray           before;
+
+        {
+            QMutexLocker locker(&storeMutex);
+            SenderKeyRecord loaded = store->loadSenderKey(senderKeyName);
+            if (loaded.isEmpty()) {
+                return;
+            }
+            before = loaded.serialize();
+        }
+
+        // A deep copy, records returned by value share their states with the store's
+        SenderKeyRecord record(before);
+        CompactionStats stats = record.compact(policy);
+
+        chunkReport.scanned++;
+        chunkReport.bytesBefore += before.size();
+
+        if (stats.isEmpty()) {
+            chunkReport.bytesAfter += before.size();
+            return;
+        }
+
+        chunkReport.bytesAfter += record.serialize().size();
+        chunkReport.stats      += stats;
+        chunkReport.rewritten++;
+
+        if (!dryRun) {
+            QMutexLocker locker(&storeMutex);
+            store->storeSenderKey(senderKeyName, record);
+        }
+    }, report);
+
+    return report;
+}
+
+void StoreCompactor::forEachChunk(int count, const std::function<void(int, CompactionReport&)> &compactOne,
+                                  CompactionReport &report)
+{
+    QMutex      reportMutex;
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+
+    int chunk = qMax(1, count / (threads * 4));
+    for (int start = 0; start < count; start += chunk) {
+        int end = qMin(count, start + chunk);
+        FunctionRunnable::start(&pool, [&, start, end]() {
+            CompactionReport chunkReport;
+
+            for (int i = start; i < end; i++) {
+                try {
+                    compactOne(i, chunkReport);
+                } catch (const WhisperException &e) {
+                    qWarning() << "Skipping record:" << e.errorType() << e.errorMessage();
+                    chunkReport.failed++;
+                }
+            }
+
+            QMutexLocker locker(&reportMutex);
+            report += chunkReport;
+        });
+    }
+
+    pool.waitForDone();
+}
@@ -0,0 +1,61 @@
+#ifndef STORECOMPACTOR_H
+#define STORECOMPACTOR_H
+
+#include <QMutex>
+#include <QList>
+
+#include <functional>
+
+#include "sessionstore.h"
+#include "compactionpolicy.h"
+#include "../axolotladdress.h"
+#include "../groups/state/senderkeystore.h"
+#include "../groups/senderkeyname.h"
+
+struct CompactionReport
+{
+    int             scanned     = 0;
+    int             rewritten   = 0;
+    int             failed      = 0;
+    int             conflicts   = 0;
+    qint64          bytesBefore = 0;
+    qint64          bytesAfter  = 0;
+    CompactionStats stats;
+
+    qint64 bytesReclaimed() const { return bytesBefore - bytesAfter; }
+    CompactionReport &operator+=(const CompactionReport &other);
+};
+
+// Rewrites the records of a store under a CompactionPolicy. Records are
+// compacted on a thread pool, calls into the store itself are serialized
+// since stores are not required to be thread safe. Only records that
+// actually shrink are stored back; with dryRun nothing is.
+//
+// A VersionedSessionStore may keep serving traffic: a copy is compacted
+// and published with compareAndSetSession(), and a record that changed in
+// the meantime is counted as a conflict and left for the next run. Any
+// other store is only compacted after setOffline(true), the caller's
+// promise that nothing else touches it, and a WhisperException is thrown
+// otherwise. Sender key stores have no versioned form and always need it.
+class StoreCompactor
+{
+public:
+    StoreCompactor(const CompactionPolicy &policy = CompactionPolicy(), int threads = 0, bool dryRun = false);
+
+    void setOffline(bool offline);
+
+    CompactionReport compactSessions(SessionStore *store, const QList<AxolotlAddress> &addresses);
+    CompactionReport compactSenderKeys(SenderKeyStore *store, const QList<SenderKeyName> &senderKeyNames);
+
+private:
+    void forEachChunk(int count, const std::function<void(int, CompactionReport&)> &compactOne,
+                      CompactionReport &report);
+
+    CompactionPolicy policy;
+    int              threads;
+    bool             dryRun;
+    bool             offline;
+    QMutex           storeMutex;
+};
+
+#endif // STORECOMPACTOR_H
@@ -0,0 +1,26 @@
+#ifndef VERSIONEDSESSIONSTORE_H
+#define VERSIONEDSESSIONSTORE_H
+
+#include "sessionrecord.h"
+
+#include "../axolotladdress.h"
+
+// Optional contract for session stores shared between nodes. Every stored
+// record carries a version that changes on each write; a writer only
+// succeeds if nobody else wrote since it loaded, so two nodes handling the
+// same peer can't fork the ratchet. SessionCipher uses it, and retries on
+// conflict, when its SessionStore also implements this interface.
+class VersionedSessionStore
+{
+public:
+    virtual ~VersionedSessionStore() {}
+
+    // Returns a copy owned by the caller, a fresh record if there is none
+    virtual SessionRecord *loadSessionVersioned(const AxolotlAddress &remoteAddress, quint64 *version) = 0;
+
+    // Stores a copy of record if the stored version is still expectedVersion, false otherwise
+    virtual bool compareAndSetSession(const AxolotlAddress &remoteAddress, quint64 expectedVersion,
+                                      SessionRecord *record) = 0;
+};
+
+#endif // VERSIONEDSESSIONSTORE_H
@@ -0,0 +1,21 @@
+TEMPLATE = app
+
+TARGET = axolotl-compact
+CONFIG += console c++11
+CONFIG -= app_bundle
+QT -= gui
+
+CONFIG += link_pkgconfig
+PKGCONFIG += openssl libssl libcrypto
+
+INCLUDEPATH += ../..
+LIBS += -L../.. -laxolotl
+LIBS += -L../../../libcurve25519 -lcurve25519
+LIBS += /usr/lib/libprotobuf.a
+
+HEADERS += \
+    recorddirectory.h
+
+SOURCES += \
+    recorddirectory.cpp \
+    main.cpp
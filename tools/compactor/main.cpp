@@ -0,0 +1,90 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QDir>
+
+#include "recorddirectory.h"
+#include "state/storecompactor.h"
+
+static void printReport(QTextStream &out, const char *name, const CompactionReport &report)
+{
+    out << QString("%1 %2 records, %3 rewritten, %4 failed, %5 conflicts")
+           .arg(name, -12).arg(report.scanned).arg(report.rewritten).arg(report.failed).arg(report.conflicts)
+        << endl;
+    out << QString("%1 %2 -> %3 bytes, %4 reclaimed (%5%)")
+           .arg("", -12).arg(report.bytesBefore).arg(report.bytesAfter).arg(report.bytesReclaimed())
+           .arg(report.bytesBefore > 0 ? 100.0 * report.bytesReclaimed() / report.bytesBefore : 0.0, 0, 'f', 1)
+        << endl;
+    out << QString("%1 dropped %2 archived states, %3 receiver chains, %4 skipped keys, %5 sender key states")
+           .arg("", -12)
+           .arg(report.stats.archivedStatesDropped).arg(report.stats.receiverChainsDropped)
+           .arg(report.stats.skippedKeysDropped).arg(report.stats.senderKeyStatesDropped)
+        << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("axolotl-compact");
+
+    CompactionPolicy defaults;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compacts a directory of serialized session and sender key records. "
+                                     "Offline only: nothing else may read or write the directory while it runs.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("directory", "Directory with one record per file.");
+
+    QCommandLineOption archivedOption("max-archived", "Archived session states kept per record.", "n", QString::number(defaults.maxArchivedStates));
+    QCommandLineOption chainsOption("max-chains", "Receiver chains kept per session state.", "n", QString::number(defaults.maxReceiverChains));
+    QCommandLineOption skippedOption("max-skipped", "Skipped message keys kept per chain.", "n", QString::number(defaults.maxSkippedKeys));
+    QCommandLineOption distanceOption("max-distance", "Drop skipped keys this many messages behind their chain, 0 keeps them.", "n", QString::number(defaults.maxSkippedKeyDistance));
+    QCommandLineOption senderStatesOption("max-sender-states", "Sender key states kept per record.", "n", QString::number(defaults.maxSenderKeyStates));
+    QCommandLineOption senderKeysOption("max-sender-keys", "Skipped sender message keys kept per state.", "n", QString::number(defaults.maxSenderMessageKeys));
+    QCommandLineOption threadsOption("threads", "Worker threads, 0 for one per core.", "n", "0");
+    QCommandLineOption dryRunOption("dry-run", "Report what would be reclaimed without writing.");
+
+    parser.addOption(archivedOption);
+    parser.addOption(chainsOption);
+    parser.addOption(skippedOption);
+    parser.addOption(distanceOption);
+    parser.addOption(senderStatesOption);
+    parser.addOption(senderKeysOption);
+    parser.addOption(threadsOption);
+    parser.addOption(dryRunOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+
+    QString directory = parser.positionalArguments().first();
+    if (!QDir(directory).exists()) {
+        QTextStream(stderr) << "No such directory " << directory << endl;
+        return 1;
+    }
+
+    CompactionPolicy policy;
+    policy.maxArchivedStates     = parser.value(archivedOption).toInt();
+    policy.maxReceiverChains     = parser.value(chainsOption).toInt();
+    policy.maxSkippedKeys        = parser.value(skippedOption).toInt();
+    policy.maxSkippedKeyDistance = parser.value(distanceOption).toUInt();
+    policy.maxSenderKeyStates    = parser.value(senderStatesOption).toInt();
+    policy.maxSenderMessageKeys  = parser.value(senderKeysOption).toInt();
+
+    RecordDirectory store(directory);
+    StoreCompactor  compactor(policy, parser.value(threadsOption).toInt(), parser.isSet(dryRunOption));
+    compactor.setOffline(true);
+
+    CompactionReport sessions   = compactor.compactSessions(&store, store.sessionAddresses());
+    CompactionReport senderKeys = compactor.compactSenderKeys(&store, store.senderKeyNames());
+
+    QTextStream out(stdout);
+    if (parser.isSet(dryRunOption)) {
+        out << "dry run, nothing written" << endl;
+    }
+    printReport(out, "sessions", sessions);
+    printReport(out, "sender keys", senderKeys);
+
+    return sessions.failed + senderKeys.failed > 0 ? 2 : 0;
+}
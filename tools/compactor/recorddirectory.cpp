@@ -0,0 +1,162 @@
+#include "recorddirectory.h"
+
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <QDebug>
+
+static QString encode(const QString &name)
+{
+    return QString::fromLatin1(QUrl::toPercentEncoding(name, QByteArray(), "."));
+}
+
+static QString decode(const QString &name)
+{
+    return QUrl::fromPercentEncoding(name.toLatin1());
+}
+
+RecordDirectory::RecordDirectory(const QString &path)
+{
+    this->path = path;
+}
+
+RecordDirectory::~RecordDirectory()
+{
+    qDeleteAll(loaded);
+}
+
+QList<AxolotlAddress> RecordDirectory::sessionAddresses() const
+{
+    QList<AxolotlAddress> addresses;
+
+    foreach (const QString &fileName, QDir(path).entryList(QDir::Files)) {
+        QStringList parts = fileName.split('.');
+        bool        ok    = false;
+        int         deviceId = parts.last().toInt(&ok);
+        if (parts.size() == 2 && ok) {
+            addresses.append(AxolotlAddress(decode(parts.first()), deviceId));
+        }
+    }
+
+    return addresses;
+}
+
+QList<SenderKeyName> RecordDirectory::senderKeyNames() const
+{
+    QList<SenderKeyName> names;
+
+    foreach (const QString &fileName, QDir(path).entryList(QDir::Files)) {
+        QStringList parts = fileName.split('.');
+        bool        ok    = false;
+        int         deviceId = parts.last().toInt(&ok);
+        if (parts.size() == 3 && ok) {
+            names.append(SenderKeyName(decode(parts.at(0)), AxolotlAddress(decode(parts.at(1)), deviceId)));
+        }
+    }
+
+    return names;
+}
+
+SessionRecord *RecordDirectory::loadSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    AddressKey   key = AddressUtil::toKey(remoteAddress);
+
+    // The directory owns the records it hands out, like the other stores
+    SessionRecord *record = loaded.value(key);
+    if (record) {
+        return record;
+    }
+
+    QFile file(sessionPath(remoteAddress));
+    if (file.open(QIODevice::ReadOnly)) {
+        record = new SessionRecord(file.readAll());
+    } else {
+        record = new SessionRecord();
+    }
+    loaded.insert(key, record);
+    return record;
+}
+
+QList<int> RecordDirectory::getSubDeviceSessions(const QString &name)
+{
+    QList<int> deviceIds;
+    foreach (const AxolotlAddress &address, sessionAddresses()) {
+        if (address.getName() == name && address.getDeviceId() != 1) {
+            deviceIds.append(address.getDeviceId());
+        }
+    }
+    return deviceIds;
+}
+
+void RecordDirectory::storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record)
+{
+    write(sessionPath(remoteAddress), record->serialize());
+
+    // Nothing reads a record again once it is written back, don't keep it around
+    QMutexLocker locker(&mutex);
+    AddressKey   key = AddressUtil::toKey(remoteAddress);
+    if (loaded.value(key) == record) {
+        delete loaded.take(key);
+    }
+}
+
+bool RecordDirectory::containsSession(const AxolotlAddress &remoteAddress)
+{
+    return QFile::exists(sessionPath(remoteAddress));
+}
+
+void RecordDirectory::deleteSession(const AxolotlAddress &remoteAddress)
+{
+    QMutexLocker locker(&mutex);
+    delete loaded.take(AddressUtil::toKey(remoteAddress));
+    QFile::remove(sessionPath(remoteAddress));
+}
+
+void RecordDirectory::deleteAllSessions(const QString &name)
+{
+    deleteSession(AxolotlAddress(name, 1));
+    foreach (int deviceId, getSubDeviceSessions(name)) {
+        deleteSession(AxolotlAddress(name, deviceId));
+    }
+}
+
+void RecordDirectory::storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record)
+{
+    write(senderKeyPath(senderKeyName), record.serialize());
+}
+
+SenderKeyRecord RecordDirectory::loadSenderKey(const SenderKeyName &senderKeyName) const
+{
+    QFile file(senderKeyPath(senderKeyName));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return SenderKeyRecord();
+    }
+    return SenderKeyRecord(file.readAll());
+}
+
+QString RecordDirectory::sessionPath(const AxolotlAddress &address) const
+{
+    return QDir(path).filePath(QString("%1.%2").arg(encode(address.getName())).arg(address.getDeviceId()));
+}
+
+QString RecordDirectory::senderKeyPath(const SenderKeyName &senderKeyName) const
+{
+    AxolotlAddress sender = senderKeyName.getSender();
+    return QDir(path).filePath(QString("%1.%2.%3")
+                               .arg(encode(senderKeyName.getGroupId()))
+                               .arg(encode(sender.getName()))
+                               .arg(sender.getDeviceId()));
+}
+
+bool RecordDirectory::write(const QString &path, const QByteArray &serialized)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(serialized) != serialized.size() || !file.commit()) {
+        qWarning() << "Can't write record" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
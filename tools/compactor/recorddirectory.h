@@ -0,0 +1,49 @@
+#ifndef RECORDDIRECTORY_H
+#define RECORDDIRECTORY_H
+
+#include <QString>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+
+#include "state/sessionstore.h"
+#include "groups/state/senderkeystore.h"
+#include "util/addresskey.h"
+
+// A store over a directory holding one serialized record per file, the
+// layout record exports and backups use. Session records are named
+// "<name>.<deviceId>", sender key records "<groupId>.<name>.<deviceId>",
+// names percent encoded.
+class RecordDirectory : public SessionStore, public SenderKeyStore
+{
+public:
+    RecordDirectory(const QString &path);
+    ~RecordDirectory();
+
+    QList<AxolotlAddress> sessionAddresses() const;
+    QList<SenderKeyName> senderKeyNames() const;
+
+    SessionRecord *loadSession(const AxolotlAddress &remoteAddress);
+    QList<int> getSubDeviceSessions(const QString &name);
+    void storeSession(const AxolotlAddress &remoteAddress, SessionRecord *record);
+    bool containsSession(const AxolotlAddress &remoteAddress);
+    void deleteSession(const AxolotlAddress &remoteAddress);
+    void deleteAllSessions(const QString &name);
+
+    void storeSenderKey(const SenderKeyName &senderKeyName, const SenderKeyRecord &record);
+    SenderKeyRecord loadSenderKey(const SenderKeyName &senderKeyName) const;
+
+private:
+    RecordDirectory(const RecordDirectory &);
+    RecordDirectory &operator=(const RecordDirectory &);
+
+    QString sessionPath(const AxolotlAddress &address) const;
+    QString senderKeyPath(const SenderKeyName &senderKeyName) const;
+    bool write(const QString &path, const QByteArray &serialized);
+
+    QString                             path;
+    QMutex                              mutex;
+    QHash<AddressKey, SessionRecord*>   loaded;
+};
+
+#endif // RECORDDIRECTORY_H
@@ -0,0 +1,101 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+#include <algorithm>
+
+#include "workloadreplayer.h"
+#include "util/randomsource.h"
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context);
+    if (type != QtDebugMsg) {
+        QTextStream(stderr) << message << endl;
+    }
+}
+
+static void printLatencies(QTextStream &out, const char *name, QVector<qint64> nanos)
+{
+    if (nanos.isEmpty()) {
+        return;
+    }
+
+    std::sort(nanos.begin(), nanos.end());
+    qint64 total = 0;
+    foreach (qint64 value, nanos) {
+        total += value;
+    }
+
+    out << QString("%1 %2 ops  mean %3 us  p50 %4 us  p99 %5 us  max %6 us")
+           .arg(name, -8)
+           .arg(nanos.size(), 8)
+           .arg(total / 1000.0 / nanos.size(), 0, 'f', 1)
+           .arg(nanos.at(nanos.size() / 2) / 1000.0, 0, 'f', 1)
+           .arg(nanos.at(qMin(nanos.size() - 1, (int)(nanos.size() * 0.99))) / 1000.0, 0, 'f', 1)
+           .arg(nanos.last() / 1000.0, 0, 'f', 1)
+        << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("axolotl-replay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a recorded libaxolotl workload against fresh in-memory stores.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "Trace written by WorkloadRecorder::save().");
+
+    QCommandLineOption seedOption("seed", "Seed for payloads and key generation.", "n", "1");
+    QCommandLineOption loopsOption("loops", "Replay the trace this many times, each on fresh stores.", "n", "1");
+    parser.addOption(seedOption);
+    parser.addOption(loopsOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+
+    QList<WorkloadRecorder::Event> events;
+    if (!WorkloadRecorder::load(parser.positionalArguments().first(), events)) {
+        QTextStream(stderr) << "Could not read trace " << parser.positionalArguments().first() << endl;
+        return 1;
+    }
+
+    qInstallMessageHandler(quietMessageHandler);
+
+    QTextStream out(stdout);
+    int         loops  = qMax(1, parser.value(loopsOption).toInt());
+    int         result = 0;
+    quint32     seed   = parser.value(seedOption).toUInt();
+
+    DeterministicRandomSource random(seed);
+    RandomSource::install(&random);
+
+    for (int loop = 0; loop < loops; loop++) {
+        // Every run starts from the same keys
+        random.reseed(seed);
+
+        WorkloadReplayer replayer(seed);
+        ReplayReport     report = replayer.replay(events);
+
+        out << QString("run %1: %2 events, %3 sessions, %4 failed, %5 unmatched, %6 s")
+               .arg(loop + 1)
+               .arg(report.events)
+               .arg(report.sessions)
+               .arg(report.failed)
+               .arg(report.unmatched)
+               .arg(report.wallNanos / 1e9, 0, 'f', 3)
+            << endl;
+        printLatencies(out, "setup", report.setupNanos);
+        printLatencies(out, "encrypt", report.encryptNanos);
+        printLatencies(out, "decrypt", report.decryptNanos);
+
+        if (report.unmatched > 0) {
+            result = 2;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,235 @@
+#include "workloadreplayer.h"
+
+#include "sessionbuilder.h"
+#include "whisperexception.h"
+#include "state/prekeybundle.h"
+#include "protocol/whispermessage.h"
+#include "protocol/prekeywhispermessage.h"
+#include "ecc/curve.h"
+#include "util/keyhelper.h"
+
+#include <QElapsedTimer>
+
+WorkloadReplayer::WorkloadReplayer(quint32 seed)
+{
+    this->seed = seed;
+}
+
+WorkloadReplayer::~WorkloadReplayer()
+{
+    qDeleteAll(sessions);
+}
+
+ReplayReport WorkloadReplayer::replay(const QList<WorkloadRecorder::Event> &events)
+{
+    ReplayReport  report;
+    QElapsedTimer wall;
+    QElapsedTimer timer;
+    wall.start();
+
+    foreach (const WorkloadRecorder::Event &event, events) {
+        Session *current = session(event.session);
+        report.events++;
+
+        switch (event.operation) {
+        case WorkloadRecorder::SessionSetup:
+            if (!current->local.store->containsSession(current->remote.address)) {
+                timer.start();
+                establish(current->local, current->remote);
+                report.setupNanos.append(timer.nsecsElapsed());
+            }
+            break;
+
+        case WorkloadRecorder::Encrypt: {
+            if (!current->local.store->containsSession(current->remote.address)) {
+                establish(current->local, current->remote);
+            }
+
+            QByteArray plaintext = payload(current, event.size);
+            InFlight   inFlight;
+            timer.start();
+            if (encrypt(current->local, plaintext, &inFlight)) {
+                report.encryptNanos.append(timer.nsecsElapsed());
+                current->toRemote.append(inFlight);
+            } else {
+                report.failed++;
+            }
+            break;
+        }
+
+        case WorkloadRecorder::DecryptWhisper:
+        case WorkloadRecorder::DecryptPreKey: {
+            ensureRemoteCanSend(current, report);
+
+            // A new recorded ratchet key means the peer saw our latest messages and stepped its ratchet
+            if (event.ratchetKey != current->remoteEpoch) {
+                deliverToRemote(current, report);
+                current->remoteEpoch = event.ratchetKey;
+                current->epochBase   = remoteSenderIndex(current);
+                current->produced.clear();
+            }
+
+            uint target   = current->epochBase + event.counter;
+            int  size     = qMax(0, (int)event.size - 1);
+            bool produced = true;
+            while (produced && remoteSenderIndex(current) <= target) {
+                uint     index = remoteSenderIndex(current);
+                InFlight inFlight;
+                produced = encrypt(current->remote, payload(current, size), &inFlight);
+                if (produced) {
+                    current->produced.insert(index, inFlight);
+                }
+            }
+
+            if (!produced) {
+                report.failed++;
+                break;
+            }
+
+            if (!current->produced.contains(target)) {
+                report.unmatched++;
+                break;
+            }
+
+            timer.start();
+            if (decrypt(current->local, current->produced.value(target))) {
+                report.decryptNanos.append(timer.nsecsElapsed());
+            } else {
+                report.failed++;
+            }
+            break;
+        }
+
+        default:
+            report.unmatched++;
+            break;
+        }
+    }
+
+    report.wallNanos = wall.nsecsElapsed();
+    report.sessions  = sessions.size();
+    return report;
+}
+
+WorkloadReplayer::Session *WorkloadReplayer::session(quint32 ordinal)
+{
+    Session *current = sessions.value(ordinal);
+    if (current) {
+        return current;
+    }
+
+    current = new Session;
+    current->local         = createParty(QString("local-%1").arg(ordinal));
+    current->remote        = createParty(QString("remote-%1").arg(ordinal));
+    current->local.cipher  = QSharedPointer<SessionCipher>(new SessionCipher(qSharedPointerCast<AxolotlStore>(current->local.store),
+                                                                             current->remote.address));
+    current->remote.cipher = QSharedPointer<SessionCipher>(new SessionCipher(qSharedPointerCast<AxolotlStore>(current->remote.store),
+                                                                             current->local.address));
+    current->remoteEpoch   = 0;
+    current->epochBase     = 0;
+    current->payloadRng.seed(seed ^ (ordinal * 0x9E3779B9u));
+
+    sessions.insert(ordinal, current);
+    return current;
+}
+
+WorkloadReplayer::Party WorkloadReplayer::createParty(const QString &name)
+{
+    Party party;
+    party.address = AxolotlAddress(name, 1);
+    party.store   = QSharedPointer<InMemoryAxolotlStore>(new InMemoryAxolotlStore(KeyHelper::generateIdentityKeyPair(),
+                                                                                  KeyHelper::generateRegistrationId()));
+    return party;
+}
+
+void WorkloadReplayer::establish(Party &initiator, Party &responder)
+{
+    IdentityKeyPair    identityKeyPair = responder.store->getIdentityKeyPair();
+    ECKeyPair          preKey          = Curve::generateKeyPair();
+    SignedPreKeyRecord signedPreKey    = KeyHelper::generateSignedPreKey(identityKeyPair, 1);
+
+    responder.store->storePreKey(1, PreKeyRecord(1, preKey));
+    responder.store->storeSignedPreKey(1, signedPreKey);
+
+    PreKeyBundle bundle(responder.store->getLocalRegistrationId(), 1,
+                        1, preKey.getPublicKey(),
+                        1, signedPreKey.getKeyPair().getPublicKey(), signedPreKey.getSignature(),
+                        identityKeyPair.getPublicKey());
+
+    SessionBuilder builder(qSharedPointerCast<AxolotlStore>(initiator.store), responder.address);
+    builder.process(bundle);
+}
+
+void WorkloadReplayer::deliverToRemote(Session *session, ReplayReport &report)
+{
+    foreach (const InFlight &inFlight, session->toRemote) {
+        if (!decrypt(session->remote, inFlight)) {
+            report.failed++;
+        }
+    }
+    session->toRemote.clear();
+}
+
+void WorkloadReplayer::ensureRemoteCanSend(Session *session, ReplayReport &report)
+{
+    if (session->remote.store->containsSession(session->local.address)) {
+        return;
+    }
+
+    if (!session->local.store->containsSession(session->remote.address)) {
+        // The peer opened the session in the recording
+        establish(session->remote, session->local);
+        return;
+    }
+
+    // We opened it, the peer needs one of our PreKeyWhisperMessages first
+    if (session->toRemote.isEmpty()) {
+        InFlight inFlight;
+        if (!encrypt(session->local, payload(session, 0), &inFlight)) {
+            report.failed++;
+            return;
+        }
+        session->toRemote.append(inFlight);
+    }
+    deliverToRemote(session, report);
+}
+
+uint WorkloadReplayer::remoteSenderIndex(Session *session)
+{
+    return session->remote.store->loadSession(session->local.address)->getSessionState()->getSenderChainIndex();
+}
+
+QByteArray WorkloadReplayer::payload(Session *session, int size)
+{
+    QByteArray bytes(size, '\0');
+    for (int i = 0; i < size; i++) {
+        bytes[i] = (char)(session->payloadRng() & 0xFF);
+    }
+    return bytes;
+}
+
+bool WorkloadReplayer::encrypt(Party &sender, const QByteArray &plaintext, InFlight *inFlight)
+{
+    try {
+        QSharedPointer<CiphertextMessage> message = sender.cipher->encrypt(plaintext);
+        inFlight->serialized = message->serialize();
+        inFlight->type       = message->getType();
+        return true;
+    } catch (const WhisperException &) {
+        return false;
+    }
+}
+
+bool WorkloadReplayer::decrypt(Party &receiver, const InFlight &inFlight)
+{
+    try {
+        if (inFlight.type == CiphertextMessage::PREKEY_TYPE) {
+            receiver.cipher->decrypt(QSharedPointer<PreKeyWhisperMessage>(new PreKeyWhisperMessage(inFlight.serialized)));
+        } else {
+            receiver.cipher->decrypt(QSharedPointer<WhisperMessage>(new WhisperMessage(inFlight.serialized)));
+        }
+        return true;
+    } catch (const WhisperException &) {
+        return false;
+    }
+}
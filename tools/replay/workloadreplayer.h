@@ -0,0 +1,80 @@
+#ifndef WORKLOADREPLAYER_H
+#define WORKLOADREPLAYER_H
+
+#include <QSharedPointer>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QMap>
+
+#include <random>
+
+#include "sessioncipher.h"
+#include "state/impl/inmemoryaxolotlstore.h"
+#include "util/workloadrecorder.h"
+
+struct ReplayReport
+{
+    qint64          events       = 0;
+    qint64          sessions     = 0;
+    qint64          failed       = 0;
+    qint64          unmatched    = 0;
+    qint64          wallNanos    = 0;
+    QVector<qint64> setupNanos;
+    QVector<qint64> encryptNanos;
+    QVector<qint64> decryptNanos;
+};
+
+// Re-executes a WorkloadRecorder trace against fresh in-memory stores. The
+// recorded side of every session is "local", its peer is simulated: peer
+// messages are produced on demand so that each recorded decrypt sees the
+// same ratchet epoch and counter, which reproduces skipped and reordered
+// messages. Only the local operations are timed.
+class WorkloadReplayer
+{
+public:
+    WorkloadReplayer(quint32 seed = 1);
+    ~WorkloadReplayer();
+
+    ReplayReport replay(const QList<WorkloadRecorder::Event> &events);
+
+private:
+    WorkloadReplayer(const WorkloadReplayer &);
+    WorkloadReplayer &operator=(const WorkloadReplayer &);
+
+    struct Party {
+        AxolotlAddress                        address;
+        QSharedPointer<InMemoryAxolotlStore>  store;
+        QSharedPointer<SessionCipher>         cipher;
+    };
+
+    struct InFlight {
+        QByteArray serialized;
+        int        type;
+    };
+
+    struct Session {
+        Party                  local;
+        Party                  remote;
+        QList<InFlight>        toRemote;
+        quint32                remoteEpoch;
+        uint                   epochBase;
+        QMap<uint, InFlight>   produced;
+        std::mt19937           payloadRng;
+    };
+
+    Session *session(quint32 ordinal);
+    Party createParty(const QString &name);
+    void establish(Party &initiator, Party &responder);
+    void deliverToRemote(Session *session, ReplayReport &report);
+    void ensureRemoteCanSend(Session *session, ReplayReport &report);
+    uint remoteSenderIndex(Session *session);
+    QByteArray payload(Session *session, int size);
+    bool encrypt(Party &sender, const QByteArray &plaintext, InFlight *inFlight);
+    bool decrypt(Party &receiver, const InFlight &inFlight);
+
+    quint32                     seed;
+    QHash<quint32, Session*>    sessions;
+};
+
+#endif // WORKLOADREPLAYER_H
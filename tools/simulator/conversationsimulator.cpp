@@ -0,0 +1,204 @@
+#include "conversationsimulator.h"
+
+#include "sessionbuilder.h"
+#include "whisperexception.h"
+#include "state/prekeybundle.h"
+#include "protocol/whispermessage.h"
+#include "protocol/prekeywhispermessage.h"
+#include "ecc/curve.h"
+#include "util/keyhelper.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+ConversationSimulator::ConversationSimulator(const SimulationConfig &config)
+    : rng(config.seed)
+{
+    this->config  = config;
+    this->payload = QByteArray(qMax(1, config.messageSize), 'm');
+}
+
+SimulationReport ConversationSimulator::run()
+{
+    SimulationReport report;
+    report.residentBefore = residentMemory();
+
+    runPairs(report);
+
+    report.residentAfter = residentMemory();
+    return report;
+}
+
+ConversationSimulator::Party ConversationSimulator::createParty(const QString &name)
+{
+    Party party;
+    party.address = AxolotlAddress(name, 1);
+    party.store   = QSharedPointer<InMemoryAxolotlStore>(new InMemoryAxolotlStore(KeyHelper::generateIdentityKeyPair(),
+                                                                                  KeyHelper::generateRegistrationId()));
+    return party;
+}
+
+PreKeyBundle ConversationSimulator::createBundle(Party &party)
+{
+    IdentityKeyPair    identityKeyPair = party.store->getIdentityKeyPair();
+    ECKeyPair          preKey          = Curve::generateKeyPair();
+    SignedPreKeyRecord signedPreKey    = KeyHelper::generateSignedPreKey(identityKeyPair, 1);
+
+    party.store->storePreKey(1, PreKeyRecord(1, preKey));
+    party.store->storeSignedPreKey(1, signedPreKey);
+
+    return PreKeyBundle(party.store->getLocalRegistrationId(), 1,
+                        1, preKey.getPublicKey(),
+                        1, signedPreKey.getKeyPair().getPublicKey(), signedPreKey.getSignature(),
+                        identityKeyPair.getPublicKey());
+}
+
+void ConversationSimulator::runPairs(SimulationReport &report)
+{
+    QList<Party> alices;
+    QList<Party> bobs;
+
+    for (int i = 0; i < config.pairs; i++) {
+        Party alice = createParty(QString("alice-%1").arg(i));
+        Party bob   = createParty(QString("bob-%1").arg(i));
+
+        SessionBuilder builder(qSharedPointerCast<AxolotlStore>(alice.store), bob.address);
+        builder.process(createBundle(bob));
+
+        alices.append(alice);
+        bobs.append(bob);
+    }
+
+    QElapsedTimer wall;
+    QElapsedTimer timer;
+    wall.start();
+
+    for (int i = 0; i < config.pairs; i++) {
+        Party *parties[2] = { &alices[i], &bobs[i] };
+        QSharedPointer<SessionCipher> ciphers[2] = {
+            QSharedPointer<SessionCipher>(new SessionCipher(qSharedPointerCast<AxolotlStore>(alices[i].store), bobs[i].address)),
+            QSharedPointer<SessionCipher>(new SessionCipher(qSharedPointerCast<AxolotlStore>(bobs[i].store), alices[i].address))
+        };
+
+        int sender = 0;
+        int sent   = 0;
+        while (sent < config.messages) {
+            int receiver = 1 - sender;
+
+            // Bob can only answer once one of Alice's PreKeyWhisperMessages got through
+            if (sent > 0 && chance(config.roleSwitchRate) &&
+                parties[receiver]->store->containsSession(parties[sender]->address))
+            {
+                sender   = receiver;
+                receiver = 1 - sender;
+            }
+
+            int             burst = 1 + uniform(qMax(1, config.maxBurst));
+            QList<InFlight> batch;
+            for (int b = 0; b < burst && sent < config.messages; b++, sent++) {
+                timer.start();
+                QSharedPointer<CiphertextMessage> message = ciphers[sender]->encrypt(payload);
+                InFlight inFlight;
+                inFlight.serialized = message->serialize();
+                inFlight.type       = message->getType();
+                report.encryptNanos.append(timer.nsecsElapsed());
+                batch.append(inFlight);
+                report.sent++;
+            }
+
+            foreach (const InFlight &inFlight, transmit(batch, report)) {
+                QByteArray ratchetKey = currentRatchetKey(*parties[receiver], parties[sender]->address);
+                timer.start();
+                try {
+                    if (inFlight.type == CiphertextMessage::PREKEY_TYPE) {
+                        ciphers[receiver]->decrypt(QSharedPointer<PreKeyWhisperMessage>(new PreKeyWhisperMessage(inFlight.serialized)));
+                    } else {
+                        ciphers[receiver]->decrypt(QSharedPointer<WhisperMessage>(new WhisperMessage(inFlight.serialized)));
+                    }
+                    report.decryptNanos.append(timer.nsecsElapsed());
+                    report.decrypted++;
+
+                    // The receiver only rotates its ratchet key when the message opened a new receiver chain
+                    if (currentRatchetKey(*parties[receiver], parties[sender]->address) != ratchetKey) {
+                        report.ratchetSteps++;
+                    }
+                } catch (const WhisperException &) {
+                    report.failed++;
+                }
+            }
+        }
+    }
+
+    report.wallNanos = wall.nsecsElapsed();
+
+    for (int i = 0; i < config.pairs; i++) {
+        if (alices[i].store->containsSession(bobs[i].address)) {
+            report.serializedBytes += alices[i].store->loadSession(bobs[i].address)->serialize().size();
+            report.sessions++;
+        }
+        if (bobs[i].store->containsSession(alices[i].address)) {
+            report.serializedBytes += bobs[i].store->loadSession(alices[i].address)->serialize().size();
+            report.sessions++;
+        }
+    }
+}
+
+QByteArray ConversationSimulator::currentRatchetKey(const Party &party, const AxolotlAddress &peer)
+{
+    if (!party.store->containsSession(peer)) {
+        return QByteArray();
+    }
+    return party.store->loadSession(peer)->getSessionState()->getSenderRatchetKey().serialize();
+}
+
+QList<ConversationSimulator::InFlight> ConversationSimulator::transmit(const QList<InFlight> &batch, SimulationReport &report)
+{
+    QList<InFlight> delivered;
+    foreach (const InFlight &inFlight, batch) {
+        if (chance(config.lossRate)) {
+            report.dropped++;
+        } else {
+            delivered.append(inFlight);
+        }
+    }
+
+    for (int i = 0; i + 1 < delivered.size(); i++) {
+        if (chance(config.reorderRate)) {
+            int j = qMin(delivered.size() - 1, i + 1 + uniform(qMax(1, config.reorderWindow)));
+            delivered.swap(i, j);
+        }
+    }
+
+    return delivered;
+}
+
+bool ConversationSimulator::chance(double probability)
+{
+    if (probability <= 0) {
+        return false;
+    }
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < probability;
+}
+
+int ConversationSimulator::uniform(int bound)
+{
+    return std::uniform_int_distribution<int>(0, bound - 1)(rng);
+}
+
+qint64 ConversationSimulator::residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (statm.open(QIODevice::ReadOnly)) {
+        QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1) {
+            return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,82 @@
+#ifndef CONVERSATIONSIMULATOR_H
+#define CONVERSATIONSIMULATOR_H
+
+#include <QSharedPointer>
+#include <QVector>
+#include <QList>
+
+#include <random>
+
+#include "sessioncipher.h"
+#include "state/impl/inmemoryaxolotlstore.h"
+
+struct SimulationConfig
+{
+    int     pairs          = 100;
+    int     messages       = 100;
+    int     messageSize    = 160;
+    double  lossRate       = 0.0;
+    double  reorderRate    = 0.0;
+    int     reorderWindow  = 4;
+    int     maxBurst       = 1;
+    double  roleSwitchRate = 0.5;
+    quint32 seed           = 1;
+};
+
+struct SimulationReport
+{
+    qint64          sent            = 0;
+    qint64          dropped         = 0;
+    qint64          decrypted       = 0;
+    qint64          failed          = 0;
+    qint64          ratchetSteps    = 0;
+    qint64          wallNanos       = 0;
+    qint64          sessions        = 0;
+    qint64          serializedBytes = 0;
+    qint64          residentBefore  = -1;
+    qint64          residentAfter   = -1;
+    QVector<qint64> encryptNanos;
+    QVector<qint64> decryptNanos;
+};
+
+// Drives traffic through the library on in-memory stores. Sets up N
+// Alice/Bob sessions from PreKeyBundles and lets the two sides talk in
+// bursts, switching roles at random. Every delivery batch can lose and
+// reorder messages. ratchetSteps counts the receiver chains the decrypts
+// actually created, so lost or reordered replies don't inflate it.
+class ConversationSimulator
+{
+public:
+    ConversationSimulator(const SimulationConfig &config);
+
+    SimulationReport run();
+
+private:
+    struct Party {
+        AxolotlAddress                        address;
+        QSharedPointer<InMemoryAxolotlStore>  store;
+    };
+
+    struct InFlight {
+        QByteArray serialized;
+        int        type;
+    };
+
+    Party createParty(const QString &name);
+    PreKeyBundle createBundle(Party &party);
+
+    void runPairs(SimulationReport &report);
+
+    QByteArray currentRatchetKey(const Party &party, const AxolotlAddress &peer);
+    QList<InFlight> transmit(const QList<InFlight> &batch, SimulationReport &report);
+    bool chance(double probability);
+    int uniform(int bound);
+
+    static qint64 residentMemory();
+
+    SimulationConfig config;
+    std::mt19937     rng;
+    QByteArray       payload;
+};
+
+#endif // CONVERSATIONSIMULATOR_H
@@ -0,0 +1,117 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+#include <algorithm>
+
+#include "conversationsimulator.h"
+#include "util/randomsource.h"
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context);
+    if (type != QtDebugMsg) {
+        QTextStream(stderr) << message << endl;
+    }
+}
+
+static double percentile(const QVector<qint64> &sorted, double fraction)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    int index = qMin(sorted.size() - 1, (int)(fraction * sorted.size()));
+    return sorted.at(index) / 1000.0;
+}
+
+static void printLatencies(QTextStream &out, const char *name, QVector<qint64> nanos)
+{
+    std::sort(nanos.begin(), nanos.end());
+    out << QString("%1 p50 %2 us  p90 %3 us  p99 %4 us  p99.9 %5 us  max %6 us")
+           .arg(name, -8)
+           .arg(percentile(nanos, 0.50), 0, 'f', 1)
+           .arg(percentile(nanos, 0.90), 0, 'f', 1)
+           .arg(percentile(nanos, 0.99), 0, 'f', 1)
+           .arg(percentile(nanos, 0.999), 0, 'f', 1)
+           .arg(nanos.isEmpty() ? 0.0 : nanos.last() / 1000.0, 0, 'f', 1)
+        << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("axolotl-simulator");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives simulated conversations through libaxolotl and reports throughput.");
+    parser.addHelpOption();
+
+    QCommandLineOption pairsOption("pairs", "Number of Alice/Bob pairs.", "n", "100");
+    QCommandLineOption messagesOption("messages", "Messages per pair.", "n", "100");
+    QCommandLineOption sizeOption("size", "Plaintext size in bytes.", "bytes", "160");
+    QCommandLineOption lossOption("loss", "Probability a message is lost.", "p", "0");
+    QCommandLineOption reorderOption("reorder", "Probability a delivered message is swapped with a later one.", "p", "0");
+    QCommandLineOption windowOption("reorder-window", "How far ahead a reordered message may move.", "n", "4");
+    QCommandLineOption burstOption("burst", "Maximum messages sent before the peer gets them.", "n", "1");
+    QCommandLineOption switchOption("switch", "Probability the other side talks next.", "p", "0.5");
+    QCommandLineOption seedOption("seed", "Seed for the traffic model and key generation.", "n", "1");
+
+    parser.addOption(pairsOption);
+    parser.addOption(messagesOption);
+    parser.addOption(sizeOption);
+    parser.addOption(lossOption);
+    parser.addOption(reorderOption);
+    parser.addOption(windowOption);
+    parser.addOption(burstOption);
+    parser.addOption(switchOption);
+    parser.addOption(seedOption);
+    parser.process(app);
+
+    SimulationConfig config;
+    config.pairs          = qMax(1, parser.value(pairsOption).toInt());
+    config.messages       = qMax(1, parser.value(messagesOption).toInt());
+    config.messageSize    = parser.value(sizeOption).toInt();
+    config.lossRate       = parser.value(lossOption).toDouble();
+    config.reorderRate    = parser.value(reorderOption).toDouble();
+    config.reorderWindow  = qMax(1, parser.value(windowOption).toInt());
+    config.maxBurst       = qMax(1, parser.value(burstOption).toInt());
+    config.roleSwitchRate = parser.value(switchOption).toDouble();
+    config.seed           = parser.value(seedOption).toUInt();
+
+    qInstallMessageHandler(quietMessageHandler);
+
+    DeterministicRandomSource random(config.seed);
+    RandomSource::install(&random);
+
+    ConversationSimulator simulator(config);
+    SimulationReport      report = simulator.run();
+
+    QTextStream out(stdout);
+    double seconds = report.wallNanos / 1e9;
+
+    out << QString("%1 pairs").arg(config.pairs)
+        << QString(", %1 messages each, %2 byte payload").arg(config.messages).arg(config.messageSize) << endl;
+    out << QString("sent %1  dropped %2  decrypted %3  failed %4  ratchet steps %5")
+           .arg(report.sent).arg(report.dropped).arg(report.decrypted).arg(report.failed).arg(report.ratchetSteps)
+        << endl;
+    out << QString("throughput %1 messages/s (%2 s)")
+           .arg(seconds > 0 ? report.decrypted / seconds : 0.0, 0, 'f', 0)
+           .arg(seconds, 0, 'f', 3)
+        << endl;
+
+    printLatencies(out, "encrypt", report.encryptNanos);
+    printLatencies(out, "decrypt", report.decryptNanos);
+
+    if (report.sessions > 0) {
+        out << QString("sessions %1  serialized %2 bytes/session")
+               .arg(report.sessions)
+               .arg((double)report.serializedBytes / report.sessions, 0, 'f', 0);
+        if (report.residentBefore >= 0 && report.residentAfter >= 0) {
+            out << QString("  resident %1 bytes/session")
+                   .arg((double)(report.residentAfter - report.residentBefore) / report.sessions, 0, 'f', 0);
+        }
+        out << endl;
+    }
+
+    return report.failed > 0 && config.lossRate <= 0 && config.reorderRate <= 0 ? 1 : 0;
+}
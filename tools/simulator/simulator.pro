@@ -0,0 +1,24 @@
+TEMPLATE = app
+
+TARGET = axolotl-simulator
+CONFIG += console c++11
+CONFIG -= app_bundle
+QT -= gui
+
+CONFIG += link_pkgconfig
+PKGCONFIG += openssl libssl libcrypto
+
+# Needs a libaxolotl built with CONFIG+=deterministic_random
+DEFINES += AXOLOTL_DETERMINISTIC_RANDOM
+
+INCLUDEPATH += ../..
+LIBS += -L../.. -laxolotl
+LIBS += -L../../../libcurve25519 -lcurve25519
+LIBS += /usr/lib/libprotobuf.a
+
+HEADERS += \
+    conversationsimulator.h
+
+SOURCES += \
+    conversationsimulator.cpp \
+    main.cpp
@@ -0,0 +1,12 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    compactor
+
+# The simulator and replay tools link against DeterministicRandomSource,
+# which libaxolotl only contains when built with CONFIG+=deterministic_random
+deterministic_random {
+    SUBDIRS += \
+        simulator \
+        replay
+}
@@ -0,0 +1,28 @@
+#ifndef ADDRESSKEY_H
+#define ADDRESSKEY_H
+
+#include <QPair>
+#include <QString>
+#include <QHash>
+
+#include "../axolotladdress.h"
+
+typedef QPair<QString, int> AddressKey;
+
+class AddressUtil
+{
+public:
+    static AddressKey toKey(const AxolotlAddress &address) {
+        return qMakePair(address.getName(), address.getDeviceId());
+    }
+
+    static AxolotlAddress toAddress(const AddressKey &key) {
+        return AxolotlAddress(key.first, key.second);
+    }
+
+    static uint stripe(const QString &name, uint stripes) {
+        return qHash(name) % stripes;
+    }
+};
+
+#endif // ADDRESSKEY_H
@@ -0,0 +1,271 @@
+#include "fileiobackend.h"
+
+#include "../concurrent/functionrunnable.h"
+#include "../whisperexception.h"
+
+#include <QThread>
+#include <QDebug>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+FileIoBackend *FileIoBackend::create(int threads)
+{
+#ifdef AXOLOTL_HAVE_IO_URING
+    try {
+        return new IoUringFileIoBackend();
+    } catch (const WhisperException &e) {
+        qWarning() << "io_uring unavailable, using a thread pool:" << e.errorMessage();
+    }
+#endif
+    return new ThreadPoolFileIoBackend(threads);
+}
+
+ThreadPoolFileIoBackend::ThreadPoolFileIoBackend(int threads)
+{
+    pool.setMaxThreadCount(qMax(1, threads));
+}
+
+ThreadPoolFileIoBackend::~ThreadPoolFileIoBackend()
+{
+    pool.waitForDone();
+}
+
+void ThreadPoolFileIoBackend::read(int fd, qint64 offset, int length, const ReadCallback &callback)
+{
+    FunctionRunnable::start(&pool, [fd, offset, length, callback]() {
+        QByteArray data(length, '\0');
+        int        done = 0;
+
+        while (done < length) {
+            ssize_t result = pread(fd, data.data() + done, length - done, offset + done);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                callback(false, QByteArray());
+                return;
+            }
+            done += result;
+        }
+
+        callback(true, data);
+    });
+}
+
+void ThreadPoolFileIoBackend::writeAndSync(int fd, qint64 offset, const QByteArray &data, const WriteCallback &callback)
+{
+    FunctionRunnable::start(&pool, [fd, offset, data, callback]() {
+        int done = 0;
+
+        while (done < data.size()) {
+            ssize_t result = pwrite(fd, data.constData() + done, data.size() - done, offset + done);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                callback(false);
+                return;
+            }
+            done += result;
+        }
+
+        callback(fdatasync(fd) == 0);
+    });
+}
+
+QString ThreadPoolFileIoBackend::name() const
+{
+    return "threadpool";
+}
+
+#ifdef AXOLOTL_HAVE_IO_URING
+
+class IoUringCompletionThread : public QThread
+{
+public:
+    IoUringCompletionThread(IoUringFileIoBackend *backend) : backend(backend) {}
+
+    void run() {
+        backend->reap();
+    }
+
+private:
+    IoUringFileIoBackend *backend;
+};
+
+struct IoUringFileIoBackend::Request
+{
+    enum Type {
+        Read,
+        Write
+    };
+
+    Type          type;
+    int           fd;
+    qint64        offset;
+    QByteArray    buffer;
+    int           done    = 0;
+    int           pending = 0;
+    bool          ok      = true;
+    ReadCallback  readCallback;
+    WriteCallback writeCallback;
+};
+
+// The fdatasync of a linked pair carries the request pointer with the low bit set
+static const quintptr SYNC_TAG = 1;
+
+IoUringFileIoBackend::IoUringFileIoBackend(unsigned entries)
+{
+    // writeAndSync() needs room for a linked pair
+    int result = io_uring_queue_init(qMax(2u, entries), &ring, 0);
+    if (result < 0) {
+        throw WhisperException("IoUringFileIoBackend", QString("io_uring_queue_init failed: %1").arg(strerror(-result)));
+    }
+
+    completionThread = new IoUringCompletionThread(this);
+    completionThread->start();
+}
+
+IoUringFileIoBackend::~IoUringFileIoBackend()
+{
+    {
+        QMutexLocker locker(&submitMutex);
+        stopping.storeRelease(1);
+
+        // Wakes the completion thread, which leaves once nothing is in flight
+        io_uring_sqe *sqe = nextSqe();
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, 0);
+        io_uring_submit(&ring);
+    }
+
+    completionThread->wait();
+    delete completionThread;
+    io_uring_queue_exit(&ring);
+}
+
+void IoUringFileIoBackend::read(int fd, qint64 offset, int length, const ReadCallback &callback)
+{
+    Request *request      = new Request();
+    request->type         = Request::Read;
+    request->fd           = fd;
+    request->offset       = offset;
+    request->buffer       = QByteArray(length, '\0');
+    request->readCallback = callback;
+
+    inflight.ref();
+    submitRead(request);
+}
+
+void IoUringFileIoBackend::writeAndSync(int fd, qint64 offset, const QByteArray &data, const WriteCallback &callback)
+{
+    Request *request       = new Request();
+    request->type          = Request::Write;
+    request->fd            = fd;
+    request->offset        = offset;
+    request->buffer        = data;
+    request->pending       = 2;
+    request->writeCallback = callback;
+
+    inflight.ref();
+
+    // Both halves of the link go in one submission, a flush in between would run the sync unlinked
+    QMutexLocker locker(&submitMutex);
+    reserveSqes(2);
+
+    io_uring_sqe *write = io_uring_get_sqe(&ring);
+    io_uring_prep_write(write, fd, request->buffer.constData(), request->buffer.size(), offset);
+    io_uring_sqe_set_data(write, request);
+    write->flags |= IOSQE_IO_LINK;
+
+    io_uring_sqe *sync = io_uring_get_sqe(&ring);
+    io_uring_prep_fsync(sync, fd, IORING_FSYNC_DATASYNC);
+    io_uring_sqe_set_data(sync, (void*)((quintptr)request | SYNC_TAG));
+
+    io_uring_submit(&ring);
+}
+
+QString IoUringFileIoBackend::name() const
+{
+    return "io_uring";
+}
+
+// Called with submitMutex held, so the reserved entries stay free
+void IoUringFileIoBackend::reserveSqes(unsigned count)
+{
+    while (io_uring_sq_space_left(&ring) < count) {
+        io_uring_submit(&ring);
+        QThread::yieldCurrentThread();
+    }
+}
+
+io_uring_sqe *IoUringFileIoBackend::nextSqe()
+{
+    reserveSqes(1);
+    return io_uring_get_sqe(&ring);
+}
+
+void IoUringFileIoBackend::submitRead(Request *request)
+{
+    QMutexLocker locker(&submitMutex);
+    io_uring_sqe *sqe = nextSqe();
+    io_uring_prep_read(sqe, request->fd, request->buffer.data() + request->done,
+                       request->buffer.size() - request->done, request->offset + request->done);
+    io_uring_sqe_set_data(sqe, request);
+    io_uring_submit(&ring);
+}
+
+void IoUringFileIoBackend::reap()
+{
+    for (;;) {
+        io_uring_cqe *cqe    = 0;
+        int           result = io_uring_wait_cqe(&ring, &cqe);
+        if (result == -EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            qCritical() << "io_uring_wait_cqe failed:" << strerror(-result);
+            return;
+        }
+
+        quintptr data = (quintptr)io_uring_cqe_get_data(cqe);
+        int      res  = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        Request *request = (Request*)(data & ~SYNC_TAG);
+        if (!request) {
+            // Wake up from the destructor
+        } else if (request->type == Request::Read) {
+            if (res > 0) {
+                request->done += res;
+            }
+            if (res > 0 && request->done < request->buffer.size()) {
+                submitRead(request);
+                continue;
+            }
+
+            bool ok = res > 0;
+            request->readCallback(ok, ok ? request->buffer : QByteArray());
+            delete request;
+            inflight.deref();
+        } else {
+            // A short write cancels the linked fdatasync, both still complete
+            if ((data & SYNC_TAG) ? res < 0 : res != request->buffer.size()) {
+                request->ok = false;
+            }
+            if (--request->pending == 0) {
+                request->writeCallback(request->ok);
+                delete request;
+                inflight.deref();
+            }
+        }
+
+        if (stopping.loadAcquire() && inflight.load() == 0) {
+            return;
+        }
+    }
+}
+
+#endif // AXOLOTL_HAVE_IO_URING
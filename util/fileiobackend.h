@@ -0,0 +1,86 @@
+#ifndef FILEIOBACKEND_H
+#define FILEIOBACKEND_H
+
+#include <QByteArray>
+#include <QThreadPool>
+
+#include <functional>
+
+// Positional file I/O with completion callbacks, which run on a backend
+// thread. The caller keeps the file descriptor open until every request on
+// it has completed.
+class FileIoBackend
+{
+public:
+    typedef std::function<void(bool ok, const QByteArray &data)> ReadCallback;
+    typedef std::function<void(bool ok)>                         WriteCallback;
+
+    virtual ~FileIoBackend() {}
+
+    virtual void read(int fd, qint64 offset, int length, const ReadCallback &callback) = 0;
+
+    // Writes data at offset and makes it durable before the callback runs
+    virtual void writeAndSync(int fd, qint64 offset, const QByteArray &data, const WriteCallback &callback) = 0;
+
+    virtual QString name() const = 0;
+
+    // io_uring when it was compiled in and the kernel allows it, a thread pool otherwise
+    static FileIoBackend *create(int threads = 4);
+};
+
+class ThreadPoolFileIoBackend : public FileIoBackend
+{
+public:
+    ThreadPoolFileIoBackend(int threads = 4);
+    ~ThreadPoolFileIoBackend();
+
+    void read(int fd, qint64 offset, int length, const ReadCallback &callback);
+    void writeAndSync(int fd, qint64 offset, const QByteArray &data, const WriteCallback &callback);
+    QString name() const;
+
+private:
+    QThreadPool pool;
+};
+
+#ifdef AXOLOTL_HAVE_IO_URING
+
+#include <QMutex>
+#include <QAtomicInt>
+
+#include <liburing.h>
+
+class IoUringCompletionThread;
+
+// Submits through one ring and reaps completions on a dedicated thread. A
+// write and its fdatasync go in as one linked pair, so a group commit costs
+// a single submission.
+class IoUringFileIoBackend : public FileIoBackend
+{
+public:
+    IoUringFileIoBackend(unsigned entries = 256);
+    ~IoUringFileIoBackend();
+
+    void read(int fd, qint64 offset, int length, const ReadCallback &callback);
+    void writeAndSync(int fd, qint64 offset, const QByteArray &data, const WriteCallback &callback);
+    QString name() const;
+
+private:
+    friend class IoUringCompletionThread;
+
+    struct Request;
+
+    void reserveSqes(unsigned count);
+    io_uring_sqe *nextSqe();
+    void submitRead(Request *request);
+    void reap();
+
+    io_uring                 ring;
+    QMutex                   submitMutex;
+    QAtomicInt               inflight;
+    QAtomicInt               stopping;
+    IoUringCompletionThread *completionThread;
+};
+
+#endif // AXOLOTL_HAVE_IO_URING
+
+#endif // FILEIOBACKEND_H
@@ -0,0 +1,77 @@
+#include "hashring.h"
+
+HashRing::HashRing(int virtualNodes)
+{
+    this->virtualNodes = qMax(1, virtualNodes);
+}
+
+void HashRing::addNode(const QString &id)
+{
+    if (ids.contains(id)) {
+        return;
+    }
+
+    ids.append(id);
+    QByteArray base = id.toUtf8() + '#';
+    for (int i = 0; i < virtualNodes; i++) {
+        ring.insert(hash(base + QByteArray::number(i)), id);
+    }
+}
+
+void HashRing::removeNode(const QString &id)
+{
+    if (!ids.removeOne(id)) {
+        return;
+    }
+
+    QMap<quint64, QString>::iterator it = ring.begin();
+    while (it != ring.end()) {
+        if (it.value() == id) {
+            it = ring.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool HashRing::containsNode(const QString &id) const
+{
+    return ids.contains(id);
+}
+
+QStringList HashRing::nodes() const
+{
+    return ids;
+}
+
+bool HashRing::isEmpty() const
+{
+    return ring.isEmpty();
+}
+
+QString HashRing::nodeFor(const QString &key) const
+{
+    if (ring.isEmpty()) {
+        return QString();
+    }
+
+    QMap<quint64, QString>::const_iterator it = ring.lowerBound(hash(key.toUtf8()));
+    if (it == ring.constEnd()) {
+        it = ring.constBegin();
+    }
+    return it.value();
+}
+
+quint64 HashRing::hash(const QByteArray &data)
+{
+    // FNV-1a, then the splitmix64 finalizer to spread the nearly identical
+    // virtual node names around the ring
+    quint64 hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < data.size(); i++) {
+        hash = (hash ^ (quint8)data.at(i)) * 0x100000001B3ULL;
+    }
+
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
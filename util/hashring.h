@@ -0,0 +1,33 @@
+#ifndef HASHRING_H
+#define HASHRING_H
+
+#include <QStringList>
+#include <QByteArray>
+#include <QMap>
+
+// Consistent hash ring over named nodes. Every node is placed at
+// virtualNodes points, so adding or removing one only moves about 1/N of
+// the keys. Positions don't depend on the process, a ring built from the
+// same node ids always routes the same way.
+class HashRing
+{
+public:
+    HashRing(int virtualNodes = 128);
+
+    void addNode(const QString &id);
+    void removeNode(const QString &id);
+    bool containsNode(const QString &id) const;
+    QStringList nodes() const;
+    bool isEmpty() const;
+
+    QString nodeFor(const QString &key) const;
+
+    static quint64 hash(const QByteArray &data);
+
+private:
+    int                     virtualNodes;
+    QStringList             ids;
+    QMap<quint64, QString>  ring;
+};
+
+#endif // HASHRING_H
@@ -1,17 +1,15 @@
 #include "keyhelper.h"
 
-#include <openssl/rand.h>
-
 #include <QDateTime>
 
 #include "../ecc/eckeypair.h"
 #include "../ecc/curve.h"
+#include "randomsource.h"
 
 quint64 KeyHelper::getRandomFFFF()
 {
     unsigned char buff1[2];
-    memset(buff1, 0, 2);
-    RAND_bytes(buff1, 2);
+    RandomSource::instance()->fill(buff1, 2);
     quint64 rand1 = ((unsigned int)buff1[1] << 8) + (unsigned int)buff1[0];
 
     return rand1;
@@ -19,14 +17,14 @@ quint64 KeyHelper::getRandomFFFF()
 
 quint64 KeyHelper::getRandom7FFFFFFF()
 {
+    unsigned char buff0[0x80 * 3];
+    RandomSource::instance()->fill(buff0, sizeof(buff0));
+
     quint64 rand2 = 0;
     for (int i = 0; i < 0x80; i++) {
-        unsigned char buff0[3];
-        memset(buff0, 0, 3);
-        RAND_bytes(buff0, 3);
-        rand2 += ((unsigned int)buff0[2] << 16);
-        rand2 += ((unsigned int)buff0[1] << 8);
-        rand2 += (unsigned int)buff0[0];
+        rand2 += ((unsigned int)buff0[i * 3 + 2] << 16);
+        rand2 += ((unsigned int)buff0[i * 3 + 1] << 8);
+        rand2 += (unsigned int)buff0[i * 3];
     }
 
     return rand2;
@@ -35,8 +33,7 @@ quint64 KeyHelper::getRandom7FFFFFFF()
 quint64 KeyHelper::getRandomFFFFFFFF()
 {
     unsigned char buff1[4];
-    memset(buff1, 0, 4);
-    RAND_bytes(buff1, 4);
+    RandomSource::instance()->fill(buff1, 4);
     quint64 rand1 = ((unsigned long)buff1[3] << 24) + ((unsigned int)buff1[2] << 16)
                        +  ((unsigned int)buff1[1] << 8)  +  (unsigned int)buff1[0];
 
@@ -45,9 +42,7 @@ quint64 KeyHelper::getRandomFFFFFFFF()
 
 QByteArray KeyHelper::getRandomBytes(int bytes)
 {
-    QByteArray buff1(bytes, '\0');
-    RAND_bytes((unsigned char*)buff1.data(), bytes);
-    return buff1;
+    return RandomSource::instance()->getBytes(bytes);
 }
 
 IdentityKeyPair KeyHelper::generateIdentityKeyPair()
@@ -87,12 +82,7 @@ ECKeyPair KeyHelper::generateSenderSigningKey()
 
 QByteArray KeyHelper::generateSenderKey()
 {
-    unsigned char buff1[32];
-    memset(buff1, 0, 32);
-    RAND_bytes(buff1, 32);
-
-    QByteArray key = QByteArray::fromRawData((const char*)buff1, 32);
-    return key;
+    return RandomSource::instance()->getBytes(32);
 }
 
 unsigned long KeyHelper::generateSenderKeyId()
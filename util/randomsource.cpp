@@ -0,0 +1,161 @@
+#include "randomsource.h"
+
+#include "../whisperexception.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#include <string.h>
+
+static std::atomic<RandomSource*> installedSource(0);
+
+RandomSource::~RandomSource()
+{
+    RandomSource *expected = this;
+    installedSource.compare_exchange_strong(expected, 0);
+}
+
+QByteArray RandomSource::getBytes(int length)
+{
+    QByteArray bytes(qMax(0, length), '\0');
+    fill((unsigned char*)bytes.data(), bytes.size());
+    return bytes;
+}
+
+void RandomSource::install(RandomSource *source)
+{
+    installedSource.store(source, std::memory_order_release);
+}
+
+RandomSource *RandomSource::instance()
+{
+    RandomSource *source = installedSource.load(std::memory_order_acquire);
+    if (source) {
+        return source;
+    }
+
+    static OpenSslRandomSource defaultSource;
+    return &defaultSource;
+}
+
+OpenSslRandomSource::OpenSslRandomSource(int bufferSize)
+{
+    this->poolSize  = qMax(64, bufferSize);
+    this->pool      = new unsigned char[poolSize];
+    this->available = 0;
+    this->pid       = 0;
+}
+
+OpenSslRandomSource::~OpenSslRandomSource()
+{
+    OPENSSL_cleanse(pool, poolSize);
+    delete[] pool;
+}
+
+void OpenSslRandomSource::fill(unsigned char *buffer, int length)
+{
+    if (length <= 0) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+
+    // A forked child must not hand out the bytes its parent will also use
+    if (pid != QCoreApplication::applicationPid()) {
+        OPENSSL_cleanse(pool, poolSize);
+        available = 0;
+        pid       = QCoreApplication::applicationPid();
+    }
+
+    // Large requests are not worth staging through the pool
+    if (length >= poolSize) {
+        if (RAND_bytes(buffer, length) != 1) {
+            throw WhisperException("RandomSource", "RAND_bytes failed");
+        }
+        return;
+    }
+
+    while (length > 0) {
+        if (available == 0) {
+            refill();
+        }
+
+        int            chunk = qMin(length, available);
+        unsigned char *start = pool + (poolSize - available);
+        memcpy(buffer, start, chunk);
+        OPENSSL_cleanse(start, chunk);
+
+        available -= chunk;
+        buffer    += chunk;
+        length    -= chunk;
+    }
+}
+
+void OpenSslRandomSource::refill()
+{
+    if (RAND_bytes(pool, poolSize) != 1) {
+        throw WhisperException("RandomSource", "RAND_bytes failed");
+    }
+    available = poolSize;
+}
+
+#ifdef AXOLOTL_DETERMINISTIC_RANDOM
+static quint64 splitmix64(quint64 &x)
+{
+    quint64 z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline quint64 rotl(quint64 x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+DeterministicRandomSource::DeterministicRandomSource(quint64 seed)
+{
+    reseed(seed);
+}
+
+void DeterministicRandomSource::reseed(quint64 seed)
+{
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < 4; i++) {
+        state[i] = splitmix64(seed);
+    }
+}
+
+quint64 DeterministicRandomSource::next()
+{
+    quint64 result = rotl(state[1] * 5, 7) * 9;
+    quint64 t      = state[1] << 17;
+
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3]  = rotl(state[3], 45);
+
+    return result;
+}
+
+void DeterministicRandomSource::fill(unsigned char *buffer, int length)
+{
+    QMutexLocker locker(&mutex);
+
+    while (length > 0) {
+        quint64 value = next();
+        int     chunk = qMin(length, 8);
+        for (int i = 0; i < chunk; i++) {
+            buffer[i] = (unsigned char)(value >> (8 * i));
+        }
+        buffer += chunk;
+        length -= chunk;
+    }
+}
+#endif
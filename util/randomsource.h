@@ -0,0 +1,69 @@
+#ifndef RANDOMSOURCE_H
+#define RANDOMSOURCE_H
+
+#include <QByteArray>
+#include <QMutex>
+
+#include <atomic>
+
+// Every random byte the library uses comes from the installed RandomSource.
+// Without one installed a buffered OpenSSL source is used. The simulator
+// and replay tools install a DeterministicRandomSource so runs are
+// reproducible and RNG cost can be measured on its own.
+class RandomSource
+{
+public:
+    virtual ~RandomSource();
+
+    virtual void fill(unsigned char *buffer, int length) = 0;
+    QByteArray getBytes(int length);
+
+    static void install(RandomSource *source);
+    static RandomSource *instance();
+};
+
+// OpenSSL RAND_bytes, drawn in blocks so small requests (registration ids,
+// key ids) do not each pay for a call into the DRBG. Served bytes are wiped
+// from the buffer, and it is discarded after a fork.
+class OpenSslRandomSource : public RandomSource
+{
+public:
+    OpenSslRandomSource(int bufferSize = 4096);
+    ~OpenSslRandomSource();
+
+    void fill(unsigned char *buffer, int length);
+
+private:
+    OpenSslRandomSource(const OpenSslRandomSource &);
+    OpenSslRandomSource &operator=(const OpenSslRandomSource &);
+
+    void refill();
+
+    QMutex          mutex;
+    unsigned char  *pool;
+    int             poolSize;
+    int             available;
+    qint64          pid;
+};
+
+#ifdef AXOLOTL_DETERMINISTIC_RANDOM
+// xoshiro256** seeded through splitmix64. Fast and reproducible, NOT
+// cryptographically secure: only built with CONFIG+=deterministic_random
+// for tests, benchmarks and replays.
+class DeterministicRandomSource : public RandomSource
+{
+public:
+    DeterministicRandomSource(quint64 seed = 1);
+
+    void fill(unsigned char *buffer, int length);
+    void reseed(quint64 seed);
+
+private:
+    quint64 next();
+
+    QMutex  mutex;
+    quint64 state[4];
+};
+#endif
+
+#endif // RANDOMSOURCE_H
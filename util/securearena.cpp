@@ -0,0 +1,142 @@
+#include "securearena.h"
+
+#include <QtGlobal>
+
+#include <openssl/crypto.h>
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+SecureArena::SecureArena(int slotSize, int slotsPerBlock, bool lockMemory)
+{
+    int minimum         = qMax(slotSize, (int)sizeof(FreeSlot));
+    this->size          = slotSize;
+    this->stride        = (minimum + 15) & ~15;
+    this->slotsPerBlock = qMax(1, slotsPerBlock);
+    this->allocated     = 0;
+    this->lockMemory    = lockMemory;
+    this->locked        = lockMemory;
+    this->freeList      = 0;
+}
+
+SecureArena::~SecureArena()
+{
+    freeBlocks();
+}
+
+unsigned char *SecureArena::allocate()
+{
+    if (!freeList) {
+        addBlock();
+    }
+
+    FreeSlot *slot = freeList;
+    freeList = slot->next;
+    allocated++;
+
+    slot->next = 0;
+    return reinterpret_cast<unsigned char*>(slot);
+}
+
+void SecureArena::release(unsigned char *slot)
+{
+    if (!slot) {
+        return;
+    }
+
+    cleanse(slot, stride);
+
+    FreeSlot *freeSlot = reinterpret_cast<FreeSlot*>(slot);
+    freeSlot->next = freeList;
+    freeList = freeSlot;
+    allocated--;
+}
+
+void SecureArena::wipe()
+{
+    freeList  = 0;
+    allocated = 0;
+
+    // Rebuild the free list back to front, so slots are handed out in address order again
+    for (int b = blocks.size() - 1; b >= 0; b--) {
+        unsigned char *block = blocks.at(b);
+        cleanse(block, (size_t)stride * slotsPerBlock);
+
+        for (int i = slotsPerBlock - 1; i >= 0; i--) {
+            FreeSlot *slot = reinterpret_cast<FreeSlot*>(block + (size_t)i * stride);
+            slot->next = freeList;
+            freeList = slot;
+        }
+    }
+}
+
+int SecureArena::slotSize() const
+{
+    return size;
+}
+
+int SecureArena::allocatedSlots() const
+{
+    return allocated;
+}
+
+int SecureArena::capacity() const
+{
+    return blocks.size() * slotsPerBlock;
+}
+
+bool SecureArena::isLocked() const
+{
+    return lockMemory && locked;
+}
+
+void SecureArena::cleanse(void *data, size_t length)
+{
+    OPENSSL_cleanse(data, length);
+}
+
+void SecureArena::addBlock()
+{
+    size_t         blockSize = (size_t)stride * slotsPerBlock;
+    unsigned char *block     = (unsigned char*)qMallocAligned(blockSize, CACHE_LINE_SIZE);
+    Q_CHECK_PTR(block);
+    memset(block, 0, blockSize);
+
+#ifdef Q_OS_UNIX
+    if (lockMemory && mlock(block, blockSize) != 0) {
+        locked = false;
+    }
+#else
+    locked = false;
+#endif
+
+    for (int i = slotsPerBlock - 1; i >= 0; i--) {
+        FreeSlot *slot = reinterpret_cast<FreeSlot*>(block + (size_t)i * stride);
+        slot->next = freeList;
+        freeList = slot;
+    }
+
+    blocks.append(block);
+}
+
+void SecureArena::freeBlocks()
+{
+    size_t blockSize = (size_t)stride * slotsPerBlock;
+
+    foreach (unsigned char *block, blocks) {
+        cleanse(block, blockSize);
+#ifdef Q_OS_UNIX
+        if (lockMemory) {
+            munlock(block, blockSize);
+        }
+#endif
+        qFreeAligned(block);
+    }
+
+    blocks.clear();
+    freeList  = 0;
+    allocated = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef SECUREARENA_H
+#define SECUREARENA_H
+
+#include <QList>
+
+// Slab allocator for fixed-size secrets (chain keys, message keys, private
+// keys). Slots come from cache line aligned blocks, allocate() and release()
+// are O(1) through an intrusive free list, and wipe() zeroizes every block at
+// once, e.g. when the session owning the arena is evicted. Blocks can
+// optionally be mlock()ed so secrets never reach swap. Not thread-safe, an
+// arena belongs to one owner.
+class SecureArena
+{
+public:
+    static const int CACHE_LINE_SIZE = 64;
+
+    SecureArena(int slotSize = 32, int slotsPerBlock = 256, bool lockMemory = false);
+    ~SecureArena();
+
+    unsigned char *allocate();
+    void release(unsigned char *slot);
+    void wipe();
+
+    int slotSize() const;
+    int allocatedSlots() const;
+    int capacity() const;
+    bool isLocked() const;
+
+    static void cleanse(void *data, size_t length);
+
+private:
+    SecureArena(const SecureArena &);
+    SecureArena &operator=(const SecureArena &);
+
+    void addBlock();
+    void freeBlocks();
+
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    int                    stride;
+    int                    size;
+    int                    slotsPerBlock;
+    int                    allocated;
+    bool                   lockMemory;
+    bool                   locked;
+    FreeSlot              *freeList;
+    QList<unsigned char*>  blocks;
+};
+
+#endif // SECUREARENA_H
@@ -0,0 +1,234 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QSaveFile>
+#include <QThread>
+
+#include <chrono>
+
+std::atomic<Tracer*> Tracer::installed(0);
+std::atomic<quint64> Tracer::generations(0);
+
+struct TraceThreadState {
+    quint64  generation;
+    void    *buffer;
+    int      depth;
+    bool     sampled;
+};
+
+static thread_local TraceThreadState threadState = { 0, 0, 0, false };
+
+Tracer::Tracer(double sampleRate, int spansPerThread)
+    : messageCounter(0), sampleInterval(0), dropped(0)
+{
+    this->generation     = ++generations;
+    this->spansPerThread = qMax(16, spansPerThread);
+    setSampleRate(sampleRate);
+}
+
+Tracer::~Tracer()
+{
+    Tracer *expected = this;
+    installed.compare_exchange_strong(expected, 0);
+
+    foreach (ThreadBuffer *buffer, buffers) {
+        delete[] buffer->spans;
+        delete buffer;
+    }
+}
+
+void Tracer::install(Tracer *tracer)
+{
+    installed.store(tracer, std::memory_order_release);
+}
+
+Tracer *Tracer::instance()
+{
+    return installed.load(std::memory_order_acquire);
+}
+
+void Tracer::setSampleRate(double sampleRate)
+{
+    if (sampleRate <= 0) {
+        sampleInterval = 0;
+    } else if (sampleRate >= 1) {
+        sampleInterval = 1;
+    } else {
+        sampleInterval = qMax((quint64)1, (quint64)qRound64(1.0 / sampleRate));
+    }
+}
+
+double Tracer::getSampleRate() const
+{
+    quint64 interval = sampleInterval.load();
+    return interval == 0 ? 0.0 : 1.0 / interval;
+}
+
+bool Tracer::shouldSample()
+{
+    quint64 interval = sampleInterval.load(std::memory_order_relaxed);
+    if (interval == 0) {
+        return false;
+    }
+    return messageCounter.fetch_add(1, std::memory_order_relaxed) % interval == 0;
+}
+
+void Tracer::record(const char *name, qint64 start, qint64 duration, int depth)
+{
+    ThreadBuffer *buffer = threadBuffer();
+    int           index  = buffer->size.load(std::memory_order_relaxed);
+
+    // Full buffers drop new spans instead of wrapping, so a concurrent dump never reads a span being rewritten
+    if (index >= buffer->capacity) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Span &span    = buffer->spans[index];
+    span.name     = name;
+    span.start    = start;
+    span.duration = duration;
+    span.depth    = depth;
+    buffer->size.store(index + 1, std::memory_order_release);
+}
+
+Tracer::ThreadBuffer *Tracer::threadBuffer()
+{
+    if (threadState.generation == generation) {
+        return static_cast<ThreadBuffer*>(threadState.buffer);
+    }
+
+    ThreadBuffer *buffer = new ThreadBuffer;
+    buffer->threadId = (quint64)(quintptr)QThread::currentThreadId();
+    buffer->capacity = spansPerThread;
+    buffer->size     = 0;
+    buffer->spans    = new Span[spansPerThread];
+
+    QMutexLocker locker(&buffersMutex);
+    buffers.append(buffer);
+
+    threadState.generation = generation;
+    threadState.buffer     = buffer;
+    return buffer;
+}
+
+bool Tracer::writeChromeTrace(const QString &path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    qint64      pid   = QCoreApplication::applicationPid();
+    bool        first = true;
+    QTextStream stream(&file);
+    stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    QMutexLocker locker(&buffersMutex);
+    foreach (ThreadBuffer *buffer, buffers) {
+        int size = buffer->size.load(std::memory_order_acquire);
+        for (int i = 0; i < size; i++) {
+            const Span &span = buffer->spans[i];
+            stream << (first ? "\n" : ",\n")
+                   << "{\"name\":\"" << span.name << "\",\"cat\":\"axolotl\",\"ph\":\"X\""
+                   << ",\"ts\":" << QString::number(span.start / 1000.0, 'f', 3)
+                   << ",\"dur\":" << QString::number(span.duration / 1000.0, 'f', 3)
+                   << ",\"pid\":" << pid << ",\"tid\":" << buffer->threadId
+                   << ",\"args\":{\"depth\":" << span.depth << "}}";
+            first = false;
+        }
+    }
+    locker.unlock();
+
+    stream << "\n]}\n";
+    stream.flush();
+    return file.commit();
+}
+
+int Tracer::spanCount()
+{
+    QMutexLocker locker(&buffersMutex);
+    int count = 0;
+    foreach (ThreadBuffer *buffer, buffers) {
+        count += buffer->size.load(std::memory_order_acquire);
+    }
+    return count;
+}
+
+quint64 Tracer::droppedSpans() const
+{
+    return dropped.load();
+}
+
+qint64 Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceMessageScope::TraceMessageScope(const char *name)
+{
+    this->name      = name;
+    this->tracer    = 0;
+    this->outermost = false;
+
+    Tracer *current = Tracer::instance();
+    if (!current) {
+        return;
+    }
+
+    if (!threadState.sampled) {
+        if (!current->shouldSample()) {
+            return;
+        }
+        outermost           = true;
+        threadState.sampled = true;
+        threadState.depth   = 0;
+    }
+
+    tracer = current;
+    start  = Tracer::now();
+    threadState.depth++;
+}
+
+TraceMessageScope::~TraceMessageScope()
+{
+    if (!tracer) {
+        return;
+    }
+
+    threadState.depth--;
+    tracer->record(name, start, Tracer::now() - start, threadState.depth);
+
+    if (outermost) {
+        threadState.sampled = false;
+    }
+}
+
+TraceScope::TraceScope(const char *name)
+{
+    this->name   = name;
+    this->tracer = 0;
+
+    if (!threadState.sampled) {
+        return;
+    }
+
+    tracer = Tracer::instance();
+    if (tracer) {
+        start = Tracer::now();
+        threadState.depth++;
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if (!tracer) {
+        return;
+    }
+
+    threadState.depth--;
+    tracer->record(name, start, Tracer::now() - start, threadState.depth);
+}
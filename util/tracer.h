@@ -0,0 +1,105 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <QMutex>
+#include <QList>
+
+#include <atomic>
+
+// Sampled per-message span tracing. A Tracer is installed process wide,
+// every thread appends spans to its own fixed-size buffer without locking,
+// and writeChromeTrace() dumps them in the Chrome trace event format that
+// Perfetto and chrome://tracing open. Outside a sampled message a scope costs
+// a thread-local flag check, defining AXOLOTL_NO_TRACING compiles them out.
+class Tracer
+{
+public:
+    struct Span {
+        const char *name;
+        qint64      start;
+        qint64      duration;
+        quint32     depth;
+    };
+
+    Tracer(double sampleRate = 0.01, int spansPerThread = 65536);
+    ~Tracer();
+
+    static void install(Tracer *tracer);
+    static Tracer *instance();
+
+    void setSampleRate(double sampleRate);
+    double getSampleRate() const;
+
+    bool shouldSample();
+    void record(const char *name, qint64 start, qint64 duration, int depth);
+
+    bool writeChromeTrace(const QString &path);
+    int spanCount();
+    quint64 droppedSpans() const;
+
+    static qint64 now();
+
+private:
+    Tracer(const Tracer &);
+    Tracer &operator=(const Tracer &);
+
+    struct ThreadBuffer {
+        quint64             threadId;
+        int                 capacity;
+        std::atomic<int>    size;
+        Span               *spans;
+    };
+
+    ThreadBuffer *threadBuffer();
+
+    quint64                     generation;
+    std::atomic<quint64>        messageCounter;
+    std::atomic<quint64>        sampleInterval;
+    std::atomic<quint64>        dropped;
+    int                         spansPerThread;
+    QMutex                      buffersMutex;
+    QList<ThreadBuffer*>        buffers;
+
+    static std::atomic<Tracer*> installed;
+    static std::atomic<quint64> generations;
+};
+
+// Opens the span of a top-level operation and decides whether this message
+// is sampled, nested TraceScopes only record inside a sampled message.
+class TraceMessageScope
+{
+public:
+    TraceMessageScope(const char *name);
+    ~TraceMessageScope();
+
+private:
+    const char *name;
+    Tracer     *tracer;
+    qint64      start;
+    bool        outermost;
+};
+
+class TraceScope
+{
+public:
+    TraceScope(const char *name);
+    ~TraceScope();
+
+private:
+    const char *name;
+    Tracer     *tracer;
+    qint64      start;
+};
+
+#ifdef AXOLOTL_NO_TRACING
+#define TRACE_MESSAGE(name)
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_MESSAGE(name) TraceMessageScope TRACE_CONCAT(traceMessage, __LINE__)(name)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif
+
+#endif // TRACER_H
@@ -0,0 +1,170 @@
+#include "workloadrecorder.h"
+#include "tracer.h"
+
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFile>
+
+std::atomic<WorkloadRecorder*> WorkloadRecorder::installed(0);
+
+WorkloadRecorder::WorkloadRecorder(int capacity)
+{
+    this->capacity = qMax(1, capacity);
+    this->dropped  = 0;
+    this->started  = Tracer::now();
+}
+
+WorkloadRecorder::~WorkloadRecorder()
+{
+    WorkloadRecorder *expected = this;
+    installed.compare_exchange_strong(expected, 0);
+}
+
+void WorkloadRecorder::install(WorkloadRecorder *recorder)
+{
+    installed.store(recorder, std::memory_order_release);
+}
+
+WorkloadRecorder *WorkloadRecorder::instance()
+{
+    return installed.load(std::memory_order_acquire);
+}
+
+void WorkloadRecorder::recordSessionSetup(const AxolotlAddress &remoteAddress)
+{
+    append(SessionSetup, remoteAddress, QByteArray(), 0, 0, 0);
+}
+
+void WorkloadRecorder::recordEncrypt(const AxolotlAddress &remoteAddress, int plaintextSize, uint counter, uint previousCounter, const QByteArray &ourRatchetKey)
+{
+    append(Encrypt, remoteAddress, ourRatchetKey, counter, previousCounter, plaintextSize);
+}
+
+void WorkloadRecorder::recordDecrypt(const AxolotlAddress &remoteAddress, bool preKeyMessage, int bodySize, uint counter, uint previousCounter, const QByteArray &theirRatchetKey)
+{
+    append(preKeyMessage ? DecryptPreKey : DecryptWhisper, remoteAddress, theirRatchetKey, counter, previousCounter, bodySize);
+}
+
+void WorkloadRecorder::append(Operation operation, const AxolotlAddress &remoteAddress, const QByteArray &ratchetKey, uint counter, uint previousCounter, int size)
+{
+    qint64     timestamp = Tracer::now() - started;
+    AddressKey key       = AddressUtil::toKey(remoteAddress);
+
+    QMutexLocker locker(&mutex);
+
+    if (events.size() >= capacity) {
+        dropped++;
+        return;
+    }
+
+    QHash<AddressKey, SessionOrdinals>::iterator ordinals = sessions.find(key);
+    if (ordinals == sessions.end()) {
+        SessionOrdinals created;
+        created.session = sessions.size();
+        ordinals = sessions.insert(key, created);
+    }
+
+    // Our and their ratchet keys share one ordinal space, they never collide
+    quint32 ratchetOrdinal = 0;
+    if (!ratchetKey.isEmpty()) {
+        QHash<QByteArray, quint32>::const_iterator known = ordinals->ratchetKeys.constFind(ratchetKey);
+        if (known == ordinals->ratchetKeys.constEnd()) {
+            ratchetOrdinal = ordinals->ratchetKeys.size() + 1;
+            ordinals->ratchetKeys.insert(ratchetKey, ratchetOrdinal);
+        } else {
+            ratchetOrdinal = known.value();
+        }
+    }
+
+    Event event;
+    event.operation       = operation;
+    event.session         = ordinals->session;
+    event.ratchetKey      = ratchetOrdinal;
+    event.counter         = counter;
+    event.previousCounter = previousCounter;
+    event.size            = qMax(0, size);
+    event.timestamp       = timestamp;
+    events.append(event);
+}
+
+QList<WorkloadRecorder::Event> WorkloadRecorder::getEvents()
+{
+    QMutexLocker locker(&mutex);
+    return events;
+}
+
+int WorkloadRecorder::eventCount()
+{
+    QMutexLocker locker(&mutex);
+    return events.size();
+}
+
+quint64 WorkloadRecorder::droppedEvents()
+{
+    QMutexLocker locker(&mutex);
+    return dropped;
+}
+
+void WorkloadRecorder::clear()
+{
+    QMutexLocker locker(&mutex);
+    sessions.clear();
+    events.clear();
+    dropped = 0;
+    started = Tracer::now();
+}
+
+bool WorkloadRecorder::save(const QString &path)
+{
+    QList<Event> snapshot = getEvents();
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << MAGIC << VERSION << (quint32)snapshot.size();
+
+    foreach (const Event &event, snapshot) {
+        stream << event.operation << event.session << event.ratchetKey
+               << event.counter << event.previousCounter << event.size << event.timestamp;
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool WorkloadRecorder::load(const QString &path, QList<Event> &events)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic   = 0;
+    quint32 version = 0;
+    quint32 count   = 0;
+    stream >> magic >> version >> count;
+    if (magic != MAGIC || version != VERSION) {
+        return false;
+    }
+
+    events.clear();
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Event event;
+        stream >> event.operation >> event.session >> event.ratchetKey
+               >> event.counter >> event.previousCounter >> event.size >> event.timestamp;
+        events.append(event);
+    }
+
+    return stream.status() == QDataStream::Ok && (quint32)events.size() == count;
+}
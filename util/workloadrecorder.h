@@ -0,0 +1,89 @@
+#ifndef WORKLOADRECORDER_H
+#define WORKLOADRECORDER_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+
+#include <atomic>
+
+#include "../util/addresskey.h"
+
+// Captures the shape of the traffic going through SessionCipher and
+// SessionBuilder so it can be replayed later against fresh stores. Nothing
+// secret is recorded: addresses and ratchet keys are replaced by ordinals
+// in order of first appearance, messages are reduced to their size and
+// counters. Installed process wide like the Tracer.
+//
+// At most capacity events are kept. Once the recorder is full, later
+// events are counted in droppedEvents() and discarded, so a saved trace is
+// always a replayable prefix of the traffic.
+class WorkloadRecorder
+{
+public:
+    enum Operation {
+        SessionSetup   = 1,
+        Encrypt        = 2,
+        DecryptWhisper = 3,
+        DecryptPreKey  = 4
+    };
+
+    struct Event {
+        quint8  operation;
+        quint32 session;
+        quint32 ratchetKey;
+        quint32 counter;
+        quint32 previousCounter;
+        quint32 size;
+        qint64  timestamp;
+    };
+
+    static const quint32 MAGIC            = 0x41585752;
+    static const quint32 VERSION          = 1;
+    static const int     DEFAULT_CAPACITY = 1 << 18;
+
+    explicit WorkloadRecorder(int capacity = DEFAULT_CAPACITY);
+    ~WorkloadRecorder();
+
+    static void install(WorkloadRecorder *recorder);
+    static WorkloadRecorder *instance();
+
+    void recordSessionSetup(const AxolotlAddress &remoteAddress);
+    void recordEncrypt(const AxolotlAddress &remoteAddress, int plaintextSize, uint counter,
+                       uint previousCounter, const QByteArray &ourRatchetKey);
+    void recordDecrypt(const AxolotlAddress &remoteAddress, bool preKeyMessage, int bodySize,
+                       uint counter, uint previousCounter, const QByteArray &theirRatchetKey);
+
+    QList<Event> getEvents();
+    int eventCount();
+    quint64 droppedEvents();
+    void clear();
+
+    bool save(const QString &path);
+    static bool load(const QString &path, QList<Event> &events);
+
+private:
+    WorkloadRecorder(const WorkloadRecorder &);
+    WorkloadRecorder &operator=(const WorkloadRecorder &);
+
+    struct SessionOrdinals {
+        quint32                     session;
+        QHash<QByteArray, quint32>  ratchetKeys;
+    };
+
+    void append(Operation operation, const AxolotlAddress &remoteAddress, const QByteArray &ratchetKey,
+                uint counter, uint previousCounter, int size);
+
+    QMutex                              mutex;
+    int                                 capacity;
+    quint64                             dropped;
+    qint64                              started;
+    QHash<AddressKey, SessionOrdinals>  sessions;
+    QList<Event>                        events;
+
+    static std::atomic<WorkloadRecorder*> installed;
+};
+
+#endif // WORKLOADRECORDER_H